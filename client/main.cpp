@@ -0,0 +1,85 @@
+#include "constants.hpp"
+#include "server_protocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+
+#endif
+
+extern char** environ;
+
+// Without iostreams, which cost more to set up than the whole round trip
+auto print_error(const std::string& message) -> void
+{
+    std::string line = "ash-client: " + message + "\n";
+    write(STDERR_FILENO, line.data(), line.size());
+}
+
+// NOTE(abi): ash-client /path/sock 'commands' [name [args...]] runs the commands on
+// an `ash --server` with this process's stdio, directory and environment, and exits
+// with their status. It links nothing of the shell but the protocol.
+auto main(int argc, char* argv[]) -> int
+{
+    if (argc < 3)
+    {
+        print_error("usage: ash-client socket command [name [args...]]");
+        return 2;
+    }
+
+    ash::ServerRequest request;
+    request.command = argv[2];
+    request.arguments.assign(argv + 3, argv + argc);
+    for (char** variable = environ; *variable != nullptr; variable++)
+    {
+        request.environment.push_back(*variable);
+    }
+
+    char cwd[ash::config::MAX_PATH_LENGTH];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr)
+    {
+        print_error(std::strerror(errno));
+        return 2;
+    }
+    request.working_directory = cwd;
+
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+
+    int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    int buffer_size = ash::config::SERVER_MAX_REQUEST_SIZE;
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    if (socket_fd == -1
+        || connect(socket_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        print_error(std::string(argv[1]) + ": " + std::strerror(errno));
+        return 2;
+    }
+
+    // One message out, one status back
+    int status = 0;
+    if (!ash::send_server_request(socket_fd, request, {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}))
+    {
+        print_error("failed to send the request");
+        return 2;
+    }
+
+    if (!ash::receive_server_status(socket_fd, status))
+    {
+        print_error("the server closed the connection");
+        return 2;
+    }
+
+    close(socket_fd);
+    return status;
+}
@@ -0,0 +1,851 @@
+#include "arithmetic.hpp"
+#include "constants.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+namespace ash
+{
+
+    enum class ArithmeticTokenType
+    {
+        NUMBER,
+        NAME,      // A variable that can be assigned to
+        REFERENCE, // $name, ${name}, $1...
+        OPERATOR,
+        END,
+    };
+
+    struct ArithmeticToken
+    {
+        ArithmeticTokenType type;
+        std::string text; // Operator, or variable name
+        int64_t value = 0;
+        size_t pos = 0;
+    };
+
+    // Integer constants are decimal, octal (leading 0) or hexadecimal (leading 0x)
+    auto parse_arithmetic_constant(std::string_view text, int64_t& value) -> bool
+    {
+        bool is_negative = !text.empty() && text[0] == '-';
+        if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+        {
+            text.remove_prefix(1);
+        }
+
+        int base = 10;
+        if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+        {
+            base = 16;
+            text.remove_prefix(2);
+        }
+        else if (text.size() > 1 && text[0] == '0')
+        {
+            base = 8;
+            text.remove_prefix(1);
+        }
+
+        uint64_t magnitude = 0;
+        auto [ptr, error_code] =
+            std::from_chars(text.data(), text.data() + text.size(), magnitude, base);
+        if (text.empty() || error_code != std::errc() || ptr != text.data() + text.size())
+        {
+            return false;
+        }
+
+        value = static_cast<int64_t>(is_negative ? 0 - magnitude : magnitude);
+        return true;
+    }
+
+    // NOTE(abi): a precedence climbing parser over a token list that emits postfix
+    // code, with jumps for the short-circuit and conditional operators.
+    struct ArithmeticCompiler
+    {
+        const std::string& expression;
+        ArithmeticProgram& program;
+        std::string& error;
+        std::vector<ArithmeticToken> tokens;
+        size_t current = 0;
+        size_t depth = 0;
+
+        auto compile() -> bool
+        {
+            if (!tokenize())
+            {
+                return false;
+            }
+
+            // $(( )) is 0
+            if (tokens.size() == 1)
+            {
+                emit(ArithmeticOp::PUSH, 0);
+                return true;
+            }
+
+            if (!parse_comma())
+            {
+                return false;
+            }
+
+            return peek().type == ArithmeticTokenType::END
+                   || fail("syntax error in expression", peek());
+        }
+
+        // Lexing
+
+        auto tokenize() -> bool
+        {
+            static const char* const operators[] = {
+                "<<=", ">>=", "**=", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--",
+                "**",  "+=",  "-=",  "*=", "/=", "%=", "&=", "^=", "|=", "+",  "-",  "*",  "/",
+                "%",   "<",   ">",   "&",  "^",  "|",  "!",  "~",  "?",  ":",  "=",  "(",  ")",
+                ","};
+
+            // Where the )) of each nested $((...)) we're inside of is
+            std::vector<size_t> nested_ends;
+
+            size_t pos = 0;
+            while (pos < expression.size())
+            {
+                char c = expression[pos];
+                if (c == ' ' || c == '\t' || c == '\n')
+                {
+                    pos++;
+                    continue;
+                }
+
+                ArithmeticToken token{ArithmeticTokenType::OPERATOR, "", 0, pos};
+                size_t nested_length = (c == '$') ? get_arithmetic_expansion_length(expression, pos)
+                                                  : 0;
+                if (!nested_ends.empty() && pos == nested_ends.back())
+                {
+                    token.text = ")";
+                    nested_ends.pop_back();
+                    pos += 2;
+                }
+                else if (nested_length > 0)
+                {
+                    // NOTE(abi): $((e)) inside an expression is worth the same as (e), so it's
+                    // lexed as one and compiled along with the rest.
+                    token.text = "(";
+                    nested_ends.push_back(pos + nested_length - 2);
+                    pos += 3;
+                }
+                else if (std::isdigit(static_cast<unsigned char>(c)))
+                {
+                    size_t end = pos;
+                    while (end < expression.size()
+                           && (std::isalnum(static_cast<unsigned char>(expression[end]))
+                               || expression[end] == '_'))
+                    {
+                        end++;
+                    }
+
+                    token.type = ArithmeticTokenType::NUMBER;
+                    token.text = expression.substr(pos, end - pos);
+                    if (!parse_arithmetic_constant(token.text, token.value))
+                    {
+                        return fail("value too great for base", token);
+                    }
+                    pos = end;
+                }
+                else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
+                {
+                    size_t end = pos;
+                    while (end < expression.size()
+                           && (std::isalnum(static_cast<unsigned char>(expression[end]))
+                               || expression[end] == '_'))
+                    {
+                        end++;
+                    }
+
+                    token.type = ArithmeticTokenType::NAME;
+                    token.text = expression.substr(pos, end - pos);
+                    pos = end;
+                }
+                else if (c == '$')
+                {
+                    size_t length = parse_variable_reference(expression, pos, token.text);
+                    if (length == 0)
+                    {
+                        return fail("syntax error: operand expected", token);
+                    }
+
+                    token.type = ArithmeticTokenType::REFERENCE;
+                    pos += length;
+                }
+                else
+                {
+                    const char* const* match =
+                        std::find_if(std::begin(operators), std::end(operators),
+                                     [this, pos](const char* op)
+                                     { return expression.compare(pos, std::strlen(op), op) == 0; });
+                    if (match == std::end(operators))
+                    {
+                        return fail("syntax error: invalid arithmetic operator", token);
+                    }
+
+                    token.text = *match;
+                    pos += token.text.size();
+                }
+
+                tokens.push_back(std::move(token));
+            }
+
+            tokens.push_back({ArithmeticTokenType::END, "", 0, expression.size()});
+            return true;
+        }
+
+        auto peek(size_t offset = 0) const -> const ArithmeticToken&
+        {
+            return tokens[std::min(current + offset, tokens.size() - 1)];
+        }
+
+        auto is_operator(const std::string& op, size_t offset = 0) const -> bool
+        {
+            const ArithmeticToken& token = peek(offset);
+            return token.type == ArithmeticTokenType::OPERATOR && token.text == op;
+        }
+
+        auto fail(const std::string& message, const ArithmeticToken& token) -> bool
+        {
+            error = message + " (error token is \"" + expression.substr(token.pos) + "\")";
+            return false;
+        }
+
+        // Code generation
+
+        auto emit(ArithmeticOp op, int64_t operand = 0) -> size_t
+        {
+            switch (op)
+            {
+            case ArithmeticOp::PUSH:
+            case ArithmeticOp::LOAD:
+            case ArithmeticOp::PRE_INCREMENT:
+            case ArithmeticOp::PRE_DECREMENT:
+            case ArithmeticOp::POST_INCREMENT:
+            case ArithmeticOp::POST_DECREMENT:
+                depth++;
+                break;
+            case ArithmeticOp::STORE:
+            case ArithmeticOp::NEGATE:
+            case ArithmeticOp::LOGICAL_NOT:
+            case ArithmeticOp::BITWISE_NOT:
+            case ArithmeticOp::TO_BOOLEAN:
+            case ArithmeticOp::JUMP:
+                break;
+            default:
+                depth--;
+                break;
+            }
+
+            program.max_stack_depth = std::max(program.max_stack_depth, depth);
+            program.instructions.push_back({op, operand});
+            return program.instructions.size() - 1;
+        }
+
+        auto patch(size_t index) -> void
+        {
+            program.instructions[index].operand =
+                static_cast<int64_t>(program.instructions.size());
+        }
+
+        auto get_variable_index(const std::string& name) -> int64_t
+        {
+            auto it = std::find(program.variables.begin(), program.variables.end(), name);
+            if (it == program.variables.end())
+            {
+                program.variables.push_back(name);
+                return static_cast<int64_t>(program.variables.size() - 1);
+            }
+
+            return static_cast<int64_t>(it - program.variables.begin());
+        }
+
+        static auto get_binary_op(const std::string& op) -> std::optional<ArithmeticOp>
+        {
+            static const std::unordered_map<std::string, ArithmeticOp> binary_ops = {
+                {"*", ArithmeticOp::MULTIPLY},     {"/", ArithmeticOp::DIVIDE},
+                {"%", ArithmeticOp::REMAINDER},    {"**", ArithmeticOp::POWER},
+                {"+", ArithmeticOp::ADD},
+                {"-", ArithmeticOp::SUBTRACT},     {"<<", ArithmeticOp::SHIFT_LEFT},
+                {">>", ArithmeticOp::SHIFT_RIGHT}, {"<", ArithmeticOp::LESS},
+                {"<=", ArithmeticOp::LESS_EQUAL},  {">", ArithmeticOp::GREATER},
+                {">=", ArithmeticOp::GREATER_EQUAL}, {"==", ArithmeticOp::EQUAL},
+                {"!=", ArithmeticOp::NOT_EQUAL},   {"&", ArithmeticOp::BITWISE_AND},
+                {"^", ArithmeticOp::BITWISE_XOR},  {"|", ArithmeticOp::BITWISE_OR}};
+
+            auto it = binary_ops.find(op);
+            if (it == binary_ops.end())
+            {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+
+        auto get_precedence(const ArithmeticToken& token) const -> int
+        {
+            static const std::unordered_map<std::string, int> precedences = {
+                {"||", 1}, {"&&", 2}, {"|", 3},  {"^", 4},  {"&", 5},  {"==", 6}, {"!=", 6},
+                {"<", 7},  {"<=", 7}, {">", 7},  {">=", 7}, {"<<", 8}, {">>", 8}, {"+", 9},
+                {"-", 9},  {"*", 10}, {"/", 10}, {"%", 10}, {"**", 11}};
+
+            if (token.type != ArithmeticTokenType::OPERATOR)
+            {
+                return 0;
+            }
+
+            auto it = precedences.find(token.text);
+            return (it != precedences.end()) ? it->second : 0;
+        }
+
+        // Grammar
+
+        auto parse_comma() -> bool
+        {
+            if (!parse_assignment())
+            {
+                return false;
+            }
+
+            while (is_operator(","))
+            {
+                current++;
+                emit(ArithmeticOp::POP);
+                if (!parse_assignment())
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        auto parse_assignment() -> bool
+        {
+            const ArithmeticToken& target = peek();
+            const ArithmeticToken& op = peek(1);
+            bool is_assignment = target.type == ArithmeticTokenType::NAME
+                                 && op.type == ArithmeticTokenType::OPERATOR
+                                 && op.text.back() == '=' && op.text != "==" && op.text != "!="
+                                 && op.text != "<=" && op.text != ">=";
+            if (!is_assignment)
+            {
+                return parse_conditional();
+            }
+
+            int64_t index = get_variable_index(target.text);
+            std::string compound_op = op.text.substr(0, op.text.size() - 1);
+            current += 2;
+
+            // x op= y is x = x op y
+            if (!compound_op.empty())
+            {
+                emit(ArithmeticOp::LOAD, index);
+            }
+            if (!parse_assignment())
+            {
+                return false;
+            }
+            if (!compound_op.empty())
+            {
+                emit(*get_binary_op(compound_op));
+            }
+
+            emit(ArithmeticOp::STORE, index);
+            return true;
+        }
+
+        auto parse_conditional() -> bool
+        {
+            if (!parse_binary(1))
+            {
+                return false;
+            }
+
+            if (!is_operator("?"))
+            {
+                return true;
+            }
+            current++;
+
+            size_t else_jump = emit(ArithmeticOp::JUMP_IF_ZERO);
+            if (!parse_comma())
+            {
+                return false;
+            }
+
+            if (!is_operator(":"))
+            {
+                return fail("syntax error: `:' expected for conditional expression", peek());
+            }
+            current++;
+
+            size_t end_jump = emit(ArithmeticOp::JUMP);
+            depth--; // Only one branch leaves its value
+            patch(else_jump);
+            if (!parse_conditional())
+            {
+                return false;
+            }
+
+            patch(end_jump);
+            return true;
+        }
+
+        auto parse_binary(int min_precedence) -> bool
+        {
+            if (!parse_unary())
+            {
+                return false;
+            }
+
+            while (true)
+            {
+                int precedence = get_precedence(peek());
+                if (precedence < min_precedence || precedence == 0)
+                {
+                    return true;
+                }
+
+                std::string op = peek().text;
+                current++;
+
+                if (op == "&&" || op == "||")
+                {
+                    size_t skip_jump =
+                        emit(op == "&&" ? ArithmeticOp::AND_JUMP : ArithmeticOp::OR_JUMP);
+                    if (!parse_binary(precedence + 1))
+                    {
+                        return false;
+                    }
+                    emit(ArithmeticOp::TO_BOOLEAN);
+                    patch(skip_jump);
+                    continue;
+                }
+
+                // ** is the only right associative operator
+                if (!parse_binary(op == "**" ? precedence : precedence + 1))
+                {
+                    return false;
+                }
+                emit(*get_binary_op(op));
+            }
+        }
+
+        auto parse_unary() -> bool
+        {
+            const ArithmeticToken& token = peek();
+            if (token.type != ArithmeticTokenType::OPERATOR)
+            {
+                return parse_primary();
+            }
+
+            if (token.text == "++" || token.text == "--")
+            {
+                bool is_increment = token.text == "++";
+                current++;
+                if (peek().type != ArithmeticTokenType::NAME)
+                {
+                    return fail("syntax error: operand expected", peek());
+                }
+
+                emit(is_increment ? ArithmeticOp::PRE_INCREMENT : ArithmeticOp::PRE_DECREMENT,
+                     get_variable_index(peek().text));
+                current++;
+                return true;
+            }
+
+            std::optional<ArithmeticOp> unary_op;
+            if (token.text == "-")
+            {
+                unary_op = ArithmeticOp::NEGATE;
+            }
+            else if (token.text == "!")
+            {
+                unary_op = ArithmeticOp::LOGICAL_NOT;
+            }
+            else if (token.text == "~")
+            {
+                unary_op = ArithmeticOp::BITWISE_NOT;
+            }
+            else if (token.text != "+")
+            {
+                return parse_primary();
+            }
+
+            current++;
+            if (!parse_unary())
+            {
+                return false;
+            }
+
+            if (unary_op.has_value())
+            {
+                emit(*unary_op);
+            }
+            return true;
+        }
+
+        auto parse_primary() -> bool
+        {
+            const ArithmeticToken& token = peek();
+            switch (token.type)
+            {
+            case ArithmeticTokenType::NUMBER:
+                emit(ArithmeticOp::PUSH, token.value);
+                current++;
+                return true;
+            case ArithmeticTokenType::NAME:
+            {
+                int64_t index = get_variable_index(token.text);
+                current++;
+                if (is_operator("++") || is_operator("--"))
+                {
+                    emit(is_operator("++") ? ArithmeticOp::POST_INCREMENT
+                                           : ArithmeticOp::POST_DECREMENT,
+                         index);
+                    current++;
+                    return true;
+                }
+
+                emit(ArithmeticOp::LOAD, index);
+                return true;
+            }
+            case ArithmeticTokenType::REFERENCE:
+                emit(ArithmeticOp::LOAD, get_variable_index(token.text));
+                current++;
+                return true;
+            case ArithmeticTokenType::OPERATOR:
+                if (token.text == "(")
+                {
+                    current++;
+                    if (!parse_comma())
+                    {
+                        return false;
+                    }
+
+                    if (!is_operator(")"))
+                    {
+                        return fail("syntax error: `)' expected", peek());
+                    }
+                    current++;
+                    return true;
+                }
+                break;
+            case ArithmeticTokenType::END:
+                break;
+            }
+
+            return fail("syntax error: operand expected", token);
+        }
+    };
+
+    auto compile_arithmetic(const std::string& expression, ArithmeticProgram& program,
+                            std::string& error) -> bool
+    {
+        ArithmeticCompiler compiler{expression, program, error};
+        return compiler.compile();
+    }
+
+    // NOTE(abi): variables holding an expression rather than a number are evaluated
+    // in turn, as in other shells, up to a fixed nesting depth.
+    auto read_arithmetic_variable(const std::string& name, int64_t& value, std::string& error)
+        -> bool
+    {
+        thread_local int nesting_depth = 0;
+
+        std::optional<std::string> text = get_variable(name);
+        if (!text.has_value() || text->empty())
+        {
+            value = 0;
+            return true;
+        }
+
+        if (parse_arithmetic_constant(*text, value))
+        {
+            return true;
+        }
+
+        if (nesting_depth >= config::MAX_ARITHMETIC_NESTING)
+        {
+            error = name + ": expression recursion level exceeded";
+            return false;
+        }
+
+        nesting_depth++;
+        bool is_evaluated = evaluate_arithmetic(*text, value, error);
+        nesting_depth--;
+
+        return is_evaluated;
+    }
+
+    auto run_arithmetic(const ArithmeticProgram& program, int64_t& result, std::string& error)
+        -> bool
+    {
+        // NOTE(abi): signed overflow wraps around, like in other shells, so the
+        // arithmetic goes through unsigned integers to stay defined.
+        auto wrap = [](uint64_t value) { return static_cast<int64_t>(value); };
+
+        int64_t local_stack[config::ARITHMETIC_STACK_SIZE];
+        std::vector<int64_t> heap_stack;
+        int64_t* stack = local_stack;
+        if (program.max_stack_depth > config::ARITHMETIC_STACK_SIZE)
+        {
+            heap_stack.resize(program.max_stack_depth);
+            stack = heap_stack.data();
+        }
+
+        size_t top = 0;
+        const std::vector<ArithmeticInstruction>& instructions = program.instructions;
+        size_t pc = 0;
+        while (pc < instructions.size())
+        {
+            const ArithmeticInstruction& instruction = instructions[pc++];
+            switch (instruction.op)
+            {
+            case ArithmeticOp::PUSH:
+                stack[top++] = instruction.operand;
+                break;
+            case ArithmeticOp::LOAD:
+                if (!read_arithmetic_variable(program.variables[instruction.operand],
+                                              stack[top++], error))
+                {
+                    return false;
+                }
+                break;
+            case ArithmeticOp::STORE:
+                set_variable(program.variables[instruction.operand],
+                             std::to_string(stack[top - 1]));
+                break;
+            case ArithmeticOp::PRE_INCREMENT:
+            case ArithmeticOp::PRE_DECREMENT:
+            case ArithmeticOp::POST_INCREMENT:
+            case ArithmeticOp::POST_DECREMENT:
+            {
+                const std::string& name = program.variables[instruction.operand];
+                int64_t value = 0;
+                if (!read_arithmetic_variable(name, value, error))
+                {
+                    return false;
+                }
+
+                bool is_increment = instruction.op == ArithmeticOp::PRE_INCREMENT
+                                    || instruction.op == ArithmeticOp::POST_INCREMENT;
+                int64_t updated = wrap(static_cast<uint64_t>(value) + (is_increment ? 1 : -1));
+                set_variable(name, std::to_string(updated));
+
+                bool is_prefix = instruction.op == ArithmeticOp::PRE_INCREMENT
+                                 || instruction.op == ArithmeticOp::PRE_DECREMENT;
+                stack[top++] = is_prefix ? updated : value;
+                break;
+            }
+            case ArithmeticOp::NEGATE:
+                stack[top - 1] = wrap(0 - static_cast<uint64_t>(stack[top - 1]));
+                break;
+            case ArithmeticOp::LOGICAL_NOT:
+                stack[top - 1] = !stack[top - 1];
+                break;
+            case ArithmeticOp::BITWISE_NOT:
+                stack[top - 1] = ~stack[top - 1];
+                break;
+            case ArithmeticOp::TO_BOOLEAN:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case ArithmeticOp::AND_JUMP:
+            case ArithmeticOp::OR_JUMP:
+            {
+                bool is_and = instruction.op == ArithmeticOp::AND_JUMP;
+                if ((stack[top - 1] == 0) == is_and)
+                {
+                    stack[top - 1] = is_and ? 0 : 1;
+                    pc = static_cast<size_t>(instruction.operand);
+                }
+                else
+                {
+                    top--;
+                }
+                break;
+            }
+            case ArithmeticOp::JUMP_IF_ZERO:
+                if (stack[--top] == 0)
+                {
+                    pc = static_cast<size_t>(instruction.operand);
+                }
+                break;
+            case ArithmeticOp::JUMP:
+                pc = static_cast<size_t>(instruction.operand);
+                break;
+            case ArithmeticOp::POP:
+                top--;
+                break;
+            default:
+            {
+                int64_t right = stack[--top];
+                int64_t left = stack[top - 1];
+                uint64_t left_bits = static_cast<uint64_t>(left);
+                uint64_t right_bits = static_cast<uint64_t>(right);
+                int64_t& value = stack[top - 1];
+
+                switch (instruction.op)
+                {
+                case ArithmeticOp::MULTIPLY:
+                    value = wrap(left_bits * right_bits);
+                    break;
+                case ArithmeticOp::DIVIDE:
+                case ArithmeticOp::REMAINDER:
+                {
+                    if (right == 0)
+                    {
+                        error = "division by 0";
+                        return false;
+                    }
+
+                    bool is_divide = instruction.op == ArithmeticOp::DIVIDE;
+                    if (left == std::numeric_limits<int64_t>::min() && right == -1)
+                    {
+                        value = is_divide ? left : 0;
+                        break;
+                    }
+                    value = is_divide ? left / right : left % right;
+                    break;
+                }
+                case ArithmeticOp::POWER:
+                {
+                    if (right < 0)
+                    {
+                        error = "exponent less than 0";
+                        return false;
+                    }
+
+                    // Square and multiply
+                    uint64_t power = 1;
+                    for (uint64_t base = left_bits, exponent = right_bits; exponent > 0;
+                         exponent >>= 1, base *= base)
+                    {
+                        power *= (exponent & 1) ? base : 1;
+                    }
+                    value = wrap(power);
+                    break;
+                }
+                case ArithmeticOp::ADD:
+                    value = wrap(left_bits + right_bits);
+                    break;
+                case ArithmeticOp::SUBTRACT:
+                    value = wrap(left_bits - right_bits);
+                    break;
+                case ArithmeticOp::SHIFT_LEFT:
+                    value = wrap(left_bits << (right & 63));
+                    break;
+                case ArithmeticOp::SHIFT_RIGHT:
+                    value = left >> (right & 63);
+                    break;
+                case ArithmeticOp::LESS:
+                    value = left < right;
+                    break;
+                case ArithmeticOp::LESS_EQUAL:
+                    value = left <= right;
+                    break;
+                case ArithmeticOp::GREATER:
+                    value = left > right;
+                    break;
+                case ArithmeticOp::GREATER_EQUAL:
+                    value = left >= right;
+                    break;
+                case ArithmeticOp::EQUAL:
+                    value = left == right;
+                    break;
+                case ArithmeticOp::NOT_EQUAL:
+                    value = left != right;
+                    break;
+                case ArithmeticOp::BITWISE_AND:
+                    value = left & right;
+                    break;
+                case ArithmeticOp::BITWISE_XOR:
+                    value = left ^ right;
+                    break;
+                case ArithmeticOp::BITWISE_OR:
+                    value = left | right;
+                    break;
+                default:
+                    break;
+                }
+                break;
+            }
+            }
+        }
+
+        result = stack[0];
+        return true;
+    }
+
+    auto evaluate_arithmetic(const std::string& expression, int64_t& result, std::string& error)
+        -> bool
+    {
+        // NOTE(abi): loops evaluate the same few expressions over and over, so they're
+        // only compiled the first time their text is seen. Variables can hold expressions
+        // that are evaluated while another program runs, and may clear the cache, so the
+        // program is held for as long as it runs.
+        thread_local std::unordered_map<std::string, std::shared_ptr<const ArithmeticProgram>>
+            cache;
+
+        std::shared_ptr<const ArithmeticProgram> program;
+        auto it = cache.find(expression);
+        if (it != cache.end())
+        {
+            program = it->second;
+        }
+        else
+        {
+            auto compiled = std::make_shared<ArithmeticProgram>();
+            if (!compile_arithmetic(expression, *compiled, error))
+            {
+                return false;
+            }
+
+            if (cache.size() >= config::ARITHMETIC_CACHE_SIZE)
+            {
+                cache.clear();
+            }
+            program = std::move(compiled);
+            cache.emplace(expression, program);
+        }
+
+        return run_arithmetic(*program, result, error);
+    }
+
+    auto get_arithmetic_expansion_length(const std::string& str, size_t dollar_pos) -> size_t
+    {
+        if (str.compare(dollar_pos, 3, "$((") != 0)
+        {
+            return 0;
+        }
+
+        int depth = 0;
+        for (size_t i = dollar_pos + 3; i < str.size(); i++)
+        {
+            if (str[i] == '(')
+            {
+                depth++;
+            }
+            else if (str[i] == ')' && depth > 0)
+            {
+                depth--;
+            }
+            else if (str[i] == ')')
+            {
+                return (i + 1 < str.size() && str[i + 1] == ')') ? i + 2 - dollar_pos : 0;
+            }
+        }
+
+        return 0;
+    }
+
+} // namespace ash
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ash
+{
+
+    enum class ArithmeticOp : uint8_t
+    {
+        PUSH,  // operand
+        LOAD,  // variables[operand]
+        STORE, // variables[operand] = top, leaves the value on the stack
+        PRE_INCREMENT,
+        PRE_DECREMENT,
+        POST_INCREMENT,
+        POST_DECREMENT,
+        NEGATE,
+        LOGICAL_NOT,
+        BITWISE_NOT,
+        TO_BOOLEAN,
+        MULTIPLY,
+        DIVIDE,
+        REMAINDER,
+        POWER,
+        ADD,
+        SUBTRACT,
+        SHIFT_LEFT,
+        SHIFT_RIGHT,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL,
+        BITWISE_AND,
+        BITWISE_XOR,
+        BITWISE_OR,
+        AND_JUMP,     // Jumps to operand keeping 0 when top is zero, pops it otherwise
+        OR_JUMP,      // Jumps to operand with 1 when top is non-zero, pops it otherwise
+        JUMP_IF_ZERO, // Pops the top, jumps to operand when it was zero
+        JUMP,
+        POP,
+    };
+
+    struct ArithmeticInstruction
+    {
+        ArithmeticOp op;
+        int64_t operand = 0;
+    };
+
+    // NOTE(abi): an expression compiled to postfix form. Variables are referenced by
+    // index, and the stack depth is known up front so evaluation never allocates.
+    struct ArithmeticProgram
+    {
+        std::vector<ArithmeticInstruction> instructions;
+        std::vector<std::string> variables;
+        size_t max_stack_depth = 0;
+    };
+
+    // Compilation
+    auto compile_arithmetic(const std::string& expression, ArithmeticProgram& program,
+                            std::string& error) -> bool;
+    auto parse_arithmetic_constant(std::string_view text, int64_t& value) -> bool;
+    auto get_arithmetic_expansion_length(const std::string& str, size_t dollar_pos) -> size_t;
+
+    // Evaluation
+    auto run_arithmetic(const ArithmeticProgram& program, int64_t& result, std::string& error)
+        -> bool;
+    auto evaluate_arithmetic(const std::string& expression, int64_t& result, std::string& error)
+        -> bool;
+    auto read_arithmetic_variable(const std::string& name, int64_t& value, std::string& error)
+        -> bool;
+
+} // namespace ash
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+namespace ash
+{
+
+    // NOTE(abi): a value computed on a background thread. The thread is detached and
+    // shares ownership of the result, so neither exit() in a forked child nor an early
+    // exit of the shell has to join it. The value is published by the release store
+    // of is_ready and must only be read after seeing it set.
+    template <typename T>
+    struct BackgroundResult
+    {
+        std::atomic<bool> is_ready = false;
+        T value;
+        std::mutex mutex; // Only for waits with a timeout
+        std::condition_variable ready_condition;
+    };
+
+    template <typename T>
+    auto start_background_task(std::function<T()> task) -> std::shared_ptr<BackgroundResult<T>>
+    {
+        auto result = std::make_shared<BackgroundResult<T>>();
+        auto run = [result, task]()
+        {
+            result->value = task();
+            {
+                std::lock_guard<std::mutex> lock(result->mutex);
+                result->is_ready.store(true, std::memory_order_release);
+            }
+            result->is_ready.notify_all();
+            result->ready_condition.notify_all();
+        };
+
+        // Without threads the work is simply done up front
+        try
+        {
+            std::thread(run).detach();
+        }
+        catch (const std::system_error&)
+        {
+            run();
+        }
+
+        return result;
+    }
+
+    template <typename T>
+    auto is_background_result_ready(const BackgroundResult<T>& result) -> bool
+    {
+        return result.is_ready.load(std::memory_order_acquire);
+    }
+
+    template <typename T>
+    auto wait_for_background_result(BackgroundResult<T>& result) -> T&
+    {
+        result.is_ready.wait(false, std::memory_order_acquire);
+        return result.value;
+    }
+
+    template <typename T>
+    auto wait_for_background_result(BackgroundResult<T>& result,
+                                    std::chrono::steady_clock::duration timeout) -> bool
+    {
+        std::unique_lock<std::mutex> lock(result.mutex);
+        return result.ready_condition.wait_for(
+            lock, timeout, [&result]() { return is_background_result_ready(result); });
+    }
+
+} // namespace ash
@@ -0,0 +1,317 @@
+#include "braces.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+
+namespace ash
+{
+
+    auto parse_brace_pattern(const Word& word) -> std::vector<BraceNode>
+    {
+        bool has_brace = std::any_of(word.parts.begin(), word.parts.end(),
+                                     [](const WordPart& part)
+                                     {
+                                         return part.type == WordPartType::LITERAL
+                                                && !part.is_quoted
+                                                && part.text.find('{') != std::string::npos;
+                                     });
+        if (!has_brace)
+        {
+            return {};
+        }
+
+        std::vector<BraceAtom> atoms = split_brace_atoms(word);
+        std::vector<BraceNode> pattern = parse_brace_nodes(atoms, 0, atoms.size());
+
+        // Braces that didn't form an expansion are plain text, as in find -exec {}
+        bool has_expansion =
+            std::any_of(pattern.begin(), pattern.end(),
+                        [](const BraceNode& node) { return node.type != BraceNodeType::PARTS; });
+        return has_expansion ? pattern : std::vector<BraceNode>();
+    }
+
+    auto split_brace_atoms(const Word& word) -> std::vector<BraceAtom>
+    {
+        std::vector<BraceAtom> atoms;
+        for (const WordPart& part : word.parts)
+        {
+            if (part.type != WordPartType::LITERAL || part.is_quoted)
+            {
+                atoms.push_back({'\0', part});
+                continue;
+            }
+
+            std::string text;
+            for (char c : part.text)
+            {
+                if (c != '{' && c != ',' && c != '}')
+                {
+                    text += c;
+                    continue;
+                }
+
+                if (!text.empty())
+                {
+                    atoms.push_back({'\0', {WordPartType::LITERAL, std::move(text), false}});
+                    text.clear();
+                }
+                atoms.push_back({c, {}});
+            }
+
+            if (!text.empty())
+            {
+                atoms.push_back({'\0', {WordPartType::LITERAL, std::move(text), false}});
+            }
+        }
+
+        return atoms;
+    }
+
+    auto parse_brace_nodes(const std::vector<BraceAtom>& atoms, size_t begin, size_t end)
+        -> std::vector<BraceNode>
+    {
+        auto multiply = [](size_t lhs, size_t rhs) -> size_t
+        {
+            size_t product;
+            return __builtin_mul_overflow(lhs, rhs, &product) ? std::numeric_limits<size_t>::max()
+                                                              : product;
+        };
+
+        auto append_part = [](std::vector<BraceNode>& nodes, const WordPart& part)
+        {
+            if (nodes.empty() || nodes.back().type != BraceNodeType::PARTS)
+            {
+                nodes.emplace_back();
+            }
+
+            std::vector<WordPart>& parts = nodes.back().parts;
+            if (!parts.empty() && parts.back().type == WordPartType::LITERAL
+                && part.type == WordPartType::LITERAL && parts.back().is_quoted == part.is_quoted)
+            {
+                parts.back().text += part.text;
+                return;
+            }
+            parts.push_back(part);
+        };
+
+        std::vector<BraceNode> nodes;
+        for (size_t i = begin; i < end; i++)
+        {
+            const BraceAtom& atom = atoms[i];
+            if (atom.brace == '{')
+            {
+                // The matching brace, and the commas at this nesting level
+                int depth = 0;
+                size_t close = std::string::npos;
+                std::vector<size_t> commas;
+                for (size_t j = i + 1; j < end && close == std::string::npos; j++)
+                {
+                    if (atoms[j].brace == '{')
+                    {
+                        depth++;
+                    }
+                    else if (atoms[j].brace == '}')
+                    {
+                        close = (depth == 0) ? j : close;
+                        depth--;
+                    }
+                    else if (atoms[j].brace == ',' && depth == 0)
+                    {
+                        commas.push_back(j);
+                    }
+                }
+
+                BraceNode node;
+                if (close != std::string::npos && !commas.empty())
+                {
+                    node.type = BraceNodeType::ALTERNATION;
+                    node.value_count = 0;
+                    commas.push_back(close);
+
+                    size_t alternative_begin = i + 1;
+                    for (size_t comma : commas)
+                    {
+                        std::vector<BraceNode> alternative =
+                            parse_brace_nodes(atoms, alternative_begin, comma);
+                        node.alternative_offsets.push_back(node.value_count);
+                        node.value_count += get_brace_expansion_count(alternative);
+                        node.alternatives.push_back(std::move(alternative));
+                        alternative_begin = comma + 1;
+                    }
+
+                    nodes.push_back(std::move(node));
+                    i = close;
+                    continue;
+                }
+
+                const BraceAtom* inner = (close == i + 2) ? &atoms[i + 1] : nullptr;
+                if (inner != nullptr && inner->brace == '\0'
+                    && inner->part.type == WordPartType::LITERAL && !inner->part.is_quoted
+                    && parse_brace_sequence(inner->part.text, node))
+                {
+                    nodes.push_back(std::move(node));
+                    i = close;
+                    continue;
+                }
+            }
+
+            // Plain text, including braces that don't form an expansion
+            append_part(nodes, (atom.brace != '\0')
+                                   ? WordPart{WordPartType::LITERAL, std::string(1, atom.brace),
+                                              false}
+                                   : atom.part);
+        }
+
+        // The last node varies fastest
+        size_t stride = 1;
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+        {
+            it->stride = stride;
+            stride = multiply(stride, it->value_count);
+        }
+
+        return nodes;
+    }
+
+    auto parse_brace_sequence(const std::string& text, BraceNode& node) -> bool
+    {
+        // start..end[..step]
+        size_t first_dots = text.find("..");
+        if (first_dots == std::string::npos)
+        {
+            return false;
+        }
+
+        size_t second_dots = text.find("..", first_dots + 2);
+        std::string start = text.substr(0, first_dots);
+        std::string end = text.substr(first_dots + 2, (second_dots == std::string::npos)
+                                                          ? std::string::npos
+                                                          : second_dots - first_dots - 2);
+        std::string step =
+            (second_dots == std::string::npos) ? "1" : text.substr(second_dots + 2);
+
+        auto parse_integer = [](const std::string& str, int64_t& value) -> bool
+        {
+            const char* first = str.data() + ((!str.empty() && str[0] == '+') ? 1 : 0);
+            auto [ptr, error_code] = std::from_chars(first, str.data() + str.size(), value);
+            return !str.empty() && error_code == std::errc() && ptr == str.data() + str.size();
+        };
+
+        auto is_letter = [](const std::string& str)
+        { return str.size() == 1 && std::isalpha(static_cast<unsigned char>(str[0])); };
+
+        int64_t start_value = 0;
+        int64_t end_value = 0;
+        int64_t step_value = 0;
+        if (!parse_integer(step, step_value))
+        {
+            return false;
+        }
+
+        if (is_letter(start) && is_letter(end))
+        {
+            node.is_character = true;
+            start_value = start[0];
+            end_value = end[0];
+        }
+        else if (parse_integer(start, start_value) && parse_integer(end, end_value))
+        {
+            // {01..10} pads every value to the widest end
+            auto has_leading_zero = [](const std::string& str)
+            {
+                size_t digits = str.find_first_not_of("+-");
+                return digits != std::string::npos && str.size() - digits > 1
+                       && str[digits] == '0';
+            };
+            if (has_leading_zero(start) || has_leading_zero(end))
+            {
+                node.width = std::max(start.size(), end.size());
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        // NOTE(abi): the count is computed in unsigned arithmetic, so that
+        // {-9223372036854775808..9223372036854775807} doesn't overflow.
+        bool is_ascending = end_value >= start_value;
+        uint64_t distance = is_ascending ? static_cast<uint64_t>(end_value) - start_value
+                                         : static_cast<uint64_t>(start_value) - end_value;
+        uint64_t step_size = (step_value < 0) ? 0 - static_cast<uint64_t>(step_value)
+                                              : static_cast<uint64_t>(step_value);
+        step_size = std::max<uint64_t>(step_size, 1);
+
+        node.type = BraceNodeType::SEQUENCE;
+        node.start = start_value;
+        node.step = static_cast<int64_t>(is_ascending ? step_size : 0 - step_size);
+        node.value_count = static_cast<size_t>(distance / step_size) + 1;
+        return true;
+    }
+
+    auto get_brace_expansion_count(const std::vector<BraceNode>& pattern) -> size_t
+    {
+        if (pattern.empty())
+        {
+            return 1;
+        }
+
+        const BraceNode& first = pattern.front();
+        size_t count;
+        return __builtin_mul_overflow(first.stride, first.value_count, &count)
+                   ? std::numeric_limits<size_t>::max()
+                   : count;
+    }
+
+    auto get_brace_expansion(const std::vector<BraceNode>& pattern, size_t index,
+                             std::vector<WordPart>& parts) -> void
+    {
+        for (const BraceNode& node : pattern)
+        {
+            size_t value_index = (index / node.stride) % node.value_count;
+            switch (node.type)
+            {
+            case BraceNodeType::PARTS:
+                parts.insert(parts.end(), node.parts.begin(), node.parts.end());
+                break;
+            case BraceNodeType::SEQUENCE:
+                parts.push_back(
+                    {WordPartType::LITERAL, format_brace_sequence_value(node, value_index), false});
+                break;
+            case BraceNodeType::ALTERNATION:
+            {
+                auto it = std::upper_bound(node.alternative_offsets.begin(),
+                                           node.alternative_offsets.end(), value_index);
+                size_t alternative = (it - node.alternative_offsets.begin()) - 1;
+                get_brace_expansion(node.alternatives[alternative],
+                                    value_index - node.alternative_offsets[alternative], parts);
+                break;
+            }
+            }
+        }
+    }
+
+    auto format_brace_sequence_value(const BraceNode& node, size_t index) -> std::string
+    {
+        int64_t value = static_cast<int64_t>(static_cast<uint64_t>(node.start)
+                                             + static_cast<uint64_t>(node.step) * index);
+        if (node.is_character)
+        {
+            return std::string(1, static_cast<char>(value));
+        }
+
+        std::string digits = std::to_string(value);
+        if (digits.size() >= node.width)
+        {
+            return digits;
+        }
+
+        // The sign counts towards the width, the padding goes after it
+        size_t sign_length = (value < 0) ? 1 : 0;
+        digits.insert(sign_length, node.width - digits.size(), '0');
+        return digits;
+    }
+
+} // namespace ash
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "parser.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // One unquoted brace character, or a run of anything else
+    struct BraceAtom
+    {
+        char brace = '\0'; // '{', ',' or '}'
+        WordPart part;
+    };
+
+    // Parsing
+    auto parse_brace_pattern(const Word& word) -> std::vector<BraceNode>;
+    auto split_brace_atoms(const Word& word) -> std::vector<BraceAtom>;
+    auto parse_brace_nodes(const std::vector<BraceAtom>& atoms, size_t begin, size_t end)
+        -> std::vector<BraceNode>;
+    auto parse_brace_sequence(const std::string& text, BraceNode& node) -> bool;
+
+    // Generation
+    auto get_brace_expansion_count(const std::vector<BraceNode>& pattern) -> size_t;
+    auto get_brace_expansion(const std::vector<BraceNode>& pattern, size_t index,
+                             std::vector<WordPart>& parts) -> void;
+    auto format_brace_sequence_value(const BraceNode& node, size_t index) -> std::string;
+
+} // namespace ash
@@ -1,12 +1,24 @@
 #include "commands.hpp"
 #include "constants.hpp"
+#include "frecency.hpp"
+#include "interpreter.hpp"
+#include "io.hpp"
+#include "memo.hpp"
+#include "resources.hpp"
+#include "scripting.hpp"
 #include "state.hpp"
+#include "variables.hpp"
+#include "watch.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <string_view>
 
 #ifdef _WIN32
     #include <windows.h>
@@ -14,29 +26,51 @@
     #include <dirent.h>
     #include <fcntl.h>
     #include <readline/history.h>
+    #include <sys/mman.h>
     #include <sys/stat.h>
+    #include <sys/wait.h>
     #include <unistd.h>
 #endif
 
 namespace ash
 {
 
-    ShellState shell_state;
+    thread_local ShellState* shell_state = nullptr;
 
-    using BuiltinHandler = std::function<void(const std::string&)>;
     const std::unordered_map<std::string, BuiltinHandler> BUILTIN_HANDLERS = {
-        {// NOTE(abi): we handle exit in handle_input(), but we still need to
-         // register it.
-         "exit", [](const std::string&) {}},
-        {"echo", [](const std::string& args) { echo_command(parse_arguments(args)); }},
+        {// NOTE(abi): exit and return are compiled into the program, but we still
+         // need to register them.
+         "exit", [](const BuiltinArguments&) { return 0; }},
+        {"return", [](const BuiltinArguments&) { return 0; }},
+        {"echo", echo_command},
         {"type", type_command},
-        {"pwd", [](const std::string&) { pwd_command(); }},
-        {"cd", cd_command},
-        {"history", history_command}};
+        {"pwd", pwd_command},
+        {"cd",
+         [](const BuiltinArguments& args) { return cd_command(args.empty() ? "" : args[0]); }},
+        {"history", history_command},
+        {"set", set_command},
+        {"hash", hash_command},
+        {"cat", cat_command},
+        {"tee", tee_command},
+        {"test", test_command},
+        {"[", bracket_test_command},
+        {"true", [](const BuiltinArguments&) { return 0; }},
+        {":", [](const BuiltinArguments&) { return 0; }},
+        {"false", [](const BuiltinArguments&) { return 1; }},
+        {"printf", printf_command},
+        {"read", read_command},
+        {"alias", alias_command},
+        {"unalias", unalias_command},
+        {"export", export_command},
+        {"unset", unset_command},
+        {"memo", memo_command},
+        {"watch-run", watch_run_command},
+        {"resources", resources_command},
+        {"j", jump_command}};
 
     const std::unordered_set<std::string> SHELL_BUILTINS = get_builtin_names();
 
-    auto echo_command(const std::vector<std::string>& args) -> void
+    auto echo_command(const std::vector<std::string>& args) -> int
     {
         for (size_t i = 0; i < args.size(); i++)
         {
@@ -48,62 +82,94 @@ namespace ash
         }
 
         std::cout << std::endl;
+        return 0;
     }
 
-    auto type_command(const std::string& name) -> void
+    auto type_command(const std::vector<std::string>& names) -> int
     {
-        if (is_builtin(name))
+        int status = 0;
+        for (const std::string& name : names)
         {
-            std::cout << name << " is a shell builtin" << std::endl;
-            return;
-        }
+            CommandType type;
+            const CommandEntry* entry = resolve_command(name, type);
+            if (entry == nullptr)
+            {
+                std::cout << name << ": not found" << std::endl;
+                status = 1;
+                continue;
+            }
 
-        if (auto filepath = find_executable_in_path(name); !filepath.empty())
-        {
-            std::cout << name << " is " << filepath << std::endl;
-            return;
+            switch (type)
+            {
+            case CommandType::ALIAS:
+                std::cout << name << " is aliased to `" << entry->alias_value << "'" << std::endl;
+                break;
+            case CommandType::FUNCTION:
+                std::cout << name << " is a function" << std::endl;
+                break;
+            case CommandType::BUILTIN:
+                std::cout << name << " is a shell builtin" << std::endl;
+                break;
+            case CommandType::EXTERNAL:
+                std::cout << name << " is " << entry->executable_path << std::endl;
+                break;
+            }
         }
 
-        std::cout << name << ": not found" << std::endl;
+        return status;
     }
 
-    auto pwd_command() -> void
+    auto pwd_command(const std::vector<std::string>& args) -> int
     {
-        char cwd[config::MAX_PATH_LENGTH];
-        if (getcwd(cwd, sizeof(cwd)) != nullptr)
+        bool is_physical = false;
+        for (const std::string& arg : args)
         {
-            std::cout << cwd << std::endl;
-            return;
+            if (arg == "-P")
+            {
+                is_physical = true;
+            }
+            else if (arg != "-L")
+            {
+                std::cerr << "pwd: " << arg << ": invalid option" << std::endl;
+                return 2;
+            }
         }
 
-        std::cerr << "pwd: error getting the current working directory" << std::endl;
+        std::string directory = is_physical ? get_physical_directory() : get_working_directory();
+        if (directory.empty())
+        {
+            std::cerr << "pwd: error getting the current working directory" << std::endl;
+            return 1;
+        }
+
+        std::cout << directory << std::endl;
+        return 0;
     }
 
-    auto cd_command(const std::string& path) -> void
+    auto cd_command(const std::string& path) -> int
     {
         std::string target_path;
 
         // Home directory
         if (path.empty() || path == "~")
         {
-            const char* home = std::getenv("HOME");
-            if (home == nullptr)
+            std::optional<std::string> home = get_variable("HOME");
+            if (!home.has_value())
             {
                 std::cerr << "cd: HOME not set" << std::endl;
-                return;
+                return 1;
             }
-            target_path = home;
+            target_path = *home;
         }
         // Previous directory
         else if (path == "-")
         {
-            if (shell_state.previous_directory.empty())
+            if (shell_state->previous_directory.empty())
             {
-                pwd_command();
-                return;
+                return pwd_command({});
             }
 
-            target_path = shell_state.previous_directory;
+            target_path = shell_state->previous_directory;
         }
         // Absolute/relative path
         else
@@ -111,21 +177,123 @@ namespace ash
             target_path = path;
         }
 
-        char current_dir[config::MAX_PATH_LENGTH];
-        if (getcwd(current_dir, sizeof(current_dir)) != nullptr)
+        // NOTE(abi): like cd -L, `..` drops the last component of the path we came in by,
+        // not of wherever a symlink along it pointed. When that logical path can't be
+        // entered (too long for one chdir, or a component is gone) the target is taken
+        // as given, relative to where we physically are.
+        std::string current_directory = get_working_directory();
+        std::string logical_path;
+        if (target_path.starts_with('/'))
+        {
+            logical_path = normalize_logical_path(target_path);
+        }
+        else if (!current_directory.empty())
+        {
+            logical_path = normalize_logical_path(current_directory + "/" + target_path);
+        }
+
+        bool is_logical = !logical_path.empty() && chdir(logical_path.c_str()) == 0;
+        if (!is_logical && chdir(target_path.c_str()) != 0)
+        {
+            std::cerr << "cd: " << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+
+        set_working_directory(is_logical ? logical_path : get_physical_directory());
+        if (path == "-")
+        {
+            std::cout << shell_state->working_directory << std::endl;
+        }
+
+        record_directory_visit(shell_state->working_directory);
+        return 0;
+    }
+
+    auto get_working_directory() -> const std::string&
+    {
+        std::string& directory = shell_state->working_directory;
+        if (!directory.empty())
+        {
+            return directory;
+        }
+
+        // An inherited $PWD is kept, symlinks and all, while it still names this directory
+        const char* pwd = get_exported_variable("PWD");
+        struct stat pwd_stat;
+        struct stat dot_stat;
+        if (pwd != nullptr && pwd[0] == '/' && normalize_logical_path(pwd) == pwd
+            && stat(pwd, &pwd_stat) == 0 && stat(".", &dot_stat) == 0
+            && pwd_stat.st_dev == dot_stat.st_dev && pwd_stat.st_ino == dot_stat.st_ino)
+        {
+            directory = pwd;
+        }
+        else
         {
-            if (chdir(target_path.c_str()) != 0)
+            directory = get_physical_directory();
+        }
+
+        return directory;
+    }
+
+    auto get_physical_directory() -> std::string
+    {
+        // Deep trees outgrow any fixed buffer
+        std::string buffer(config::MAX_PATH_LENGTH, '\0');
+        while (getcwd(buffer.data(), buffer.size()) == nullptr)
+        {
+            if (errno != ERANGE)
             {
-                std::cout << "cd: " << path << ": No such file or directory" << std::endl;
+                return "";
             }
-            else
+            buffer.resize(buffer.size() * 2);
+        }
+
+        buffer.resize(std::strlen(buffer.c_str()));
+        return buffer;
+    }
+
+    auto set_working_directory(const std::string& directory) -> void
+    {
+        shell_state->previous_directory = get_working_directory();
+        shell_state->working_directory = directory;
+        set_variable("OLDPWD", shell_state->previous_directory);
+        set_variable("PWD", directory);
+    }
+
+    auto normalize_logical_path(const std::string& path) -> std::string
+    {
+        std::vector<std::string_view> components;
+        std::string_view rest(path);
+        while (!rest.empty())
+        {
+            size_t slash = rest.find('/');
+            std::string_view component = rest.substr(0, slash);
+            rest = (slash == std::string_view::npos) ? "" : rest.substr(slash + 1);
+
+            if (component == "..")
             {
-                shell_state.previous_directory = current_dir;
+                if (!components.empty())
+                {
+                    components.pop_back();
+                }
+            }
+            else if (!component.empty() && component != ".")
+            {
+                components.push_back(component);
             }
         }
+
+        std::string normalized;
+        for (std::string_view component : components)
+        {
+            normalized += '/';
+            normalized += component;
+        }
+
+        return normalized.empty() ? "/" : normalized;
     }
 
-    auto load_history_from_file(const std::string& filepath) -> bool
+    auto read_history_file(const std::string& filepath, std::vector<std::string>& entries) -> bool
     {
         std::ifstream file(filepath);
         if (!file.is_open())
@@ -136,21 +304,71 @@ namespace ash
         std::string line;
         while (std::getline(file, line))
         {
-            if (line.empty())
+            if (!line.empty())
             {
-                continue;
+                entries.push_back(std::move(line));
             }
+        }
 
-            shell_state.command_history.push_back(line);
-            ::add_history(line.c_str());
+        return true;
+    }
+
+    auto load_history_from_file(const std::string& filepath) -> bool
+    {
+        std::vector<std::string> entries;
+        if (!read_history_file(filepath, entries))
+        {
+            return false;
         }
 
-        file.close();
-        shell_state.command_history_last_write_index = shell_state.command_history.size();
+        for (std::string& line : entries)
+        {
+            ::add_history(line.c_str());
+            shell_state->command_history.push_back(std::move(line));
+        }
+        shell_state->command_history_last_write_index = shell_state->command_history.size();
 
         return true;
     }
 
+    auto start_loading_history(const std::string& filepath) -> void
+    {
+        shell_state->pending_history = start_background_task<std::vector<std::string>>(
+            [filepath]()
+            {
+                std::vector<std::string> entries;
+                read_history_file(filepath, entries);
+                return entries;
+            });
+    }
+
+    auto finish_loading_history(bool wait) -> void
+    {
+        auto& pending = shell_state->pending_history;
+        if (pending == nullptr || (!wait && !is_background_result_ready(*pending)))
+        {
+            return;
+        }
+
+        std::vector<std::string> entries = std::move(wait_for_background_result(*pending));
+        pending.reset();
+
+        // Lines entered while the file was loading come after it
+        size_t loaded_count = entries.size();
+        entries.insert(entries.end(), std::make_move_iterator(shell_state->command_history.begin()),
+                       std::make_move_iterator(shell_state->command_history.end()));
+        shell_state->command_history = std::move(entries);
+        shell_state->command_history_last_write_index += loaded_count;
+
+        // NOTE(abi): readline's list is only touched here, on the main thread.
+        ::clear_history();
+        for (const std::string& line : shell_state->command_history)
+        {
+            ::add_history(line.c_str());
+        }
+        ::using_history();
+    }
+
     auto write_history_to_file(const std::string& filepath, bool append) -> bool
     {
         std::ofstream file(filepath, append ? std::ios::app : std::ios::out);
@@ -161,91 +379,401 @@ namespace ash
 
         if (append)
         {
-            for (size_t i = shell_state.command_history_last_write_index;
-                 i < shell_state.command_history.size(); i++)
+            for (size_t i = shell_state->command_history_last_write_index;
+                 i < shell_state->command_history.size(); i++)
             {
-                file << shell_state.command_history[i] << std::endl;
+                file << shell_state->command_history[i] << std::endl;
             }
         }
         else
         {
-            for (const std::string& cmd : shell_state.command_history)
+            for (const std::string& cmd : shell_state->command_history)
             {
                 file << cmd << std::endl;
             }
         }
 
         file.close();
-        shell_state.command_history_last_write_index = shell_state.command_history.size();
+        shell_state->command_history_last_write_index = shell_state->command_history.size();
 
         return true;
     }
 
-    auto history_command(const std::string& args) -> void
+    auto history_command(const std::vector<std::string>& args) -> int
     {
-        if (args.find("-r") == 0 || args.find("-w") == 0 || args.find("-a") == 0)
+        finish_loading_history(true);
+
+        if (!args.empty() && (args[0] == "-r" || args[0] == "-w" || args[0] == "-a"))
         {
-            bool read_mode = (args.find("-r") == 0);
-            bool append_mode = read_mode ? false : (args.find("-a") == 0);
+            bool read_mode = (args[0] == "-r");
+            bool append_mode = (args[0] == "-a");
 
-            auto filename = extract_filename_from_arguments(args, 2);
-            if (!filename.has_value())
+            if (args.size() < 2)
             {
-                if (read_mode)
-                {
-                    std::cerr << "history: -r requires a filename" << std::endl;
-                    return;
-                }
+                std::cerr << "history: " << args[0] << " requires a filename" << std::endl;
+                return 1;
+            }
+
+            const std::string& filename = args[1];
+            bool success = read_mode ? load_history_from_file(filename)
+                                     : write_history_to_file(filename, append_mode);
+            if (!success)
+            {
+                std::cerr << "history: cannot open " << filename << std::endl;
+                return 1;
+            }
+
+            return 0;
+        }
+
+        int num_entries = shell_state->command_history.size();
+
+        if (!args.empty())
+        {
+            try
+            {
+                num_entries = std::stoi(args[0]);
+            }
+            catch (...)
+            {
+                std::cerr << "history: invalid argument" << std::endl;
+                return 1;
+            }
+        }
+
+        size_t start_index = 0;
+        if (num_entries < static_cast<int>(shell_state->command_history.size()))
+        {
+            start_index = shell_state->command_history.size() - num_entries;
+        }
+
+        for (size_t i = start_index; i < shell_state->command_history.size(); i++)
+        {
+            std::cout << std::setw(5) << (i + 1) << "  " << shell_state->command_history[i]
+                      << std::endl;
+        }
+
+        return 0;
+    }
 
-                std::cerr << "history: " << (append_mode ? "-a" : "-w") << " requires a filename"
+    auto set_command(const std::vector<std::string>& args) -> int
+    {
+        const std::vector<std::pair<std::string, bool*>> options = {
+            {"bigpipes", &shell_state->options.big_pipes},
+            {"nativeedit", &shell_state->options.native_editor},
+        };
+
+        if (args.empty() || (args.size() == 1 && (args[0] == "-o" || args[0] == "+o")))
+        {
+            for (const auto& [name, value] : options)
+            {
+                std::cout << std::left << std::setw(15) << name << (*value ? "on" : "off")
                           << std::endl;
-                return;
             }
+            return 0;
+        }
+
+        for (size_t i = 0; i + 1 < args.size(); i += 2)
+        {
+            if (args[i] != "-o" && args[i] != "+o")
+            {
+                std::cerr << "set: " << args[i] << ": invalid option" << std::endl;
+                return 2;
+            }
+
+            auto it = std::find_if(options.begin(), options.end(),
+                                   [&](const auto& option) { return option.first == args[i + 1]; });
+            if (it == options.end())
+            {
+                std::cerr << "set: " << args[i + 1] << ": invalid option name" << std::endl;
+                return 2;
+            }
+
+            *it->second = (args[i] == "-o");
+        }
+
+        return 0;
+    }
+
+    auto hash_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.size() == 1 && args[0] == "-r")
+        {
+            forget_hashed_paths();
+            clear_program_cache();
+            return 0;
+        }
+
+        if (!args.empty())
+        {
+            std::cerr << "hash: usage: hash [-r]" << std::endl;
+            return 2;
+        }
+
+        // What the shell's caches saved it
+        size_t hashed_count = std::count_if(shell_state->command_table.begin(),
+                                            shell_state->command_table.end(),
+                                            [](const auto& entry)
+                                            { return !entry.second.executable_path.empty(); });
+        const ProgramCache& cache = shell_state->program_cache;
+        uint64_t lookups = cache.hits + cache.misses;
+        double hit_rate = (lookups > 0) ? 100.0 * cache.hits / lookups : 0;
+
+        std::cout << std::left << std::setw(15) << "commands" << hashed_count << " hashed"
+                  << std::endl;
+        std::cout << std::left << std::setw(15) << "programs" << cache.entries.size() << "/"
+                  << config::PROGRAM_CACHE_SIZE << " cached, " << cache.hits << " hits, "
+                  << cache.misses << " misses (" << std::fixed << std::setprecision(1)
+                  << hit_rate << "%)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        return 0;
+    }
+
+    auto cat_command(const std::vector<std::string>& args) -> int
+    {
+        std::vector<std::string> files;
+        for (const std::string& arg : args)
+        {
+            // NOTE(abi): output is never buffered here, so -u is a no-op.
+            if (arg != "-u")
+            {
+                files.push_back(arg);
+            }
+        }
 
-            if (read_mode)
+        if (files.empty())
+        {
+            files.push_back("-");
+        }
+
+        int status = 0;
+        for (const std::string& file : files)
+        {
+            int fd = (file == "-") ? static_cast<int>(StandardStream::IN)
+                                   : open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
             {
-                if (!load_history_from_file(*filename))
+                std::cerr << "cat: " << file << ": " << std::strerror(errno) << std::endl;
+                status = 1;
+                continue;
+            }
+
+            // A reader that stopped early ends cat as SIGPIPE would, without a message
+            if (!copy_file_descriptor(fd, static_cast<int>(StandardStream::OUT)))
+            {
+                if (errno == EPIPE)
                 {
-                    std::cerr << "history: cannot open " << *filename << std::endl;
+                    if (fd != static_cast<int>(StandardStream::IN))
+                    {
+                        close(fd);
+                    }
+                    return 128 + SIGPIPE;
                 }
+
+                std::cerr << "cat: " << file << ": " << std::strerror(errno) << std::endl;
+                status = 1;
             }
-            else
+
+            if (fd != static_cast<int>(StandardStream::IN))
             {
-                if (!write_history_to_file(*filename, append_mode))
+                close(fd);
+            }
+        }
+
+        return status;
+    }
+
+    auto tee_command(const std::vector<std::string>& args) -> int
+    {
+        int status = 0;
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        std::vector<int> output_fds;
+        for (const std::string& arg : args)
+        {
+            if (arg == "-a")
+            {
+                flags = (flags & ~O_TRUNC) | O_APPEND;
+                continue;
+            }
+
+            int fd = open(arg.c_str(), flags, permissions::DEFAULT_FILE_MODE);
+            if (fd == -1)
+            {
+                std::cerr << "tee: " << arg << ": " << std::strerror(errno) << std::endl;
+                status = 1;
+                continue;
+            }
+            output_fds.push_back(fd);
+        }
+        output_fds.push_back(static_cast<int>(StandardStream::OUT));
+
+        if (!tee_file_descriptor(static_cast<int>(StandardStream::IN), output_fds))
+        {
+            if (errno != EPIPE)
+            {
+                std::cerr << "tee: " << std::strerror(errno) << std::endl;
+            }
+            status = 1;
+        }
+
+        for (size_t i = 0; i + 1 < output_fds.size(); i++)
+        {
+            close(output_fds[i]);
+        }
+
+        return status;
+    }
+
+    auto alias_command(const std::vector<std::string>& args) -> int
+    {
+        auto print_alias = [](const std::string& name, const std::string& value)
+        {
+            std::string quoted_value;
+            for (char c : value)
+            {
+                quoted_value += (c == '\'') ? "'\\''" : std::string(1, c);
+            }
+            std::cout << "alias " << name << "='" << quoted_value << "'" << std::endl;
+        };
+
+        if (args.empty())
+        {
+            std::vector<std::pair<std::string, std::string>> aliases;
+            for (const auto& [name, entry] : shell_state->command_table)
+            {
+                if (!entry.alias_value.empty())
                 {
-                    std::cerr << "history: cannot open " << *filename << std::endl;
+                    aliases.emplace_back(name, entry.alias_value);
                 }
             }
 
-            return;
+            std::sort(aliases.begin(), aliases.end());
+            for (const auto& [name, value] : aliases)
+            {
+                print_alias(name, value);
+            }
+            return 0;
         }
 
-        int num_entries = shell_state.command_history.size();
+        int status = 0;
+        for (const std::string& arg : args)
+        {
+            size_t equals_pos = arg.find('=');
+            if (equals_pos != std::string::npos)
+            {
+                status = define_alias(arg.substr(0, equals_pos), arg.substr(equals_pos + 1))
+                             ? status
+                             : 1;
+                continue;
+            }
 
-        if (!args.empty())
+            auto it = shell_state->command_table.find(arg);
+            if (it == shell_state->command_table.end() || it->second.alias_value.empty())
+            {
+                std::cerr << "alias: " << arg << ": not found" << std::endl;
+                status = 1;
+                continue;
+            }
+            print_alias(arg, it->second.alias_value);
+        }
+
+        return status;
+    }
+
+    auto unalias_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.empty())
         {
-            try
+            std::cerr << "unalias: usage: unalias [-a] name [name ...]" << std::endl;
+            return 2;
+        }
+
+        int status = 0;
+        for (auto& [name, entry] : shell_state->command_table)
+        {
+            bool is_removed =
+                args[0] == "-a" || std::find(args.begin(), args.end(), name) != args.end();
+            if (is_removed)
             {
-                num_entries = std::stoi(args);
+                entry.alias_value.clear();
+                entry.alias_pipeline.clear();
             }
-            catch (...)
+        }
+
+        for (const std::string& name : args)
+        {
+            if (name != "-a" && !shell_state->command_table.contains(name))
             {
-                std::cerr << "history: invalid argument" << std::endl;
-                return;
+                std::cerr << "unalias: " << name << ": not found" << std::endl;
+                status = 1;
             }
         }
 
-        size_t start_index = 0;
-        if (num_entries < static_cast<int>(shell_state.command_history.size()))
+        return status;
+    }
+
+    auto export_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.empty() || (args.size() == 1 && args[0] == "-p"))
         {
-            start_index = shell_state.command_history.size() - num_entries;
+            for (const auto& [name, value] : get_exported_variables())
+            {
+                std::string quoted_value;
+                for (char c : value)
+                {
+                    quoted_value += (c == '\'') ? "'\\''" : std::string(1, c);
+                }
+                std::cout << "export " << name << "='" << quoted_value << "'" << std::endl;
+            }
+            return 0;
         }
 
-        for (size_t i = start_index; i < shell_state.command_history.size(); i++)
+        int status = 0;
+        for (const std::string& arg : args)
         {
-            std::cout << std::setw(5) << (i + 1) << "  " << shell_state.command_history[i]
-                      << std::endl;
+            size_t equals_pos = arg.find('=');
+            std::string name = arg.substr(0, equals_pos);
+            if (!is_valid_variable_name(name))
+            {
+                std::cerr << "export: `" << arg << "': not a valid identifier" << std::endl;
+                status = 1;
+                continue;
+            }
+
+            // NOTE(abi): a name without a value is only exported once it has one, the
+            // environment has no room for a variable that is exported but unset.
+            std::optional<std::string> value = (equals_pos != std::string::npos)
+                                                   ? arg.substr(equals_pos + 1)
+                                                   : get_variable(name);
+            if (value.has_value())
+            {
+                export_variable(name, *value);
+            }
         }
+
+        return status;
+    }
+
+    auto unset_command(const std::vector<std::string>& args) -> int
+    {
+        int status = 0;
+        for (const std::string& name : args)
+        {
+            if (name == "-v")
+            {
+                continue;
+            }
+
+            if (!is_valid_variable_name(name))
+            {
+                std::cerr << "unset: `" << name << "': not a valid identifier" << std::endl;
+                status = 1;
+                continue;
+            }
+            unset_variable(name);
+        }
+
+        return status;
     }
 
     auto get_builtin_names() -> std::unordered_set<std::string>
@@ -264,6 +792,150 @@ namespace ash
         return SHELL_BUILTINS.find(command) != SHELL_BUILTINS.end();
     }
 
+    auto resolve_command(const std::string& name, CommandType& type, bool allow_alias)
+        -> const CommandEntry*
+    {
+        auto [it, is_new] = shell_state->command_table.try_emplace(name);
+        CommandEntry& entry = it->second;
+        if (is_new)
+        {
+            auto builtin = BUILTIN_HANDLERS.find(name);
+            entry.builtin = (builtin != BUILTIN_HANDLERS.end()) ? &builtin->second : nullptr;
+        }
+
+        // NOTE(abi): an alias isn't expanded again while its own value is running, so
+        // that alias ls='ls -F' reaches the real ls.
+        bool is_expanding =
+            std::find(shell_state->expanding_aliases.begin(), shell_state->expanding_aliases.end(),
+                      name)
+            != shell_state->expanding_aliases.end();
+        if (!entry.alias_value.empty() && allow_alias && !is_expanding)
+        {
+            type = CommandType::ALIAS;
+            return &entry;
+        }
+
+        if (entry.function != nullptr)
+        {
+            type = CommandType::FUNCTION;
+            return &entry;
+        }
+
+        if (entry.builtin != nullptr)
+        {
+            type = CommandType::BUILTIN;
+            return &entry;
+        }
+
+        // Paths are looked up once and hashed, except for names with a slash, which
+        // depend on the working directory
+        if (name.find('/') != std::string::npos)
+        {
+            entry.executable_path = is_executable(name) ? name : "";
+        }
+        else if (entry.executable_path.empty())
+        {
+            entry.executable_path = find_executable_in_path(name);
+        }
+
+        if (entry.executable_path.empty())
+        {
+            if (entry.alias_value.empty())
+            {
+                shell_state->command_table.erase(it);
+            }
+            return nullptr;
+        }
+
+        type = CommandType::EXTERNAL;
+        return &entry;
+    }
+
+    auto define_alias(const std::string& name, const std::string& value) -> bool
+    {
+        if (find_unquoted(value, ";") != std::string::npos
+            || find_unquoted(value, "&&") != std::string::npos
+            || find_unquoted(value, "||") != std::string::npos
+            || value.find('\n') != std::string::npos)
+        {
+            std::cerr << "alias: " << name << ": only commands and pipelines are supported"
+                      << std::endl;
+            return false;
+        }
+
+        std::vector<CommandSpec> pipeline;
+        if (has_pipes(value))
+        {
+            pipeline = parse_pipeline(value);
+        }
+        else if (auto cmd = parse_command_segment(value))
+        {
+            pipeline.push_back(*cmd);
+        }
+
+        if (pipeline.empty())
+        {
+            std::cerr << "alias: " << name << ": empty alias" << std::endl;
+            return false;
+        }
+
+        for (const CommandSpec& cmd : pipeline)
+        {
+            if (cmd.redirection.is_target_missing)
+            {
+                std::cerr << "alias: " << name << ": redirection without a target" << std::endl;
+                return false;
+            }
+        }
+
+        CommandEntry& entry = shell_state->command_table[name];
+        entry.alias_value = value;
+        entry.alias_pipeline = std::move(pipeline);
+        return true;
+    }
+
+    auto define_function(const std::string& name, std::shared_ptr<const Program> body) -> void
+    {
+        shell_state->command_table[name].function = std::move(body);
+    }
+
+    auto apply_alias(const CommandEntry& entry, const CommandSpec& cmd) -> std::vector<CommandSpec>
+    {
+        // The command's own arguments and redirections go to the last stage, its
+        // assignments to the first one, ahead of the alias' own
+        std::vector<CommandSpec> pipeline = entry.alias_pipeline;
+        CommandSpec& first = pipeline.front();
+        first.assignments.insert(first.assignments.begin(), cmd.assignments.begin(),
+                                 cmd.assignments.end());
+        CommandSpec& last = pipeline.back();
+        last.args.insert(last.args.end(), cmd.args.begin(), cmd.args.end());
+        last.redirection.redirections.insert(last.redirection.redirections.end(),
+                                             cmd.redirection.redirections.begin(),
+                                             cmd.redirection.redirections.end());
+        last.process_substitutions.insert(last.process_substitutions.end(),
+                                          cmd.process_substitutions.begin(),
+                                          cmd.process_substitutions.end());
+        if (!cmd.fan_out.empty())
+        {
+            last.fan_out = cmd.fan_out;
+        }
+
+        return pipeline;
+    }
+
+    auto forget_hashed_paths() -> void
+    {
+        for (auto it = shell_state->command_table.begin(); it != shell_state->command_table.end();)
+        {
+            CommandEntry& entry = it->second;
+            entry.executable_path.clear();
+
+            bool is_empty = entry.alias_value.empty() && entry.function == nullptr
+                            && entry.builtin == nullptr;
+            it = is_empty ? shell_state->command_table.erase(it) : std::next(it);
+        }
+    }
+
     auto get_histfile() -> std::optional<std::string>
     {
         const char* histfile = std::getenv("HISTFILE");
@@ -291,13 +963,13 @@ namespace ash
 
     auto get_path_directories() -> std::vector<std::string>
     {
-        const char* path_cstr = std::getenv("PATH");
-        if (path_cstr == nullptr)
+        std::optional<std::string> path = get_variable("PATH");
+        if (!path.has_value())
         {
             return {};
         }
 
-        return split_path(path_cstr);
+        return split_path(*path);
     }
 
     auto find_executable_in_path(const std::string& command) -> std::string
@@ -317,10 +989,22 @@ namespace ash
 
     auto get_matching_executables_in_path(const std::string& prefix, bool sort)
         -> std::vector<std::string>
+    {
+        std::vector<std::string> matches =
+            find_executables_in_directories(get_path_directories(), prefix);
+        if (sort)
+        {
+            std::sort(matches.begin(), matches.end());
+        }
+
+        return matches;
+    }
+
+    auto find_executables_in_directories(const std::vector<std::string>& directories,
+                                         const std::string& prefix) -> std::vector<std::string>
     {
         std::unordered_set<std::string> unique_executables;
 
-        std::vector<std::string> directories = get_path_directories();
         for (const std::string& dir : directories)
         {
             // Check if the directory exists
@@ -359,13 +1043,64 @@ namespace ash
             closedir(dirp);
         }
 
-        std::vector<std::string> matches(unique_executables.begin(), unique_executables.end());
-        if (sort)
+        return std::vector<std::string>(unique_executables.begin(), unique_executables.end());
+    }
+
+    auto get_directory_mtimes(const std::vector<std::string>& directories) -> std::vector<int64_t>
+    {
+        std::vector<int64_t> mtimes;
+        mtimes.reserve(directories.size());
+        for (const std::string& dir : directories)
         {
-            std::sort(matches.begin(), matches.end());
+            struct stat st;
+            bool exists = stat(dir.c_str(), &st) == 0;
+            mtimes.push_back(exists ? st.st_mtim.tv_sec * 1'000'000'000LL + st.st_mtim.tv_nsec
+                                    : -1);
         }
 
-        return matches;
+        return mtimes;
+    }
+
+    auto build_executable_index(const std::string& path) -> ExecutableIndex
+    {
+        ExecutableIndex index;
+        index.path = path;
+
+        // NOTE(abi): the mtimes are taken before the scan, so an executable added
+        // while scanning makes the index look stale rather than silently missing.
+        std::vector<std::string> directories = split_path(path);
+        index.directory_mtimes = get_directory_mtimes(directories);
+        index.names = find_executables_in_directories(directories, "");
+        std::sort(index.names.begin(), index.names.end());
+
+        return index;
+    }
+
+    auto start_indexing_executables() -> void
+    {
+        std::string path_value = get_variable("PATH").value_or("");
+        shell_state->pending_executable_index = start_background_task<ExecutableIndex>(
+            [path_value]() { return build_executable_index(path_value); });
+    }
+
+    auto get_executable_index() -> const ExecutableIndex&
+    {
+        ExecutableIndex& index = shell_state->executable_index;
+        if (shell_state->pending_executable_index != nullptr)
+        {
+            index = std::move(wait_for_background_result(*shell_state->pending_executable_index));
+            shell_state->pending_executable_index.reset();
+        }
+
+        // Rebuilt when PATH or the contents of one of its directories changed
+        std::string path_value = get_variable("PATH").value_or("");
+        if (index.path != path_value
+            || index.directory_mtimes != get_directory_mtimes(split_path(path_value)))
+        {
+            index = build_executable_index(path_value);
+        }
+
+        return index;
     }
 
 #ifdef _WIN32
@@ -412,35 +1147,274 @@ namespace ash
     }
 #endif
 
-    auto redirect_stream(StandardStream stream_file_descriptor, const std::string& filename,
-                         RedirectionMode mode) -> bool
+    auto compile_fd_actions(const RedirectionSpec& redirection_spec,
+                            std::vector<FdAction> actions) -> std::vector<FdAction>
     {
-        int fd = open(filename.c_str(), get_redirection_file_descriptor_flags(mode),
-                      permissions::DEFAULT_FILE_MODE);
-        if (fd == -1)
+        // NOTE(abi): targets are expanded here rather than by the parser, a command
+        // in a loop body may redirect to a different file on every iteration.
+        for (const Redirection& redirection : redirection_spec.redirections)
         {
-            std::cerr << "Failed to open file: " << filename << std::endl;
-            return false;
+            bool is_here_string = redirection.here_document_delimiter.empty();
+            switch (redirection.op)
+            {
+            case RedirectionOperator::DUPLICATE:
+                actions.push_back({FdActionType::DUPLICATE, redirection.fd, redirection.source_fd});
+                break;
+            case RedirectionOperator::CLOSE:
+                actions.push_back({FdActionType::CLOSE, redirection.fd});
+                break;
+            case RedirectionOperator::DOCUMENT:
+            {
+                std::string document;
+                if (is_here_string)
+                {
+                    document = unquote_word(redirection.target) + "\n";
+                }
+                else
+                {
+                    document = redirection.is_delimiter_quoted
+                                   ? redirection.target
+                                   : expand_here_document(redirection.target);
+                }
+                actions.push_back(
+                    {FdActionType::DOCUMENT, redirection.fd, -1, 0, std::move(document)});
+                break;
+            }
+            default:
+                actions.push_back({FdActionType::OPEN, redirection.fd, -1,
+                                   get_redirection_file_descriptor_flags(redirection.op),
+                                   unquote_word(redirection.target)});
+                break;
+            }
         }
 
-        int duplicate_fd = dup2(fd, static_cast<int>(stream_file_descriptor));
-        if (duplicate_fd == -1)
+        optimize_fd_actions(actions);
+        return actions;
+    }
+
+    auto optimize_fd_actions(std::vector<FdAction>& actions) -> void
+    {
+        // NOTE(abi): walk the plan backwards, tracking descriptors that get reassigned
+        // later before anything reads them. Assignments to those are dead: dups and
+        // closes are dropped, opens are kept only for their side effects.
+        std::unordered_set<int> reassigned_fds;
+        std::vector<FdAction> optimized;
+
+        for (auto it = actions.rbegin(); it != actions.rend(); it++)
         {
-            std::cerr << "Failed to redirect output" << std::endl;
-            close(fd);
-            return false;
+            FdAction action = *it;
+
+            if (action.type == FdActionType::DUPLICATE && action.fd == action.source_fd)
+            {
+                continue;
+            }
+
+            if (action.fd >= 0 && reassigned_fds.contains(action.fd))
+            {
+                if (action.type != FdActionType::OPEN)
+                {
+                    continue;
+                }
+                action.fd = -1;
+            }
+            else if (action.fd >= 0)
+            {
+                reassigned_fds.insert(action.fd);
+            }
+
+            if (action.type == FdActionType::DUPLICATE)
+            {
+                reassigned_fds.erase(action.source_fd);
+            }
+
+            optimized.push_back(action);
+        }
+
+        actions.assign(optimized.rbegin(), optimized.rend());
+    }
+
+    auto apply_fd_actions(const std::vector<FdAction>& actions, std::vector<SavedFd>* saved_fds)
+        -> bool
+    {
+        // NOTE(abi): in a child about to exec, temporary descriptors are opened
+        // O_CLOEXEC and left for exec to close, which saves a close() per redirection;
+        // dup2() clears the flag on the descriptor it installs. In-process builtins
+        // pass saved_fds instead, so everything they touch can be put back.
+        for (const FdAction& action : actions)
+        {
+            if (saved_fds != nullptr && action.fd >= 0
+                && std::none_of(saved_fds->begin(), saved_fds->end(),
+                                [&](const SavedFd& saved) { return saved.fd == action.fd; }))
+            {
+                saved_fds->push_back(
+                    {action.fd, fcntl(action.fd, F_DUPFD_CLOEXEC, config::SAVED_FD_BASE)});
+            }
+
+            switch (action.type)
+            {
+            case FdActionType::OPEN:
+            case FdActionType::DOCUMENT:
+            {
+                int fd = (action.type == FdActionType::OPEN)
+                             ? open(action.path.c_str(), action.flags | O_CLOEXEC,
+                                    permissions::DEFAULT_FILE_MODE)
+                             : open_document_file_descriptor(action.path);
+                if (fd == -1)
+                {
+                    if (action.type == FdActionType::OPEN)
+                    {
+                        std::cerr << "Failed to open file: " << action.path << std::endl;
+                    }
+                    else
+                    {
+                        std::cerr << "Failed to create here-document" << std::endl;
+                    }
+                    return false;
+                }
+
+                int result = 0;
+                if (action.fd >= 0)
+                {
+                    result = (fd == action.fd) ? fcntl(fd, F_SETFD, 0) : dup2(fd, action.fd);
+                }
+
+                if (saved_fds != nullptr && fd != action.fd)
+                {
+                    close(fd);
+                }
+
+                if (result == -1)
+                {
+                    std::cerr << "Failed to redirect file descriptor " << action.fd << std::endl;
+                    return false;
+                }
+                break;
+            }
+            case FdActionType::DUPLICATE:
+                if (dup2(action.source_fd, action.fd) == -1)
+                {
+                    std::cerr << action.source_fd << ": Bad file descriptor" << std::endl;
+                    return false;
+                }
+                break;
+            case FdActionType::CLOSE:
+                close(action.fd);
+                break;
+            }
         }
 
-        close(fd);
         return true;
     }
 
-    auto get_redirection_file_descriptor_flags(RedirectionMode mode) -> int
+    auto restore_fds(std::vector<SavedFd>& saved_fds) -> void
     {
-        int flags = O_WRONLY | O_CREAT;
-        flags |= (mode == RedirectionMode::APPEND) ? O_APPEND : O_TRUNC;
+        for (auto it = saved_fds.rbegin(); it != saved_fds.rend(); it++)
+        {
+            if (it->saved_fd == -1)
+            {
+                close(it->fd);
+                continue;
+            }
 
-        return flags;
+            dup2(it->saved_fd, it->fd);
+            close(it->saved_fd);
+        }
+
+        saved_fds.clear();
+    }
+
+    auto open_document_file_descriptor(const std::string& document) -> int
+    {
+        // NOTE(abi): the document lives in an anonymous in-memory file, so even huge
+        // bodies never touch the filesystem.
+        int fd = memfd_create("ash-heredoc", MFD_CLOEXEC);
+        if (fd != -1)
+        {
+            if (!write_all(fd, document.data(), document.size())
+                || lseek(fd, 0, SEEK_SET) == -1)
+            {
+                close(fd);
+                return -1;
+            }
+
+            return fd;
+        }
+
+        // Fallback for kernels without memfd: feed the body through a pipe
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+        {
+            return -1;
+        }
+
+        int pipe_capacity = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+        if (pipe_capacity != -1 && document.size() <= static_cast<size_t>(pipe_capacity))
+        {
+            write_all(pipe_fds[1], document.data(), document.size());
+            close(pipe_fds[1]);
+            return pipe_fds[0];
+        }
+
+        // NOTE(abi): bodies larger than the pipe need a concurrent writer. A thread
+        // would die with the exec that follows, so we double-fork a writer process
+        // instead, which leaves nothing behind for the exec'd program to reap.
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            return -1;
+        }
+
+        if (pid == 0)
+        {
+            close(pipe_fds[0]);
+            if (fork() == 0)
+            {
+                write_all(pipe_fds[1], document.data(), document.size());
+            }
+            _exit(0);
+        }
+
+        close(pipe_fds[1]);
+        waitpid(pid, nullptr, 0);
+        return pipe_fds[0];
+    }
+
+    auto write_all(int fd, const char* data, size_t size) -> bool
+    {
+        while (size > 0)
+        {
+            ssize_t written = write(fd, data, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            data += written;
+            size -= written;
+        }
+
+        return true;
+    }
+
+    auto get_redirection_file_descriptor_flags(RedirectionOperator op) -> int
+    {
+        switch (op)
+        {
+        case RedirectionOperator::INPUT:
+            return O_RDONLY;
+        case RedirectionOperator::READ_WRITE:
+            return O_RDWR | O_CREAT;
+        case RedirectionOperator::APPEND:
+            return O_WRONLY | O_CREAT | O_APPEND;
+        default:
+            return O_WRONLY | O_CREAT | O_TRUNC;
+        }
     }
 
 } // namespace ash
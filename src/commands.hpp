@@ -2,9 +2,12 @@
 
 #include "parser.hpp"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -28,22 +31,106 @@ namespace ash
         ERR = STDERR_FILENO
     };
 
+    enum class FdActionType
+    {
+        OPEN,
+        DOCUMENT,
+        DUPLICATE,
+        CLOSE
+    };
+
+    // NOTE(abi): one step of a command's redirection plan. A negative fd on an OPEN
+    // means the file is opened only for its side effects (creation, truncation).
+    struct FdAction
+    {
+        FdActionType type;
+        int fd;
+        int source_fd = -1;
+        int flags = 0;
+        std::string path; // Filename, or the document body
+    };
+
+    struct SavedFd
+    {
+        int fd;
+        int saved_fd; // -1 when fd was closed
+    };
+
+    // NOTE(abi): builtins get their already expanded arguments (without the command
+    // name) and return an exit status.
+    using BuiltinArguments = std::vector<std::string>;
+    using BuiltinHandler = std::function<int(const BuiltinArguments&)>;
+
     extern const std::unordered_set<std::string> SHELL_BUILTINS;
-    extern const std::unordered_map<std::string, std::function<void(const std::string&)>>
-        BUILTIN_HANDLERS;
+    extern const std::unordered_map<std::string, BuiltinHandler> BUILTIN_HANDLERS;
+
+    struct Program;
+
+    enum class CommandType
+    {
+        ALIAS,
+        FUNCTION,
+        BUILTIN,
+        EXTERNAL
+    };
+
+    // NOTE(abi): aliases, functions, builtins and hashed PATH hits share one entry per
+    // name, so resolving a command is a single hash lookup. Alias values and function
+    // bodies are stored already parsed.
+    struct CommandEntry
+    {
+        std::string alias_value;
+        std::vector<CommandSpec> alias_pipeline;
+        std::shared_ptr<const Program> function;
+        const BuiltinHandler* builtin = nullptr;
+        std::string executable_path;
+    };
+
+    // Every executable name found in PATH, sorted, for completion
+    struct ExecutableIndex
+    {
+        std::string path;
+        std::vector<int64_t> directory_mtimes;
+        std::vector<std::string> names;
+    };
 
     // Builtin commands
-    auto echo_command(const std::vector<std::string>& args) -> void;
-    auto type_command(const std::string& name) -> void;
-    auto pwd_command() -> void;
-    auto cd_command(const std::string& path) -> void;
-    auto history_command(const std::string& args) -> void;
+    auto echo_command(const std::vector<std::string>& args) -> int;
+    auto type_command(const std::vector<std::string>& names) -> int;
+    auto pwd_command(const std::vector<std::string>& args) -> int;
+    auto cd_command(const std::string& path) -> int;
+    auto history_command(const std::vector<std::string>& args) -> int;
+    auto set_command(const std::vector<std::string>& args) -> int;
+    auto hash_command(const std::vector<std::string>& args) -> int;
+    auto cat_command(const std::vector<std::string>& args) -> int;
+    auto tee_command(const std::vector<std::string>& args) -> int;
+    auto alias_command(const std::vector<std::string>& args) -> int;
+    auto unalias_command(const std::vector<std::string>& args) -> int;
+    auto export_command(const std::vector<std::string>& args) -> int;
+    auto unset_command(const std::vector<std::string>& args) -> int;
     auto get_builtin_names() -> std::unordered_set<std::string>;
     auto is_builtin(const std::string& command) -> bool;
 
+    // Working directory
+    auto get_working_directory() -> const std::string&;
+    auto get_physical_directory() -> std::string;
+    auto set_working_directory(const std::string& directory) -> void;
+    auto normalize_logical_path(const std::string& path) -> std::string;
+
+    // Command table
+    auto resolve_command(const std::string& name, CommandType& type, bool allow_alias = true)
+        -> const CommandEntry*;
+    auto define_alias(const std::string& name, const std::string& value) -> bool;
+    auto define_function(const std::string& name, std::shared_ptr<const Program> body) -> void;
+    auto apply_alias(const CommandEntry& entry, const CommandSpec& cmd) -> std::vector<CommandSpec>;
+    auto forget_hashed_paths() -> void;
+
     // History
     auto get_histfile() -> std::optional<std::string>;
+    auto read_history_file(const std::string& filepath, std::vector<std::string>& entries) -> bool;
     auto load_history_from_file(const std::string& filepath) -> bool;
+    auto start_loading_history(const std::string& filepath) -> void;
+    auto finish_loading_history(bool wait) -> void;
     auto write_history_to_file(const std::string& filepath, bool append = false) -> bool;
 
     // Path utilities (for external executables)
@@ -52,11 +139,24 @@ namespace ash
     auto find_executable_in_path(const std::string& command) -> std::string;
     auto get_matching_executables_in_path(const std::string& prefix, bool sort = true)
         -> std::vector<std::string>;
+    auto find_executables_in_directories(const std::vector<std::string>& directories,
+                                         const std::string& prefix) -> std::vector<std::string>;
+    auto get_directory_mtimes(const std::vector<std::string>& directories)
+        -> std::vector<int64_t>;
+    auto build_executable_index(const std::string& path) -> ExecutableIndex;
+    auto start_indexing_executables() -> void;
+    auto get_executable_index() -> const ExecutableIndex&;
     auto is_executable(const std::string& filepath) -> bool;
 
     // Redirection
-    auto redirect_stream(StandardStream stream_file_descriptor, const std::string& filename,
-                         RedirectionMode mode) -> bool;
-    auto get_redirection_file_descriptor_flags(RedirectionMode mode) -> int;
+    auto compile_fd_actions(const RedirectionSpec& redirection_spec,
+                            std::vector<FdAction> actions = {}) -> std::vector<FdAction>;
+    auto optimize_fd_actions(std::vector<FdAction>& actions) -> void;
+    auto apply_fd_actions(const std::vector<FdAction>& actions,
+                          std::vector<SavedFd>* saved_fds = nullptr) -> bool;
+    auto restore_fds(std::vector<SavedFd>& saved_fds) -> void;
+    auto open_document_file_descriptor(const std::string& document) -> int;
+    auto write_all(int fd, const char* data, size_t size) -> bool;
+    auto get_redirection_file_descriptor_flags(RedirectionOperator op) -> int;
 
 } // namespace ash
@@ -0,0 +1,335 @@
+#include "completion.hpp"
+#include "constants.hpp"
+#include "interpreter.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto get_completion_context(const std::string& line, size_t start, std::string& command)
+        -> CompletionContext
+    {
+        CompletionContext context = CompletionContext::COMMAND;
+        bool is_redirection = false;
+        std::string word;
+        command.clear();
+
+        auto end_word = [&]()
+        {
+            if (word.empty())
+            {
+                return;
+            }
+
+            // Reserved words like `then` are followed by another command
+            bool is_assignment = word.find('=') != std::string::npos && word[0] != '=';
+            bool is_command_prefix = is_reserved_word(word) && word != "for" && word != "case"
+                                     && word != "function";
+            if (is_redirection)
+            {
+                is_redirection = false;
+            }
+            else if (context == CompletionContext::COMMAND && !is_assignment && !is_command_prefix)
+            {
+                command = word;
+                context = CompletionContext::ARGUMENT;
+            }
+            word.clear();
+        };
+
+        char quote = '\0';
+        for (size_t i = 0; i < start && i < line.size(); i++)
+        {
+            char c = line[i];
+            if (quote != '\0')
+            {
+                if (c == quote)
+                {
+                    quote = '\0';
+                }
+                else
+                {
+                    word += c;
+                }
+                continue;
+            }
+
+            if (c == '\\' && i + 1 < start)
+            {
+                word += line[++i];
+            }
+            else if (c == '\'' || c == '"')
+            {
+                quote = c;
+            }
+            else if (c == ' ' || c == '\t')
+            {
+                end_word();
+            }
+            else if (c == '<' || c == '>' || (c == '&' && i + 1 < start && line[i + 1] == '>'))
+            {
+                // A leading fd number belongs to the operator, as in 2>
+                bool is_fd = !word.empty() && std::all_of(word.begin(), word.end(), ::isdigit);
+                if (is_fd)
+                {
+                    word.clear();
+                }
+                end_word();
+
+                while (i + 1 < start && std::strchr("<>&|", line[i + 1]) != nullptr)
+                {
+                    i++;
+                }
+                is_redirection = true;
+            }
+            else if (std::strchr(";|&()\n", c) != nullptr)
+            {
+                end_word();
+                context = CompletionContext::COMMAND;
+                is_redirection = false;
+                command.clear();
+            }
+            else
+            {
+                word += c;
+            }
+        }
+
+        return is_redirection ? CompletionContext::REDIRECTION : context;
+    }
+
+    auto get_completion_filter(CompletionContext context, const std::string& command)
+        -> FilenameFilter
+    {
+        // Paths to run, directories for cd, and any file otherwise
+        if (context == CompletionContext::COMMAND)
+        {
+            return FilenameFilter::EXECUTABLES;
+        }
+        if (context == CompletionContext::ARGUMENT && command == "cd")
+        {
+            return FilenameFilter::DIRECTORIES;
+        }
+        return FilenameFilter::ALL;
+    }
+
+    auto is_completion_char_quoted(char* line, int index) -> int
+    {
+        // Escaped by an odd number of backslashes
+        int backslashes = 0;
+        while (index - backslashes > 0 && line[index - backslashes - 1] == '\\')
+        {
+            backslashes++;
+        }
+
+        return backslashes % 2;
+    }
+
+    auto read_directory_entries(const std::string& path) -> std::vector<DirectoryEntry>
+    {
+        std::vector<DirectoryEntry> entries;
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return entries;
+        }
+
+        // NOTE(abi): getdents64 hands back whole batches with d_type filled in, so a
+        // listing costs a few syscalls and no stat per entry.
+        alignas(struct dirent64) char buffer[config::DIRECTORY_READ_BUFFER_SIZE];
+        ssize_t bytes_read;
+        while ((bytes_read = getdents64(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t offset = 0; offset < bytes_read;)
+            {
+                auto* entry = reinterpret_cast<struct dirent64*>(buffer + offset);
+                offset += entry->d_reclen;
+
+                if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+                {
+                    entries.push_back({entry->d_name, entry->d_type});
+                }
+            }
+        }
+
+        close(fd);
+        return entries;
+    }
+
+    auto get_directory_listing(const std::string& path) -> std::shared_ptr<const DirectoryListing>
+    {
+        // Relative paths are cached by where they point now
+        std::string key = path;
+        if (!path.starts_with('/'))
+        {
+            key = get_working_directory() + "/" + path;
+        }
+
+        // A lookup still running from an earlier Tab is waited on again
+        std::unordered_map<std::string, std::shared_ptr<DirectoryLookup>>& listings =
+            shell_state->directory_listings;
+        auto it = listings.find(key);
+        if (it == listings.end() || is_background_result_ready(*it->second))
+        {
+            if (it == listings.end() && listings.size() >= config::DIRECTORY_LISTING_CACHE_SIZE)
+            {
+                listings.clear();
+            }
+
+            std::shared_ptr<const DirectoryListing> previous =
+                (it == listings.end()) ? nullptr : it->second->value;
+            auto lookup = start_background_task<std::shared_ptr<const DirectoryListing>>(
+                [path, previous]() { return read_directory_listing(path, previous); });
+            it = listings.insert_or_assign(key, lookup).first;
+        }
+
+        auto timeout = std::chrono::milliseconds(config::DIRECTORY_LISTING_TIMEOUT_MS);
+        if (!wait_for_background_result(*it->second, timeout))
+        {
+            return nullptr;
+        }
+
+        return it->second->value;
+    }
+
+    auto read_directory_listing(const std::string& path,
+                                std::shared_ptr<const DirectoryListing> previous)
+        -> std::shared_ptr<const DirectoryListing>
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            return nullptr;
+        }
+
+        int64_t mtime = st.st_mtim.tv_sec * 1'000'000'000LL + st.st_mtim.tv_nsec;
+        if (previous != nullptr && previous->mtime == mtime)
+        {
+            return previous;
+        }
+
+        auto listing = std::make_shared<DirectoryListing>();
+        listing->mtime = mtime;
+        listing->entries = read_directory_entries(path);
+        for (DirectoryEntry& entry : listing->entries)
+        {
+            if (is_directory_entry(path, entry))
+            {
+                entry.type = DT_DIR;
+            }
+        }
+
+        return listing;
+    }
+
+    auto is_directory_entry(const std::string& directory, const DirectoryEntry& entry) -> bool
+    {
+        // Only links and filesystems without d_type need a stat
+        if (entry.type != DT_LNK && entry.type != DT_UNKNOWN)
+        {
+            return entry.type == DT_DIR;
+        }
+
+        struct stat st;
+        std::string path = directory + "/" + entry.name;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    auto complete_filename(const std::string& text, FilenameFilter filter, bool is_quoted)
+        -> std::vector<std::string>
+    {
+        // Inside quotes readline has already taken the quote off, and escapes are literal
+        std::string word = is_quoted ? text : unescape_completion(text);
+        size_t last_slash = word.rfind('/');
+        std::string directory_text =
+            (last_slash == std::string::npos) ? "" : word.substr(0, last_slash + 1);
+        std::string prefix = word.substr(directory_text.size());
+
+        // ~/ is read from the home directory but stays in the completed word
+        std::string directory = directory_text.empty() ? "." : directory_text;
+        const char* home = std::getenv("HOME");
+        if (directory.starts_with("~/") && home != nullptr)
+        {
+            directory = home + directory.substr(1);
+        }
+
+        std::vector<std::string> matches;
+        std::shared_ptr<const DirectoryListing> listing = get_directory_listing(directory);
+        if (listing == nullptr)
+        {
+            return matches;
+        }
+
+        for (const DirectoryEntry& entry : listing->entries)
+        {
+            // Hidden files only when asked for
+            if (!entry.name.starts_with(prefix)
+                || (entry.name[0] == '.' && !prefix.starts_with('.')))
+            {
+                continue;
+            }
+
+            bool is_directory = entry.type == DT_DIR;
+            if ((filter == FilenameFilter::DIRECTORIES && !is_directory)
+                || (filter == FilenameFilter::EXECUTABLES && !is_directory
+                    && access((directory + "/" + entry.name).c_str(), X_OK) != 0))
+            {
+                continue;
+            }
+
+            std::string match = directory_text + entry.name;
+            matches.push_back((is_quoted ? match : escape_completion(match))
+                              + (is_directory ? "/" : ""));
+        }
+
+        std::sort(matches.begin(), matches.end());
+        return matches;
+    }
+
+    auto escape_completion(const std::string& text) -> std::string
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (std::strchr(" \t\n\"'\\|&;()<>$`*?[]{}!#", c) != nullptr)
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+
+        return escaped;
+    }
+
+    auto unescape_completion(const std::string& text) -> std::string
+    {
+        std::string unescaped;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            if (text[i] == '\\' && i + 1 < text.size())
+            {
+                i++;
+            }
+            unescaped += text[i];
+        }
+
+        return unescaped;
+    }
+
+} // namespace ash
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "background.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    enum class CompletionContext
+    {
+        COMMAND,
+        ARGUMENT,
+        REDIRECTION,
+    };
+
+    enum class FilenameFilter
+    {
+        ALL,
+        DIRECTORIES,
+        EXECUTABLES, // And directories, to get to them
+    };
+
+    struct DirectoryEntry
+    {
+        std::string name;
+        unsigned char type; // d_type, DT_UNKNOWN when the filesystem doesn't report it
+    };
+
+    // NOTE(abi): listings are looked up off the main thread, stat and all, and reused
+    // until the directory's mtime changes. One that isn't ready within the timeout
+    // completes to nothing, and is there for the next Tab.
+    struct DirectoryListing
+    {
+        int64_t mtime;
+        std::vector<DirectoryEntry> entries; // Links and unknowns to directories are DT_DIR
+    };
+
+    using DirectoryLookup = BackgroundResult<std::shared_ptr<const DirectoryListing>>;
+
+    // Context
+    auto get_completion_context(const std::string& line, size_t start, std::string& command)
+        -> CompletionContext;
+    auto get_completion_filter(CompletionContext context, const std::string& command)
+        -> FilenameFilter;
+    auto is_completion_char_quoted(char* line, int index) -> int;
+
+    // Directory listings
+    auto read_directory_entries(const std::string& path) -> std::vector<DirectoryEntry>;
+    auto get_directory_listing(const std::string& path) -> std::shared_ptr<const DirectoryListing>;
+    auto read_directory_listing(const std::string& path,
+                                std::shared_ptr<const DirectoryListing> previous)
+        -> std::shared_ptr<const DirectoryListing>;
+    auto is_directory_entry(const std::string& directory, const DirectoryEntry& entry) -> bool;
+
+    // Filenames
+    auto complete_filename(const std::string& text, FilenameFilter filter, bool is_quoted)
+        -> std::vector<std::string>;
+    auto escape_completion(const std::string& text) -> std::string;
+    auto unescape_completion(const std::string& text) -> std::string;
+
+} // namespace ash
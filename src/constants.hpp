@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 namespace ash
 {
@@ -8,14 +9,101 @@ namespace ash
     namespace config
     {
         constexpr const char* PROMPT = "$ ";
+        constexpr const char* CONTINUATION_PROMPT = "> ";
         constexpr size_t MAX_PATH_LENGTH = 1024;
 
+        // NOTE(abi): stands in for a process substitution in the argument string until
+        // its /dev/fd path is known at execution time.
+        constexpr char PROCESS_SUBSTITUTION_MARKER = '\x1f';
+
 #ifdef _WIN32
         constexpr char PATH_LIST_SEPARATOR = ';';
 #else
         constexpr char PATH_LIST_SEPARATOR = ':';
 #endif
 
+        // Bytes the delimiter scanner classifies at a time, one bit each
+        constexpr size_t SCAN_BLOCK_SIZE = 64;
+
+        // Lowest descriptor used to stash fds that in-process builtins redirect
+        constexpr int SAVED_FD_BASE = 10;
+
+        // Pipe capacity used by `set -o bigpipes` when /proc doesn't report a limit
+        constexpr int BIG_PIPE_SIZE = 1 << 20;
+        constexpr const char* PIPE_MAX_SIZE_PATH = "/proc/sys/fs/pipe-max-size";
+
+        // Compiled $((...)) expressions kept around, and their evaluation limits
+        constexpr size_t ARITHMETIC_CACHE_SIZE = 256;
+        constexpr size_t ARITHMETIC_STACK_SIZE = 32;
+        constexpr int MAX_ARITHMETIC_NESTING = 32;
+
+        // Compiled lines kept for when they run again, and the longest source kept
+        constexpr size_t PROGRAM_CACHE_SIZE = 512;
+        constexpr size_t PROGRAM_CACHE_MAX_SOURCE = 4096;
+
+        // Startup file, read by interactive shells, and its compiled snapshot
+        constexpr const char* RC_FILENAME = ".ashrc";
+        constexpr const char* SNAPSHOT_SUFFIX = ".snapshot";
+        constexpr const char* SNAPSHOT_MAGIC = "ASHSNAP\n";
+        constexpr int SNAPSHOT_VERSION = 8; // Bump whenever Program or its parts change
+
+
+        // Command-backed \(...) segments of PS1. The grace period is how long a prompt
+        // waits for them before drawing with cached values and redrawing later.
+        constexpr int PROMPT_SEGMENT_GRACE_MS = 20;
+        constexpr int PROMPT_SEGMENT_TIMEOUT_MS = 2000;
+        constexpr size_t PROMPT_SEGMENT_MAX_OUTPUT = 4096;
+        constexpr size_t PROMPT_SEGMENT_CACHE_SIZE = 256;
+
+        // Interactive lines are read with readline, unless `set -o nativeedit` (or a build
+        // with -DASH_NATIVE_EDITOR=ON) picks the built-in editor
+#ifdef ASH_NATIVE_EDITOR
+        constexpr bool NATIVE_EDITOR_DEFAULT = true;
+#else
+        constexpr bool NATIVE_EDITOR_DEFAULT = false;
+#endif
+        constexpr int EDITOR_EVENT_INTERVAL_MS = 50; // While history or prompt segments load
+        constexpr int EDITOR_ESCAPE_TIMEOUT_MS = 50; // For the rest of a split escape sequence
+        constexpr size_t EDITOR_READ_BUFFER_SIZE = 4096;
+
+        // Directory listings read for filename completion
+        constexpr const char* COMPLETION_WORD_BREAKS = " \t\n;|&<>()";
+        constexpr const char* COMPLETION_QUOTES = "'\"";
+        constexpr size_t DIRECTORY_READ_BUFFER_SIZE = 32 * 1024;
+        constexpr size_t DIRECTORY_LISTING_CACHE_SIZE = 64;
+        constexpr int DIRECTORY_LISTING_TIMEOUT_MS = 150;
+
+        // ash --server and ash-client
+        constexpr const char* SERVER_PROTOCOL_MAGIC = "ash-server-1";
+        constexpr size_t SERVER_MAX_REQUEST_SIZE = 128 * 1024;
+        constexpr int SERVER_REQUEST_TIMEOUT_SECONDS = 1;
+
+        // memo's cache entries, and the variables every key includes
+        constexpr const char* MEMO_FORMAT_MAGIC = "ASHMEMO1";
+        constexpr const char* MEMO_ENVIRONMENT[] = {"PATH", "LANG", "LC_ALL"};
+        constexpr size_t MEMO_READ_BUFFER_SIZE = 64 * 1024;
+
+        // watch-run waits for events to settle before rerunning, and gives a command it
+        // restarts some time to stop before killing it
+        constexpr int WATCH_DEBOUNCE_MS = 50;
+        constexpr int WATCH_STOP_TIMEOUT_MS = 1000;
+        constexpr int WATCH_REAP_INTERVAL_MS = 100; // Without pidfds, and while stopping
+        constexpr size_t WATCH_EVENT_BUFFER_SIZE = 16 * 1024;
+
+        // Job placement set with `resources`
+        constexpr int MAX_JOB_CPUS = 1024; // CPU_SETSIZE, and as many NUMA nodes
+        constexpr int64_t CGROUP_CPU_PERIOD_US = 100000;
+        constexpr const char* CGROUP_SHELL_LEAF = "shell"; // Next to the jobs' cgroups
+
+        // Directories visited with cd, ranked for j. The file is rewritten once it holds
+        // twice as many lines as directories plus the slack, and ranks fade once their
+        // total passes the maximum.
+        constexpr const char* DIRECTORY_INDEX_FILENAME = ".ash_directories";
+        constexpr size_t DIRECTORY_INDEX_COMPACT_SLACK = 1024;
+        constexpr double DIRECTORY_INDEX_MAX_RANK = 10000;
+        constexpr double DIRECTORY_INDEX_AGING = 0.9;
+        constexpr size_t DIRECTORY_LIST_SIZE = 20; // Best matches listed, or tried in turn
+
     } // namespace config
 
     namespace permissions
@@ -0,0 +1,969 @@
+#include "editor.hpp"
+#include "commands.hpp"
+#include "completion.hpp"
+#include "constants.hpp"
+#include "prompt.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <poll.h>
+    #include <sys/ioctl.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto read_edited_line(const char* prompt) -> std::optional<std::string>
+    {
+        LineEditor& editor = shell_state->editor;
+        if (!enable_raw_mode(editor))
+        {
+            return std::nullopt;
+        }
+
+        editor.main_prompt = prompt;
+        editor.buffer.clear();
+        editor.cursor = 0;
+        editor.history_index = shell_state->command_history.size();
+        editor.edited_line.clear();
+        editor.is_searching = false;
+        editor.last_key = EditorKey::IGNORED;
+        editor.is_active = true;
+        update_terminal_columns(editor);
+
+        std::string out;
+        set_editor_prompt(editor, editor.main_prompt);
+        print_editor_prompt(editor, out);
+        write_all(STDOUT_FILENO, out.data(), out.size());
+
+        // NOTE(abi): everything read at once is handled before a single redraw, so a
+        // paste costs one write however long it is. Whatever follows an accepted line
+        // (the next lines of a paste, or typeahead) is kept for the next call.
+        EditorResult result = EditorResult::CONTINUE;
+        while (result == EditorResult::CONTINUE)
+        {
+            if (editor.pending_input.empty() || editor.is_input_incomplete)
+            {
+                if (!read_editor_input(editor))
+                {
+                    result = EditorResult::END_OF_FILE;
+                    break;
+                }
+            }
+
+            update_terminal_columns(editor);
+            result = handle_editor_input(editor);
+            refresh_editor_line(editor);
+        }
+
+        out.clear();
+        move_editor_cursor(editor, out,
+                           get_editor_column(editor, editor.displayed, editor.displayed_cursor),
+                           get_editor_column(editor, editor.displayed, editor.displayed.size()));
+        out += (result == EditorResult::CANCEL) ? "^C\r\n" : "\r\n";
+        write_all(STDOUT_FILENO, out.data(), out.size());
+
+        editor.is_active = false;
+        disable_raw_mode(editor);
+
+        switch (result)
+        {
+        case EditorResult::ACCEPT:
+            return std::move(editor.buffer);
+        case EditorResult::CANCEL:
+            editor.pending_input.clear();
+            return "";
+        default:
+            return std::nullopt;
+        }
+    }
+
+    auto enable_raw_mode(LineEditor& editor) -> bool
+    {
+        if (tcgetattr(STDIN_FILENO, &editor.saved_termios) == -1)
+        {
+            return false;
+        }
+
+        // Signals are keys too: Ctrl-C cancels the line rather than the shell
+        struct termios raw = editor.saved_termios;
+        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        raw.c_cflag |= CS8;
+        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1)
+        {
+            return false;
+        }
+
+        // Bracketed paste, so pasted text is never taken for keys
+        const char enable_paste[] = "\033[?2004h";
+        write_all(STDOUT_FILENO, enable_paste, sizeof(enable_paste) - 1);
+        return true;
+    }
+
+    auto disable_raw_mode(LineEditor& editor) -> void
+    {
+        const char disable_paste[] = "\033[?2004l";
+        write_all(STDOUT_FILENO, disable_paste, sizeof(disable_paste) - 1);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &editor.saved_termios);
+        editor.is_pasting = false;
+    }
+
+    auto read_editor_input(LineEditor& editor) -> bool
+    {
+        while (true)
+        {
+            // History and prompt segments still loading are checked on while we wait
+            bool is_loading = shell_state->pending_history != nullptr
+                              || !shell_state->prompt.pending_segments.empty();
+            int timeout_ms = -1;
+            if (editor.is_input_incomplete)
+            {
+                timeout_ms = config::EDITOR_ESCAPE_TIMEOUT_MS;
+            }
+            else if (is_loading)
+            {
+                timeout_ms = config::EDITOR_EVENT_INTERVAL_MS;
+            }
+
+            struct pollfd input_poll = {STDIN_FILENO, POLLIN, 0};
+            int ready = poll(&input_poll, 1, timeout_ms);
+            if (ready == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            if (ready == 0)
+            {
+                // A lone Escape, or a sequence that isn't going to finish
+                if (editor.is_input_incomplete)
+                {
+                    editor.pending_input.clear();
+                    editor.is_input_incomplete = false;
+                    return true;
+                }
+
+                poll_editor_events(editor);
+                continue;
+            }
+
+            char chunk[config::EDITOR_READ_BUFFER_SIZE];
+            ssize_t bytes_read = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (bytes_read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (bytes_read <= 0)
+            {
+                return false;
+            }
+
+            editor.pending_input.append(chunk, bytes_read);
+            return true;
+        }
+    }
+
+    auto poll_editor_events(LineEditor& editor) -> void
+    {
+        // Leave the list alone while the user is scrolling through it
+        std::vector<std::string>& history = shell_state->command_history;
+        if (editor.history_index == history.size())
+        {
+            finish_loading_history(false);
+            editor.history_index = history.size();
+        }
+
+        if (poll_prompt_segments(0))
+        {
+            redraw_prompt();
+        }
+    }
+
+    auto handle_editor_input(LineEditor& editor) -> EditorResult
+    {
+        EditorResult result = EditorResult::CONTINUE;
+        editor.is_input_incomplete = false;
+
+        const std::string& input = editor.pending_input;
+        size_t pos = 0;
+        while (pos < input.size() && result == EditorResult::CONTINUE)
+        {
+            size_t key_start = pos;
+            std::string text;
+            EditorKey key = read_editor_key(editor, input, pos, text);
+            if (key == EditorKey::INCOMPLETE)
+            {
+                editor.is_input_incomplete = true;
+                pos = key_start;
+                break;
+            }
+
+            result = editor.is_searching ? handle_search_key(editor, key, text)
+                                         : handle_editor_key(editor, key, text);
+            editor.last_key = key;
+        }
+
+        editor.pending_input.erase(0, pos);
+        return result;
+    }
+
+    auto read_editor_key(const LineEditor& editor, const std::string& input, size_t& pos,
+                         std::string& text) -> EditorKey
+    {
+        unsigned char c = input[pos];
+        if (c == '\033')
+        {
+            return read_escape_sequence(input, pos);
+        }
+
+        // Pasted text goes in as it is, up to each line break
+        if (editor.is_pasting)
+        {
+            if (c == '\r' || c == '\n')
+            {
+                pos += (c == '\r' && pos + 1 < input.size() && input[pos + 1] == '\n') ? 2 : 1;
+                return EditorKey::ENTER;
+            }
+
+            size_t end = std::min(input.find_first_of("\033\r\n", pos), input.size());
+            text.assign(input, pos, end - pos);
+            pos = end;
+            return EditorKey::TEXT;
+        }
+
+        // A run of printable bytes, UTF-8 included, is inserted in one go
+        if (c >= 0x20 && c != 0x7f)
+        {
+            size_t end = pos;
+            while (end < input.size() && static_cast<unsigned char>(input[end]) >= 0x20
+                   && input[end] != 0x7f)
+            {
+                end++;
+            }
+            text.assign(input, pos, end - pos);
+            pos = end;
+            return EditorKey::TEXT;
+        }
+
+        pos++;
+        switch (c)
+        {
+        case 0x01: // Ctrl-A
+            return EditorKey::HOME;
+        case 0x02: // Ctrl-B
+            return EditorKey::LEFT;
+        case 0x03: // Ctrl-C
+            return EditorKey::CANCEL;
+        case 0x04: // Ctrl-D
+            return EditorKey::DELETE_OR_EOF;
+        case 0x05: // Ctrl-E
+            return EditorKey::END;
+        case 0x06: // Ctrl-F
+            return EditorKey::RIGHT;
+        case 0x07: // Ctrl-G
+            return EditorKey::ABORT;
+        case 0x08: // Ctrl-H
+        case 0x7f:
+            return EditorKey::BACKSPACE;
+        case '\t':
+            return EditorKey::TAB;
+        case '\n':
+        case '\r':
+            return EditorKey::ENTER;
+        case 0x0b: // Ctrl-K
+            return EditorKey::KILL_TO_END;
+        case 0x0c: // Ctrl-L
+            return EditorKey::CLEAR_SCREEN;
+        case 0x0e: // Ctrl-N
+            return EditorKey::DOWN;
+        case 0x10: // Ctrl-P
+            return EditorKey::UP;
+        case 0x12: // Ctrl-R
+            return EditorKey::SEARCH;
+        case 0x15: // Ctrl-U
+            return EditorKey::KILL_TO_START;
+        case 0x17: // Ctrl-W
+            return EditorKey::KILL_WORD;
+        case 0x19: // Ctrl-Y
+            return EditorKey::YANK;
+        default:
+            return EditorKey::IGNORED;
+        }
+    }
+
+    auto read_escape_sequence(const std::string& input, size_t& pos) -> EditorKey
+    {
+        if (pos + 1 >= input.size())
+        {
+            return EditorKey::INCOMPLETE;
+        }
+
+        // Meta keys
+        char next = input[pos + 1];
+        if (next != '[' && next != 'O')
+        {
+            pos += 2;
+            switch (next)
+            {
+            case 'b':
+                return EditorKey::WORD_LEFT;
+            case 'f':
+                return EditorKey::WORD_RIGHT;
+            case 0x08:
+            case 0x7f:
+                return EditorKey::KILL_WORD;
+            default:
+                return EditorKey::IGNORED;
+            }
+        }
+
+        // Parameter and intermediate bytes, then the final one
+        size_t end = pos + 2;
+        while (end < input.size() && input[end] >= 0x20 && input[end] <= 0x3f)
+        {
+            end++;
+        }
+        if (end >= input.size())
+        {
+            return EditorKey::INCOMPLETE;
+        }
+
+        std::string_view sequence(input.data() + pos + 1, end - pos);
+        pos = end + 1;
+
+        static constexpr std::pair<std::string_view, EditorKey> SEQUENCES[] = {
+            {"[A", EditorKey::UP},           {"OA", EditorKey::UP},
+            {"[B", EditorKey::DOWN},         {"OB", EditorKey::DOWN},
+            {"[C", EditorKey::RIGHT},        {"OC", EditorKey::RIGHT},
+            {"[D", EditorKey::LEFT},         {"OD", EditorKey::LEFT},
+            {"[H", EditorKey::HOME},         {"OH", EditorKey::HOME},
+            {"[1~", EditorKey::HOME},        {"[7~", EditorKey::HOME},
+            {"[F", EditorKey::END},          {"OF", EditorKey::END},
+            {"[4~", EditorKey::END},         {"[8~", EditorKey::END},
+            {"[3~", EditorKey::DELETE},      {"[1;5C", EditorKey::WORD_RIGHT},
+            {"[1;3C", EditorKey::WORD_RIGHT}, {"[1;5D", EditorKey::WORD_LEFT},
+            {"[1;3D", EditorKey::WORD_LEFT}, {"[200~", EditorKey::PASTE_START},
+            {"[201~", EditorKey::PASTE_END},
+        };
+        for (const auto& [bytes, key] : SEQUENCES)
+        {
+            if (sequence == bytes)
+            {
+                return key;
+            }
+        }
+
+        return EditorKey::IGNORED;
+    }
+
+    auto handle_editor_key(LineEditor& editor, EditorKey key, const std::string& text)
+        -> EditorResult
+    {
+        std::string& buffer = editor.buffer;
+        size_t& cursor = editor.cursor;
+        switch (key)
+        {
+        case EditorKey::TEXT:
+            buffer.insert(cursor, text);
+            cursor += text.size();
+            break;
+        case EditorKey::ENTER:
+            return EditorResult::ACCEPT;
+        case EditorKey::CANCEL:
+            return EditorResult::CANCEL;
+        case EditorKey::TAB:
+            complete_editor_word(editor, editor.last_key == EditorKey::TAB);
+            break;
+        case EditorKey::DELETE_OR_EOF:
+            if (buffer.empty())
+            {
+                return EditorResult::END_OF_FILE;
+            }
+            [[fallthrough]];
+        case EditorKey::DELETE:
+            buffer.erase(cursor, get_next_char(buffer, cursor) - cursor);
+            break;
+        case EditorKey::BACKSPACE:
+        {
+            size_t previous = get_previous_char(buffer, cursor);
+            buffer.erase(previous, cursor - previous);
+            cursor = previous;
+            break;
+        }
+        case EditorKey::LEFT:
+            cursor = get_previous_char(buffer, cursor);
+            break;
+        case EditorKey::RIGHT:
+            cursor = get_next_char(buffer, cursor);
+            break;
+        case EditorKey::WORD_LEFT:
+            cursor = get_word_start(buffer, cursor);
+            break;
+        case EditorKey::WORD_RIGHT:
+            cursor = get_word_end(buffer, cursor);
+            break;
+        case EditorKey::HOME:
+            cursor = 0;
+            break;
+        case EditorKey::END:
+            cursor = buffer.size();
+            break;
+        case EditorKey::UP:
+            if (editor.history_index > 0)
+            {
+                show_history_entry(editor, editor.history_index - 1);
+            }
+            break;
+        case EditorKey::DOWN:
+            if (editor.history_index < shell_state->command_history.size())
+            {
+                show_history_entry(editor, editor.history_index + 1);
+            }
+            break;
+        case EditorKey::KILL_TO_END:
+            editor.kill_buffer = buffer.substr(cursor);
+            buffer.erase(cursor);
+            break;
+        case EditorKey::KILL_TO_START:
+            editor.kill_buffer = buffer.substr(0, cursor);
+            buffer.erase(0, cursor);
+            cursor = 0;
+            break;
+        case EditorKey::KILL_WORD:
+        {
+            size_t start = get_word_start(buffer, cursor);
+            editor.kill_buffer = buffer.substr(start, cursor - start);
+            buffer.erase(start, cursor - start);
+            cursor = start;
+            break;
+        }
+        case EditorKey::YANK:
+            buffer.insert(cursor, editor.kill_buffer);
+            cursor += editor.kill_buffer.size();
+            break;
+        case EditorKey::CLEAR_SCREEN:
+        {
+            std::string out = "\033[H\033[2J";
+            print_editor_prompt(editor, out);
+            write_all(STDOUT_FILENO, out.data(), out.size());
+            break;
+        }
+        case EditorKey::SEARCH:
+            if (editor.history_index == shell_state->command_history.size())
+            {
+                editor.edited_line = buffer;
+            }
+            editor.is_searching = true;
+            editor.is_search_failed = false;
+            editor.search_query.clear();
+            editor.search_index = editor.history_index;
+            show_search_prompt(editor);
+            break;
+        case EditorKey::PASTE_START:
+            editor.is_pasting = true;
+            break;
+        case EditorKey::PASTE_END:
+            editor.is_pasting = false;
+            break;
+        default:
+            break;
+        }
+
+        return EditorResult::CONTINUE;
+    }
+
+    auto show_history_entry(LineEditor& editor, size_t index) -> void
+    {
+        const std::vector<std::string>& history = shell_state->command_history;
+        if (editor.history_index >= history.size())
+        {
+            editor.edited_line = editor.buffer;
+        }
+
+        editor.history_index = index;
+        editor.buffer = (index < history.size()) ? history[index] : editor.edited_line;
+        editor.cursor = editor.buffer.size();
+    }
+
+    auto get_previous_char(const std::string& text, size_t pos) -> size_t
+    {
+        // Back over UTF-8 continuation bytes to the start of the character
+        while (pos > 0)
+        {
+            pos--;
+            if ((static_cast<unsigned char>(text[pos]) & 0xc0) != 0x80)
+            {
+                break;
+            }
+        }
+        return pos;
+    }
+
+    auto get_next_char(const std::string& text, size_t pos) -> size_t
+    {
+        if (pos >= text.size())
+        {
+            return text.size();
+        }
+
+        pos++;
+        while (pos < text.size() && (static_cast<unsigned char>(text[pos]) & 0xc0) == 0x80)
+        {
+            pos++;
+        }
+        return pos;
+    }
+
+    auto get_word_start(const std::string& text, size_t pos) -> size_t
+    {
+        while (pos > 0 && std::isspace(static_cast<unsigned char>(text[pos - 1])))
+        {
+            pos--;
+        }
+        while (pos > 0 && !std::isspace(static_cast<unsigned char>(text[pos - 1])))
+        {
+            pos--;
+        }
+        return pos;
+    }
+
+    auto get_word_end(const std::string& text, size_t pos) -> size_t
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        {
+            pos++;
+        }
+        while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])))
+        {
+            pos++;
+        }
+        return pos;
+    }
+
+    auto handle_search_key(LineEditor& editor, EditorKey key, const std::string& text)
+        -> EditorResult
+    {
+        const std::vector<std::string>& history = shell_state->command_history;
+        bool is_matched = editor.search_index < editor.history_index;
+        switch (key)
+        {
+        // NOTE(abi): a longer query can only match the current entry or older ones,
+        // so each keypress carries on from the match instead of starting over.
+        case EditorKey::TEXT:
+            editor.search_query += text;
+            if (!editor.is_search_failed)
+            {
+                find_history_match(editor, is_matched ? editor.search_index + 1
+                                                      : editor.history_index);
+            }
+            break;
+        case EditorKey::SEARCH:
+            if (!editor.search_query.empty())
+            {
+                find_history_match(editor, editor.search_index);
+            }
+            break;
+        case EditorKey::BACKSPACE:
+            editor.search_query.erase(
+                get_previous_char(editor.search_query, editor.search_query.size()));
+            find_history_match(editor, editor.history_index);
+            break;
+        case EditorKey::CANCEL:
+        case EditorKey::ABORT:
+            editor.search_index = editor.history_index;
+            editor.buffer = (editor.history_index < history.size())
+                                ? history[editor.history_index]
+                                : editor.edited_line;
+            editor.cursor = editor.buffer.size();
+            stop_history_search(editor);
+            return EditorResult::CONTINUE;
+        default:
+            // Any other key takes the match and then does what it normally does
+            editor.history_index = editor.search_index;
+            stop_history_search(editor);
+            return handle_editor_key(editor, key, text);
+        }
+
+        show_search_prompt(editor);
+        return EditorResult::CONTINUE;
+    }
+
+    auto find_history_match(LineEditor& editor, size_t from) -> void
+    {
+        const std::vector<std::string>& history = shell_state->command_history;
+        editor.is_search_failed = false;
+        if (editor.search_query.empty())
+        {
+            editor.search_index = editor.history_index;
+            editor.buffer = (editor.history_index < history.size()) ? history[editor.history_index]
+                                                                     : editor.edited_line;
+            editor.cursor = editor.buffer.size();
+            return;
+        }
+
+        // Newest first, below `from`
+        for (size_t i = std::min(from, history.size()); i-- > 0;)
+        {
+            size_t match = history[i].find(editor.search_query);
+            if (match != std::string::npos)
+            {
+                editor.search_index = i;
+                editor.buffer = history[i];
+                editor.cursor = match;
+                return;
+            }
+        }
+
+        editor.is_search_failed = true;
+    }
+
+    auto show_search_prompt(LineEditor& editor) -> void
+    {
+        std::string prompt = editor.is_search_failed ? "(failed reverse-i-search)`"
+                                                     : "(reverse-i-search)`";
+        prompt += editor.search_query + "': ";
+        redraw_editor_line(editor, prompt);
+    }
+
+    auto stop_history_search(LineEditor& editor) -> void
+    {
+        editor.is_searching = false;
+        redraw_editor_line(editor, editor.main_prompt);
+    }
+
+    auto complete_editor_word(LineEditor& editor, bool is_listing) -> void
+    {
+        // The word under the cursor, from after a break or an unclosed quote, the way
+        // readline finds it
+        const std::string& line = editor.buffer;
+        char quote = '\0';
+        size_t word_start = 0;
+        size_t quote_start = 0;
+        for (size_t i = 0; i < editor.cursor; i++)
+        {
+            char c = line[i];
+            if (quote != '\0')
+            {
+                quote = (c == quote) ? '\0' : quote;
+            }
+            else if (c == '\\')
+            {
+                i++;
+            }
+            else if (c != '\0' && std::strchr(config::COMPLETION_QUOTES, c) != nullptr)
+            {
+                quote = c;
+                quote_start = i;
+            }
+            else if (c != '\0' && std::strchr(config::COMPLETION_WORD_BREAKS, c) != nullptr)
+            {
+                word_start = i + 1;
+            }
+        }
+
+        size_t start = (quote != '\0') ? quote_start + 1 : std::min(word_start, editor.cursor);
+        std::string text = line.substr(start, editor.cursor - start);
+
+        std::string command;
+        CompletionContext context = get_completion_context(line, start, command);
+        bool is_filename = context != CompletionContext::COMMAND
+                           || text.find('/') != std::string::npos;
+        std::vector<std::string> matches =
+            is_filename ? complete_filename(text, get_completion_filter(context, command),
+                                            quote != '\0')
+                        : get_command_matches(text);
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+        if (matches.empty())
+        {
+            return;
+        }
+
+        // A single match is closed off, unless it's a directory to carry on into
+        std::string insertion;
+        if (matches.size() == 1)
+        {
+            insertion = matches[0];
+            if (!insertion.ends_with('/'))
+            {
+                insertion += (quote != '\0') ? std::string{quote, ' '} : std::string(" ");
+            }
+        }
+        else
+        {
+            insertion = get_common_prefix(matches);
+            if (insertion.size() <= text.size())
+            {
+                if (is_listing)
+                {
+                    list_editor_completions(editor, matches, is_filename);
+                }
+                return;
+            }
+        }
+
+        editor.buffer.replace(start, editor.cursor - start, insertion);
+        editor.cursor = start + insertion.size();
+    }
+
+    auto list_editor_completions(LineEditor& editor, const std::vector<std::string>& matches,
+                                 bool is_filename) -> void
+    {
+        // Only the last path component is listed, in columns filled top to bottom
+        std::vector<std::string> names;
+        size_t width = 0;
+        for (const std::string& match : matches)
+        {
+            std::string name = match;
+            if (is_filename)
+            {
+                size_t end = name.size() - (name.ends_with('/') ? 1 : 0);
+                size_t slash = (end > 0) ? name.rfind('/', end - 1) : std::string::npos;
+                if (slash != std::string::npos)
+                {
+                    name.erase(0, slash + 1);
+                }
+            }
+            width = std::max(width, get_display_width(name));
+            names.push_back(std::move(name));
+        }
+
+        width += 2;
+        size_t per_row = std::max<size_t>(1, editor.columns / width);
+        size_t rows = (names.size() + per_row - 1) / per_row;
+
+        std::string out;
+        move_editor_cursor(editor, out,
+                           get_editor_column(editor, editor.displayed, editor.displayed_cursor),
+                           get_editor_column(editor, editor.displayed, editor.displayed.size()));
+        out += "\r\n";
+        for (size_t row = 0; row < rows; row++)
+        {
+            for (size_t column = 0; column < per_row; column++)
+            {
+                size_t index = column * rows + row;
+                if (index >= names.size())
+                {
+                    break;
+                }
+
+                out += names[index];
+                if (column + 1 < per_row && index + rows < names.size())
+                {
+                    out.append(width - get_display_width(names[index]), ' ');
+                }
+            }
+            out += "\r\n";
+        }
+
+        print_editor_prompt(editor, out);
+        write_all(STDOUT_FILENO, out.data(), out.size());
+    }
+
+    auto get_common_prefix(const std::vector<std::string>& matches) -> std::string
+    {
+        std::string prefix = matches[0];
+        for (const std::string& match : matches)
+        {
+            auto [end, _] = std::mismatch(prefix.begin(), prefix.end(), match.begin(), match.end());
+            prefix.erase(end, prefix.end());
+        }
+
+        // Not in the middle of a character
+        if (prefix.size() < matches[0].size()
+            && (static_cast<unsigned char>(matches[0][prefix.size()]) & 0xc0) == 0x80)
+        {
+            prefix.erase(get_previous_char(prefix, prefix.size()));
+        }
+        return prefix;
+    }
+
+    auto set_editor_prompt(LineEditor& editor, const std::string& prompt) -> void
+    {
+        // readline's markers wrap escape sequences that take up no columns
+        editor.prompt.clear();
+        editor.prompt_width = 0;
+        editor.prompt_rows = 0;
+        bool is_invisible = false;
+        for (char c : prompt)
+        {
+            if (c == '\001' || c == '\002')
+            {
+                is_invisible = (c == '\001');
+                continue;
+            }
+
+            editor.prompt += c;
+            if (is_invisible)
+            {
+                continue;
+            }
+
+            if (c == '\n')
+            {
+                editor.prompt_rows++;
+                editor.prompt_width = 0;
+            }
+            else if ((static_cast<unsigned char>(c) & 0xc0) != 0x80)
+            {
+                editor.prompt_width++;
+            }
+        }
+    }
+
+    auto update_editor_prompt(LineEditor& editor, const std::string& prompt) -> void
+    {
+        editor.main_prompt = prompt;
+        if (!editor.is_searching)
+        {
+            redraw_editor_line(editor, prompt);
+        }
+    }
+
+    auto refresh_editor_line(LineEditor& editor) -> void
+    {
+        // NOTE(abi): everything up to the first change is already on screen. The cursor
+        // goes there, the rest is written out, and whatever the old line had past the
+        // new end is cleared.
+        const std::string& old_text = editor.displayed;
+        const std::string& new_text = editor.buffer;
+        auto [old_diff, _] =
+            std::mismatch(old_text.begin(), old_text.end(), new_text.begin(), new_text.end());
+        size_t common = old_diff - old_text.begin();
+        while (common > 0
+               && ((common < old_text.size()
+                    && (static_cast<unsigned char>(old_text[common]) & 0xc0) == 0x80)
+                   || (common < new_text.size()
+                       && (static_cast<unsigned char>(new_text[common]) & 0xc0) == 0x80)))
+        {
+            common--;
+        }
+
+        std::string out;
+        size_t position = get_editor_column(editor, old_text, editor.displayed_cursor);
+        if (common < old_text.size() || common < new_text.size())
+        {
+            size_t old_end = get_editor_column(editor, old_text, old_text.size());
+            size_t new_end = get_editor_column(editor, new_text, new_text.size());
+            move_editor_cursor(editor, out, position, get_editor_column(editor, new_text, common));
+            out.append(new_text, common);
+
+            // A line that ends on the last column leaves the cursor there until
+            // something else is written, so it's moved to the next row by hand
+            if (common < new_text.size() && new_end % editor.columns == 0)
+            {
+                out += "\n\r";
+            }
+            if (new_end < old_end)
+            {
+                out += "\033[J";
+            }
+            position = new_end;
+        }
+
+        move_editor_cursor(editor, out, position,
+                           get_editor_column(editor, new_text, editor.cursor));
+        if (!out.empty())
+        {
+            write_all(STDOUT_FILENO, out.data(), out.size());
+        }
+
+        editor.displayed = new_text;
+        editor.displayed_cursor = editor.cursor;
+    }
+
+    auto redraw_editor_line(LineEditor& editor, const std::string& prompt) -> void
+    {
+        // Back up to the first line of the prompt, and draw both from scratch
+        size_t cursor_row =
+            get_editor_column(editor, editor.displayed, editor.displayed_cursor) / editor.columns;
+        size_t rows_up = cursor_row + editor.prompt_rows;
+
+        std::string out;
+        if (rows_up > 0)
+        {
+            out += "\033[" + std::to_string(rows_up) + "A";
+        }
+        out += "\r\033[J";
+        set_editor_prompt(editor, prompt);
+        print_editor_prompt(editor, out);
+        write_all(STDOUT_FILENO, out.data(), out.size());
+        refresh_editor_line(editor);
+    }
+
+    auto print_editor_prompt(LineEditor& editor, std::string& out) -> void
+    {
+        out += editor.prompt;
+        editor.displayed.clear();
+        editor.displayed_cursor = 0;
+    }
+
+    auto move_editor_cursor(const LineEditor& editor, std::string& out, size_t from, size_t to)
+        -> void
+    {
+        if (from == to)
+        {
+            return;
+        }
+
+        size_t from_row = from / editor.columns;
+        size_t to_row = to / editor.columns;
+        if (to_row < from_row)
+        {
+            out += "\033[" + std::to_string(from_row - to_row) + "A";
+        }
+        else if (to_row > from_row)
+        {
+            out += "\033[" + std::to_string(to_row - from_row) + "B";
+        }
+
+        out += "\r";
+        size_t to_column = to % editor.columns;
+        if (to_column > 0)
+        {
+            out += "\033[" + std::to_string(to_column) + "C";
+        }
+    }
+
+    auto get_editor_column(const LineEditor& editor, std::string_view text, size_t pos) -> size_t
+    {
+        return editor.prompt_width + get_display_width(text.substr(0, pos));
+    }
+
+    auto get_display_width(std::string_view text) -> size_t
+    {
+        // A column per character, counting the bytes that start one
+        return std::count_if(text.begin(), text.end(), [](char c)
+                             { return (static_cast<unsigned char>(c) & 0xc0) != 0x80; });
+    }
+
+    auto update_terminal_columns(LineEditor& editor) -> void
+    {
+        struct winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        {
+            editor.columns = size.ws_col;
+        }
+    }
+
+} // namespace ash
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <termios.h>
+
+#endif
+
+namespace ash
+{
+
+    enum class EditorKey
+    {
+        TEXT,
+        ENTER,
+        TAB,
+        BACKSPACE,
+        DELETE,
+        DELETE_OR_EOF, // Ctrl-D
+        LEFT,
+        RIGHT,
+        WORD_LEFT,
+        WORD_RIGHT,
+        HOME,
+        END,
+        UP,
+        DOWN,
+        KILL_TO_END,
+        KILL_TO_START,
+        KILL_WORD,
+        YANK,
+        CLEAR_SCREEN,
+        SEARCH,
+        CANCEL, // Ctrl-C
+        ABORT,  // Ctrl-G
+        PASTE_START,
+        PASTE_END,
+        IGNORED,
+        INCOMPLETE // The rest of an escape sequence hasn't arrived yet
+    };
+
+    enum class EditorResult
+    {
+        CONTINUE,
+        ACCEPT,
+        CANCEL,
+        END_OF_FILE
+    };
+
+    // NOTE(abi): the built-in alternative to readline (`set -o nativeedit`). It keeps
+    // what the terminal shows, and each batch of input (a keypress, or a whole paste)
+    // redraws only from the first changed character on.
+    struct LineEditor
+    {
+        std::string main_prompt;  // As rendered, with readline's ignore markers
+        std::string prompt;       // What is written, markers removed
+        size_t prompt_width = 0;  // Of its last line
+        size_t prompt_rows = 0;   // Lines above the last
+        std::string buffer;
+        size_t cursor = 0;        // Byte offset into buffer
+        std::string displayed;    // The buffer as last drawn
+        size_t displayed_cursor = 0;
+        size_t columns = 80;
+        size_t history_index = 0; // command_history.size() while on the new line
+        std::string edited_line;  // The new line, while browsing history
+        std::string kill_buffer;
+        std::string search_query;
+        size_t search_index = 0;
+        bool is_search_failed = false;
+        bool is_searching = false;
+        std::string pending_input; // Read but not handled yet, such as the rest of a paste
+        bool is_input_incomplete = false;
+        bool is_pasting = false;
+        EditorKey last_key = EditorKey::IGNORED;
+        bool is_active = false;
+#ifndef _WIN32
+        struct termios saved_termios;
+#endif
+    };
+
+    // Reading
+    auto read_edited_line(const char* prompt) -> std::optional<std::string>;
+    auto enable_raw_mode(LineEditor& editor) -> bool;
+    auto disable_raw_mode(LineEditor& editor) -> void;
+    auto read_editor_input(LineEditor& editor) -> bool;
+    auto poll_editor_events(LineEditor& editor) -> void;
+
+    // Keys
+    auto handle_editor_input(LineEditor& editor) -> EditorResult;
+    auto read_editor_key(const LineEditor& editor, const std::string& input, size_t& pos,
+                         std::string& text) -> EditorKey;
+    auto read_escape_sequence(const std::string& input, size_t& pos) -> EditorKey;
+    auto handle_editor_key(LineEditor& editor, EditorKey key, const std::string& text)
+        -> EditorResult;
+    auto show_history_entry(LineEditor& editor, size_t index) -> void;
+    auto get_previous_char(const std::string& text, size_t pos) -> size_t;
+    auto get_next_char(const std::string& text, size_t pos) -> size_t;
+    auto get_word_start(const std::string& text, size_t pos) -> size_t;
+    auto get_word_end(const std::string& text, size_t pos) -> size_t;
+
+    // History search
+    auto handle_search_key(LineEditor& editor, EditorKey key, const std::string& text)
+        -> EditorResult;
+    auto find_history_match(LineEditor& editor, size_t from) -> void;
+    auto show_search_prompt(LineEditor& editor) -> void;
+    auto stop_history_search(LineEditor& editor) -> void;
+
+    // Completion
+    auto complete_editor_word(LineEditor& editor, bool is_listing) -> void;
+    auto list_editor_completions(LineEditor& editor, const std::vector<std::string>& matches,
+                                 bool is_filename) -> void;
+    auto get_common_prefix(const std::vector<std::string>& matches) -> std::string;
+
+    // Display
+    auto set_editor_prompt(LineEditor& editor, const std::string& prompt) -> void;
+    auto update_editor_prompt(LineEditor& editor, const std::string& prompt) -> void;
+    auto refresh_editor_line(LineEditor& editor) -> void;
+    auto redraw_editor_line(LineEditor& editor, const std::string& prompt) -> void;
+    auto print_editor_prompt(LineEditor& editor, std::string& out) -> void;
+    auto move_editor_cursor(const LineEditor& editor, std::string& out, size_t from, size_t to)
+        -> void;
+    auto get_editor_column(const LineEditor& editor, std::string_view text, size_t pos) -> size_t;
+    auto get_display_width(std::string_view text) -> size_t;
+    auto update_terminal_columns(LineEditor& editor) -> void;
+
+} // namespace ash
@@ -0,0 +1,500 @@
+#include "frecency.hpp"
+#include "background.hpp"
+#include "constants.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto jump_command(const BuiltinArguments& args) -> int
+    {
+        bool is_listing = args.empty();
+        std::vector<std::string> fragments;
+        for (const std::string& arg : args)
+        {
+            if (arg == "-l")
+            {
+                is_listing = true;
+            }
+            else if (arg.starts_with('-'))
+            {
+                std::cerr << "j: " << arg << ": invalid option" << std::endl;
+                std::cerr << "usage: j [-l] fragment..." << std::endl;
+                return 2;
+            }
+            else if (!arg.empty())
+            {
+                fragments.push_back(fold_case(arg));
+            }
+        }
+
+        // Shells that never started recording (scripts) do from their first jump on
+        if (shell_state->directory_index_file.empty())
+        {
+            start_loading_directory_index();
+        }
+
+        const FrecencyIndex& index = get_directory_index();
+        std::vector<uint32_t> ids = find_directories(index, fragments, std::time(nullptr));
+        if (is_listing)
+        {
+            print_directory_matches(index, ids);
+            return 0;
+        }
+
+        // The best match that still exists and isn't where we already are
+        const std::string& current_directory = get_working_directory();
+        for (uint32_t id : ids)
+        {
+            struct stat st;
+            const std::string& path = index.entries[id].path;
+            if (path == current_directory || stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+            {
+                continue;
+            }
+
+            // NOTE(abi): cd records the visit, which may rebuild the index under us.
+            std::string target = path;
+            int status = cd_command(target);
+            if (status == 0)
+            {
+                std::cout << shell_state->working_directory << std::endl;
+            }
+
+            return status;
+        }
+
+        std::cerr << "j: no matching directory" << std::endl;
+        return 1;
+    }
+
+    auto print_directory_matches(const FrecencyIndex& index, const std::vector<uint32_t>& ids)
+        -> void
+    {
+        // Best last, next to the prompt
+        int64_t now = std::time(nullptr);
+        for (size_t i = ids.size(); i > 0; i--)
+        {
+            const FrecencyEntry& entry = index.entries[ids[i - 1]];
+            std::cout << std::fixed << std::setprecision(1) << std::setw(10)
+                      << get_frecency_score(entry, now) << "  " << entry.path << std::endl;
+        }
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    auto get_directory_index_file() -> std::optional<std::string>
+    {
+        const char* home = std::getenv("HOME");
+        if (home == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        return std::string(home) + "/" + config::DIRECTORY_INDEX_FILENAME;
+    }
+
+    auto start_loading_directory_index() -> void
+    {
+        std::optional<std::string> filepath = get_directory_index_file();
+        if (!filepath.has_value())
+        {
+            return;
+        }
+
+        // NOTE(abi): cd appends to the file as soon as the shell is up. Only what was
+        // there at this point is read here; later visits are replayed once it's loaded.
+        struct stat st;
+        int64_t size = (stat(filepath->c_str(), &st) == 0) ? st.st_size : 0;
+        shell_state->directory_index_file = *filepath;
+        shell_state->pending_directory_index = start_background_task<FrecencyIndex>(
+            [filepath = *filepath, size]() { return read_directory_index(filepath, size); });
+    }
+
+    auto get_directory_index() -> FrecencyIndex&
+    {
+        FrecencyIndex& index = shell_state->directory_index;
+        if (shell_state->pending_directory_index != nullptr)
+        {
+            index = std::move(wait_for_background_result(*shell_state->pending_directory_index));
+            shell_state->pending_directory_index.reset();
+
+            for (const DirectoryVisit& visit : shell_state->pending_directory_visits)
+            {
+                add_directory_visit(index, visit);
+                index.record_count++;
+            }
+            shell_state->pending_directory_visits.clear();
+        }
+
+        return index;
+    }
+
+    auto read_directory_index(const std::string& filepath, int64_t size_limit) -> FrecencyIndex
+    {
+        FrecencyIndex index;
+        int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return index;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return index;
+        }
+
+        int64_t size = (size_limit < 0) ? st.st_size : std::min<int64_t>(size_limit, st.st_size);
+        std::string contents(size, '\0');
+        size_t offset = 0;
+        while (offset < contents.size())
+        {
+            ssize_t count = read(fd, contents.data() + offset, contents.size() - offset);
+            if (count <= 0)
+            {
+                break;
+            }
+            offset += count;
+        }
+        close(fd);
+
+        // Each line is "rank\ttime\tpath"; a partly written last line is left out
+        const char* cursor = contents.data();
+        const char* end = contents.data() + offset;
+        while (cursor < end)
+        {
+            const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+            if (newline == nullptr)
+            {
+                break;
+            }
+
+            char* field_end = nullptr;
+            DirectoryVisit visit;
+            visit.rank = std::strtod(cursor, &field_end);
+            if (field_end < newline && *field_end == '\t')
+            {
+                visit.time = std::strtoll(field_end + 1, &field_end, 10);
+                if (field_end < newline && *field_end == '\t' && field_end[1] == '/')
+                {
+                    visit.path.assign(field_end + 1, newline - field_end - 1);
+                    add_directory_visit(index, visit);
+                    index.record_count++;
+                }
+            }
+
+            cursor = newline + 1;
+        }
+
+        return index;
+    }
+
+    auto write_directory_index(const std::string& filepath, const FrecencyIndex& index) -> bool
+    {
+        std::string contents;
+        for (const FrecencyEntry& entry : index.entries)
+        {
+            contents += format_directory_visit({entry.path, entry.rank, entry.last_visit});
+        }
+
+        std::string temp_path = filepath + ".tmp." + std::to_string(getpid());
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        size_t offset = 0;
+        while (offset < contents.size())
+        {
+            ssize_t count = write(fd, contents.data() + offset, contents.size() - offset);
+            if (count <= 0)
+            {
+                break;
+            }
+            offset += count;
+        }
+
+        if (close(fd) != 0 || offset != contents.size()
+            || rename(temp_path.c_str(), filepath.c_str()) != 0)
+        {
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    auto compact_directory_index(const std::string& filepath) -> void
+    {
+        // NOTE(abi): read back from the file rather than written from memory, so visits
+        // other shells appended since we loaded survive the rewrite.
+        FrecencyIndex index = read_directory_index(filepath);
+
+        // Ranks fade once they add up to too much, and rarely visited directories drop out
+        double total_rank = 0;
+        for (const FrecencyEntry& entry : index.entries)
+        {
+            total_rank += entry.rank;
+        }
+
+        if (total_rank > config::DIRECTORY_INDEX_MAX_RANK)
+        {
+            FrecencyIndex aged;
+            for (const FrecencyEntry& entry : index.entries)
+            {
+                double rank = entry.rank * config::DIRECTORY_INDEX_AGING;
+                if (rank >= 1)
+                {
+                    add_directory_visit(aged, {entry.path, rank, entry.last_visit});
+                }
+            }
+            index = std::move(aged);
+        }
+
+        index.record_count = index.entries.size();
+        if (write_directory_index(filepath, index))
+        {
+            shell_state->directory_index = std::move(index);
+        }
+    }
+
+    auto format_directory_visit(const DirectoryVisit& visit) -> std::string
+    {
+        char prefix[64];
+        std::snprintf(prefix, sizeof(prefix), "%.6g\t%lld\t", visit.rank,
+                      static_cast<long long>(visit.time));
+        return prefix + visit.path + "\n";
+    }
+
+    auto record_directory_visit(const std::string& path) -> void
+    {
+        const std::string& filepath = shell_state->directory_index_file;
+        if (filepath.empty() || path.find('\n') != std::string::npos)
+        {
+            return;
+        }
+
+        // One short append, so shells sharing the file don't interleave lines
+        DirectoryVisit visit{path, 1, std::time(nullptr)};
+        std::string line = format_directory_visit(visit);
+        int fd = open(filepath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd >= 0)
+        {
+            ssize_t count = write(fd, line.data(), line.size());
+            (void)count;
+            close(fd);
+        }
+
+        auto& pending = shell_state->pending_directory_index;
+        if (pending != nullptr && !is_background_result_ready(*pending))
+        {
+            shell_state->pending_directory_visits.push_back(std::move(visit));
+            return;
+        }
+
+        FrecencyIndex& index = get_directory_index();
+        add_directory_visit(index, visit);
+        index.record_count++;
+        if (index.record_count > 2 * index.entries.size() + config::DIRECTORY_INDEX_COMPACT_SLACK)
+        {
+            compact_directory_index(filepath);
+        }
+    }
+
+    auto add_directory_visit(FrecencyIndex& index, const DirectoryVisit& visit) -> void
+    {
+        auto [it, is_new] = index.ids.try_emplace(visit.path, index.entries.size());
+        if (is_new)
+        {
+            uint32_t id = it->second;
+            index.entries.push_back({visit.path, fold_case(visit.path)});
+
+            // Ids only grow, so a repeated trigram of this path is always at the back
+            const std::string& folded_path = index.entries.back().folded_path;
+            size_t name_start = folded_path.rfind('/') + 1;
+            for (size_t i = 0; i + 3 <= folded_path.size(); i++)
+            {
+                uint32_t trigram = get_trigram(&folded_path[i]);
+                std::vector<uint32_t>& ids = index.trigrams[trigram];
+                if (ids.empty() || ids.back() != id)
+                {
+                    ids.push_back(id);
+                }
+
+                if (i >= name_start)
+                {
+                    std::vector<uint32_t>& name_ids = index.name_trigrams[trigram];
+                    if (name_ids.empty() || name_ids.back() != id)
+                    {
+                        name_ids.push_back(id);
+                    }
+                }
+            }
+        }
+
+        FrecencyEntry& entry = index.entries[it->second];
+        entry.rank += visit.rank;
+        entry.last_visit = std::max(entry.last_visit, visit.time);
+    }
+
+    auto find_directories(const FrecencyIndex& index, const std::vector<std::string>& fragments,
+                          int64_t now) -> std::vector<uint32_t>
+    {
+        // Candidates are in every posting list of the fragments' trigrams; fragments too
+        // short to have one scan them all. A last fragment without a slash has to be in
+        // the final component, whose lists are far shorter.
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (size_t f = 0; f < fragments.size(); f++)
+        {
+            const std::string& fragment = fragments[f];
+            bool is_name = (f + 1 == fragments.size() && fragment.find('/') == std::string::npos);
+            const auto& trigrams = is_name ? index.name_trigrams : index.trigrams;
+            for (size_t i = 0; i + 3 <= fragment.size(); i++)
+            {
+                auto it = trigrams.find(get_trigram(&fragment[i]));
+                if (it == trigrams.end())
+                {
+                    return {};
+                }
+                lists.push_back(&it->second);
+            }
+        }
+
+        // Intersected from the shortest list, each one narrowing it further
+        std::sort(lists.begin(), lists.end(),
+                  [](const auto* a, const auto* b) { return a->size() < b->size(); });
+        std::vector<uint32_t> candidates;
+        if (!lists.empty())
+        {
+            candidates = *lists[0];
+        }
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++)
+        {
+            auto cursor = lists[i]->begin();
+            size_t kept = 0;
+            for (uint32_t id : candidates)
+            {
+                cursor = std::lower_bound(cursor, lists[i]->end(), id);
+                if (cursor != lists[i]->end() && *cursor == id)
+                {
+                    candidates[kept++] = id;
+                }
+            }
+            candidates.resize(kept);
+        }
+
+        std::vector<std::pair<double, uint32_t>> matches;
+        size_t count = lists.empty() ? index.entries.size() : candidates.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t id = lists.empty() ? static_cast<uint32_t>(i) : candidates[i];
+            const FrecencyEntry& entry = index.entries[id];
+            if (has_fragments_in_order(entry.folded_path, fragments))
+            {
+                matches.emplace_back(get_frecency_score(entry, now), id);
+            }
+        }
+
+        // Only the best few are ever looked at
+        size_t kept = std::min(matches.size(), config::DIRECTORY_LIST_SIZE);
+        std::partial_sort(matches.begin(), matches.begin() + kept, matches.end(),
+                          [](const auto& a, const auto& b) { return a.first > b.first; });
+        matches.resize(kept);
+
+        std::vector<uint32_t> ids;
+        ids.reserve(matches.size());
+        for (const auto& [score, id] : matches)
+        {
+            ids.push_back(id);
+        }
+
+        return ids;
+    }
+
+    auto has_fragments_in_order(const std::string& folded_path,
+                                const std::vector<std::string>& fragments) -> bool
+    {
+        if (fragments.empty())
+        {
+            return true;
+        }
+
+        size_t position = 0;
+        for (size_t i = 0; i + 1 < fragments.size(); i++)
+        {
+            position = folded_path.find(fragments[i], position);
+            if (position == std::string::npos)
+            {
+                return false;
+            }
+            position += fragments[i].size();
+        }
+
+        // NOTE(abi): the last fragment has to end in the final component, so `j src`
+        // lands on a src directory rather than somewhere below one.
+        const std::string& last = fragments.back();
+        size_t last_slash = folded_path.rfind('/');
+        size_t start = (last_slash + 1 >= last.size()) ? last_slash + 2 - last.size() : 0;
+        return folded_path.find(last, std::max(position, start)) != std::string::npos;
+    }
+
+    auto get_frecency_score(const FrecencyEntry& entry, int64_t now) -> double
+    {
+        int64_t age = now - entry.last_visit;
+        if (age < 60 * 60)
+        {
+            return entry.rank * 4;
+        }
+        if (age < 24 * 60 * 60)
+        {
+            return entry.rank * 2;
+        }
+        if (age < 7 * 24 * 60 * 60)
+        {
+            return entry.rank / 2;
+        }
+
+        return entry.rank / 4;
+    }
+
+    auto get_trigram(const char* text) -> uint32_t
+    {
+        return static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16
+               | static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8
+               | static_cast<unsigned char>(text[2]);
+    }
+
+    auto fold_case(std::string text) -> std::string
+    {
+        for (char& c : text)
+        {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+
+        return text;
+    }
+
+} // namespace ash
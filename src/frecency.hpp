@@ -0,0 +1,67 @@
+#pragma once
+
+#include "commands.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ash
+{
+
+    struct FrecencyEntry
+    {
+        std::string path;
+        std::string folded_path; // Lowercased, what queries are matched against
+        double rank = 0;         // Visits, faded as the total grows
+        int64_t last_visit = 0;  // Seconds since the epoch
+    };
+
+    // NOTE(abi): every distinct trigram of a folded path maps to the entries containing
+    // it, in id order. A query only scores the entries on all of its trigrams' lists,
+    // so it stays fast however many directories have been visited.
+    struct FrecencyIndex
+    {
+        std::vector<FrecencyEntry> entries;
+        std::unordered_map<std::string, uint32_t> ids; // By path
+        std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> name_trigrams; // Final component's
+        size_t record_count = 0; // Lines in the file it was read from, plus those appended
+    };
+
+    struct DirectoryVisit
+    {
+        std::string path;
+        double rank;
+        int64_t time;
+    };
+
+    // Builtin
+    auto jump_command(const BuiltinArguments& args) -> int;
+    auto print_directory_matches(const FrecencyIndex& index, const std::vector<uint32_t>& ids)
+        -> void;
+
+    // Index file
+    auto get_directory_index_file() -> std::optional<std::string>;
+    auto start_loading_directory_index() -> void;
+    auto get_directory_index() -> FrecencyIndex&;
+    auto read_directory_index(const std::string& filepath, int64_t size_limit = -1)
+        -> FrecencyIndex;
+    auto write_directory_index(const std::string& filepath, const FrecencyIndex& index) -> bool;
+    auto compact_directory_index(const std::string& filepath) -> void;
+    auto format_directory_visit(const DirectoryVisit& visit) -> std::string;
+    auto record_directory_visit(const std::string& path) -> void;
+    auto add_directory_visit(FrecencyIndex& index, const DirectoryVisit& visit) -> void;
+
+    // Queries
+    auto find_directories(const FrecencyIndex& index, const std::vector<std::string>& fragments,
+                          int64_t now) -> std::vector<uint32_t>;
+    auto has_fragments_in_order(const std::string& folded_path,
+                                const std::vector<std::string>& fragments) -> bool;
+    auto get_frecency_score(const FrecencyEntry& entry, int64_t now) -> double;
+    auto get_trigram(const char* text) -> uint32_t;
+    auto fold_case(std::string text) -> std::string;
+
+} // namespace ash
@@ -0,0 +1,1695 @@
+#include "interpreter.hpp"
+#include "arithmetic.hpp"
+#include "constants.hpp"
+#include "scanner.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fnmatch.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    struct LoopContext
+    {
+        bool is_for = false;
+        size_t continue_target = 0;
+        std::vector<size_t> break_jumps;
+    };
+
+    struct PendingHereDocument
+    {
+        size_t index;         // Into pipelines, or into redirections for compound commands
+        size_t command_index; // std::string::npos for compound commands
+        Program* program = nullptr; // The subshell body it belongs to, if not the current one
+    };
+
+    // Where the compiler was, so that a command can be parsed again as a pipeline stage
+    struct CompilerCheckpoint
+    {
+        size_t pos = 0;
+        size_t instruction_count = 0;
+        size_t pipeline_count = 0;
+        size_t assignment_count = 0;
+        size_t for_loop_count = 0;
+        size_t word_count = 0;
+        size_t case_pattern_count = 0;
+        size_t redirection_count = 0;
+        size_t function_count = 0;
+        size_t subshell_count = 0;
+        std::vector<LoopContext> loops; // break records its jump in the loop it leaves
+        std::vector<PendingHereDocument> pending_here_documents;
+    };
+
+    // NOTE(abi): a recursive descent parser over the raw source that emits code as it
+    // goes. Simple commands are cut out of the source and handed to the existing
+    // pipeline parser, so that they support exactly what a single line does.
+    struct ProgramCompiler
+    {
+        const std::string& source;
+        Program& program;
+        std::string& error;
+        size_t pos = 0;
+        CompileStatus status = CompileStatus::OK;
+        std::vector<LoopContext> loops;
+        std::vector<PendingHereDocument> pending_here_documents;
+
+        auto compile() -> CompileStatus
+        {
+            if (parse_list({}) && !pending_here_documents.empty())
+            {
+                fail(CompileStatus::INCOMPLETE, "here-document delimited by end-of-file");
+            }
+
+            return status;
+        }
+
+        // Code generation
+
+        auto emit(OpCode op, size_t operand = 0, size_t target = 0) -> size_t
+        {
+            program.instructions.push_back(
+                {op, static_cast<uint32_t>(operand), static_cast<uint32_t>(target)});
+            return program.instructions.size() - 1;
+        }
+
+        auto patch(size_t index) -> void
+        {
+            program.instructions[index].target = static_cast<uint32_t>(program.instructions.size());
+        }
+
+        // Errors
+
+        auto fail(CompileStatus failure, const std::string& message) -> bool
+        {
+            if (status == CompileStatus::OK)
+            {
+                status = failure;
+                error = message;
+            }
+            return false;
+        }
+
+        auto fail_near(const std::string& token) -> bool
+        {
+            if (at_end())
+            {
+                return fail(CompileStatus::INCOMPLETE, "syntax error: unexpected end of file");
+            }
+            return fail(CompileStatus::SYNTAX_ERROR,
+                        "syntax error near unexpected token `" + token + "'");
+        }
+
+        // A redirection operator with no word after it, which is never worth more input
+        auto fail_missing_target(bool is_piped) -> bool
+        {
+            std::string token = is_piped ? "|" : (at_end() ? "newline" : current_token());
+            return fail(CompileStatus::SYNTAX_ERROR,
+                        "syntax error near unexpected token `" + token + "'");
+        }
+
+        // Lexing
+
+        auto at_end() const -> bool
+        {
+            return pos >= source.size();
+        }
+
+        auto skip_blanks() -> void
+        {
+            while (pos < source.size())
+            {
+                char c = source[pos];
+                if (c == ' ' || c == '\t')
+                {
+                    pos++;
+                }
+                else if (c == '\\' && pos + 1 < source.size() && source[pos + 1] == '\n')
+                {
+                    pos += 2;
+                }
+                else if (c == '#')
+                {
+                    pos = std::min(source.find('\n', pos), source.size());
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        auto skip_linebreaks() -> bool
+        {
+            skip_blanks();
+            while (pos < source.size() && source[pos] == '\n')
+            {
+                if (!consume_newline())
+                {
+                    return false;
+                }
+                skip_blanks();
+            }
+
+            return true;
+        }
+
+        auto consume_newline() -> bool
+        {
+            pos++;
+
+            // Here-document bodies start on the line after their operator
+            for (const PendingHereDocument& pending : pending_here_documents)
+            {
+                for (Redirection& redirection : get_pending_redirections(pending).redirections)
+                {
+                    if (redirection.op != RedirectionOperator::DOCUMENT
+                        || redirection.here_document_delimiter.empty())
+                    {
+                        continue;
+                    }
+
+                    bool terminated = false;
+                    while (!terminated && pos < source.size())
+                    {
+                        size_t line_end = std::min(source.find('\n', pos), source.size());
+                        std::string line = source.substr(pos, line_end - pos);
+                        pos = std::min(line_end + 1, source.size());
+
+                        if (redirection.strip_leading_tabs)
+                        {
+                            line.erase(0, line.find_first_not_of('\t'));
+                        }
+
+                        terminated = (line == redirection.here_document_delimiter);
+                        if (!terminated)
+                        {
+                            redirection.target += line;
+                            redirection.target += '\n';
+                        }
+                    }
+
+                    if (!terminated)
+                    {
+                        return fail(CompileStatus::INCOMPLETE,
+                                    "here-document delimited by end-of-file");
+                    }
+                }
+            }
+
+            pending_here_documents.clear();
+            return true;
+        }
+
+        auto get_pending_redirections(const PendingHereDocument& pending) -> RedirectionSpec&
+        {
+            Program& target = (pending.program != nullptr) ? *pending.program : program;
+            return (pending.command_index == std::string::npos)
+                       ? target.redirections[pending.index]
+                       : target.pipelines[pending.index][pending.command_index].redirection;
+        }
+
+        auto peek_word() const -> std::string
+        {
+            return peek_word_at(pos);
+        }
+
+        auto peek_word_at(size_t start) const -> std::string
+        {
+            size_t end = start;
+            while (end < source.size() && std::strchr(" \t\n;&|<>()", source[end]) == nullptr)
+            {
+                end++;
+            }
+
+            return source.substr(start, end - start);
+        }
+
+        auto is_compound_start(size_t start) const -> bool
+        {
+            std::string word = peek_word_at(start);
+            return (word.empty() && start < source.size() && source[start] == '(') || word == "{"
+                   || word == "if" || word == "while" || word == "until" || word == "for"
+                   || word == "case";
+        }
+
+        // A | that isn't || or |>, whose next stage is compound or on the next line
+        auto is_compound_stage_ahead(size_t pipe_pos) const -> bool
+        {
+            size_t start = std::min(source.find_first_not_of(" \t", pipe_pos + 1), source.size());
+            return start < source.size() && (source[start] == '\n' || is_compound_start(start));
+        }
+
+        auto is_pipe_ahead() const -> bool
+        {
+            return pos < source.size() && source[pos] == '|'
+                   && (pos + 1 == source.size() || std::strchr("|>", source[pos + 1]) == nullptr);
+        }
+
+        auto current_token() const -> std::string
+        {
+            if (at_end())
+            {
+                return "end of file";
+            }
+
+            std::string word = peek_word();
+            if (!word.empty())
+            {
+                return word;
+            }
+
+            if (source[pos] == '\n')
+            {
+                return "newline";
+            }
+
+            bool is_doubled = pos + 1 < source.size() && source[pos + 1] == source[pos];
+            return source.substr(pos, is_doubled ? 2 : 1);
+        }
+
+        auto consume_keyword(const std::string& keyword) -> bool
+        {
+            skip_blanks();
+            if (peek_word() != keyword)
+            {
+                return fail_near(current_token());
+            }
+
+            pos += keyword.size();
+            return true;
+        }
+
+        // Cuts the text of a simple command out of the source, up to the next
+        // unquoted control operator
+        auto scan_command_text(bool is_stopped_by_pipe = false) -> std::string
+        {
+            std::string text;
+            int parenthesis_depth = 0;
+            int brace_depth = 0;
+
+            // Everything between two stops is copied as it is
+            DelimiterScanner scanner{source, "\\\n;|&()#}>"};
+            scanner.reset(pos);
+            while (pos < source.size())
+            {
+                size_t stop = std::min(scanner.next(pos), source.size());
+                text.append(source, pos, stop - pos);
+                pos = stop;
+                if (pos == source.size())
+                {
+                    break;
+                }
+
+                char c = source[pos];
+                if (c == '\\' && pos + 1 < source.size())
+                {
+                    // Line continuation
+                    if (source[pos + 1] != '\n')
+                    {
+                        text += c;
+                        text += source[pos + 1];
+                    }
+                    pos += 2;
+                    continue;
+                }
+
+                if (c == '(')
+                {
+                    parenthesis_depth++;
+                }
+                else if (c == ')')
+                {
+                    if (parenthesis_depth == 0)
+                    {
+                        break;
+                    }
+                    parenthesis_depth--;
+                }
+                else if (brace_depth > 0)
+                {
+                    // Consumer groups of |> { a ; b } may span lines
+                    brace_depth -= (c == '}') ? 1 : 0;
+                    c = (c == '\n') ? ';' : c;
+                }
+                else if (parenthesis_depth == 0)
+                {
+                    char next = (pos + 1 < source.size()) ? source[pos + 1] : '\0';
+                    char previous = text.empty() ? ' ' : text.back();
+
+                    if (c == '\n' || c == ';' || (c == '|' && next == '|'))
+                    {
+                        break;
+                    }
+                    if (c == '|' && next != '>'
+                        && (is_stopped_by_pipe || is_compound_stage_ahead(pos)))
+                    {
+                        break;
+                    }
+                    if (c == '&' && next != '>' && previous != '>' && previous != '<')
+                    {
+                        break;
+                    }
+                    if (c == '#' && (previous == ' ' || previous == '\t'))
+                    {
+                        pos = std::min(source.find('\n', pos), source.size());
+                        break;
+                    }
+                    if (c == '>' && previous == '|')
+                    {
+                        size_t group = std::min(source.find_first_not_of(" \t", pos + 1),
+                                                source.size());
+                        brace_depth += (group < source.size() && source[group] == '{') ? 1 : 0;
+                    }
+                }
+
+                text += c;
+                pos++;
+            }
+
+            return text;
+        }
+
+        auto scan_word() -> std::string
+        {
+            size_t start = pos;
+            bool in_single_quotes = false;
+            bool in_double_quotes = false;
+
+            for (; pos < source.size(); pos++)
+            {
+                char c = source[pos];
+                if (c == '\\' && !in_single_quotes)
+                {
+                    pos++;
+                }
+                else if (c == '$' && !in_single_quotes
+                         && get_arithmetic_expansion_length(source, pos) > 0)
+                {
+                    pos += get_arithmetic_expansion_length(source, pos) - 1;
+                }
+                else if (c == '\'' && !in_double_quotes)
+                {
+                    in_single_quotes = !in_single_quotes;
+                }
+                else if (c == '\"' && !in_single_quotes)
+                {
+                    in_double_quotes = !in_double_quotes;
+                }
+                else if (!in_single_quotes && !in_double_quotes
+                         && std::strchr(" \t\n;&|<>()", c) != nullptr)
+                {
+                    break;
+                }
+            }
+
+            pos = std::min(pos, source.size());
+            return source.substr(start, pos - start);
+        }
+
+        auto has_here_document(const RedirectionSpec& redirection_spec) const -> bool
+        {
+            return std::any_of(redirection_spec.redirections.begin(),
+                               redirection_spec.redirections.end(),
+                               [](const Redirection& redirection)
+                               {
+                                   return redirection.op == RedirectionOperator::DOCUMENT
+                                          && !redirection.here_document_delimiter.empty();
+                               });
+        }
+
+        // Grammar
+
+        auto parse_list(const std::vector<std::string>& terminators) -> bool
+        {
+            bool has_command = false;
+            while (true)
+            {
+                if (!skip_linebreaks())
+                {
+                    return false;
+                }
+
+                if (at_end())
+                {
+                    return terminators.empty() || fail_near("");
+                }
+
+                std::string word = (source.compare(pos, 2, ";;") == 0) ? std::string(";;")
+                                   : (source[pos] == ')')              ? std::string(")")
+                                                                       : peek_word();
+                if (std::find(terminators.begin(), terminators.end(), word) != terminators.end())
+                {
+                    return has_command || fail_near(word);
+                }
+
+                if (!parse_and_or())
+                {
+                    return false;
+                }
+                has_command = true;
+
+                skip_blanks();
+                if (at_end())
+                {
+                    continue;
+                }
+
+                if (source[pos] == ';' && source.compare(pos, 2, ";;") != 0)
+                {
+                    pos++;
+                }
+                else if (source[pos] == '\n')
+                {
+                    if (!consume_newline())
+                    {
+                        return false;
+                    }
+                }
+                else if (source[pos] == ')'
+                         && std::find(terminators.begin(), terminators.end(), ")")
+                                != terminators.end())
+                {
+                    // Unlike }, a closing parenthesis needs no separator before it
+                    continue;
+                }
+                else if (source[pos] != ';')
+                {
+                    return fail_near(current_token());
+                }
+            }
+        }
+
+        auto parse_and_or() -> bool
+        {
+            if (!parse_pipeline_command())
+            {
+                return false;
+            }
+
+            while (true)
+            {
+                skip_blanks();
+                bool is_and = source.compare(pos, 2, "&&") == 0;
+                bool is_or = source.compare(pos, 2, "||") == 0;
+                if (!is_and && !is_or)
+                {
+                    return true;
+                }
+
+                pos += 2;
+                if (!skip_linebreaks())
+                {
+                    return false;
+                }
+
+                // Skip the right-hand side when the left one already decided the result
+                size_t skip_jump = emit(is_and ? OpCode::JUMP_IF_FAILURE : OpCode::JUMP_IF_SUCCESS);
+                if (!parse_pipeline_command())
+                {
+                    return false;
+                }
+                patch(skip_jump);
+            }
+        }
+
+        auto parse_pipeline_command() -> bool
+        {
+            skip_blanks();
+            bool is_negated = peek_word() == "!";
+            if (is_negated)
+            {
+                pos++;
+            }
+
+            // NOTE(abi): a command is compiled as if it stood alone, which it nearly always
+            // does. When a | follows after all, its code is dropped and the whole pipeline
+            // parsed again stage by stage.
+            CompilerCheckpoint checkpoint = save_checkpoint();
+            if (!parse_command())
+            {
+                return false;
+            }
+
+            skip_blanks();
+            if (is_pipe_ahead())
+            {
+                restore_checkpoint(checkpoint);
+                if (!parse_pipeline_stages())
+                {
+                    return false;
+                }
+            }
+
+            if (is_negated)
+            {
+                emit(OpCode::NEGATE_STATUS);
+            }
+            return true;
+        }
+
+        auto parse_command() -> bool
+        {
+            skip_blanks();
+            std::string word = peek_word();
+
+            if (word == "function" || is_function_definition(word))
+            {
+                return parse_function_definition(word == "function");
+            }
+
+            if (word.empty() && !at_end() && source[pos] == '(')
+            {
+                size_t redirect_slot = emit(OpCode::NOP);
+                return parse_subshell() && parse_compound_redirections(redirect_slot);
+            }
+
+            if (word == "{" || word == "if" || word == "while" || word == "until" || word == "for"
+                || word == "case")
+            {
+                // Placeholder for the compound command's redirections, if it has any
+                size_t redirect_slot = emit(OpCode::NOP);
+
+                bool is_parsed = false;
+                if (word == "{")
+                {
+                    pos++;
+                    is_parsed = parse_list({"}"}) && consume_keyword("}");
+                }
+                else if (word == "if")
+                {
+                    is_parsed = parse_if();
+                }
+                else if (word == "for")
+                {
+                    is_parsed = parse_for();
+                }
+                else if (word == "case")
+                {
+                    is_parsed = parse_case();
+                }
+                else
+                {
+                    is_parsed = parse_while(word == "until");
+                }
+
+                return is_parsed && parse_compound_redirections(redirect_slot);
+            }
+
+            if (word == "break" || word == "continue")
+            {
+                return parse_loop_control(word == "break");
+            }
+
+            if (is_reserved_word(word))
+            {
+                return fail_near(word);
+            }
+
+            return parse_simple_command();
+        }
+
+        auto parse_simple_command() -> bool
+        {
+            std::string text = trim_whitespace(scan_command_text());
+            if (text.empty())
+            {
+                return fail_near(current_token());
+            }
+
+            // NAME=value...
+            if (!has_pipes(text) && find_unquoted(text, "<") == std::string::npos
+                && find_unquoted(text, ">") == std::string::npos)
+            {
+                std::vector<Word> words = lex_words(text);
+                if (std::all_of(words.begin(), words.end(),
+                                [](const Word& word) { return get_assignment_length(word) > 0; }))
+                {
+                    std::vector<Assignment> assignments;
+                    for (const Word& word : words)
+                    {
+                        assignments.push_back(make_assignment(word));
+                    }
+
+                    emit(OpCode::ASSIGN, program.assignments.size());
+                    program.assignments.push_back(std::move(assignments));
+                    return true;
+                }
+            }
+
+            std::vector<CommandSpec> commands;
+            return parse_simple_stages(text, commands) && emit_pipeline(std::move(commands));
+        }
+
+        // Simple commands, and the pipelines between them that need no compound stage
+        auto parse_simple_stages(const std::string& text, std::vector<CommandSpec>& commands)
+            -> bool
+        {
+            if (has_pipes(text))
+            {
+                commands = parse_pipeline(text);
+            }
+            else if (auto cmd = parse_command_segment(text))
+            {
+                commands.push_back(*cmd);
+            }
+
+            if (commands.empty())
+            {
+                return fail_near(text);
+            }
+
+            for (size_t i = 0; i < commands.size(); i++)
+            {
+                bool is_target_missing = commands[i].redirection.is_target_missing;
+                for (const std::vector<CommandSpec>& consumer : commands[i].fan_out)
+                {
+                    for (const CommandSpec& cmd : consumer)
+                    {
+                        is_target_missing = is_target_missing || cmd.redirection.is_target_missing;
+                    }
+                }
+
+                if (is_target_missing)
+                {
+                    return fail_missing_target(i + 1 < commands.size());
+                }
+            }
+
+            return true;
+        }
+
+        auto emit_pipeline(std::vector<CommandSpec> commands) -> bool
+        {
+            size_t pipeline_index = program.pipelines.size();
+            for (size_t i = 0; i < commands.size(); i++)
+            {
+                if (has_here_document(commands[i].redirection))
+                {
+                    pending_here_documents.push_back({pipeline_index, i});
+                }
+            }
+
+            OpCode op = OpCode::RUN_PIPELINE;
+            if (commands.size() == 1 && commands[0].command == "exit")
+            {
+                op = OpCode::EXIT;
+            }
+            else if (commands.size() == 1 && commands[0].command == "return")
+            {
+                op = OpCode::RETURN;
+            }
+
+            program.pipelines.push_back(std::move(commands));
+            emit(op, pipeline_index);
+            return true;
+        }
+
+        // command | command ..., where any stage may be compound
+        auto parse_pipeline_stages() -> bool
+        {
+            std::vector<CommandSpec> stages;
+            while (true)
+            {
+                skip_blanks();
+                if (is_compound_start(pos))
+                {
+                    CommandSpec stage;
+                    if (!parse_compound_stage(stage))
+                    {
+                        return false;
+                    }
+                    stages.push_back(std::move(stage));
+                }
+                else
+                {
+                    std::vector<CommandSpec> commands;
+                    if (!parse_simple_stages(trim_whitespace(scan_command_text()), commands))
+                    {
+                        return false;
+                    }
+                    std::move(commands.begin(), commands.end(), std::back_inserter(stages));
+                }
+
+                skip_blanks();
+                if (!is_pipe_ahead())
+                {
+                    break;
+                }
+
+                // The next stage may start on the next line
+                pos++;
+                if (!skip_linebreaks())
+                {
+                    return false;
+                }
+                if (at_end())
+                {
+                    return fail_near("");
+                }
+            }
+
+            return emit_pipeline(std::move(stages));
+        }
+
+        // Compiled on its own like a subshell body, it runs in the stage's child
+        auto parse_compound_stage(CommandSpec& stage) -> bool
+        {
+            auto body = std::make_shared<Program>();
+            ProgramCompiler body_compiler{source, *body, error};
+            body_compiler.pos = pos;
+            bool is_parsed = body_compiler.parse_command();
+
+            pos = body_compiler.pos;
+            if (!is_parsed)
+            {
+                status = body_compiler.status;
+                return false;
+            }
+
+            for (PendingHereDocument pending : body_compiler.pending_here_documents)
+            {
+                pending.program = (pending.program != nullptr) ? pending.program : body.get();
+                pending_here_documents.push_back(pending);
+            }
+
+            stage.body = std::move(body);
+            return true;
+        }
+
+        auto save_checkpoint() const -> CompilerCheckpoint
+        {
+            return {pos,
+                    program.instructions.size(),
+                    program.pipelines.size(),
+                    program.assignments.size(),
+                    program.for_loops.size(),
+                    program.words.size(),
+                    program.case_patterns.size(),
+                    program.redirections.size(),
+                    program.functions.size(),
+                    program.subshells.size(),
+                    loops,
+                    pending_here_documents};
+        }
+
+        auto restore_checkpoint(const CompilerCheckpoint& checkpoint) -> void
+        {
+            pos = checkpoint.pos;
+            program.instructions.resize(checkpoint.instruction_count);
+            program.pipelines.resize(checkpoint.pipeline_count);
+            program.assignments.resize(checkpoint.assignment_count);
+            program.for_loops.resize(checkpoint.for_loop_count);
+            program.words.resize(checkpoint.word_count);
+            program.case_patterns.resize(checkpoint.case_pattern_count);
+            program.redirections.resize(checkpoint.redirection_count);
+            program.functions.resize(checkpoint.function_count);
+            program.subshells.resize(checkpoint.subshell_count);
+            loops = checkpoint.loops;
+
+            // Bodies read since are read again
+            pending_here_documents = checkpoint.pending_here_documents;
+            for (const PendingHereDocument& pending : pending_here_documents)
+            {
+                for (Redirection& redirection : get_pending_redirections(pending).redirections)
+                {
+                    if (redirection.op == RedirectionOperator::DOCUMENT
+                        && !redirection.here_document_delimiter.empty())
+                    {
+                        redirection.target.clear();
+                    }
+                }
+            }
+        }
+
+        // name() compound-command
+        auto is_function_definition(const std::string& name) const -> bool
+        {
+            if (name.empty() || is_reserved_word(name)
+                || name.find_first_of("$'\"\\=") != std::string::npos)
+            {
+                return false;
+            }
+
+            size_t open_pos = source.find_first_not_of(" \t", pos + name.size());
+            if (open_pos == std::string::npos || source[open_pos] != '(')
+            {
+                return false;
+            }
+
+            size_t close_pos = source.find_first_not_of(" \t", open_pos + 1);
+            return close_pos != std::string::npos && source[close_pos] == ')';
+        }
+
+        // function name [()] compound-command
+        auto parse_function_definition(bool has_keyword) -> bool
+        {
+            if (has_keyword)
+            {
+                pos += 8;
+                skip_blanks();
+            }
+
+            std::string name = peek_word();
+            if (name.empty() || is_reserved_word(name))
+            {
+                return fail_near(current_token());
+            }
+            pos += name.size();
+
+            skip_blanks();
+            if (!at_end() && source[pos] == '(')
+            {
+                pos++;
+                skip_blanks();
+                if (at_end() || source[pos] != ')')
+                {
+                    return fail_near(current_token());
+                }
+                pos++;
+            }
+
+            if (!skip_linebreaks())
+            {
+                return false;
+            }
+
+            std::string keyword = peek_word();
+            if (keyword != "{" && keyword != "if" && keyword != "while" && keyword != "until"
+                && keyword != "for" && keyword != "case")
+            {
+                return fail_near(current_token());
+            }
+
+            // NOTE(abi): the body is compiled once, into its own program, and shared with
+            // the command table, so calls don't parse anything.
+            auto body = std::make_shared<Program>();
+            ProgramCompiler body_compiler{source, *body, error};
+            body_compiler.pos = pos;
+            bool is_parsed = body_compiler.parse_command();
+
+            // Here-documents opened on the line of the closing brace
+            if (is_parsed && !body_compiler.pending_here_documents.empty())
+            {
+                body_compiler.skip_blanks();
+                bool is_at_newline =
+                    !body_compiler.at_end() && source[body_compiler.pos] == '\n';
+                is_parsed = is_at_newline ? body_compiler.consume_newline()
+                                          : body_compiler.fail_near(body_compiler.current_token());
+            }
+
+            pos = body_compiler.pos;
+            if (!is_parsed)
+            {
+                status = body_compiler.status;
+                return false;
+            }
+
+            emit(OpCode::DEFINE_FUNCTION, program.functions.size());
+            program.functions.push_back({name, std::move(body)});
+            return true;
+        }
+
+        // ( list )
+        auto parse_subshell() -> bool
+        {
+            pos++;
+
+            auto body = std::make_shared<Program>();
+            ProgramCompiler body_compiler{source, *body, error};
+            body_compiler.pos = pos;
+            bool is_parsed = body_compiler.parse_list({")"});
+
+            pos = body_compiler.pos;
+            if (!is_parsed)
+            {
+                status = body_compiler.status;
+                return false;
+            }
+            pos++;
+
+            // Here-documents opened on the line of the closing parenthesis are read with
+            // ours, at the end of that line
+            for (PendingHereDocument pending : body_compiler.pending_here_documents)
+            {
+                pending.program = (pending.program != nullptr) ? pending.program : body.get();
+                pending_here_documents.push_back(pending);
+            }
+
+            emit(OpCode::RUN_SUBSHELL, program.subshells.size());
+            program.subshells.push_back({std::move(body)});
+            return true;
+        }
+
+        auto parse_compound_redirections(size_t redirect_slot) -> bool
+        {
+            // Up to the next stage, when it's piped
+            skip_blanks();
+            std::string text = scan_command_text(true);
+            if (trim_whitespace(text).empty())
+            {
+                return true;
+            }
+
+            RedirectionSpec redirection_spec = parse_and_strip_redirection(text);
+            if (!trim_whitespace(text).empty())
+            {
+                return fail_near(trim_whitespace(text));
+            }
+
+            if (redirection_spec.is_target_missing)
+            {
+                return fail_missing_target(false);
+            }
+
+            size_t redirection_index = program.redirections.size();
+            if (has_here_document(redirection_spec))
+            {
+                pending_here_documents.push_back({redirection_index, std::string::npos});
+            }
+            program.redirections.push_back(std::move(redirection_spec));
+
+            size_t redirect_end = emit(OpCode::REDIRECT_END);
+            program.instructions[redirect_slot] = {OpCode::REDIRECT_BEGIN,
+                                                   static_cast<uint32_t>(redirection_index),
+                                                   static_cast<uint32_t>(redirect_end)};
+            return true;
+        }
+
+        auto parse_if() -> bool
+        {
+            pos += 2;
+
+            std::vector<size_t> end_jumps;
+            while (true)
+            {
+                if (!parse_list({"then"}) || !consume_keyword("then"))
+                {
+                    return false;
+                }
+
+                size_t next_branch = emit(OpCode::JUMP_IF_FAILURE);
+                if (!parse_list({"elif", "else", "fi"}))
+                {
+                    return false;
+                }
+                end_jumps.push_back(emit(OpCode::JUMP));
+                patch(next_branch);
+
+                std::string word = peek_word();
+                pos += word.size();
+                if (word == "elif")
+                {
+                    continue;
+                }
+
+                if (word == "else")
+                {
+                    if (!parse_list({"fi"}) || !consume_keyword("fi"))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    // No branch was taken
+                    emit(OpCode::SET_STATUS, 0);
+                }
+                break;
+            }
+
+            for (size_t end_jump : end_jumps)
+            {
+                patch(end_jump);
+            }
+            return true;
+        }
+
+        auto parse_while(bool is_until) -> bool
+        {
+            pos += 5;
+
+            size_t condition = program.instructions.size();
+            if (!parse_list({"do"}) || !consume_keyword("do"))
+            {
+                return false;
+            }
+
+            size_t exit_jump = emit(is_until ? OpCode::JUMP_IF_SUCCESS : OpCode::JUMP_IF_FAILURE);
+            loops.push_back({false, condition, {}});
+            if (!parse_list({"done"}) || !consume_keyword("done"))
+            {
+                return false;
+            }
+
+            emit(OpCode::JUMP, 0, condition);
+            patch(exit_jump);
+            emit(OpCode::SET_STATUS, 0);
+            close_loop();
+            return true;
+        }
+
+        auto parse_for() -> bool
+        {
+            pos += 3;
+            skip_blanks();
+
+            ForLoop loop;
+            loop.variable = peek_word();
+            if (!is_valid_variable_name(loop.variable))
+            {
+                return loop.variable.empty()
+                           ? fail_near(current_token())
+                           : fail(CompileStatus::SYNTAX_ERROR,
+                                  "`" + loop.variable + "': not a valid identifier");
+            }
+            pos += loop.variable.size();
+
+            if (!skip_linebreaks())
+            {
+                return false;
+            }
+
+            if (peek_word() == "in")
+            {
+                pos += 2;
+                loop.words = lex_words(scan_command_text());
+            }
+            else
+            {
+                loop.words = lex_words("\"$@\"");
+            }
+            if (!at_end() && source[pos] == ';')
+            {
+                pos++;
+            }
+            if (!skip_linebreaks() || !consume_keyword("do"))
+            {
+                return false;
+            }
+
+            size_t loop_index = program.for_loops.size();
+            program.for_loops.push_back(std::move(loop));
+            emit(OpCode::FOR_BEGIN, loop_index);
+            size_t next = emit(OpCode::FOR_NEXT, loop_index);
+
+            loops.push_back({true, next, {}});
+            if (!parse_list({"done"}) || !consume_keyword("done"))
+            {
+                return false;
+            }
+
+            emit(OpCode::JUMP, 0, next);
+            patch(next);
+            close_loop();
+            return true;
+        }
+
+        auto parse_case() -> bool
+        {
+            pos += 4;
+            skip_blanks();
+
+            std::vector<Word> subject = lex_words(scan_word());
+            if (subject.size() != 1)
+            {
+                return fail_near(current_token());
+            }
+
+            if (!skip_linebreaks() || !consume_keyword("in"))
+            {
+                return false;
+            }
+
+            size_t case_begin = emit(OpCode::CASE_BEGIN, program.words.size());
+            program.words.push_back(std::move(subject[0]));
+
+            std::vector<size_t> end_jumps;
+            while (true)
+            {
+                if (!skip_linebreaks())
+                {
+                    return false;
+                }
+
+                if (peek_word() == "esac")
+                {
+                    pos += 4;
+                    break;
+                }
+
+                if (at_end())
+                {
+                    return fail_near("");
+                }
+
+                // pattern [| pattern]... )
+                if (source[pos] == '(')
+                {
+                    pos++;
+                }
+                size_t close_pos = find_unquoted(source, ")", pos);
+                if (close_pos == std::string::npos)
+                {
+                    pos = source.size();
+                    return fail_near("");
+                }
+
+                std::string pattern_list = source.substr(pos, close_pos - pos);
+                pos = close_pos + 1;
+
+                std::vector<Word> patterns;
+                size_t start = 0;
+                while (start <= pattern_list.size())
+                {
+                    size_t end = std::min(find_unquoted(pattern_list, "|", start),
+                                          pattern_list.size());
+                    std::vector<Word> pattern =
+                        lex_words(trim_whitespace(pattern_list.substr(start, end - start)));
+                    if (pattern.size() != 1)
+                    {
+                        return fail_near(")");
+                    }
+                    patterns.push_back(std::move(pattern[0]));
+                    start = end + 1;
+                }
+
+                size_t next_arm = emit(OpCode::CASE_MATCH, program.case_patterns.size());
+                program.case_patterns.push_back(std::move(patterns));
+
+                if (!skip_linebreaks())
+                {
+                    return false;
+                }
+
+                if (source.compare(pos, 2, ";;") == 0 || peek_word() == "esac")
+                {
+                    emit(OpCode::SET_STATUS, 0);
+                }
+                else if (!parse_list({";;", "esac"}))
+                {
+                    return false;
+                }
+
+                if (source.compare(pos, 2, ";;") == 0)
+                {
+                    pos += 2;
+                }
+
+                end_jumps.push_back(emit(OpCode::JUMP));
+                patch(next_arm);
+            }
+
+            // No pattern matched
+            emit(OpCode::SET_STATUS, 0);
+
+            for (size_t end_jump : end_jumps)
+            {
+                patch(end_jump);
+            }
+            patch(case_begin);
+            return true;
+        }
+
+        auto parse_loop_control(bool is_break) -> bool
+        {
+            std::string name = is_break ? "break" : "continue";
+            pos += name.size();
+            skip_blanks();
+
+            size_t count = 1;
+            std::string argument = peek_word();
+            if (!argument.empty())
+            {
+                auto [ptr, error_code] =
+                    std::from_chars(argument.data(), argument.data() + argument.size(), count);
+                if (error_code != std::errc() || ptr != argument.data() + argument.size()
+                    || count == 0)
+                {
+                    return fail(CompileStatus::SYNTAX_ERROR,
+                                name + ": " + argument + ": loop count out of range");
+                }
+                pos += argument.size();
+            }
+
+            // NOTE(abi): outside of a loop this is a no-op, as in other shells.
+            if (loops.empty())
+            {
+                emit(OpCode::SET_STATUS, 0);
+                return true;
+            }
+
+            // Leaving a for loop drops its iteration state
+            count = std::min(count, loops.size());
+            for (size_t i = 0; i < count; i++)
+            {
+                bool is_left = is_break || i + 1 < count;
+                if (loops[loops.size() - 1 - i].is_for && is_left)
+                {
+                    emit(OpCode::FOR_END);
+                }
+            }
+
+            LoopContext& loop = loops[loops.size() - count];
+            if (is_break)
+            {
+                loop.break_jumps.push_back(emit(OpCode::JUMP));
+            }
+            else
+            {
+                emit(OpCode::JUMP, 0, loop.continue_target);
+            }
+            return true;
+        }
+
+        auto close_loop() -> void
+        {
+            for (size_t break_jump : loops.back().break_jumps)
+            {
+                patch(break_jump);
+            }
+            loops.pop_back();
+        }
+    };
+
+    auto compile_program(const std::string& source, Program& program, std::string& error)
+        -> CompileStatus
+    {
+        ProgramCompiler compiler{source, program, error};
+        return compiler.compile();
+    }
+
+    auto get_compiled_program(const std::string& source, std::shared_ptr<const Program>& program,
+                              std::string& error, bool is_run) -> CompileStatus
+    {
+        // NOTE(abi): the REPL looks each line up twice, once to see whether it's complete
+        // and again to run it. Only the run counts, as a hit if the line ran before.
+        ProgramCache& cache = shell_state->program_cache;
+        auto it = cache.positions.find(source);
+        if (it != cache.positions.end())
+        {
+            ProgramCache::Entry& entry = *it->second;
+            if (is_run)
+            {
+                (entry.is_unrun ? cache.misses : cache.hits)++;
+                entry.is_unrun = false;
+            }
+            cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+            program = entry.program;
+            return CompileStatus::OK;
+        }
+
+        if (is_run)
+        {
+            cache.misses++;
+        }
+        auto compiled = std::make_shared<Program>();
+        CompileStatus status = compile_program(source, *compiled, error);
+        if (status != CompileStatus::OK)
+        {
+            return status;
+        }
+        program = compiled;
+
+        // Whole scripts are only run once, and would push every line out
+        if (source.size() <= config::PROGRAM_CACHE_MAX_SOURCE)
+        {
+            if (cache.entries.size() >= config::PROGRAM_CACHE_SIZE)
+            {
+                cache.positions.erase(cache.entries.back().source);
+                cache.entries.pop_back();
+            }
+
+            cache.entries.push_front({source, std::move(compiled), !is_run});
+            cache.positions.emplace(cache.entries.front().source, cache.entries.begin());
+        }
+
+        return status;
+    }
+
+    auto clear_program_cache() -> void
+    {
+        ProgramCache& cache = shell_state->program_cache;
+        cache.positions.clear();
+        cache.entries.clear();
+    }
+
+    auto is_reserved_word(const std::string& word) -> bool
+    {
+        static const char* const reserved_words[] = {
+            "if", "then", "elif", "else", "fi",   "while", "until",   "for",
+            "do", "done", "case", "esac", "{",    "}",     "function"};
+        return std::find(std::begin(reserved_words), std::end(reserved_words), word)
+               != std::end(reserved_words);
+    }
+
+    auto run_program(const Program& program, bool can_exec_last) -> bool
+    {
+        // NOTE(abi): for loops pull their values from the generator one at a time, so
+        // a brace expansion like {1..1000000} is never held in memory as a whole.
+        struct ForLoopState
+        {
+            const ForLoop* loop;
+            WordGenerator values;
+        };
+
+        struct RedirectFrame
+        {
+            size_t begin;
+            size_t end;
+            std::vector<SavedFd> saved_fds;
+        };
+
+        std::vector<ForLoopState> loop_stack;
+        std::vector<RedirectFrame> redirect_stack;
+        std::string case_subject;
+        std::string loop_value;
+        int& status = shell_state->last_exit_status;
+
+        // NOTE(abi): jumping out of a redirected compound command (break, continue)
+        // has to put its descriptors back, so every taken jump checks the frames.
+        auto jump = [&redirect_stack](size_t target) -> size_t
+        {
+            while (!redirect_stack.empty()
+                   && (target <= redirect_stack.back().begin || target > redirect_stack.back().end))
+            {
+                restore_fds(redirect_stack.back().saved_fds);
+                redirect_stack.pop_back();
+            }
+            return target;
+        };
+
+        const std::vector<Instruction>& instructions = program.instructions;
+        size_t pc = 0;
+        while (pc < instructions.size())
+        {
+            const Instruction& instruction = instructions[pc++];
+            switch (instruction.op)
+            {
+            case OpCode::NOP:
+                break;
+            case OpCode::RUN_PIPELINE:
+            {
+                // The last command of a forked subshell may become the subshell
+                const std::vector<CommandSpec>& commands = program.pipelines[instruction.operand];
+                shell_state->can_exec_in_place = can_exec_last && pc == instructions.size()
+                                                 && redirect_stack.empty() && commands.size() == 1
+                                                 && commands[0].fan_out.empty();
+                run_pipeline(commands);
+                shell_state->can_exec_in_place = false;
+
+                // exit inside a function leaves every program on the way out
+                if (shell_state->is_exiting)
+                {
+                    pc = instructions.size();
+                }
+                break;
+            }
+            case OpCode::ASSIGN:
+            {
+                status = assign_variables(program.assignments[instruction.operand]) ? 0 : 1;
+                break;
+            }
+            case OpCode::EXIT:
+            case OpCode::RETURN:
+            {
+                std::string name = program.pipelines[instruction.operand][0].command;
+                std::optional<std::vector<std::string>> args =
+                    expand_words(program.pipelines[instruction.operand][0].args);
+                if (!args.has_value())
+                {
+                    status = 1;
+                    break;
+                }
+
+                if (!args->empty())
+                {
+                    int exit_status = 0;
+                    const std::string& arg = (*args)[0];
+                    auto [ptr, error_code] =
+                        std::from_chars(arg.data(), arg.data() + arg.size(), exit_status);
+                    if (error_code != std::errc() || ptr != arg.data() + arg.size())
+                    {
+                        std::cerr << name << ": " << arg << ": numeric argument required"
+                                  << std::endl;
+                        exit_status = 2;
+                    }
+                    status = exit_status & 0xff;
+                }
+                shell_state->is_exiting = shell_state->is_exiting || instruction.op == OpCode::EXIT;
+                pc = instructions.size();
+                break;
+            }
+            case OpCode::SET_STATUS:
+                status = static_cast<int>(instruction.operand);
+                break;
+            case OpCode::NEGATE_STATUS:
+                status = (status == 0) ? 1 : 0;
+                break;
+            case OpCode::JUMP:
+                pc = jump(instruction.target);
+                break;
+            case OpCode::JUMP_IF_SUCCESS:
+                if (status == 0)
+                {
+                    pc = jump(instruction.target);
+                }
+                break;
+            case OpCode::JUMP_IF_FAILURE:
+                if (status != 0)
+                {
+                    pc = jump(instruction.target);
+                }
+                break;
+            case OpCode::FOR_BEGIN:
+            {
+                const ForLoop& loop = program.for_loops[instruction.operand];
+                loop_stack.push_back({&loop, WordGenerator{&loop.words}});
+                break;
+            }
+            case OpCode::FOR_NEXT:
+            {
+                ForLoopState& state = loop_stack.back();
+                if (state.values.next(loop_value))
+                {
+                    set_variable(state.loop->variable, loop_value);
+                }
+                else
+                {
+                    status = state.values.is_failed ? 1 : status;
+                    loop_stack.pop_back();
+                    pc = jump(instruction.target);
+                }
+                break;
+            }
+            case OpCode::FOR_END:
+                loop_stack.pop_back();
+                break;
+            case OpCode::CASE_BEGIN:
+                // A subject that fails to expand skips the whole statement
+                if (expand_word(program.words[instruction.operand], case_subject)
+                    == ExpansionResult::FAILED)
+                {
+                    status = 1;
+                    pc = jump(instruction.target);
+                }
+                break;
+            case OpCode::CASE_MATCH:
+                if (!matches_case_pattern(case_subject,
+                                          program.case_patterns[instruction.operand]))
+                {
+                    pc = jump(instruction.target);
+                }
+                break;
+            case OpCode::REDIRECT_BEGIN:
+            {
+                RedirectFrame frame{pc - 1, instruction.target, {}};
+                if (!apply_fd_actions(compile_fd_actions(program.redirections[instruction.operand]),
+                                      &frame.saved_fds))
+                {
+                    restore_fds(frame.saved_fds);
+                    status = 1;
+                    pc = instruction.target + 1;
+                    break;
+                }
+                redirect_stack.push_back(std::move(frame));
+                break;
+            }
+            case OpCode::REDIRECT_END:
+                restore_fds(redirect_stack.back().saved_fds);
+                redirect_stack.pop_back();
+                break;
+            case OpCode::RUN_SUBSHELL:
+                run_subshell(*program.subshells[instruction.operand].body);
+                break;
+            case OpCode::DEFINE_FUNCTION:
+            {
+                const FunctionDefinition& function = program.functions[instruction.operand];
+                define_function(function.name, function.body);
+                status = 0;
+                break;
+            }
+            }
+        }
+
+        // exit and return can leave from inside a redirected compound command
+        while (!redirect_stack.empty())
+        {
+            restore_fds(redirect_stack.back().saved_fds);
+            redirect_stack.pop_back();
+        }
+
+        return !shell_state->is_exiting;
+    }
+
+    auto run_pipeline(const std::vector<CommandSpec>& commands) -> void
+    {
+        if (commands.size() == 1 && commands[0].fan_out.empty())
+        {
+            if (!execute_command(commands[0]))
+            {
+                handle_invalid_command(commands[0].command);
+                shell_state->last_exit_status = 127;
+            }
+            return;
+        }
+
+        execute_pipeline(commands);
+    }
+
+    auto run_subshell(const Program& body) -> void
+    {
+        if (can_run_subshell_inline(body))
+        {
+            run_program(body);
+            return;
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            std::cerr << "Failed to fork process" << std::endl;
+            shell_state->last_exit_status = 1;
+            return;
+        }
+
+        if (pid == 0)
+        {
+            run_program(body, true);
+            exit(shell_state->last_exit_status);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        shell_state->last_exit_status = get_exit_status(status);
+    }
+
+    auto can_run_subshell_inline(const Program& body) -> bool
+    {
+        // NOTE(abi): a subshell only needs a process of its own to keep its changes to
+        // the shell to itself. One that only starts external commands (and pipelines,
+        // whose stages are forked anyway) changes nothing, and runs in place.
+        for (const Instruction& instruction : body.instructions)
+        {
+            switch (instruction.op)
+            {
+            case OpCode::NOP:
+            case OpCode::SET_STATUS:
+            case OpCode::NEGATE_STATUS:
+            case OpCode::JUMP:
+            case OpCode::JUMP_IF_SUCCESS:
+            case OpCode::JUMP_IF_FAILURE:
+            case OpCode::CASE_BEGIN:
+            case OpCode::CASE_MATCH:
+            case OpCode::REDIRECT_BEGIN:
+            case OpCode::REDIRECT_END:
+            case OpCode::RUN_SUBSHELL:
+                break;
+            case OpCode::RUN_PIPELINE:
+            {
+                const std::vector<CommandSpec>& commands = body.pipelines[instruction.operand];
+                if (!commands.back().fan_out.empty())
+                {
+                    return false;
+                }
+
+                // $((x = 1)) assigns while the words are expanded, in the shell itself
+                auto has_arithmetic = [](const Word& word)
+                {
+                    return std::any_of(word.parts.begin(), word.parts.end(),
+                                       [](const WordPart& part)
+                                       { return part.type == WordPartType::ARITHMETIC; });
+                };
+                for (const CommandSpec& cmd : commands)
+                {
+                    if (std::any_of(cmd.args.begin(), cmd.args.end(), has_arithmetic)
+                        || std::any_of(cmd.assignments.begin(), cmd.assignments.end(),
+                                       [&](const Assignment& assignment)
+                                       { return has_arithmetic(assignment.value); }))
+                    {
+                        return false;
+                    }
+                }
+
+                CommandType type;
+                if (commands.size() == 1
+                    && (resolve_command(commands[0].command, type) == nullptr
+                        || type != CommandType::EXTERNAL))
+                {
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    auto call_function(const Program& body, const std::vector<std::string>& args) -> int
+    {
+        std::vector<std::string> saved_parameters =
+            std::exchange(shell_state->positional_parameters, args);
+        run_program(body);
+        shell_state->positional_parameters = std::move(saved_parameters);
+
+        return shell_state->last_exit_status;
+    }
+
+    auto matches_case_pattern(const std::string& subject, const std::vector<Word>& patterns)
+        -> bool
+    {
+        for (const Word& pattern : patterns)
+        {
+            if (fnmatch(expand_word_as_pattern(pattern).c_str(), subject.c_str(), 0) == 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+} // namespace ash
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "commands.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ash
+{
+
+    enum class OpCode : uint8_t
+    {
+        NOP,
+        RUN_PIPELINE,    // Runs pipelines[operand], $? becomes its status
+        ASSIGN,          // Expands and assigns assignments[operand]
+        EXIT,            // Leaves the shell, with the status argument of pipelines[operand]
+        SET_STATUS,      // $? = operand
+        NEGATE_STATUS,   // ! pipeline
+        JUMP,            // To target
+        JUMP_IF_SUCCESS, // To target when $? == 0
+        JUMP_IF_FAILURE, // To target when $? != 0
+        FOR_BEGIN,       // Expands the word list of for_loops[operand] onto the loop stack
+        FOR_NEXT,        // Assigns the next value, or pops the loop and jumps to target
+        FOR_END,         // Pops the innermost loop (break)
+        CASE_BEGIN,      // Expands words[operand] into the subject, or jumps to target on error
+        CASE_MATCH,      // Jumps to target unless the subject matches case_patterns[operand]
+        REDIRECT_BEGIN,  // Applies redirections[operand] until the REDIRECT_END at target
+        REDIRECT_END,
+        DEFINE_FUNCTION, // Binds functions[operand] in the command table
+        RETURN,          // Leaves the program, with the status argument of pipelines[operand]
+        RUN_SUBSHELL,    // Runs subshells[operand] as a child, $? becomes its status
+    };
+
+    struct Instruction
+    {
+        OpCode op = OpCode::NOP;
+        uint32_t operand = 0;
+        uint32_t target = 0;
+    };
+
+    struct ForLoop
+    {
+        std::string variable;
+        std::vector<Word> words;
+    };
+
+    struct FunctionDefinition
+    {
+        std::string name;
+        std::shared_ptr<const Program> body;
+    };
+
+    // ( list ), compiled on its own like a function body
+    struct Subshell
+    {
+        std::shared_ptr<const Program> body;
+    };
+
+    // NOTE(abi): instructions only carry indices into the tables below, commands are
+    // parsed and word-split once when the program is compiled.
+    struct Program
+    {
+        std::vector<Instruction> instructions;
+        std::vector<std::vector<CommandSpec>> pipelines;
+        std::vector<std::vector<Assignment>> assignments;
+        std::vector<ForLoop> for_loops;
+        std::vector<Word> words;
+        std::vector<std::vector<Word>> case_patterns;
+        std::vector<RedirectionSpec> redirections;
+        std::vector<FunctionDefinition> functions;
+        std::vector<Subshell> subshells;
+    };
+
+    enum class CompileStatus
+    {
+        OK,
+        INCOMPLETE, // Ran out of input inside a construct or a here-document
+        SYNTAX_ERROR,
+    };
+
+    // NOTE(abi): compiled programs by their exact source text, so lines that run again
+    // skip the compiler. A program never changes once compiled, everything that depends
+    // on the shell's state (variables, aliases, globs) is looked up when it runs.
+    struct ProgramCache
+    {
+        struct Entry
+        {
+            std::string source;
+            std::shared_ptr<const Program> program;
+            bool is_unrun; // Compiled to check the line was complete, counted when run
+        };
+
+        std::list<Entry> entries; // Most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> positions;
+        uint64_t hits = 0; // Only runs are counted
+        uint64_t misses = 0;
+    };
+
+    // Compilation
+    auto compile_program(const std::string& source, Program& program, std::string& error)
+        -> CompileStatus;
+    auto get_compiled_program(const std::string& source, std::shared_ptr<const Program>& program,
+                              std::string& error, bool is_run = true) -> CompileStatus;
+    auto clear_program_cache() -> void;
+    auto is_reserved_word(const std::string& word) -> bool;
+
+    // Execution
+    auto run_program(const Program& program, bool can_exec_last = false) -> bool;
+    auto run_pipeline(const std::vector<CommandSpec>& commands) -> void;
+    auto run_subshell(const Program& body) -> void;
+    auto can_run_subshell_inline(const Program& body) -> bool;
+    auto call_function(const Program& body, const std::vector<std::string>& args) -> int;
+    auto matches_case_pattern(const std::string& subject, const std::vector<Word>& patterns)
+        -> bool;
+
+} // namespace ash
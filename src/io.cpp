@@ -0,0 +1,398 @@
+#include "io.hpp"
+#include "commands.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <sys/sendfile.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    constexpr size_t COPY_CHUNK_SIZE = 1 << 20;
+    constexpr size_t COPY_BUFFER_SIZE = 128 * 1024;
+
+    auto copy_file_descriptor(int input_fd, int output_fd) -> bool
+    {
+        struct stat input_stat;
+        struct stat output_stat;
+        if (fstat(input_fd, &input_stat) != 0 || fstat(output_fd, &output_stat) != 0)
+        {
+            return false;
+        }
+
+        // NOTE(abi): every strategy advances the file offsets, so when one bails out
+        // halfway (EXDEV, EINVAL on odd file systems, ...) the next one picks up
+        // where it left off. A reader that went away (EPIPE) ends the copy instead.
+        auto run = [](auto&& copy_chunk) -> ssize_t
+        {
+            ssize_t n;
+            do
+            {
+                n = copy_chunk();
+            } while (n > 0 || (n == -1 && errno == EINTR));
+            return n;
+        };
+
+        // File to file: copy_file_range, which may share extents (reflinks)
+        if (S_ISREG(input_stat.st_mode) && S_ISREG(output_stat.st_mode))
+        {
+            ssize_t n = run(
+                [&]() {
+                    return copy_file_range(input_fd, nullptr, output_fd, nullptr, COPY_CHUNK_SIZE,
+                                           0);
+                });
+            if (n == 0 || errno == EPIPE)
+            {
+                return n == 0;
+            }
+        }
+
+        // Pipe on either side: splice
+        if (S_ISFIFO(input_stat.st_mode) || S_ISFIFO(output_stat.st_mode))
+        {
+            ssize_t n = run(
+                [&]() {
+                    return splice(input_fd, nullptr, output_fd, nullptr, COPY_CHUNK_SIZE,
+                                  SPLICE_F_MOVE | SPLICE_F_MORE);
+                });
+            if (n == 0 || errno == EPIPE)
+            {
+                return n == 0;
+            }
+        }
+
+        // File to anything else: sendfile
+        if (S_ISREG(input_stat.st_mode) || S_ISBLK(input_stat.st_mode))
+        {
+            ssize_t n =
+                run([&]() { return sendfile(output_fd, input_fd, nullptr, COPY_CHUNK_SIZE); });
+            if (n == 0 || errno == EPIPE)
+            {
+                return n == 0;
+            }
+        }
+
+        return copy_buffered(input_fd, {output_fd});
+    }
+
+    auto tee_file_descriptor(int input_fd, const std::vector<int>& output_fds) -> bool
+    {
+        if (output_fds.size() == 1)
+        {
+            return copy_file_descriptor(input_fd, output_fds[0]);
+        }
+
+        struct stat input_stat;
+        if (fstat(input_fd, &input_stat) != 0 || !S_ISFIFO(input_stat.st_mode)
+            || output_fds.empty())
+        {
+            return copy_buffered(input_fd, output_fds);
+        }
+
+        // NOTE(abi): tee(2) only writes into pipes, so every output but the last gets
+        // a scratch pipe as large as the input pipe. Being empty at the start of each
+        // round, a scratch pipe always takes the whole chunk.
+        int input_capacity = fcntl(input_fd, F_GETPIPE_SZ);
+        std::vector<std::array<int, 2>> scratch_pipes(output_fds.size() - 1);
+        size_t created = 0;
+        for (; created < scratch_pipes.size(); created++)
+        {
+            if (pipe2(scratch_pipes[created].data(), O_CLOEXEC) == -1)
+            {
+                break;
+            }
+            fcntl(scratch_pipes[created][1], F_SETPIPE_SZ, input_capacity);
+        }
+
+        bool success = created == scratch_pipes.size();
+        while (success)
+        {
+            ssize_t chunk_size = tee(input_fd, scratch_pipes[0][1], COPY_CHUNK_SIZE, 0);
+            if (chunk_size == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (chunk_size <= 0)
+            {
+                success = (chunk_size == 0);
+                break;
+            }
+
+            for (size_t i = 1; i < scratch_pipes.size() && success; i++)
+            {
+                success = tee(input_fd, scratch_pipes[i][1], chunk_size, 0) == chunk_size;
+            }
+
+            success = success && splice_exact(input_fd, output_fds.back(), chunk_size);
+            for (size_t i = 0; i < scratch_pipes.size() && success; i++)
+            {
+                success = splice_exact(scratch_pipes[i][0], output_fds[i], chunk_size);
+            }
+        }
+
+        for (size_t i = 0; i < created; i++)
+        {
+            close(scratch_pipes[i][0]);
+            close(scratch_pipes[i][1]);
+        }
+
+        return success;
+    }
+
+    auto copy_buffered(int input_fd, const std::vector<int>& output_fds) -> bool
+    {
+        std::vector<char> buffer(COPY_BUFFER_SIZE);
+        while (true)
+        {
+            ssize_t n = read(input_fd, buffer.data(), buffer.size());
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return n == 0;
+            }
+
+            for (int output_fd : output_fds)
+            {
+                if (!write_all(output_fd, buffer.data(), n))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    auto splice_exact(int input_fd, int output_fd, size_t size) -> bool
+    {
+        while (size > 0)
+        {
+            ssize_t n = splice(input_fd, nullptr, output_fd, nullptr, size, SPLICE_F_MOVE);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            // Outputs that can't take spliced data (some ttys) get a plain copy
+            if (n == -1 && errno == EINVAL)
+            {
+                std::vector<char> buffer(size);
+                return read_exact(input_fd, buffer.data(), size)
+                       && write_all(output_fd, buffer.data(), size);
+            }
+
+            if (n <= 0)
+            {
+                return false;
+            }
+            size -= n;
+        }
+
+        return true;
+    }
+
+    auto fan_out_pipe(int input_fd, std::vector<int> output_fds) -> bool
+    {
+        // NOTE(abi): a consumer that exits early must not take the shell down with
+        // it, we just stop feeding it.
+        struct sigaction ignore_action = {};
+        struct sigaction previous_action = {};
+        ignore_action.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore_action, &previous_action);
+
+        std::vector<char> buffer;
+        bool success = true;
+
+        while (!output_fds.empty())
+        {
+            // Single consumer left, just move the data across
+            if (output_fds.size() == 1)
+            {
+                ssize_t n = splice(input_fd, nullptr, output_fds[0], nullptr, COPY_CHUNK_SIZE,
+                                   SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (n <= 0)
+                {
+                    success = (n == 0 || errno == EPIPE);
+                    break;
+                }
+                continue;
+            }
+
+            // NOTE(abi): tee(2) duplicates the head of the input pipe into every output
+            // but the last one without consuming it, then splice(2) moves it into the
+            // last one. The data never leaves the kernel.
+            ssize_t chunk_size = tee(input_fd, output_fds[0], COPY_CHUNK_SIZE, 0);
+            if (chunk_size == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (chunk_size == -1 && errno == EPIPE)
+            {
+                output_fds.erase(output_fds.begin());
+                continue;
+            }
+
+            if (chunk_size <= 0)
+            {
+                success = (chunk_size == 0);
+                break;
+            }
+
+            size_t last = output_fds.size() - 1;
+            std::vector<ssize_t> delivered(output_fds.size(), chunk_size);
+            delivered[last] = 0;
+
+            bool is_partial = false;
+            for (size_t i = 1; i < last; i++)
+            {
+                do
+                {
+                    delivered[i] = tee(input_fd, output_fds[i], chunk_size, 0);
+                } while (delivered[i] == -1 && errno == EINTR);
+
+                is_partial = is_partial || (delivered[i] >= 0 && delivered[i] < chunk_size);
+            }
+
+            if (!is_partial)
+            {
+                ssize_t remaining = chunk_size;
+                while (remaining > 0)
+                {
+                    ssize_t n = splice(input_fd, nullptr, output_fds[last], nullptr, remaining,
+                                       SPLICE_F_MOVE | SPLICE_F_MORE);
+                    if (n == -1 && errno == EINTR)
+                    {
+                        continue;
+                    }
+
+                    if (n <= 0)
+                    {
+                        delivered[last] = -1;
+                        discard_pipe_data(input_fd, remaining);
+                        break;
+                    }
+                    remaining -= n;
+                }
+            }
+            else
+            {
+                // A full consumer took only part of the chunk. tee(2) can't resume
+                // mid-chunk, so this one chunk goes through user space.
+                buffer.resize(chunk_size);
+                if (!read_exact(input_fd, buffer.data(), chunk_size))
+                {
+                    success = false;
+                    break;
+                }
+
+                for (size_t i = 1; i <= last; i++)
+                {
+                    if (delivered[i] >= 0 && delivered[i] < chunk_size
+                        && !write_all(output_fds[i], buffer.data() + delivered[i],
+                                      chunk_size - delivered[i]))
+                    {
+                        delivered[i] = -1;
+                    }
+                }
+            }
+
+            // Stop feeding consumers that went away
+            for (size_t i = output_fds.size(); i-- > 1;)
+            {
+                if (delivered[i] == -1)
+                {
+                    output_fds.erase(output_fds.begin() + i);
+                }
+            }
+        }
+
+        sigaction(SIGPIPE, &previous_action, nullptr);
+        return success;
+    }
+
+    auto read_exact(int fd, char* data, size_t size) -> bool
+    {
+        while (size > 0)
+        {
+            ssize_t n = read(fd, data, size);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return false;
+            }
+
+            data += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    auto read_all(int fd, std::string& data) -> bool
+    {
+        // Pipes and terminals don't know their size, so read until end of file
+        std::vector<char> buffer(COPY_BUFFER_SIZE);
+        while (true)
+        {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return n == 0;
+            }
+            data.append(buffer.data(), n);
+        }
+    }
+
+    auto discard_pipe_data(int input_fd, size_t size) -> bool
+    {
+        char buffer[4096];
+        while (size > 0)
+        {
+            ssize_t n = read(input_fd, buffer, std::min(size, sizeof(buffer)));
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return false;
+            }
+            size -= n;
+        }
+
+        return true;
+    }
+
+} // namespace ash
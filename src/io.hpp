@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // Zero-copy copies
+    auto copy_file_descriptor(int input_fd, int output_fd) -> bool;
+    auto tee_file_descriptor(int input_fd, const std::vector<int>& output_fds) -> bool;
+    auto copy_buffered(int input_fd, const std::vector<int>& output_fds) -> bool;
+
+    // Zero-copy relays
+    auto fan_out_pipe(int input_fd, std::vector<int> output_fds) -> bool;
+    auto discard_pipe_data(int input_fd, size_t size) -> bool;
+    auto splice_exact(int input_fd, int output_fd, size_t size) -> bool;
+    auto read_exact(int fd, char* data, size_t size) -> bool;
+    auto read_all(int fd, std::string& data) -> bool;
+
+} // namespace ash
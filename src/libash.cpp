@@ -0,0 +1,162 @@
+#include "libash.hpp"
+#include "commands.hpp"
+#include "constants.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+#include "variables.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    ShellContext::~ShellContext() = default;
+
+    auto create_shell_context(const std::string& name, const std::vector<std::string>& arguments)
+        -> std::unique_ptr<ShellContext>
+    {
+        auto context = std::make_unique<ShellContext>();
+        context->state = std::make_unique<ShellState>();
+        context->state->shell_name = name;
+        context->state->positional_parameters = arguments;
+        context->state->has_own_environment = true;
+        context->state->environment = copy_process_environment();
+        return context;
+    }
+
+    auto run_shell_string(ShellContext& context, const std::string& script, ShellOutput& output)
+        -> int
+    {
+        std::lock_guard<std::mutex> lock(get_execution_mutex());
+        output = ShellOutput();
+
+        // Output goes to in-memory files, which unlike pipes never need draining
+        int out_fd = memfd_create("ash-stdout", MFD_CLOEXEC);
+        int err_fd = memfd_create("ash-stderr", MFD_CLOEXEC);
+        int directory_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (out_fd == -1 || err_fd == -1 || directory_fd == -1)
+        {
+            for (int fd : {out_fd, err_fd, directory_fd})
+            {
+                if (fd != -1)
+                {
+                    close(fd);
+                }
+            }
+            output.err = "ash: failed to capture output\n";
+            output.exit_status = 1;
+            return output.exit_status;
+        }
+
+        // Anything the host buffered belongs in its own streams
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+
+        std::vector<SavedFd> saved_fds;
+        std::vector<FdAction> actions = {
+            {FdActionType::OPEN, static_cast<int>(StandardStream::IN), -1, O_RDONLY, "/dev/null"},
+            {FdActionType::DUPLICATE, static_cast<int>(StandardStream::OUT), out_fd},
+            {FdActionType::DUPLICATE, static_cast<int>(StandardStream::ERR), err_fd},
+        };
+
+        ShellState* previous_state = shell_state;
+        shell_state = context.state.get();
+        shell_state->is_exiting = false;
+        shell_state->working_directory = context.working_directory; // Or found again
+
+        bool is_ready = apply_fd_actions(actions, &saved_fds)
+                        && (context.working_directory.empty()
+                            || chdir(context.working_directory.c_str()) == 0);
+        if (is_ready)
+        {
+            execute_line(script);
+        }
+        else
+        {
+            std::cerr << "ash: failed to enter the context" << std::endl;
+            shell_state->last_exit_status = 1;
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        restore_fds(saved_fds);
+
+        // The context keeps its directory, the host gets its own back
+        context.working_directory = get_working_directory();
+        fchdir(directory_fd);
+        close(directory_fd);
+
+        output.exit_status = shell_state->last_exit_status;
+        shell_state = previous_state;
+
+        read_captured_output(out_fd, output.out);
+        read_captured_output(err_fd, output.err);
+        close(out_fd);
+        close(err_fd);
+
+        return output.exit_status;
+    }
+
+    auto set_shell_variable(ShellContext& context, const std::string& name,
+                            const std::string& value) -> void
+    {
+        // NOTE(abi): exported into the context's environment, so the commands it runs
+        // see it too. The host's environment is left alone.
+        std::lock_guard<std::mutex> lock(get_execution_mutex());
+        ShellState* previous_state = shell_state;
+        shell_state = context.state.get();
+
+        export_variable(name, value);
+
+        shell_state = previous_state;
+    }
+
+    auto get_shell_variable(ShellContext& context, const std::string& name)
+        -> std::optional<std::string>
+    {
+        std::lock_guard<std::mutex> lock(get_execution_mutex());
+        ShellState* previous_state = shell_state;
+        shell_state = context.state.get();
+
+        std::optional<std::string> value = get_variable(name);
+
+        shell_state = previous_state;
+        return value;
+    }
+
+    auto get_execution_mutex() -> std::mutex&
+    {
+        static std::mutex execution_mutex;
+        return execution_mutex;
+    }
+
+    auto read_captured_output(int fd, std::string& output) -> void
+    {
+        off_t size = lseek(fd, 0, SEEK_END);
+        if (size <= 0)
+        {
+            return;
+        }
+
+        output.resize(static_cast<size_t>(size));
+        if (pread(fd, output.data(), output.size(), 0) != size)
+        {
+            output.clear();
+        }
+    }
+
+} // namespace ash
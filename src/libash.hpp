@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    struct ShellState;
+
+    // What a string run through a context printed, and how it ended
+    struct ShellOutput
+    {
+        std::string out;
+        std::string err;
+        int exit_status = 0;
+    };
+
+    // NOTE(abi): an independent shell for embedders, with its own variables, environment,
+    // functions, aliases and working directory. Contexts can be used from any thread, but runs
+    // are serialized: the standard streams they capture and the directory they run in
+    // belong to the process.
+    struct ShellContext
+    {
+        std::unique_ptr<ShellState> state;
+        std::string working_directory; // Empty until a run leaves it somewhere
+
+        ~ShellContext();
+    };
+
+    // Contexts
+    auto create_shell_context(const std::string& name = "ash",
+                              const std::vector<std::string>& arguments = {})
+        -> std::unique_ptr<ShellContext>;
+    auto run_shell_string(ShellContext& context, const std::string& script,
+                          ShellOutput& output) -> int;
+    auto set_shell_variable(ShellContext& context, const std::string& name,
+                            const std::string& value) -> void;
+    auto get_shell_variable(ShellContext& context, const std::string& name)
+        -> std::optional<std::string>;
+
+    // Execution
+    auto get_execution_mutex() -> std::mutex&;
+    auto read_captured_output(int fd, std::string& output) -> void;
+
+} // namespace ash
@@ -1,10 +1,77 @@
+#include "server.hpp"
 #include "shell.hpp"
+#include "state.hpp"
 
-auto main() -> int
+#include <cstring>
+#include <iostream>
+
+auto main(int argc, char* argv[]) -> int
 {
+    ash::ShellState state;
+    ash::shell_state = &state;
+
+    // Long options come before the mode arguments
+    const char* server_socket_path = nullptr;
+    int first_argument = 1;
+    for (; first_argument < argc && std::strncmp(argv[first_argument], "--", 2) == 0;
+         first_argument++)
+    {
+        if (std::strcmp(argv[first_argument], "--startup-profile") == 0)
+        {
+            ash::shell_state->options.startup_profile = true;
+        }
+        else if (std::strcmp(argv[first_argument], "--server") == 0 && first_argument + 1 < argc)
+        {
+            server_socket_path = argv[++first_argument];
+        }
+        else
+        {
+            std::cerr << "ash: " << argv[first_argument] << ": invalid option" << std::endl;
+            return 2;
+        }
+    }
+    argc -= first_argument - 1;
+    argv += first_argument - 1;
+
+    // ash --server /path/sock serves ash-client invocations until SIGTERM
+    if (server_socket_path != nullptr)
+    {
+        return ash::run_server(server_socket_path);
+    }
+
     ash::initialize_shell();
-    ash::repl_loop();
+
+    // ash -c 'commands', ash script, or the REPL
+    // NOTE(abi): like sh -c, the operands after the command become $0 and $1...
+    if (argc > 2 && std::strcmp(argv[1], "-c") == 0)
+    {
+        if (argc > 3)
+        {
+            ash::shell_state->shell_name = argv[3];
+            ash::shell_state->positional_parameters.assign(argv + 4, argv + argc);
+        }
+        ash::print_startup_profile();
+        ash::execute_line(argv[2]);
+    }
+    else if (argc > 1)
+    {
+        ash::shell_state->shell_name = argv[1];
+        ash::shell_state->positional_parameters.assign(argv + 2, argv + argc);
+        ash::print_startup_profile();
+        ash::execute_script_file(argv[1]);
+    }
+    else
+    {
+        // Only interactive shells read the rc file
+        bool keep_running = ash::load_rc_file();
+        ash::print_startup_profile();
+        if (keep_running)
+        {
+            ash::repl_loop();
+        }
+    }
+
     ash::cleanup_shell();
 
-    return 0;
+    return ash::shell_state->last_exit_status;
 }
@@ -0,0 +1,491 @@
+#include "memo.hpp"
+#include "constants.hpp"
+#include "io.hpp"
+#include "libash.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+#include "variables.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto memo_command(const BuiltinArguments& args) -> int
+    {
+        MemoOptions options;
+        if (!parse_memo_options(args, options))
+        {
+            std::cerr << "memo: usage: memo [--inputs files...] [--env names...] [--mtime] "
+                         "[--stdin] -- command [args...]"
+                      << std::endl;
+            return 2;
+        }
+
+        // NOTE(abi): a command reading a pipe or a file can print anything, so its stdin
+        // has to be part of the key. It is with --stdin; otherwise only commands whose
+        // stdin has nothing to read are cached, and the rest just run.
+        std::string input;
+        if (options.use_stdin)
+        {
+            read_all(STDIN_FILENO, input);
+        }
+
+        std::string directory;
+        if (options.use_stdin || has_inert_stdin())
+        {
+            directory = get_memo_directory();
+        }
+        std::string entry_path =
+            directory.empty() ? "" : directory + "/" + get_memo_key(options, input);
+
+        MemoEntry entry;
+        if (!entry_path.empty() && load_memo_entry(entry_path, entry))
+        {
+            std::cout.flush();
+            write_all(STDOUT_FILENO, entry.out.data(), entry.out.size());
+            write_all(STDERR_FILENO, entry.err.data(), entry.err.size());
+            return entry.exit_status;
+        }
+
+        // NOTE(abi): runs that were interrupted or never started say nothing about the
+        // command, only clean exits are worth replaying.
+        bool is_recorded = run_memo_command(options, input, entry);
+        if (is_recorded && !entry_path.empty() && entry.exit_status < 128)
+        {
+            save_memo_entry(entry_path, entry);
+        }
+
+        return entry.exit_status;
+    }
+
+    auto parse_memo_options(const BuiltinArguments& args, MemoOptions& options) -> bool
+    {
+        std::vector<std::string>* list = nullptr;
+        size_t i = 0;
+        for (; i < args.size(); i++)
+        {
+            const std::string& arg = args[i];
+            if (arg == "--")
+            {
+                i++;
+                break;
+            }
+            else if (arg == "--inputs")
+            {
+                list = &options.inputs;
+            }
+            else if (arg == "--env")
+            {
+                list = &options.environment;
+            }
+            else if (arg == "--mtime")
+            {
+                options.use_mtimes = true;
+                list = nullptr;
+            }
+            else if (arg == "--stdin")
+            {
+                options.use_stdin = true;
+                list = nullptr;
+            }
+            else if (list != nullptr && arg.rfind("--", 0) != 0)
+            {
+                list->push_back(arg);
+            }
+            else if (i == 0 && arg.rfind("--", 0) != 0)
+            {
+                // No options at all, the command starts right away
+                break;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        options.command.assign(args.begin() + i, args.end());
+        return !options.command.empty();
+    }
+
+    auto MemoHash::update(const char* data, size_t size) -> void
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            uint64_t byte = static_cast<unsigned char>(data[i]);
+            low = (low ^ byte) * 0x100000001b3;
+            high = (high ^ byte) * 0x9e3779b97f4a7c15;
+        }
+    }
+
+    auto MemoHash::update_field(const std::string& field) -> void
+    {
+        // Length-prefixed, so ("ab", "c") and ("a", "bc") don't collide
+        uint64_t size = field.size();
+        update(reinterpret_cast<const char*>(&size), sizeof(size));
+        update(field.data(), field.size());
+    }
+
+    auto MemoHash::to_hex() const -> std::string
+    {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        std::string hex;
+        for (uint64_t lane : {high, low})
+        {
+            for (int shift = 60; shift >= 0; shift -= 4)
+            {
+                hex += DIGITS[(lane >> shift) & 0xf];
+            }
+        }
+        return hex;
+    }
+
+    auto get_memo_key(const MemoOptions& options, const std::string& input) -> std::string
+    {
+        MemoHash hash;
+        hash.update_field(config::MEMO_FORMAT_MAGIC);
+
+        hash.update_field(std::to_string(options.command.size()));
+        for (const std::string& arg : options.command)
+        {
+            hash.update_field(arg);
+        }
+
+        // Relative paths in the command mean something else in another directory
+        hash.update_field(get_working_directory());
+
+        std::vector<std::string> names(std::begin(config::MEMO_ENVIRONMENT),
+                                       std::end(config::MEMO_ENVIRONMENT));
+        names.insert(names.end(), options.environment.begin(), options.environment.end());
+        for (const std::string& name : names)
+        {
+            std::optional<std::string> value = get_variable(name);
+            hash.update_field(name);
+            hash.update_field(value.has_value() ? "=" + *value : "");
+        }
+
+        hash.update_field(options.use_mtimes ? "mtime" : "content");
+        for (const std::string& input : options.inputs)
+        {
+            hash.update_field(input);
+            hash_memo_input(hash, input, options.use_mtimes);
+        }
+
+        if (options.use_stdin)
+        {
+            hash.update_field("stdin");
+            hash.update_field(input);
+        }
+
+        return hash.to_hex();
+    }
+
+    auto has_inert_stdin() -> bool
+    {
+        // A terminal, /dev/null or nothing at all
+        struct stat input_stat;
+        struct stat null_stat;
+        if (isatty(STDIN_FILENO) || fstat(STDIN_FILENO, &input_stat) == -1)
+        {
+            return true;
+        }
+
+        return S_ISCHR(input_stat.st_mode) && stat("/dev/null", &null_stat) == 0
+               && input_stat.st_rdev == null_stat.st_rdev;
+    }
+
+    auto hash_memo_input(MemoHash& hash, const std::string& path, bool use_mtimes) -> void
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1)
+        {
+            hash.update_field("missing");
+            return;
+        }
+
+        // Directories change their mtime whenever an entry comes or goes
+        int fd = -1;
+        if (!use_mtimes && S_ISREG(st.st_mode))
+        {
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+
+        if (fd == -1)
+        {
+            hash.update_field(std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec)
+                              + "." + std::to_string(st.st_mtim.tv_nsec));
+            return;
+        }
+
+        std::string buffer(config::MEMO_READ_BUFFER_SIZE, '\0');
+        ssize_t bytes_read;
+        while ((bytes_read = read(fd, buffer.data(), buffer.size())) != 0)
+        {
+            if (bytes_read == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                hash.update_field("unreadable");
+                break;
+            }
+            hash.update(buffer.data(), static_cast<size_t>(bytes_read));
+        }
+        close(fd);
+    }
+
+    auto get_memo_directory() -> std::string
+    {
+        std::string directory;
+        const char* cache_home = std::getenv("XDG_CACHE_HOME");
+        const char* home = std::getenv("HOME");
+        if (cache_home != nullptr && cache_home[0] == '/')
+        {
+            directory = cache_home;
+        }
+        else if (home != nullptr && home[0] != '\0')
+        {
+            directory = std::string(home) + "/.cache";
+        }
+        else
+        {
+            return "";
+        }
+
+        // Created one level at a time, like mkdir -p
+        directory += "/ash/memo";
+        for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1))
+        {
+            std::string prefix = directory.substr(0, slash);
+            if (mkdir(prefix.c_str(), 0700) == -1 && errno != EEXIST)
+            {
+                return "";
+            }
+            if (slash == std::string::npos)
+            {
+                break;
+            }
+        }
+
+        return directory;
+    }
+
+    auto load_memo_entry(const std::string& path, MemoEntry& entry) -> bool
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        std::string data;
+        read_captured_output(fd, data);
+        close(fd);
+
+        // Magic, exit status, stdout size and stderr size, then both streams
+        size_t magic_size = std::strlen(config::MEMO_FORMAT_MAGIC);
+        size_t header_size = magic_size + 3 * sizeof(int64_t);
+        if (data.size() < header_size
+            || data.compare(0, magic_size, config::MEMO_FORMAT_MAGIC) != 0)
+        {
+            return false;
+        }
+
+        int64_t header[3];
+        std::memcpy(header, data.data() + magic_size, sizeof(header));
+        uint64_t out_size = static_cast<uint64_t>(header[1]);
+        uint64_t err_size = static_cast<uint64_t>(header[2]);
+        if (out_size > data.size() - header_size
+            || err_size != data.size() - header_size - out_size)
+        {
+            return false;
+        }
+
+        entry.exit_status = static_cast<int>(header[0]);
+        entry.out = data.substr(header_size, out_size);
+        entry.err = data.substr(header_size + out_size);
+        return true;
+    }
+
+    auto save_memo_entry(const std::string& path, const MemoEntry& entry) -> bool
+    {
+        std::string data = config::MEMO_FORMAT_MAGIC;
+        int64_t header[3] = {entry.exit_status, static_cast<int64_t>(entry.out.size()),
+                             static_cast<int64_t>(entry.err.size())};
+        data.append(reinterpret_cast<const char*>(header), sizeof(header));
+        data += entry.out;
+        data += entry.err;
+
+        // Written aside and renamed into place, so a concurrent memo never replays a
+        // half-written entry
+        std::string temporary_path = path + "." + std::to_string(getpid());
+        int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      permissions::DEFAULT_FILE_MODE);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        bool is_written = write_all(fd, data.data(), data.size());
+        is_written = (close(fd) == 0) && is_written;
+        if (!is_written || rename(temporary_path.c_str(), path.c_str()) == -1)
+        {
+            unlink(temporary_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    auto run_memo_command(const MemoOptions& options, const std::string& input, MemoEntry& entry)
+        -> bool
+    {
+        CommandSpec cmd = make_literal_command(options.command);
+
+        int out_pipe[2];
+        int err_pipe[2];
+        if (pipe2(out_pipe, O_CLOEXEC) == -1)
+        {
+            std::cerr << "memo: " << std::strerror(errno) << std::endl;
+            entry.exit_status = 1;
+            return false;
+        }
+        if (pipe2(err_pipe, O_CLOEXEC) == -1)
+        {
+            std::cerr << "memo: " << std::strerror(errno) << std::endl;
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+            entry.exit_status = 1;
+            return false;
+        }
+
+        // The relay tees into copies of the real streams, the originals are swapped for
+        // the pipes while the command runs
+        std::cout.flush();
+        std::cerr.flush();
+        int out_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, config::SAVED_FD_BASE);
+        int err_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, config::SAVED_FD_BASE);
+
+        std::vector<SavedFd> saved_fds;
+        std::vector<FdAction> actions = {
+            {FdActionType::DUPLICATE, static_cast<int>(StandardStream::OUT), out_pipe[1]},
+            {FdActionType::DUPLICATE, static_cast<int>(StandardStream::ERR), err_pipe[1]},
+        };
+        if (options.use_stdin)
+        {
+            actions.push_back({FdActionType::DOCUMENT, static_cast<int>(StandardStream::IN), -1, 0,
+                               input});
+        }
+
+        std::thread relay;
+        bool is_relaying = false;
+        if (out_fd != -1 && err_fd != -1 && apply_fd_actions(actions, &saved_fds))
+        {
+            try
+            {
+                relay = std::thread(relay_memo_output, out_pipe[0], err_pipe[0], out_fd, err_fd,
+                                    std::ref(entry));
+                is_relaying = true;
+            }
+            catch (const std::system_error&)
+            {
+                restore_fds(saved_fds);
+            }
+        }
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+
+        // Without a relay the command still runs, it just isn't recorded
+        bool is_found;
+        if (is_relaying)
+        {
+            is_found = execute_command(cmd);
+            std::cout.flush();
+            std::cerr.flush();
+            restore_fds(saved_fds);
+            relay.join();
+        }
+        else
+        {
+            is_found = execute_command(cmd);
+        }
+
+        for (int fd : {out_pipe[0], err_pipe[0], out_fd, err_fd})
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+        }
+
+        if (!is_found)
+        {
+            handle_invalid_command(cmd.command);
+            entry.exit_status = 127;
+            return false;
+        }
+
+        entry.exit_status = shell_state->last_exit_status;
+        return is_relaying;
+    }
+
+    auto relay_memo_output(int out_read_fd, int err_read_fd, int out_fd, int err_fd,
+                           MemoEntry& entry) -> void
+    {
+        struct pollfd poll_fds[2] = {{out_read_fd, POLLIN, 0}, {err_read_fd, POLLIN, 0}};
+        std::string* streams[2] = {&entry.out, &entry.err};
+        int targets[2] = {out_fd, err_fd};
+        char buffer[config::MEMO_READ_BUFFER_SIZE];
+
+        // Until the command and everything it started have closed both pipes
+        while (poll_fds[0].fd != -1 || poll_fds[1].fd != -1)
+        {
+            if (poll(poll_fds, 2, -1) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            for (int i = 0; i < 2; i++)
+            {
+                if (poll_fds[i].fd == -1 || poll_fds[i].revents == 0)
+                {
+                    continue;
+                }
+
+                ssize_t bytes_read = read(poll_fds[i].fd, buffer, sizeof(buffer));
+                if (bytes_read > 0)
+                {
+                    streams[i]->append(buffer, static_cast<size_t>(bytes_read));
+                    write_all(targets[i], buffer, static_cast<size_t>(bytes_read));
+                }
+                else if (bytes_read == 0 || errno != EINTR)
+                {
+                    poll_fds[i].fd = -1;
+                }
+            }
+        }
+    }
+
+} // namespace ash
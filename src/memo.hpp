@@ -0,0 +1,60 @@
+#pragma once
+
+#include "commands.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // NOTE(abi): what `memo` keys its cache on, besides the command line itself. Inputs
+    // are hashed by content, or by size and mtime with --mtime for large trees.
+    struct MemoOptions
+    {
+        std::vector<std::string> inputs;
+        std::vector<std::string> environment; // Names on top of config::MEMO_ENVIRONMENT
+        bool use_mtimes = false;
+        bool use_stdin = false; // Read up front, hashed, and fed to the command
+        std::vector<std::string> command; // Name first
+    };
+
+    // A recorded run, replayed on a hit
+    struct MemoEntry
+    {
+        int exit_status = 0;
+        std::string out;
+        std::string err;
+    };
+
+    // Two independent 64-bit FNV-1a lanes, 128 bits are plenty for a cache key
+    struct MemoHash
+    {
+        uint64_t low = 0xcbf29ce484222325;
+        uint64_t high = 0x84222325cbf29ce4;
+
+        auto update(const char* data, size_t size) -> void;
+        auto update_field(const std::string& field) -> void;
+        auto to_hex() const -> std::string;
+    };
+
+    // Builtin
+    auto memo_command(const BuiltinArguments& args) -> int;
+    auto parse_memo_options(const BuiltinArguments& args, MemoOptions& options) -> bool;
+
+    // Cache
+    auto get_memo_key(const MemoOptions& options, const std::string& input) -> std::string;
+    auto has_inert_stdin() -> bool;
+    auto hash_memo_input(MemoHash& hash, const std::string& path, bool use_mtimes) -> void;
+    auto get_memo_directory() -> std::string;
+    auto load_memo_entry(const std::string& path, MemoEntry& entry) -> bool;
+    auto save_memo_entry(const std::string& path, const MemoEntry& entry) -> bool;
+
+    // Execution
+    auto run_memo_command(const MemoOptions& options, const std::string& input, MemoEntry& entry)
+        -> bool;
+    auto relay_memo_output(int out_read_fd, int err_read_fd, int out_fd, int err_fd,
+                           MemoEntry& entry) -> void;
+
+} // namespace ash
@@ -1,4 +1,14 @@
 #include "parser.hpp"
+#include "arithmetic.hpp"
+#include "braces.hpp"
+#include "constants.hpp"
+#include "scanner.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string_view>
 
 namespace ash
 {
@@ -10,12 +20,14 @@ namespace ash
             return {"", 0};
         }
 
+        // The first unquoted blank ends the name, which then only loses its quotes
+        DelimiterScanner scanner{input, " \t"};
+        size_t end = std::min(scanner.next(0), input.size());
+
         std::string command;
         bool in_single_quotes = false;
         bool in_double_quotes = false;
-
-        size_t i = 0;
-        for (; i < input.size(); i++)
+        for (size_t i = 0; i < end; i++)
         {
             char c = input[i];
 
@@ -27,309 +39,734 @@ namespace ash
             {
                 in_double_quotes = !in_double_quotes;
             }
-            else if (!in_single_quotes && !in_double_quotes && (c == ' ' || c == '\t'))
-            {
-                break;
-            }
             else
             {
                 command += c;
             }
         }
 
-        return {command, i};
+        return {command, end};
     }
 
     auto parse_arguments(const std::string& args) -> std::vector<std::string>
     {
-        std::vector<std::string> parsed_args;
-        std::string current_arg;
+        return expand_words(lex_words(args)).value_or(std::vector<std::string>());
+    }
+
+    auto lex_words(const std::string& args) -> std::vector<Word>
+    {
+        std::vector<Word> words;
+        Word current_word;
+        bool has_current_word = false;
         bool in_single_quotes = false;
         bool in_double_quotes = false;
 
+        auto append_literal = [&current_word](std::string_view text, bool is_quoted)
+        {
+            std::vector<WordPart>& parts = current_word.parts;
+            if (parts.empty() || parts.back().type != WordPartType::LITERAL
+                || parts.back().is_quoted != is_quoted)
+            {
+                parts.push_back({WordPartType::LITERAL, "", is_quoted});
+            }
+            parts.back().text += text;
+        };
+
+        // Quoting changes meaning as we go, so the scanner reports every special
+        // character and the runs of plain text between them are appended whole
+        std::string_view view(args);
+        DelimiterScanner scanner{args, "'\"\\$ \t", false};
         for (size_t i = 0; i < args.length(); i++)
         {
+            size_t stop = std::min(scanner.next(i), args.length());
+            if (stop > i)
+            {
+                append_literal(view.substr(i, stop - i), in_single_quotes || in_double_quotes);
+                has_current_word = true;
+                i = stop;
+                if (i == args.length())
+                {
+                    break;
+                }
+            }
+
             char c = args[i];
 
             // Double quotes
             if (c == '\"' && !in_single_quotes)
             {
                 in_double_quotes = !in_double_quotes;
+                current_word.is_quoted = true;
+                has_current_word = true;
             }
 
             // Single quotes
             else if (c == '\'' && !in_double_quotes)
             {
                 in_single_quotes = !in_single_quotes;
+                current_word.is_quoted = true;
+                has_current_word = true;
             }
 
             // Whitespace
-            else if (c == ' ' && !in_double_quotes && !in_single_quotes)
+            else if ((c == ' ' || c == '\t') && !in_double_quotes && !in_single_quotes)
             {
-                if (!current_arg.empty())
+                if (has_current_word)
                 {
-                    parsed_args.push_back(current_arg);
-                    current_arg.clear();
+                    current_word.brace_pattern = parse_brace_pattern(current_word);
+                    words.push_back(std::move(current_word));
+                    current_word = Word();
+                    has_current_word = false;
                 }
             }
 
             // Escaped characters
             else if (c == '\\' && !in_single_quotes && i + 1 < args.length())
             {
-                if (!in_double_quotes || args[i + 1] == '\"' || args[i + 1] == '\\')
+                if (!in_double_quotes || args[i + 1] == '\"' || args[i + 1] == '\\'
+                    || args[i + 1] == '$')
                 {
-                    current_arg += args[++i];
+                    append_literal(view.substr(++i, 1), true);
                 }
                 else
                 {
-                    current_arg += '\\';
+                    append_literal("\\", true);
                 }
+                has_current_word = true;
+            }
+
+            // Arithmetic expansion
+            else if (c == '$' && !in_single_quotes
+                     && get_arithmetic_expansion_length(args, i) > 0)
+            {
+                size_t length = get_arithmetic_expansion_length(args, i);
+                current_word.parts.push_back(
+                    {WordPartType::ARITHMETIC, args.substr(i + 3, length - 5), in_double_quotes});
+                i += length - 1;
+                has_current_word = true;
+            }
+
+            // Parameter expansion
+            else if (c == '$' && !in_single_quotes)
+            {
+                std::string name;
+                size_t reference_length = parse_variable_reference(args, i, name);
+                if (reference_length == 0)
+                {
+                    append_literal(view.substr(i, 1), in_double_quotes);
+                }
+                else
+                {
+                    current_word.parts.push_back({WordPartType::VARIABLE, name, in_double_quotes});
+                    i += reference_length - 1;
+                }
+                has_current_word = true;
             }
 
             else
             {
-                current_arg += c;
+                append_literal(view.substr(i, 1), in_single_quotes || in_double_quotes);
+                has_current_word = true;
             }
         }
 
-        if (!current_arg.empty())
+        if (has_current_word)
         {
-            parsed_args.push_back(current_arg);
+            current_word.brace_pattern = parse_brace_pattern(current_word);
+            words.push_back(std::move(current_word));
         }
 
-        return parsed_args;
+        return words;
     }
 
-    auto parse_and_strip_redirection(std::string& args) -> RedirectionSpec
+    auto expand_word_part(const WordPart& part, std::string& expanded) -> bool
     {
-        RedirectionSpec redirection_spec;
-
-        size_t stderr_pos = std::string::npos;
-        size_t stderr_len = 0;
-        size_t stdout_pos = std::string::npos;
-        size_t stdout_len = 0;
-
-        // Stderr append (2>>)
-        stderr_len = 3;
-        stderr_pos = args.find("2>>");
-        if (stderr_pos != std::string::npos)
+        switch (part.type)
         {
-            size_t filename_start = stderr_pos + stderr_len;
-            while (filename_start < args.length()
-                   && (args[filename_start] == ' ' || args[filename_start] == '\t'))
+        case WordPartType::LITERAL:
+            expanded += part.text;
+            break;
+        case WordPartType::VARIABLE:
+            if (std::optional<std::string> value = get_variable(part.text))
             {
-                filename_start++;
+                expanded += *value;
             }
-
-            if (filename_start < args.length())
+            break;
+        case WordPartType::ARITHMETIC:
+        {
+            int64_t value = 0;
+            std::string error;
+            if (!evaluate_arithmetic(part.text, value, error))
             {
-                size_t filename_end = filename_start;
-                while (filename_end < args.length() && args[filename_end] != ' '
-                       && args[filename_end] != '\t')
-                {
-                    filename_end++;
-                }
+                std::cerr << "ash: " << part.text << ": " << error << std::endl;
+                return false;
+            }
+            expanded += std::to_string(value);
+            break;
+        }
+        }
+        return true;
+    }
 
-                redirection_spec.stderr_filename =
-                    args.substr(filename_start, filename_end - filename_start);
-                redirection_spec.has_stderr_redirection = true;
-                redirection_spec.stderr_mode = RedirectionMode::APPEND;
+    auto expand_word(const Word& word, std::string& expanded) -> ExpansionResult
+    {
+        expanded.clear();
+        for (const WordPart& part : word.parts)
+        {
+            if (!expand_word_part(part, expanded))
+            {
+                return ExpansionResult::FAILED;
             }
         }
 
-        // Stderr overwrite (2>)
-        if (redirection_spec.stderr_mode != RedirectionMode::APPEND)
+        // NOTE(abi): unquoted words that expand to nothing are dropped, as in "$unset".
+        return (word.is_quoted || !expanded.empty()) ? ExpansionResult::FIELD
+                                                     : ExpansionResult::NO_FIELD;
+    }
+
+    auto expand_word_fields(const Word& word, std::vector<std::string>& fields) -> bool
+    {
+        // NOTE(abi): only what unquoted $var and $((...)) produce is split on IFS. Runs of
+        // IFS whitespace separate fields and are dropped at either end, any other IFS
+        // character ends a field of its own, even an empty one.
+        std::optional<std::string> ifs = get_variable("IFS");
+        std::string separators = ifs.has_value() ? *ifs : " \t\n";
+        fields.clear();
+        std::string field;
+        bool has_field = false;
+        bool is_after_separator = false; // A non-whitespace one, which the next one follows
+        for (const WordPart& part : word.parts)
         {
-            stderr_len = 2;
-            stderr_pos = args.find("2>");
-            if (stderr_pos != std::string::npos)
+            std::string value;
+            if (!expand_word_part(part, value))
             {
-                size_t filename_start = stderr_pos + stderr_len;
-                while (filename_start < args.length()
-                       && (args[filename_start] == ' ' || args[filename_start] == '\t'))
+                return false;
+            }
+
+            if (part.type == WordPartType::LITERAL || part.is_quoted)
+            {
+                field += value;
+                has_field = true;
+                is_after_separator = false;
+                continue;
+            }
+
+            for (char c : value)
+            {
+                if (separators.find(c) == std::string::npos)
                 {
-                    filename_start++;
+                    field += c;
+                    has_field = true;
+                    is_after_separator = false;
                 }
-
-                if (filename_start < args.length())
+                else if (std::strchr(" \t\n", c) == nullptr)
                 {
-                    size_t filename_end = filename_start;
-                    while (filename_end < args.length() && args[filename_end] != ' '
-                           && args[filename_end] != '\t')
+                    if (has_field || is_after_separator || fields.empty())
                     {
-                        filename_end++;
+                        fields.push_back(std::move(field));
                     }
-
-                    redirection_spec.stderr_filename =
-                        args.substr(filename_start, filename_end - filename_start);
-                    redirection_spec.has_stderr_redirection = true;
+                    field.clear();
+                    has_field = false;
+                    is_after_separator = true;
+                }
+                else if (has_field)
+                {
+                    fields.push_back(std::move(field));
+                    field.clear();
+                    has_field = false;
                 }
             }
         }
 
-        // Stdout append (1>> or >>)
-        stdout_len = 0;
-        stdout_pos = args.find("1>>");
-        if (stdout_pos != std::string::npos)
+        // Quoted words survive expansion even when empty
+        if (has_field || (word.is_quoted && fields.empty()))
         {
-            stdout_len = 3;
+            fields.push_back(std::move(field));
         }
-        else
+        return true;
+    }
+
+    auto expand_here_document(const std::string& body) -> std::string
+    {
+        // NOTE(abi): the body of an unquoted <<EOF is expanded as if double quoted, except
+        // that quotes are ordinary characters. A backslash only escapes $, ` and itself,
+        // and joins a line with the next.
+        std::string expanded;
+        expanded.reserve(body.size());
+        for (size_t i = 0; i < body.size(); i++)
         {
-            size_t pos = 0;
-            while ((pos = args.find(">>", pos)) != std::string::npos)
+            char c = body[i];
+            if (c == '\\' && i + 1 < body.size())
             {
-                if (pos > 0 && args[pos - 1] == '2')
+                char next = body[++i];
+                if (next != '\n')
                 {
-                    pos += 2;
-                    continue;
+                    if (next != '$' && next != '`' && next != '\\')
+                    {
+                        expanded += '\\';
+                    }
+                    expanded += next;
                 }
-                stdout_pos = pos;
-                stdout_len = 2;
-                break;
+                continue;
             }
-        }
 
-        if (stdout_pos != std::string::npos)
-        {
-            size_t filename_start = stdout_pos + stdout_len;
-            if (filename_start == args.length())
+            if (c != '$')
             {
-                return redirection_spec;
+                expanded += c;
+                continue;
             }
 
-            while (filename_start < args.length() && args[filename_start] == ' ')
+            std::string name;
+            size_t length = get_arithmetic_expansion_length(body, i);
+            if (length > 0)
             {
-                filename_start++;
+                expand_word_part({WordPartType::ARITHMETIC, body.substr(i + 3, length - 5), true},
+                                 expanded);
             }
-
-            size_t filename_end = filename_start;
-            while (filename_end < args.length() && args[filename_end] != ' ')
+            else if ((length = parse_variable_reference(body, i, name)) > 0)
+            {
+                expand_word_part({WordPartType::VARIABLE, name, true}, expanded);
+            }
+            else
             {
-                filename_end++;
+                expanded += c;
+                continue;
             }
+            i += length - 1;
+        }
+
+        return expanded;
+    }
 
-            redirection_spec.stdout_filename =
-                args.substr(filename_start, filename_end - filename_start);
-            redirection_spec.has_stdout_redirection = true;
-            redirection_spec.stdout_mode = RedirectionMode::APPEND;
+    auto expand_words(const std::vector<Word>& words) -> std::optional<std::vector<std::string>>
+    {
+        std::vector<std::string> expanded_words;
+        expanded_words.reserve(words.size());
+
+        WordGenerator generator{&words};
+        std::string expanded;
+        while (generator.next(expanded))
+        {
+            expanded_words.push_back(expanded);
+        }
+
+        if (generator.is_failed)
+        {
+            return std::nullopt;
         }
+        return expanded_words;
+    }
 
-        // Stdout overwrite (> or 1>)
-        if (redirection_spec.stdout_mode != RedirectionMode::APPEND)
+    auto WordGenerator::next(std::string& value) -> bool
+    {
+        if (field_index < fields.size())
         {
-            stdout_len = 0;
-            stdout_pos = args.find("1>");
-            if (stdout_pos != std::string::npos)
+            value = std::move(fields[field_index++]);
+            return true;
+        }
+
+        while (word_index < words->size())
+        {
+            const Word& word = (*words)[word_index];
+
+            // "$@" expands to one word per positional parameter
+            bool is_all_parameters = word.parts.size() == 1
+                                     && word.parts[0].type == WordPartType::VARIABLE
+                                     && word.parts[0].text == "@";
+            if (is_all_parameters)
             {
-                stdout_len = 2;
+                const std::vector<std::string>& parameters = get_positional_parameters();
+                if (value_index < parameters.size())
+                {
+                    value = parameters[value_index++];
+                    return true;
+                }
             }
-            else
+            else if (!word.brace_pattern.empty())
             {
-                size_t pos = 0;
-                while ((pos = args.find(">", pos)) != std::string::npos)
+                while (value_index < get_brace_expansion_count(word.brace_pattern))
                 {
-                    if (pos > 0 && args[pos - 1] == '2')
+                    brace_word.parts.clear();
+                    brace_word.is_quoted = word.is_quoted;
+                    get_brace_expansion(word.brace_pattern, value_index++, brace_word.parts);
+                    is_failed = !expand_word_fields(brace_word, fields);
+                    field_index = 0;
+                    if (is_failed || !fields.empty())
                     {
-                        pos += 2;
-                        continue;
+                        return !is_failed && next(value);
                     }
+                }
+            }
+            else if (value_index == 0)
+            {
+                value_index++;
+                is_failed = !expand_word_fields(word, fields);
+                field_index = 0;
+                if (is_failed || !fields.empty())
+                {
+                    return !is_failed && next(value);
+                }
+            }
 
-                    if (pos + 1 < args.length() && args[pos + 1] == '>')
-                    {
-                        pos += 2;
-                        continue;
-                    }
+            word_index++;
+            value_index = 0;
+        }
 
-                    stdout_pos = pos;
-                    stdout_len = 1;
-                    break;
+        return false;
+    }
+
+    auto expand_word_as_pattern(const Word& word) -> std::string
+    {
+        // Quoted text matches literally, so its pattern characters get escaped
+        std::string pattern;
+        for (const WordPart& part : word.parts)
+        {
+            std::string value;
+            expand_word_part(part, value);
+
+            for (char c : value)
+            {
+                if (part.is_quoted && (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\'))
+                {
+                    pattern += '\\';
                 }
+                pattern += c;
             }
+        }
+
+        return pattern;
+    }
+
+    auto get_assignment_length(const Word& word) -> size_t
+    {
+        // NAME=value, where the NAME= part is unquoted
+        if (word.parts.empty() || word.parts[0].type != WordPartType::LITERAL
+            || word.parts[0].is_quoted)
+        {
+            return 0;
+        }
+
+        const std::string& text = word.parts[0].text;
+        size_t equals_pos = text.find('=');
+        if (equals_pos == std::string::npos || equals_pos == 0
+            || !is_valid_variable_name(text.substr(0, equals_pos)))
+        {
+            return 0;
+        }
+
+        return equals_pos + 1;
+    }
 
-            if (stdout_pos != std::string::npos)
+    auto make_assignment(const Word& word) -> Assignment
+    {
+        size_t length = get_assignment_length(word);
+        const std::string& first_part = word.parts[0].text;
+
+        // The value is never split or globbed, as if it were quoted
+        Assignment assignment;
+        assignment.name = first_part.substr(0, length - 1);
+        assignment.value.is_quoted = true;
+        if (length < first_part.size())
+        {
+            assignment.value.parts.push_back(
+                {WordPartType::LITERAL, first_part.substr(length), false});
+        }
+        assignment.value.parts.insert(assignment.value.parts.end(), word.parts.begin() + 1,
+                                      word.parts.end());
+        return assignment;
+    }
+
+    auto parse_and_strip_redirection(std::string& args) -> RedirectionSpec
+    {
+        RedirectionSpec redirection_spec;
+
+        bool in_single_quotes = false;
+        bool in_double_quotes = false;
+        size_t word_start = std::string::npos;
+
+        size_t i = 0;
+        while (i < args.length())
+        {
+            char c = args[i];
+            bool is_quoted = in_single_quotes || in_double_quotes;
+
+            Redirection redirection;
+            size_t operator_length =
+                is_quoted ? 0 : parse_redirection_operator(args, i, redirection);
+            if (operator_length == 0)
             {
-                size_t filename_start = stdout_pos + stdout_len;
-                if (filename_start == args.length())
+                if (!is_quoted && (c == ' ' || c == '\t'))
                 {
-                    return redirection_spec;
+                    word_start = std::string::npos;
+                }
+                else if (word_start == std::string::npos)
+                {
+                    word_start = i;
                 }
 
-                while (filename_start < args.length() && args[filename_start] == ' ')
+                if (c == '\\' && !in_single_quotes)
+                {
+                    i++;
+                }
+                else if (c == '$' && !in_single_quotes
+                         && get_arithmetic_expansion_length(args, i) > 0)
                 {
-                    filename_start++;
+                    // $((a < b)) is a comparison, not a redirection
+                    i += get_arithmetic_expansion_length(args, i) - 1;
                 }
+                else if (!in_double_quotes && c == '\'')
+                {
+                    in_single_quotes = !in_single_quotes;
+                }
+                else if (!in_single_quotes && c == '\"')
+                {
+                    in_double_quotes = !in_double_quotes;
+                }
+
+                i++;
+                continue;
+            }
+
+            // An all-digit word prefix is the redirected file descriptor (IO number)
+            size_t redirection_start = i;
+            if (word_start != std::string::npos && redirection.fd != -1 && i - word_start <= 4
+                && std::all_of(args.begin() + word_start, args.begin() + i,
+                               [](char d) { return d >= '0' && d <= '9'; }))
+            {
+                redirection.fd = std::stoi(args.substr(word_start, i - word_start));
+                redirection_start = word_start;
+            }
 
-                size_t filename_end = filename_start;
-                while (filename_end < args.length() && args[filename_end] != ' ')
+            bool is_here_string = args.compare(i, 3, "<<<") == 0;
+
+            size_t target_start = args.find_first_not_of(" \t", i + operator_length);
+            if (target_start == std::string::npos)
+            {
+                target_start = args.length();
+            }
+            size_t target_end = find_word_end(args, target_start);
+            std::string raw_target = args.substr(target_start, target_end - target_start);
+            std::string target = unquote_word(raw_target);
+
+            args.replace(redirection_start, target_end - redirection_start, " ");
+            i = redirection_start + 1;
+            word_start = std::string::npos;
+
+            if (target_start == target_end)
+            {
+                redirection_spec.is_target_missing = true;
+                continue;
+            }
+
+            switch (redirection.op)
+            {
+            case RedirectionOperator::DUPLICATE:
+                if (target == "-")
+                {
+                    redirection.op = RedirectionOperator::CLOSE;
+                }
+                else if (target.length() <= 4
+                         && std::all_of(target.begin(), target.end(),
+                                        [](char d) { return d >= '0' && d <= '9'; }))
+                {
+                    redirection.source_fd = std::stoi(target);
+                }
+                else
+                {
+                    // NOTE(abi): ">&file" is the old spelling of "&>file".
+                    redirection.op = RedirectionOperator::OUTPUT;
+                    redirection.target = raw_target;
+                    if (redirection.fd == 1)
+                    {
+                        redirection.fd = -1;
+                    }
+                }
+                break;
+            case RedirectionOperator::DOCUMENT:
+                if (is_here_string)
                 {
-                    filename_end++;
+                    redirection.target = raw_target;
                 }
+                else
+                {
+                    redirection.here_document_delimiter = target;
+                    redirection.is_delimiter_quoted =
+                        raw_target.find_first_of("'\"\\") != std::string::npos;
+                }
+                break;
+            default:
+                redirection.target = raw_target;
+                break;
+            }
 
-                redirection_spec.stdout_filename =
-                    args.substr(filename_start, filename_end - filename_start);
-                redirection_spec.has_stdout_redirection = true;
+            // Both stdout and stderr (&>, &>>)
+            if (redirection.fd == -1)
+            {
+                redirection.fd = 1;
+                redirection_spec.redirections.push_back(redirection);
+
+                Redirection duplicate;
+                duplicate.fd = 2;
+                duplicate.op = RedirectionOperator::DUPLICATE;
+                duplicate.source_fd = 1;
+                redirection_spec.redirections.push_back(duplicate);
+                continue;
             }
+
+            redirection_spec.redirections.push_back(redirection);
         }
 
-        // Clean arguments string
-        size_t first_redirection_pos = std::string::npos;
-        if (stdout_pos != std::string::npos && stderr_pos != std::string::npos)
+        if (!redirection_spec.redirections.empty() || redirection_spec.is_target_missing)
         {
-            first_redirection_pos = std::min(stdout_pos, stderr_pos);
+            args = trim_whitespace(args);
         }
-        else if (stdout_pos != std::string::npos)
+
+        return redirection_spec;
+    }
+
+    auto parse_redirection_operator(const std::string& args, size_t pos, Redirection& redirection)
+        -> size_t
+    {
+        struct RedirectionToken
         {
-            first_redirection_pos = stdout_pos;
+            const char* text;
+            RedirectionOperator op;
+            int fd;
+        };
+
+        // NOTE(abi): longest tokens first, so that prefixes don't shadow them. A
+        // descriptor of -1 stands for both stdout and stderr.
+        static const RedirectionToken tokens[] = {
+            {"&>>", RedirectionOperator::APPEND, -1},   {"&>", RedirectionOperator::OUTPUT, -1},
+            {"<<<", RedirectionOperator::DOCUMENT, 0},  {"<<-", RedirectionOperator::DOCUMENT, 0},
+            {"<<", RedirectionOperator::DOCUMENT, 0},   {"<>", RedirectionOperator::READ_WRITE, 0},
+            {"<&", RedirectionOperator::DUPLICATE, 0},  {"<", RedirectionOperator::INPUT, 0},
+            {">>", RedirectionOperator::APPEND, 1},     {">|", RedirectionOperator::OUTPUT, 1},
+            {">&", RedirectionOperator::DUPLICATE, 1},  {">", RedirectionOperator::OUTPUT, 1},
+        };
+
+        char c = args[pos];
+        if (c != '<' && c != '>' && c != '&')
+        {
+            return 0;
         }
-        else if (stderr_pos != std::string::npos)
+
+        for (const RedirectionToken& token : tokens)
         {
-            first_redirection_pos = stderr_pos;
+            size_t length = std::char_traits<char>::length(token.text);
+            if (args.compare(pos, length, token.text) == 0)
+            {
+                redirection.op = token.op;
+                redirection.fd = token.fd;
+                redirection.strip_leading_tabs = (length == 3 && token.text[2] == '-');
+                return length;
+            }
         }
 
-        if (first_redirection_pos != std::string::npos)
+        return 0;
+    }
+
+    auto parse_and_strip_process_substitutions(std::string& args)
+        -> std::vector<ProcessSubstitution>
+    {
+        std::vector<ProcessSubstitution> process_substitutions;
+
+        size_t pos = 0;
+        while (true)
         {
-            args = args.substr(0, first_redirection_pos);
+            size_t input_pos = find_unquoted(args, "<(", pos);
+            size_t output_pos = find_unquoted(args, ">(", pos);
+            size_t open_pos = std::min(input_pos, output_pos);
+            if (open_pos == std::string::npos)
+            {
+                break;
+            }
+
+            // Only at the start of a word, so that "2>(" and friends stay redirections
+            if (open_pos > 0 && args[open_pos - 1] != ' ' && args[open_pos - 1] != '\t')
+            {
+                pos = open_pos + 2;
+                continue;
+            }
+
+            size_t close_pos = find_closing_parenthesis(args, open_pos + 1);
+            if (close_pos == std::string::npos)
+            {
+                break;
+            }
+
+            ProcessSubstitution process_substitution;
+            process_substitution.command_line =
+                trim_whitespace(args.substr(open_pos + 2, close_pos - open_pos - 2));
+            process_substitution.direction = (open_pos == input_pos)
+                                                 ? ProcessSubstitutionDirection::INPUT
+                                                 : ProcessSubstitutionDirection::OUTPUT;
+            process_substitutions.push_back(process_substitution);
+
+            args.replace(open_pos, close_pos - open_pos + 1, 1,
+                         config::PROCESS_SUBSTITUTION_MARKER);
+            pos = open_pos + 1;
         }
 
-        return redirection_spec;
+        return process_substitutions;
+    }
+
+    auto replace_process_substitution_markers(std::vector<std::string>& args,
+                                              const std::vector<std::string>& paths) -> void
+    {
+        size_t path_index = 0;
+        for (std::string& arg : args)
+        {
+            size_t marker_pos = arg.find(config::PROCESS_SUBSTITUTION_MARKER);
+            while (marker_pos != std::string::npos && path_index < paths.size())
+            {
+                arg.replace(marker_pos, 1, paths[path_index]);
+                marker_pos = arg.find(config::PROCESS_SUBSTITUTION_MARKER,
+                                      marker_pos + paths[path_index].size());
+                path_index++;
+            }
+        }
     }
 
     auto parse_pipeline(const std::string& input) -> std::vector<CommandSpec>
     {
         std::vector<CommandSpec> commands;
 
-        std::string current_segment;
-        bool in_single_quotes = false;
-        bool in_double_quotes = false;
-
-        for (char c : input)
+        DelimiterScanner scanner{input, "|()"};
+        int parenthesis_depth = 0;
+        size_t segment_start = 0;
+        for (size_t i = scanner.next(0); i != std::string::npos; i = scanner.next(i + 1))
         {
-            if (!in_double_quotes && c == '\'')
+            char c = input[i];
+            if (c == '(' || c == ')')
             {
-                in_single_quotes = !in_single_quotes;
-                current_segment += c;
+                parenthesis_depth += (c == '(') ? 1 : -1;
+                continue;
             }
-            else if (!in_single_quotes && c == '\"')
+
+            if (parenthesis_depth > 0)
             {
-                in_double_quotes = !in_double_quotes;
-                current_segment += c;
+                continue;
             }
-            else if (!in_single_quotes && !in_double_quotes && c == '|')
+
+            if (auto cmd = parse_command_segment(input.substr(segment_start, i - segment_start)))
             {
-                if (auto cmd = parse_command_segment(current_segment))
-                {
-                    commands.push_back(*cmd);
-                }
-                current_segment.clear();
+                commands.push_back(*cmd);
             }
-            else
+            segment_start = i + 1;
+
+            // Fan-out (|>) ends the pipeline: the rest are its consumers
+            if (i + 1 < input.length() && input[i + 1] == '>')
             {
-                current_segment += c;
+                if (!commands.empty())
+                {
+                    commands.back().fan_out = parse_fan_out_consumers(input.substr(i + 2));
+                }
+                return commands;
             }
         }
 
-        if (auto cmd = parse_command_segment(current_segment))
+        if (auto cmd = parse_command_segment(input.substr(segment_start)))
         {
             commands.push_back(*cmd);
         }
@@ -337,6 +774,35 @@ namespace ash
         return commands;
     }
 
+    auto parse_fan_out_consumers(const std::string& input) -> std::vector<std::vector<CommandSpec>>
+    {
+        std::string consumers = trim_whitespace(input);
+        if (consumers.size() >= 2 && consumers.front() == '{' && consumers.back() == '}')
+        {
+            consumers = consumers.substr(1, consumers.size() - 2);
+        }
+
+        std::vector<std::vector<CommandSpec>> pipelines;
+        size_t start = 0;
+        while (start <= consumers.length())
+        {
+            size_t end = find_unquoted(consumers, ";", start);
+            if (end == std::string::npos)
+            {
+                end = consumers.length();
+            }
+
+            auto pipeline = parse_pipeline(consumers.substr(start, end - start));
+            if (!pipeline.empty())
+            {
+                pipelines.push_back(pipeline);
+            }
+            start = end + 1;
+        }
+
+        return pipelines;
+    }
+
     auto parse_command_segment(const std::string& segment) -> std::optional<CommandSpec>
     {
         std::string trimmed = trim_whitespace(segment);
@@ -345,36 +811,149 @@ namespace ash
             return std::nullopt;
         }
 
+        // Redirections may come anywhere, even before the command or stuck to its name
+        std::vector<ProcessSubstitution> process_substitutions =
+            parse_and_strip_process_substitutions(trimmed);
+        RedirectionSpec redirection_spec = parse_and_strip_redirection(trimmed);
+        trimmed = trim_whitespace(trimmed);
+
+        // NAME=value words in front of the command only apply to it
+        std::vector<Assignment> assignments;
+        size_t command_start = 0;
+        while (command_start < trimmed.length())
+        {
+            size_t word_end = find_word_end(trimmed, command_start);
+            std::vector<Word> words =
+                lex_words(trimmed.substr(command_start, word_end - command_start));
+            if (words.size() != 1 || get_assignment_length(words[0]) == 0)
+            {
+                break;
+            }
+
+            assignments.push_back(make_assignment(words[0]));
+            command_start = trimmed.find_first_not_of(" \t", word_end);
+        }
+        trimmed = (command_start < trimmed.length()) ? trimmed.substr(command_start) : "";
+
         auto [command, command_end_pos] = parse_command_and_position(trimmed);
         std::string args =
             (command_end_pos < trimmed.length()) ? trimmed.substr(command_end_pos + 1) : "";
-        RedirectionSpec redirection_spec = parse_and_strip_redirection(args);
 
-        return CommandSpec{command, args, redirection_spec};
+        // The name is only known once it's expanded, it's then looked up like any other
+        std::optional<Word> command_word;
+        if (trimmed.find('$') < command_end_pos)
+        {
+            std::vector<Word> words = lex_words(trimmed.substr(0, command_end_pos));
+            bool is_expanded =
+                words.size() == 1
+                && std::any_of(words[0].parts.begin(), words[0].parts.end(),
+                               [](const WordPart& part)
+                               { return part.type != WordPartType::LITERAL; });
+            if (is_expanded)
+            {
+                command_word = std::move(words[0]);
+            }
+        }
+
+        return CommandSpec{command,
+                           std::move(command_word),
+                           lex_words(args),
+                           redirection_spec,
+                           process_substitutions,
+                           std::move(assignments)};
     }
 
     auto has_pipes(const std::string& input) -> bool
     {
-        bool in_single_quotes = false;
-        bool in_double_quotes = false;
+        DelimiterScanner scanner{input, "|()"};
+        int parenthesis_depth = 0;
+        for (size_t i = scanner.next(0); i != std::string::npos; i = scanner.next(i + 1))
+        {
+            if (input[i] == '(' || input[i] == ')')
+            {
+                parenthesis_depth += (input[i] == '(') ? 1 : -1;
+            }
+            else if (parenthesis_depth <= 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
 
-        for (char c : input)
+    auto find_unquoted(const std::string& str, const std::string& token, size_t pos) -> size_t
+    {
+        const char delimiters[] = {token[0], '$'};
+        DelimiterScanner scanner{str, std::string_view(delimiters, 2)};
+        scanner.reset(pos);
+        for (size_t i = scanner.next(pos); i != std::string::npos; i = scanner.next(i + 1))
         {
-            if (!in_double_quotes && c == '\'')
+            size_t arithmetic_length =
+                (str[i] == '$') ? get_arithmetic_expansion_length(str, i) : 0;
+            if (arithmetic_length > 0)
             {
-                in_single_quotes = !in_single_quotes;
+                // Operators inside $((...)) belong to the expression
+                i += arithmetic_length - 1;
+                scanner.reset(i + 1);
             }
-            else if (!in_single_quotes && c == '\"')
+            else if (str.compare(i, token.length(), token) == 0)
             {
-                in_double_quotes = !in_double_quotes;
+                return i;
             }
-            else if (!in_single_quotes && !in_double_quotes && c == '|')
+        }
+
+        return std::string::npos;
+    }
+
+    auto find_word_end(const std::string& str, size_t start) -> size_t
+    {
+        DelimiterScanner scanner{str, " \t$"};
+        scanner.reset(start);
+        for (size_t i = scanner.next(start); i != std::string::npos; i = scanner.next(i + 1))
+        {
+            if (str[i] != '$')
             {
-                return true;
+                return i;
+            }
+
+            size_t arithmetic_length = get_arithmetic_expansion_length(str, i);
+            if (arithmetic_length > 0)
+            {
+                i += arithmetic_length - 1;
+                scanner.reset(i + 1);
             }
         }
 
-        return false;
+        return str.length();
+    }
+
+    auto find_closing_parenthesis(const std::string& str, size_t open_pos) -> size_t
+    {
+        int depth = 0;
+        size_t pos = open_pos;
+        while (true)
+        {
+            size_t open_next = find_unquoted(str, "(", pos);
+            size_t close_next = find_unquoted(str, ")", pos);
+            if (close_next == std::string::npos)
+            {
+                return std::string::npos;
+            }
+
+            if (open_next < close_next)
+            {
+                depth++;
+                pos = open_next + 1;
+                continue;
+            }
+
+            if (--depth == 0)
+            {
+                return close_next;
+            }
+            pos = close_next + 1;
+        }
     }
 
     auto extract_filename_from_arguments(const std::string& args, size_t offset)
@@ -397,6 +976,17 @@ namespace ash
         return filename;
     }
 
+    auto unquote_word(const std::string& word) -> std::string
+    {
+        std::string unquoted;
+        for (const std::string& part : parse_arguments(word))
+        {
+            unquoted += part;
+        }
+
+        return unquoted;
+    }
+
     auto trim_whitespace(const std::string& str) -> std::string
     {
         size_t start = str.find_first_not_of(" \t");
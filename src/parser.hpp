@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -8,37 +10,168 @@
 namespace ash
 {
 
-    enum class RedirectionMode
+    struct Program;
+
+    enum class RedirectionOperator
     {
-        TRUNCATE,
-        APPEND
+        INPUT,      // [n]<file
+        OUTPUT,     // [n]>file, [n]>|file
+        APPEND,     // [n]>>file
+        READ_WRITE, // [n]<>file
+        DUPLICATE,  // [n]>&m, [n]<&m
+        CLOSE,      // [n]>&-, [n]<&-
+        DOCUMENT,   // [n]<<delimiter, [n]<<-delimiter, [n]<<<word
+    };
+
+    struct Redirection
+    {
+        int fd = 1;
+        RedirectionOperator op = RedirectionOperator::OUTPUT;
+        std::string target; // Filename word as written, or the document body
+        int source_fd = -1;
+        std::string here_document_delimiter;
+        bool strip_leading_tabs = false;
+        bool is_delimiter_quoted = false; // The body is taken literally, without expansion
     };
 
     struct RedirectionSpec
     {
-        std::string stdout_filename;
-        std::string stderr_filename;
-        bool has_stdout_redirection = false;
-        bool has_stderr_redirection = false;
-        RedirectionMode stdout_mode = RedirectionMode::TRUNCATE;
-        RedirectionMode stderr_mode = RedirectionMode::TRUNCATE;
+        std::vector<Redirection> redirections;
+        bool is_target_missing = false; // An operator ended the command, a syntax error
+    };
+
+    enum class ProcessSubstitutionDirection
+    {
+        INPUT,  // <(...): the command reads the substituted process' output
+        OUTPUT, // >(...): the command writes to the substituted process' input
+    };
+
+    struct ProcessSubstitution
+    {
+        std::string command_line;
+        ProcessSubstitutionDirection direction = ProcessSubstitutionDirection::INPUT;
+    };
+
+    enum class WordPartType
+    {
+        LITERAL,    // Text with its quotes and escapes already removed
+        VARIABLE,   // $NAME, ${NAME}, $?, $$
+        ARITHMETIC, // $((expression))
+    };
+
+    struct WordPart
+    {
+        WordPartType type = WordPartType::LITERAL;
+        std::string text; // The literal text, the variable name or the expression
+        bool is_quoted = false;
+    };
+
+    enum class BraceNodeType
+    {
+        PARTS,       // Text outside of any braces
+        ALTERNATION, // {a,b,c}
+        SEQUENCE,    // {1..10}, {001..100..5}, {a..z}
+    };
+
+    // NOTE(abi): brace expansions are kept as a tree and the n-th word is computed on
+    // demand, so {1..1000000} costs the same as {a,b} until its words are used.
+    struct BraceNode
+    {
+        BraceNodeType type = BraceNodeType::PARTS;
+        std::vector<WordPart> parts;
+        std::vector<std::vector<BraceNode>> alternatives;
+        std::vector<size_t> alternative_offsets; // First value index of each alternative
+        int64_t start = 0;
+        int64_t step = 1;
+        size_t width = 0; // Zero padded sequences
+        bool is_character = false;
+        size_t value_count = 1;
+        size_t stride = 1; // Product of the value counts of the nodes after this one
+    };
+
+    // A word is lexed once and expanded every time it's used, so that loop bodies
+    // don't go back through the parser on every iteration.
+    struct Word
+    {
+        std::vector<WordPart> parts;
+        bool is_quoted = false;               // Quoted words survive expansion even when empty
+        std::vector<BraceNode> brace_pattern; // Empty when the word has no brace expansion
+    };
+
+    // NAME=value, on its own or before a command
+    struct Assignment
+    {
+        std::string name;
+        Word value;
+    };
+
+    enum class ExpansionResult
+    {
+        FIELD,
+        NO_FIELD, // An unquoted word that expanded to nothing
+        FAILED,   // An arithmetic error, already reported
+    };
+
+    // Streams the expansion of a word list one field at a time
+    struct WordGenerator
+    {
+        const std::vector<Word>* words;
+        size_t word_index = 0;
+        size_t value_index = 0; // Into the current word's brace expansion, or into "$@"
+        Word brace_word;
+        std::vector<std::string> fields; // Split from the current value, not handed out yet
+        size_t field_index = 0;
+        bool is_failed = false; // The list stopped early on an expansion error
+
+        auto next(std::string& value) -> bool;
     };
 
     struct CommandSpec
     {
         std::string command;
-        std::string args;
+        std::optional<Word> command_word; // $c args, set when the name needs expanding
+        std::vector<Word> args;
         RedirectionSpec redirection;
+        std::vector<ProcessSubstitution> process_substitutions;
+        std::vector<Assignment> assignments; // NAME=value words before the command
+
+        // Consumer pipelines the command's stdout is duplicated to (producer |> { a ; b }),
+        // the last consumer's status is the pipeline's
+        std::vector<std::vector<CommandSpec>> fan_out;
+
+        // A compound stage such as ( a; b ) | c, run in the stage's child instead of command
+        std::shared_ptr<const Program> body;
     };
 
     auto parse_command_and_position(const std::string& input) -> std::pair<std::string, size_t>;
     auto parse_arguments(const std::string& args) -> std::vector<std::string>;
+    auto lex_words(const std::string& args) -> std::vector<Word>;
+    auto expand_word_part(const WordPart& part, std::string& expanded) -> bool;
+    auto expand_word(const Word& word, std::string& expanded) -> ExpansionResult;
+    auto expand_word_fields(const Word& word, std::vector<std::string>& fields) -> bool;
+    auto expand_here_document(const std::string& body) -> std::string;
+    auto expand_words(const std::vector<Word>& words) -> std::optional<std::vector<std::string>>;
+    auto expand_word_as_pattern(const Word& word) -> std::string;
+    auto get_assignment_length(const Word& word) -> size_t;
+    auto make_assignment(const Word& word) -> Assignment;
     auto parse_and_strip_redirection(std::string& args) -> RedirectionSpec;
+    auto parse_and_strip_process_substitutions(std::string& args)
+        -> std::vector<ProcessSubstitution>;
+    auto replace_process_substitution_markers(std::vector<std::string>& args,
+                                              const std::vector<std::string>& paths) -> void;
+    auto parse_redirection_operator(const std::string& args, size_t pos, Redirection& redirection)
+        -> size_t;
     auto parse_pipeline(const std::string& input) -> std::vector<CommandSpec>;
+    auto parse_fan_out_consumers(const std::string& input) -> std::vector<std::vector<CommandSpec>>;
     auto parse_command_segment(const std::string& segment) -> std::optional<CommandSpec>;
     auto has_pipes(const std::string& input) -> bool;
+    auto find_unquoted(const std::string& str, const std::string& token, size_t pos = 0)
+        -> size_t;
+    auto find_word_end(const std::string& str, size_t start) -> size_t;
+    auto find_closing_parenthesis(const std::string& str, size_t open_pos) -> size_t;
     auto extract_filename_from_arguments(const std::string& args, size_t offset)
         -> std::optional<std::string>;
+    auto unquote_word(const std::string& word) -> std::string;
     auto trim_whitespace(const std::string& str) -> std::string;
 
 } // namespace ash
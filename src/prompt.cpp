@@ -0,0 +1,419 @@
+#include "prompt.hpp"
+#include "constants.hpp"
+#include "editor.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pwd.h>
+    #include <readline/readline.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto parse_prompt(const std::string& source) -> std::vector<PromptPart>
+    {
+        std::vector<PromptPart> parts;
+        auto append_literal = [&parts](const std::string& text)
+        {
+            if (parts.empty() || parts.back().type != PromptPartType::LITERAL)
+            {
+                parts.push_back({PromptPartType::LITERAL, ""});
+            }
+            parts.back().text += text;
+        };
+
+        for (size_t i = 0; i < source.size(); i++)
+        {
+            if (source[i] != '\\' || i + 1 == source.size())
+            {
+                append_literal(std::string(1, source[i]));
+                continue;
+            }
+
+            char escape = source[++i];
+            switch (escape)
+            {
+            case 'w':
+                parts.push_back({PromptPartType::WORKING_DIRECTORY, ""});
+                break;
+            case 'W':
+                parts.push_back({PromptPartType::DIRECTORY_NAME, ""});
+                break;
+            case '?':
+                parts.push_back({PromptPartType::EXIT_STATUS, ""});
+                break;
+            case 't':
+                parts.push_back({PromptPartType::TIME, ""});
+                break;
+            case 'u':
+                parts.push_back({PromptPartType::USER, ""});
+                break;
+            case 'h':
+                parts.push_back({PromptPartType::HOST, ""});
+                break;
+            case '$':
+                parts.push_back({PromptPartType::PROMPT_SIGN, ""});
+                break;
+            case 'n':
+                append_literal("\n");
+                break;
+            case 'e':
+                append_literal("\033");
+                break;
+            // Readline needs non-printing sequences marked to compute the prompt width
+            case '[':
+                append_literal(std::string(1, RL_PROMPT_START_IGNORE));
+                break;
+            case ']':
+                append_literal(std::string(1, RL_PROMPT_END_IGNORE));
+                break;
+            case '(':
+            {
+                // Up to the matching parenthesis
+                int depth = 1;
+                size_t end = i + 1;
+                for (; end < source.size() && depth > 0; end++)
+                {
+                    depth += (source[end] == '(') ? 1 : (source[end] == ')') ? -1 : 0;
+                }
+
+                if (depth != 0)
+                {
+                    append_literal(source.substr(i - 1));
+                    i = source.size();
+                    break;
+                }
+
+                parts.push_back({PromptPartType::SEGMENT, source.substr(i + 1, end - i - 2)});
+                i = end - 1;
+                break;
+            }
+            default:
+                append_literal(std::string(1, escape));
+                break;
+            }
+        }
+
+        return parts;
+    }
+
+    auto get_prompt_parts() -> const std::vector<PromptPart>&
+    {
+        PromptState& prompt = shell_state->prompt;
+        std::string source = get_variable("PS1").value_or(config::PROMPT);
+        if (source != prompt.source)
+        {
+            prompt.parts = parse_prompt(source);
+            prompt.source = std::move(source);
+        }
+
+        return prompt.parts;
+    }
+
+    auto render_prompt() -> std::string
+    {
+        std::string rendered;
+        for (const PromptPart& part : get_prompt_parts())
+        {
+            switch (part.type)
+            {
+            case PromptPartType::LITERAL:
+                rendered += part.text;
+                break;
+            case PromptPartType::WORKING_DIRECTORY:
+                rendered += get_prompt_directory(false);
+                break;
+            case PromptPartType::DIRECTORY_NAME:
+                rendered += get_prompt_directory(true);
+                break;
+            case PromptPartType::EXIT_STATUS:
+                rendered += std::to_string(shell_state->last_exit_status);
+                break;
+            case PromptPartType::TIME:
+            {
+                char time_buffer[16];
+                std::time_t now = std::time(nullptr);
+                std::strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S", std::localtime(&now));
+                rendered += time_buffer;
+                break;
+            }
+            case PromptPartType::USER:
+            {
+                const char* user = std::getenv("USER");
+                struct passwd* pw = (user == nullptr) ? getpwuid(geteuid()) : nullptr;
+                rendered += (user != nullptr) ? user : (pw != nullptr) ? pw->pw_name : "";
+                break;
+            }
+            case PromptPartType::HOST:
+            {
+                char host[config::MAX_PATH_LENGTH] = {};
+                if (gethostname(host, sizeof(host) - 1) == 0)
+                {
+                    std::string name(host);
+                    rendered += name.substr(0, name.find('.'));
+                }
+                break;
+            }
+            case PromptPartType::PROMPT_SIGN:
+                rendered += (geteuid() == 0) ? "#" : "$";
+                break;
+            case PromptPartType::SEGMENT:
+            {
+                auto it = shell_state->prompt.segment_cache.find(get_prompt_segment_key(part.text));
+                if (it != shell_state->prompt.segment_cache.end())
+                {
+                    rendered += it->second;
+                }
+                break;
+            }
+            }
+        }
+
+        return rendered;
+    }
+
+    auto get_prompt_directory(bool is_basename) -> std::string
+    {
+        const std::string& directory = get_working_directory();
+        if (directory.empty())
+        {
+            return "?";
+        }
+
+        const char* home = std::getenv("HOME");
+        if (home != nullptr && *home != '\0' && directory == home)
+        {
+            return "~";
+        }
+
+        if (is_basename)
+        {
+            size_t last_slash = directory.rfind('/');
+            return (directory == "/" || last_slash == std::string::npos)
+                       ? directory
+                       : directory.substr(last_slash + 1);
+        }
+
+        // The home directory abbreviates to ~
+        std::string home_prefix = (home != nullptr) ? std::string(home) + "/" : "";
+        if (home_prefix.size() > 1 && directory.starts_with(home_prefix))
+        {
+            return "~/" + directory.substr(home_prefix.size());
+        }
+
+        return directory;
+    }
+
+    auto get_prompt_segment_key(const std::string& command) -> std::string
+    {
+        return command + '\0' + get_working_directory();
+    }
+
+    auto start_prompt_segments() -> void
+    {
+        PromptState& prompt = shell_state->prompt;
+        for (const PromptPart& part : get_prompt_parts())
+        {
+            if (part.type != PromptPartType::SEGMENT)
+            {
+                continue;
+            }
+
+            // One refresh at a time per segment
+            std::string key = get_prompt_segment_key(part.text);
+            bool is_pending =
+                std::any_of(prompt.pending_segments.begin(), prompt.pending_segments.end(),
+                            [&key](const PendingPromptSegment& pending)
+                            { return pending.key == key; });
+            if (!is_pending)
+            {
+                start_prompt_segment(key, part.text);
+            }
+        }
+    }
+
+    auto start_prompt_segment(const std::string& key, const std::string& command) -> bool
+    {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+        {
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            return false;
+        }
+
+        if (pid == 0)
+        {
+            // Its own process group, so a timeout takes down whatever it started
+            setpgid(0, 0);
+
+            close(pipe_fds[0]);
+            dup2(pipe_fds[1], STDOUT_FILENO);
+            close(pipe_fds[1]);
+
+            int null_fd = open("/dev/null", O_RDWR);
+            if (null_fd != -1)
+            {
+                dup2(null_fd, STDIN_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+                close(null_fd);
+            }
+
+            execute_line(command);
+            exit(shell_state->last_exit_status);
+        }
+
+        setpgid(pid, pid);
+        close(pipe_fds[1]);
+        fcntl(pipe_fds[0], F_SETFL, fcntl(pipe_fds[0], F_GETFL) | O_NONBLOCK);
+        shell_state->prompt.pending_segments.push_back(
+            {key, pid, pipe_fds[0], "", std::chrono::steady_clock::now()});
+        return true;
+    }
+
+    auto poll_prompt_segments(int timeout_ms) -> bool
+    {
+        PromptState& prompt = shell_state->prompt;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        bool is_changed = false;
+
+        while (!prompt.pending_segments.empty())
+        {
+            auto now = std::chrono::steady_clock::now();
+            int remaining_ms = static_cast<int>(
+                std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         deadline - now)
+                                         .count()));
+
+            std::vector<struct pollfd> poll_fds;
+            for (const PendingPromptSegment& segment : prompt.pending_segments)
+            {
+                poll_fds.push_back({segment.fd, POLLIN, 0});
+            }
+
+            if (poll(poll_fds.data(), poll_fds.size(), remaining_ms) == -1 && errno != EINTR)
+            {
+                break;
+            }
+
+            now = std::chrono::steady_clock::now();
+            for (size_t i = poll_fds.size(); i-- > 0;)
+            {
+                PendingPromptSegment& segment = prompt.pending_segments[i];
+                bool is_finished = false;
+                if (poll_fds[i].revents != 0)
+                {
+                    char buffer[4096];
+                    ssize_t bytes_read;
+                    while ((bytes_read = read(segment.fd, buffer, sizeof(buffer))) > 0)
+                    {
+                        size_t room = config::PROMPT_SEGMENT_MAX_OUTPUT - segment.output.size();
+                        segment.output.append(buffer,
+                                              std::min(room, static_cast<size_t>(bytes_read)));
+                    }
+                    is_finished = (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN
+                                                       && errno != EINTR));
+                }
+
+                bool is_timed_out = !is_finished
+                                    && now - segment.start_time
+                                           >= std::chrono::milliseconds(
+                                               config::PROMPT_SEGMENT_TIMEOUT_MS);
+                if (!is_finished && !is_timed_out)
+                {
+                    continue;
+                }
+
+                std::string previous = prompt.segment_cache[segment.key];
+                finish_prompt_segment(segment, is_timed_out);
+                is_changed = is_changed || prompt.segment_cache[segment.key] != previous;
+                prompt.pending_segments.erase(prompt.pending_segments.begin() + i);
+            }
+
+            if (now >= deadline)
+            {
+                break;
+            }
+        }
+
+        return is_changed;
+    }
+
+    auto finish_prompt_segment(PendingPromptSegment& segment, bool is_timed_out) -> void
+    {
+        close(segment.fd);
+
+        // NOTE(abi): a segment that closed its output but lingers is killed too, so
+        // reaping it never blocks the prompt.
+        if (waitpid(segment.pid, nullptr, WNOHANG) == 0)
+        {
+            kill(-segment.pid, SIGKILL);
+            waitpid(segment.pid, nullptr, 0);
+        }
+
+        // A timed out segment keeps showing its last value
+        if (is_timed_out)
+        {
+            return;
+        }
+
+        // Only the first line, as with a branch name from a command
+        std::string& output = segment.output;
+        output.erase(std::min(output.find('\n'), output.size()));
+
+        std::unordered_map<std::string, std::string>& cache = shell_state->prompt.segment_cache;
+        if (cache.size() >= config::PROMPT_SEGMENT_CACHE_SIZE && !cache.contains(segment.key))
+        {
+            cache.clear();
+        }
+        cache[segment.key] = std::move(output);
+    }
+
+    auto redraw_prompt() -> void
+    {
+        if (!shell_state->prompt.is_displayed)
+        {
+            return;
+        }
+
+        if (shell_state->editor.is_active)
+        {
+            update_editor_prompt(shell_state->editor, render_prompt());
+            return;
+        }
+
+        // NOTE(abi): readline only tracks what it drew after the prompt, so the line is
+        // cleared by hand and redrawn from its start.
+        FILE* stream = (::rl_outstream != nullptr) ? ::rl_outstream : stdout;
+        std::fputs("\r\033[K", stream);
+        std::fflush(stream);
+        ::rl_set_prompt(render_prompt().c_str());
+        ::rl_on_new_line();
+        ::rl_redisplay();
+    }
+
+} // namespace ash
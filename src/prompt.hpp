@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <sys/types.h>
+
+#endif
+
+namespace ash
+{
+
+    enum class PromptPartType
+    {
+        LITERAL,
+        WORKING_DIRECTORY, // \w
+        DIRECTORY_NAME,    // \W
+        EXIT_STATUS,       // \?
+        TIME,              // \t
+        USER,              // \u
+        HOST,              // \h
+        PROMPT_SIGN,       // \$
+        SEGMENT,           // \(command)
+    };
+
+    struct PromptPart
+    {
+        PromptPartType type;
+        std::string text; // Literal text, or the segment's command line
+    };
+
+    // A \(command) segment being refreshed in a child process
+    struct PendingPromptSegment
+    {
+        std::string key;
+        pid_t pid;
+        int fd;
+        std::string output;
+        std::chrono::steady_clock::time_point start_time;
+    };
+
+    struct PromptState
+    {
+        std::string source; // The PS1 the parts were parsed from
+        std::vector<PromptPart> parts;
+        // NOTE(abi): segment output is cached per command and directory, so a prompt
+        // shows the last known value right away and a refresh lands through a redraw.
+        std::unordered_map<std::string, std::string> segment_cache;
+        std::vector<PendingPromptSegment> pending_segments;
+        bool is_displayed = false;
+    };
+
+    // Parsing
+    auto parse_prompt(const std::string& source) -> std::vector<PromptPart>;
+    auto get_prompt_parts() -> const std::vector<PromptPart>&;
+
+    // Rendering
+    auto render_prompt() -> std::string;
+    auto get_prompt_directory(bool is_basename) -> std::string;
+    auto get_prompt_segment_key(const std::string& command) -> std::string;
+
+    // Segments
+    auto start_prompt_segments() -> void;
+    auto start_prompt_segment(const std::string& key, const std::string& command) -> bool;
+    auto poll_prompt_segments(int timeout_ms) -> bool;
+    auto finish_prompt_segment(PendingPromptSegment& segment, bool is_timed_out) -> void;
+    auto redraw_prompt() -> void;
+
+} // namespace ash
@@ -0,0 +1,535 @@
+#include "resources.hpp"
+#include "commands.hpp"
+#include "constants.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <linux/mempolicy.h>
+    #include <sched.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto resources_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.empty())
+        {
+            print_job_resources(shell_state->job_resources);
+            return 0;
+        }
+
+        // NOTE(abi): with a command the options only hold for it, otherwise they become
+        // the defaults of every job that follows.
+        JobResources resources = shell_state->job_resources;
+        size_t command_start = args.size();
+        if (!parse_resource_options(args, resources, command_start))
+        {
+            return 2;
+        }
+
+        if (command_start == args.size())
+        {
+            shell_state->job_resources = std::move(resources);
+            return 0;
+        }
+
+        std::vector<std::string> command(args.begin() + command_start, args.end());
+        std::swap(shell_state->job_resources, resources);
+        bool is_found = execute_command(make_literal_command(command));
+        std::swap(shell_state->job_resources, resources);
+
+        if (!is_found)
+        {
+            handle_invalid_command(command[0]);
+            return 127;
+        }
+        return shell_state->last_exit_status;
+    }
+
+    auto parse_resource_options(const std::vector<std::string>& args, JobResources& resources,
+                                size_t& command_start) -> bool
+    {
+        auto report = [](const std::string& option, const std::string& message)
+        {
+            std::cerr << "resources: " << option << ": " << message << std::endl;
+            return false;
+        };
+
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const std::string& option = args[i];
+            if (option == "--")
+            {
+                command_start = i + 1;
+                if (command_start == args.size())
+                {
+                    return report(option, "command expected");
+                }
+                break;
+            }
+            else if (option == "--reset")
+            {
+                resources = JobResources();
+                continue;
+            }
+            else if (option == "--batch" || option == "--no-batch")
+            {
+                resources.is_batch = (option == "--batch");
+                continue;
+            }
+
+            bool has_value = option == "--cpus" || option == "--nodes" || option == "--nice"
+                             || option == "--cpu-max" || option == "--memory-max"
+                             || option == "--cgroup-parent";
+            if (!has_value)
+            {
+                std::cerr << "resources: usage: resources [--reset] [--cpus list] [--nodes list] "
+                             "[--nice n] [--batch|--no-batch] [--cpu-max limit] "
+                             "[--memory-max limit] [--cgroup-parent path] [-- command [args...]]"
+                          << std::endl;
+                return false;
+            }
+            if (++i == args.size())
+            {
+                return report(option, "value expected");
+            }
+
+            const std::string& value = args[i];
+            if (option == "--cpus")
+            {
+                if (!parse_cpu_list(value, resources.cpus))
+                {
+                    return report(option, "invalid CPU list: " + value);
+                }
+                resources.cpu_list = value;
+            }
+            else if (option == "--nodes")
+            {
+                if (!parse_cpu_list(value, resources.nodes)
+                    || (!resources.nodes.empty() && get_node_cpus(resources.nodes).empty()))
+                {
+                    return report(option, "invalid NUMA node list: " + value);
+                }
+                resources.node_list = value;
+            }
+            else if (option == "--nice")
+            {
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(),
+                                                    resources.nice);
+                if (error != std::errc() || end != value.data() + value.size())
+                {
+                    return report(option, "invalid niceness: " + value);
+                }
+            }
+            else if (option == "--cpu-max")
+            {
+                if (!parse_cpu_max(value, resources.cpu_max))
+                {
+                    return report(option, "invalid limit: " + value);
+                }
+            }
+            else if (option == "--memory-max")
+            {
+                // The kernel parses sizes like 512M and 2G itself
+                resources.memory_max = value;
+            }
+            else
+            {
+                resources.cgroup_parent = value;
+            }
+        }
+
+        // Pinning to nodes is pinning to their CPUs, on top of any given directly
+        std::vector<int> cpus;
+        parse_cpu_list(resources.cpu_list, cpus);
+        std::vector<int> node_cpus = get_node_cpus(resources.nodes);
+        cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        resources.cpus = std::move(cpus);
+
+        return true;
+    }
+
+    auto print_job_resources(const JobResources& resources) -> void
+    {
+        auto print = [](const std::string& name, const std::string& value)
+        {
+            std::cout << std::left << std::setw(15) << name << (value.empty() ? "-" : value)
+                      << std::endl;
+        };
+
+        print("cpus", resources.cpu_list);
+        print("nodes", resources.node_list);
+        print("nice", std::to_string(resources.nice));
+        print("batch", resources.is_batch ? "on" : "off");
+        print("cpu-max", resources.cpu_max);
+        print("memory-max", resources.memory_max);
+        print("cgroup-parent", resources.cgroup_parent);
+    }
+
+    auto parse_cpu_list(const std::string& list, std::vector<int>& values) -> bool
+    {
+        // The kernel's list format: 0-3,8,10-11
+        values.clear();
+        for (size_t pos = 0; pos < list.size();)
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+            {
+                end = list.size();
+            }
+
+            const char* first = list.data() + pos;
+            const char* last = list.data() + end;
+            int low = 0;
+            int high = 0;
+            std::from_chars_result result = std::from_chars(first, last, low);
+            high = low;
+            if (result.ec == std::errc() && result.ptr != last && *result.ptr == '-')
+            {
+                result = std::from_chars(result.ptr + 1, last, high);
+            }
+
+            if (result.ec != std::errc() || result.ptr != last || low < 0 || high < low
+                || high >= config::MAX_JOB_CPUS)
+            {
+                values.clear();
+                return false;
+            }
+
+            for (int value = low; value <= high; value++)
+            {
+                values.push_back(value);
+            }
+            pos = end + 1;
+        }
+
+        return true;
+    }
+
+    auto get_node_cpus(const std::vector<int>& nodes) -> std::vector<int>
+    {
+        std::vector<int> cpus;
+        for (int node : nodes)
+        {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            std::vector<int> node_cpus;
+            if (!std::getline(file, list) || !parse_cpu_list(list, node_cpus))
+            {
+                return {};
+            }
+            cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+        }
+
+        return cpus;
+    }
+
+    auto parse_cpu_max(const std::string& limit, std::string& cpu_max) -> bool
+    {
+        // max, a share of one CPU (250% is two and a half), or quota and period in us
+        if (limit == "max" || limit.empty())
+        {
+            cpu_max = limit;
+            return true;
+        }
+
+        int64_t quota = 0;
+        int64_t period = config::CGROUP_CPU_PERIOD_US;
+        const char* last = limit.data() + limit.size();
+        std::from_chars_result result = std::from_chars(limit.data(), last, quota);
+        bool is_number = result.ec == std::errc();
+        if (is_number && result.ptr + 1 == last && *result.ptr == '%')
+        {
+            quota = quota * period / 100;
+        }
+        else if (is_number && result.ptr != last && *result.ptr == ' ')
+        {
+            result = std::from_chars(result.ptr + 1, last, period);
+            if (result.ec != std::errc() || result.ptr != last)
+            {
+                return false;
+            }
+        }
+        else if (!is_number || result.ptr != last)
+        {
+            return false;
+        }
+
+        if (quota <= 0 || period <= 0)
+        {
+            return false;
+        }
+
+        cpu_max = std::to_string(quota) + " " + std::to_string(period);
+        return true;
+    }
+
+    auto has_job_cgroup(const JobResources& resources) -> bool
+    {
+        return !resources.cpu_max.empty() || !resources.memory_max.empty()
+               || !resources.cgroup_parent.empty();
+    }
+
+    auto get_cgroup_mount() -> std::string
+    {
+        // Usually /sys/fs/cgroup, /sys/fs/cgroup/unified on hybrid setups
+        std::ifstream mounts("/proc/self/mounts");
+        std::string line;
+        while (std::getline(mounts, line))
+        {
+            std::istringstream fields(line);
+            std::string device, mount_point, type;
+            if (fields >> device >> mount_point >> type && type == "cgroup2")
+            {
+                return mount_point;
+            }
+        }
+
+        return "";
+    }
+
+    auto get_shell_cgroup() -> std::string
+    {
+        std::ifstream file("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.rfind("0::", 0) == 0)
+            {
+                return line.substr(3);
+            }
+        }
+
+        return "";
+    }
+
+    auto create_job_cgroup(const JobResources& resources) -> std::string
+    {
+        std::string step; // What failed, for the report
+        std::string parent = resources.cgroup_parent.empty() ? get_delegated_cgroup(step)
+                                                             : resources.cgroup_parent;
+        std::string path = parent + "/ash-" + std::to_string(getpid()) + "-"
+                           + std::to_string(++shell_state->job_count);
+        bool is_created = false;
+        if (parent.empty())
+        {
+        }
+        else if (!resources.cpu_max.empty() && !enable_cgroup_controller(parent, "cpu"))
+        {
+            step = "enabling cpu in " + parent;
+        }
+        else if (!resources.memory_max.empty() && !enable_cgroup_controller(parent, "memory"))
+        {
+            step = "enabling memory in " + parent;
+        }
+        else if (mkdir(path.c_str(), 0755) != 0)
+        {
+            step = "creating " + path;
+        }
+        else
+        {
+            is_created = true;
+            if (!resources.cpu_max.empty()
+                && !write_cgroup_file(path + "/cpu.max", resources.cpu_max))
+            {
+                step = "setting " + path + "/cpu.max";
+            }
+            else if (!resources.memory_max.empty()
+                     && !write_cgroup_file(path + "/memory.max", resources.memory_max))
+            {
+                step = "setting " + path + "/memory.max";
+            }
+            else
+            {
+                return path;
+            }
+        }
+
+        // NOTE(abi): cgroupfs is often read-only or not delegated to us. Jobs still run,
+        // just without their limits, and that's only worth saying once.
+        int error = errno;
+        if (is_created)
+        {
+            rmdir(path.c_str());
+        }
+        if (!shell_state->is_cgroup_failure_reported)
+        {
+            std::cerr << "ash: cgroup: " << step << ": " << std::strerror(error)
+                      << ", running jobs without limits" << std::endl;
+            shell_state->is_cgroup_failure_reported = true;
+        }
+        return "";
+    }
+
+    auto get_delegated_cgroup(std::string& step) -> std::string
+    {
+        // NOTE(abi): only a cgroup with no processes of its own may enable controllers for
+        // its children, so the shell moves into a leaf next to the jobs' cgroups. That
+        // needs a cgroup the shell has to itself, as with systemd-run --user --scope;
+        // anywhere else --cgroup-parent has to name one.
+        std::string mount = get_cgroup_mount();
+        std::string cgroup = get_shell_cgroup();
+        if (mount.empty() || cgroup.empty())
+        {
+            step = "finding the cgroup v2 hierarchy";
+            errno = ENOENT;
+            return "";
+        }
+
+        std::string current = mount + (cgroup == "/" ? "" : cgroup);
+        std::string leaf = std::string("/") + config::CGROUP_SHELL_LEAF;
+        if (cgroup == "/")
+        {
+            return current; // The root is exempt
+        }
+        if (current.ends_with(leaf))
+        {
+            return current.substr(0, current.size() - leaf.size()); // Moved already
+        }
+
+        std::ifstream procs(current + "/cgroup.procs");
+        pid_t pid = 0;
+        while (procs >> pid)
+        {
+            if (pid != getpid())
+            {
+                step = current + " has other processes, see --cgroup-parent";
+                errno = EBUSY;
+                return "";
+            }
+        }
+
+        if (mkdir((current + leaf).c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            step = "creating " + current + leaf;
+            return "";
+        }
+        if (!write_cgroup_file(current + leaf + "/cgroup.procs", std::to_string(getpid())))
+        {
+            step = "moving the shell to " + current + leaf;
+            return "";
+        }
+
+        return current;
+    }
+
+    auto enable_cgroup_controller(const std::string& cgroup, const std::string& controller)
+        -> bool
+    {
+        std::ifstream file(cgroup + "/cgroup.subtree_control");
+        std::string enabled;
+        while (file >> enabled)
+        {
+            if (enabled == controller)
+            {
+                return true;
+            }
+        }
+
+        return write_cgroup_file(cgroup + "/cgroup.subtree_control", "+" + controller);
+    }
+
+    auto remove_job_cgroup(const std::string& cgroup) -> void
+    {
+        // Anything the job left running keeps it around, it's harmless
+        if (!cgroup.empty())
+        {
+            rmdir(cgroup.c_str());
+        }
+    }
+
+    auto write_cgroup_file(const std::string& path, const std::string& value) -> bool
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        bool is_written = write(fd, value.data(), value.size())
+                          == static_cast<ssize_t>(value.size());
+        int error = errno;
+        close(fd);
+        errno = error;
+        return is_written;
+    }
+
+    auto apply_job_resources(const JobResources& resources, const std::string& cgroup) -> void
+    {
+        // Joining fails when we may create the cgroup but not move into it, the job
+        // then runs where the shell does
+        if (!cgroup.empty())
+        {
+            write_cgroup_file(cgroup + "/cgroup.procs", "0");
+        }
+
+        if (resources.is_batch)
+        {
+            struct sched_param parameters = {};
+            if (sched_setscheduler(0, SCHED_BATCH, &parameters) == -1)
+            {
+                std::cerr << "ash: batch: " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        if (resources.nice != 0)
+        {
+            errno = 0;
+            if (nice(resources.nice) == -1 && errno != 0)
+            {
+                std::cerr << "ash: nice: " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        if (!resources.cpus.empty())
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (int cpu : resources.cpus)
+            {
+                CPU_SET(cpu, &cpus);
+            }
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+            {
+                std::cerr << "ash: cpus: " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        if (!resources.nodes.empty())
+        {
+            constexpr size_t BITS = 8 * sizeof(unsigned long);
+            unsigned long nodes[config::MAX_JOB_CPUS / BITS] = {};
+            for (int node : resources.nodes)
+            {
+                nodes[node / BITS] |= 1UL << (node % BITS);
+            }
+            if (syscall(SYS_set_mempolicy, MPOL_BIND, nodes, config::MAX_JOB_CPUS) == -1)
+            {
+                std::cerr << "ash: nodes: " << std::strerror(errno) << std::endl;
+            }
+        }
+    }
+
+} // namespace ash
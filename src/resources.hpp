@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // NOTE(abi): what jobs started by the shell run with. Everything is applied in each
+    // forked child before it execs; the shell itself keeps running as it was. Limits
+    // need a cgroup of the job's own, which is created per pipeline and removed after.
+    struct JobResources
+    {
+        std::string cpu_list;  // As given, e.g. 0-3,8
+        std::string node_list; // NUMA nodes, their CPUs and memory
+        std::vector<int> cpus; // Both lists combined, empty to inherit
+        std::vector<int> nodes;
+        int nice = 0; // Added to the shell's
+        bool is_batch = false;
+        std::string cpu_max;    // cpu.max, "max" or "quota period"
+        std::string memory_max; // memory.max
+        std::string cgroup_parent;
+    };
+
+    // Builtin
+    auto resources_command(const std::vector<std::string>& args) -> int;
+    auto parse_resource_options(const std::vector<std::string>& args, JobResources& resources,
+                                size_t& command_start) -> bool;
+    auto print_job_resources(const JobResources& resources) -> void;
+
+    // CPUs and nodes
+    auto parse_cpu_list(const std::string& list, std::vector<int>& values) -> bool;
+    auto get_node_cpus(const std::vector<int>& nodes) -> std::vector<int>;
+    auto parse_cpu_max(const std::string& limit, std::string& cpu_max) -> bool;
+
+    // cgroups
+    auto has_job_cgroup(const JobResources& resources) -> bool;
+    auto get_cgroup_mount() -> std::string;
+    auto get_shell_cgroup() -> std::string;
+    auto create_job_cgroup(const JobResources& resources) -> std::string;
+    auto get_delegated_cgroup(std::string& step) -> std::string;
+    auto enable_cgroup_controller(const std::string& cgroup, const std::string& controller)
+        -> bool;
+    auto remove_job_cgroup(const std::string& cgroup) -> void;
+    auto write_cgroup_file(const std::string& path, const std::string& value) -> bool;
+
+    // Children
+    auto apply_job_resources(const JobResources& resources, const std::string& cgroup) -> void;
+
+} // namespace ash
@@ -0,0 +1,223 @@
+#include "scanner.hpp"
+#include "constants.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__)
+    #include <immintrin.h>
+#endif
+
+namespace ash
+{
+
+    auto DelimiterScanner::next(size_t from) -> size_t
+    {
+        while (true)
+        {
+            if (from < block_end)
+            {
+                uint64_t remaining =
+                    (from > block_start) ? stops & (~0ULL << (from - block_start)) : stops;
+                if (remaining != 0)
+                {
+                    return block_start + std::countr_zero(remaining);
+                }
+                from = block_end;
+            }
+
+            if (from >= text.size())
+            {
+                return std::string::npos;
+            }
+
+            // Quoting carries over from one block to the next, so those can't skip ahead
+            scan_block(is_quote_aware ? block_end : from);
+        }
+    }
+
+    auto DelimiterScanner::reset(size_t pos, QuoteState new_state) -> void
+    {
+        block_start = pos;
+        block_end = pos;
+        stops = 0;
+        state = new_state;
+        is_escaping = false;
+    }
+
+    auto DelimiterScanner::scan_block(size_t start) -> void
+    {
+        // The last block is padded out with bytes that are never delimiters
+        const char* block = text.data() + start;
+        size_t length = std::min(config::SCAN_BLOCK_SIZE, text.size() - start);
+        char padded[config::SCAN_BLOCK_SIZE] = {};
+        if (length < config::SCAN_BLOCK_SIZE)
+        {
+            std::memcpy(padded, block, length);
+            block = padded;
+        }
+
+        ScanMasks masks;
+        get_block_classifier()(block, delimiters, masks);
+
+        block_start = start;
+        block_end = start + length;
+        stops = is_quote_aware ? resolve_quoted_stops(masks, state, is_escaping) : masks.delimiters;
+        if (length < config::SCAN_BLOCK_SIZE)
+        {
+            stops &= (1ULL << length) - 1;
+        }
+    }
+
+    auto get_block_classifier() -> ClassifyFunction
+    {
+        static const ClassifyFunction classifier = []() -> ClassifyFunction
+        {
+#if defined(__x86_64__)
+            // SSE2 is part of x86-64 itself
+            return __builtin_cpu_supports("avx2") ? classify_block_avx2 : classify_block_sse2;
+#else
+            return classify_block_scalar;
+#endif
+        }();
+
+        return classifier;
+    }
+
+    auto classify_block_scalar(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void
+    {
+        for (size_t i = 0; i < config::SCAN_BLOCK_SIZE; i++)
+        {
+            char c = block[i];
+            uint64_t bit = 1ULL << i;
+            masks.single_quotes |= (c == '\'') ? bit : 0;
+            masks.double_quotes |= (c == '\"') ? bit : 0;
+            masks.backslashes |= (c == '\\') ? bit : 0;
+            masks.delimiters |= (delimiters.find(c) != std::string_view::npos) ? bit : 0;
+        }
+    }
+
+#if defined(__x86_64__)
+    auto classify_block_sse2(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void
+    {
+        __m128i chunks[4];
+        for (int i = 0; i < 4; i++)
+        {
+            chunks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        }
+
+        uint64_t* targets[] = {&masks.single_quotes, &masks.double_quotes, &masks.backslashes};
+        const char needles[] = {'\'', '\"', '\\'};
+        for (size_t n = 0; n < 3 + delimiters.size(); n++)
+        {
+            __m128i needle = _mm_set1_epi8((n < 3) ? needles[n] : delimiters[n - 3]);
+            uint64_t bits = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi8(chunks[i], needle));
+                bits |= static_cast<uint64_t>(matches) << (16 * i);
+            }
+            *((n < 3) ? targets[n] : &masks.delimiters) |= bits;
+        }
+    }
+
+    __attribute__((target("avx2"))) auto classify_block_avx2(const char* block,
+                                                             std::string_view delimiters,
+                                                             ScanMasks& masks) -> void
+    {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+
+        uint64_t* targets[] = {&masks.single_quotes, &masks.double_quotes, &masks.backslashes};
+        const char needles[] = {'\'', '\"', '\\'};
+        for (size_t n = 0; n < 3 + delimiters.size(); n++)
+        {
+            __m256i needle = _mm256_set1_epi8((n < 3) ? needles[n] : delimiters[n - 3]);
+            uint32_t low_matches = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle));
+            uint32_t high_matches = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, needle));
+            *((n < 3) ? targets[n] : &masks.delimiters) |=
+                static_cast<uint64_t>(high_matches) << 32 | low_matches;
+        }
+    }
+#else
+    auto classify_block_sse2(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void
+    {
+        classify_block_scalar(block, delimiters, masks);
+    }
+
+    auto classify_block_avx2(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void
+    {
+        classify_block_scalar(block, delimiters, masks);
+    }
+#endif
+
+    auto resolve_quoted_stops(const ScanMasks& masks, QuoteState& state, bool& is_escaping)
+        -> uint64_t
+    {
+        // NOTE(abi): only quotes and backslashes can change the state, and they are rare,
+        // so those bits are walked in order. Every quote that opens or closes a region
+        // marks a toggle; the prefix XOR of the toggles then covers each region.
+        uint64_t escaped = is_escaping ? 1 : 0;
+        uint64_t active_backslashes = 0;
+        uint64_t toggles = 0;
+        bool was_quoted = (state != QuoteState::NONE);
+        is_escaping = false;
+
+        uint64_t events = masks.single_quotes | masks.double_quotes | masks.backslashes;
+        events &= ~escaped;
+        while (events != 0)
+        {
+            uint64_t bit = events & -events;
+            events ^= bit;
+
+            if ((masks.backslashes & bit) != 0)
+            {
+                if (state == QuoteState::SINGLE)
+                {
+                    continue;
+                }
+
+                active_backslashes |= bit;
+                if (bit == 1ULL << 63)
+                {
+                    is_escaping = true;
+                }
+                escaped |= bit << 1;
+                events &= ~(bit << 1);
+            }
+            else if ((masks.single_quotes & bit) != 0 && state != QuoteState::DOUBLE)
+            {
+                state = (state == QuoteState::NONE) ? QuoteState::SINGLE : QuoteState::NONE;
+                toggles |= bit;
+            }
+            else if ((masks.double_quotes & bit) != 0 && state != QuoteState::SINGLE)
+            {
+                state = (state == QuoteState::NONE) ? QuoteState::DOUBLE : QuoteState::NONE;
+                toggles |= bit;
+            }
+        }
+
+        uint64_t quoted = get_prefix_xor(toggles) ^ (was_quoted ? ~0ULL : 0);
+        uint64_t delimiters = masks.delimiters & ~masks.backslashes & ~quoted & ~escaped;
+        return delimiters | (masks.delimiters & active_backslashes);
+    }
+
+    auto get_prefix_xor(uint64_t bits) -> uint64_t
+    {
+        // Each bit becomes the XOR of itself and every bit below it
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+} // namespace ash
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace ash
+{
+
+    enum class QuoteState : uint8_t
+    {
+        NONE,
+        SINGLE,
+        DOUBLE
+    };
+
+    // The bytes of one block that matter for quoting, one bit each
+    struct ScanMasks
+    {
+        uint64_t single_quotes = 0;
+        uint64_t double_quotes = 0;
+        uint64_t backslashes = 0;
+        uint64_t delimiters = 0;
+    };
+
+    using ClassifyFunction = void (*)(const char* block, std::string_view delimiters,
+                                      ScanMasks& masks);
+
+    // NOTE(abi): finds delimiters a block of input at a time instead of a byte at a
+    // time. Blocks are classified with SIMD compares; quoted regions are then filled in
+    // from the few quote and backslash bits alone. Quote-aware scanners only stop at
+    // delimiters outside quotes and escapes (and at backslashes that escape something,
+    // when '\\' is a delimiter); raw ones stop at every delimiter, and callers track
+    // quoting themselves.
+    struct DelimiterScanner
+    {
+        std::string_view text;
+        std::string_view delimiters;
+        bool is_quote_aware = true;
+        size_t block_start = 0;
+        size_t block_end = 0; // Nothing is known about the text past it yet
+        uint64_t stops = 0;
+        QuoteState state = QuoteState::NONE; // At block_end
+        bool is_escaping = false;            // The block ended on an active backslash
+
+        auto next(size_t from) -> size_t;
+        auto reset(size_t pos, QuoteState new_state = QuoteState::NONE) -> void;
+        auto scan_block(size_t start) -> void;
+    };
+
+    // Classification
+    auto get_block_classifier() -> ClassifyFunction;
+    auto classify_block_scalar(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void;
+    auto classify_block_sse2(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void;
+    auto classify_block_avx2(const char* block, std::string_view delimiters, ScanMasks& masks)
+        -> void;
+
+    // Quotes
+    auto resolve_quoted_stops(const ScanMasks& masks, QuoteState& state, bool& is_escaping)
+        -> uint64_t;
+    auto get_prefix_xor(uint64_t bits) -> uint64_t;
+
+} // namespace ash
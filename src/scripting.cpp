@@ -0,0 +1,970 @@
+#include "scripting.hpp"
+#include "commands.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    // NOTE(abi): these builtins run inside loops, so the common paths work on the
+    // argument strings in place and write through fixed buffers instead of
+    // allocating.
+
+    struct TestExpressionParser
+    {
+        const std::vector<std::string>& args;
+        size_t pos;
+        size_t end;
+        bool has_error = false;
+
+        auto parse_or() -> bool
+        {
+            bool result = parse_and();
+            while (!has_error && pos < end && args[pos] == "-o")
+            {
+                pos++;
+                result = parse_and() || result;
+            }
+            return result;
+        }
+
+        auto parse_and() -> bool
+        {
+            bool result = parse_not();
+            while (!has_error && pos < end && args[pos] == "-a")
+            {
+                pos++;
+                result = parse_not() && result;
+            }
+            return result;
+        }
+
+        auto parse_not() -> bool
+        {
+            if (pos < end && args[pos] == "!")
+            {
+                pos++;
+                return !parse_not();
+            }
+            return parse_primary();
+        }
+
+        auto parse_primary() -> bool
+        {
+            if (pos >= end)
+            {
+                has_error = true;
+                return false;
+            }
+
+            if (args[pos] == "(")
+            {
+                pos++;
+                bool result = parse_or();
+                if (pos >= end || args[pos] != ")")
+                {
+                    has_error = true;
+                    return false;
+                }
+                pos++;
+                return result;
+            }
+
+            int status = -1;
+            if (pos + 2 < end && is_binary_test_operator(args[pos + 1]))
+            {
+                status = evaluate_binary_test(args[pos], args[pos + 1], args[pos + 2]);
+                pos += 3;
+            }
+            else if (pos + 1 < end && is_unary_test_operator(args[pos]))
+            {
+                status = evaluate_unary_test(args[pos], args[pos + 1]);
+                pos += 2;
+            }
+            else
+            {
+                status = args[pos].empty() ? 1 : 0;
+                pos++;
+            }
+
+            has_error = has_error || status == 2;
+            return status == 0;
+        }
+    };
+
+    struct PrintfOutput
+    {
+        char buffer[4096];
+        size_t size = 0;
+
+        auto append(const char* data, size_t length) -> void
+        {
+            if (size + length > sizeof(buffer))
+            {
+                flush();
+            }
+
+            if (length > sizeof(buffer))
+            {
+                write_all(STDOUT_FILENO, data, length);
+                return;
+            }
+
+            std::memcpy(buffer + size, data, length);
+            size += length;
+        }
+
+        auto append(char c) -> void
+        {
+            append(&c, 1);
+        }
+
+        auto append_padded(const char* data, size_t length, int width, bool left_align) -> void
+        {
+            size_t padding = 0;
+            if (width > 0 && static_cast<size_t>(width) > length)
+            {
+                padding = width - length;
+            }
+            if (!left_align)
+            {
+                for (size_t i = 0; i < padding; i++)
+                {
+                    append(' ');
+                }
+            }
+
+            append(data, length);
+
+            if (left_align)
+            {
+                for (size_t i = 0; i < padding; i++)
+                {
+                    append(' ');
+                }
+            }
+        }
+
+        auto flush() -> void
+        {
+            write_all(STDOUT_FILENO, buffer, size);
+            size = 0;
+        }
+    };
+
+    auto negate_test_status(int status) -> int
+    {
+        return (status == 2) ? 2 : 1 - status;
+    }
+
+    auto parse_test_integer(const std::string& str, long long& value) -> bool
+    {
+        const char* begin = str.data();
+        const char* end = str.data() + str.size();
+        while (begin < end && (*begin == ' ' || *begin == '\t'))
+        {
+            begin++;
+        }
+        if (begin < end && *begin == '+')
+        {
+            begin++;
+        }
+
+        auto [ptr, error] = std::from_chars(begin, end, value);
+        while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+        {
+            ptr++;
+        }
+
+        if (error != std::errc() || ptr != end)
+        {
+            std::cerr << "test: " << str << ": integer expression expected" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    auto test_command(const std::vector<std::string>& args) -> int
+    {
+        return evaluate_test(args, 0, args.size());
+    }
+
+    auto bracket_test_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.empty() || args.back() != "]")
+        {
+            std::cerr << "[: missing `]'" << std::endl;
+            return 2;
+        }
+
+        return evaluate_test(args, 0, args.size() - 1);
+    }
+
+    auto evaluate_test(const std::vector<std::string>& args, size_t begin, size_t end) -> int
+    {
+        // NOTE(abi): POSIX decides up to four arguments by their count alone, which
+        // keeps things like `[ "$x" = "!" ]` unambiguous.
+        auto at = [&](size_t i) -> const std::string& { return args[begin + i]; };
+
+        switch (end - begin)
+        {
+        case 0:
+            return 1;
+        case 1:
+            return at(0).empty() ? 1 : 0;
+        case 2:
+            if (at(0) == "!")
+            {
+                return negate_test_status(evaluate_test(args, begin + 1, end));
+            }
+            if (is_unary_test_operator(at(0)))
+            {
+                return evaluate_unary_test(at(0), at(1));
+            }
+            break;
+        case 3:
+            if (is_binary_test_operator(at(1)))
+            {
+                return evaluate_binary_test(at(0), at(1), at(2));
+            }
+            if (at(1) == "-a" || at(1) == "-o")
+            {
+                break;
+            }
+            if (at(0) == "!")
+            {
+                return negate_test_status(evaluate_test(args, begin + 1, end));
+            }
+            if (at(0) == "(" && at(2) == ")")
+            {
+                return evaluate_test(args, begin + 1, end - 1);
+            }
+            break;
+        case 4:
+            if (at(0) == "!")
+            {
+                return negate_test_status(evaluate_test(args, begin + 1, end));
+            }
+            if (at(0) == "(" && at(3) == ")")
+            {
+                return evaluate_test(args, begin + 1, end - 1);
+            }
+            break;
+        default:
+            break;
+        }
+
+        TestExpressionParser parser{args, begin, end};
+        bool result = parser.parse_or();
+        if (parser.has_error || parser.pos != end)
+        {
+            if (!parser.has_error)
+            {
+                std::cerr << "test: too many arguments" << std::endl;
+            }
+            return 2;
+        }
+
+        return result ? 0 : 1;
+    }
+
+    auto evaluate_unary_test(const std::string& op, const std::string& operand) -> int
+    {
+        if (op == "-n")
+        {
+            return operand.empty() ? 1 : 0;
+        }
+
+        if (op == "-z")
+        {
+            return operand.empty() ? 0 : 1;
+        }
+
+        if (op == "-t")
+        {
+            long long fd = 0;
+            if (!parse_test_integer(operand, fd))
+            {
+                return 2;
+            }
+            return isatty(static_cast<int>(fd)) ? 0 : 1;
+        }
+
+        if (op == "-r" || op == "-w" || op == "-x")
+        {
+            int mode = (op == "-r") ? R_OK : (op == "-w") ? W_OK : X_OK;
+            return access(operand.c_str(), mode) == 0 ? 0 : 1;
+        }
+
+        struct stat file_stat;
+        bool is_link_test = (op == "-L" || op == "-h");
+        int result = is_link_test ? lstat(operand.c_str(), &file_stat)
+                                  : stat(operand.c_str(), &file_stat);
+        if (result != 0)
+        {
+            return 1;
+        }
+
+        mode_t mode = file_stat.st_mode;
+        bool is_true = false;
+        switch (op[1])
+        {
+        case 'e':
+            is_true = true;
+            break;
+        case 'f':
+            is_true = S_ISREG(mode);
+            break;
+        case 'd':
+            is_true = S_ISDIR(mode);
+            break;
+        case 'b':
+            is_true = S_ISBLK(mode);
+            break;
+        case 'c':
+            is_true = S_ISCHR(mode);
+            break;
+        case 'p':
+            is_true = S_ISFIFO(mode);
+            break;
+        case 'S':
+            is_true = S_ISSOCK(mode);
+            break;
+        case 'L':
+        case 'h':
+            is_true = S_ISLNK(mode);
+            break;
+        case 's':
+            is_true = file_stat.st_size > 0;
+            break;
+        case 'g':
+            is_true = (mode & S_ISGID) != 0;
+            break;
+        case 'u':
+            is_true = (mode & S_ISUID) != 0;
+            break;
+        case 'k':
+            is_true = (mode & S_ISVTX) != 0;
+            break;
+        case 'O':
+            is_true = file_stat.st_uid == geteuid();
+            break;
+        case 'G':
+            is_true = file_stat.st_gid == getegid();
+            break;
+        default:
+            break;
+        }
+
+        return is_true ? 0 : 1;
+    }
+
+    auto evaluate_binary_test(const std::string& lhs, const std::string& op,
+                              const std::string& rhs) -> int
+    {
+        if (op == "=" || op == "==")
+        {
+            return lhs == rhs ? 0 : 1;
+        }
+        if (op == "!=")
+        {
+            return lhs != rhs ? 0 : 1;
+        }
+        if (op == "<")
+        {
+            return lhs < rhs ? 0 : 1;
+        }
+        if (op == ">")
+        {
+            return lhs > rhs ? 0 : 1;
+        }
+
+        // File comparisons
+        if (op == "-nt" || op == "-ot" || op == "-ef")
+        {
+            struct stat lhs_stat;
+            struct stat rhs_stat;
+            bool has_lhs = stat(lhs.c_str(), &lhs_stat) == 0;
+            bool has_rhs = stat(rhs.c_str(), &rhs_stat) == 0;
+
+            if (op == "-ef")
+            {
+                return (has_lhs && has_rhs && lhs_stat.st_dev == rhs_stat.st_dev
+                        && lhs_stat.st_ino == rhs_stat.st_ino)
+                           ? 0
+                           : 1;
+            }
+
+            auto mtime = [](const struct stat& file_stat)
+            { return file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec; };
+            bool is_newer = has_lhs && (!has_rhs || mtime(lhs_stat) > mtime(rhs_stat));
+            bool is_older = has_rhs && (!has_lhs || mtime(lhs_stat) < mtime(rhs_stat));
+            return ((op == "-nt") ? is_newer : is_older) ? 0 : 1;
+        }
+
+        // Integer comparisons
+        long long lhs_value = 0;
+        long long rhs_value = 0;
+        if (!parse_test_integer(lhs, lhs_value) || !parse_test_integer(rhs, rhs_value))
+        {
+            return 2;
+        }
+
+        bool is_true = false;
+        switch (op[1] << 8 | op[2])
+        {
+        case 'e' << 8 | 'q':
+            is_true = lhs_value == rhs_value;
+            break;
+        case 'n' << 8 | 'e':
+            is_true = lhs_value != rhs_value;
+            break;
+        case 'l' << 8 | 't':
+            is_true = lhs_value < rhs_value;
+            break;
+        case 'l' << 8 | 'e':
+            is_true = lhs_value <= rhs_value;
+            break;
+        case 'g' << 8 | 't':
+            is_true = lhs_value > rhs_value;
+            break;
+        case 'g' << 8 | 'e':
+            is_true = lhs_value >= rhs_value;
+            break;
+        default:
+            break;
+        }
+
+        return is_true ? 0 : 1;
+    }
+
+    auto is_unary_test_operator(const std::string& op) -> bool
+    {
+        if (op.size() != 2 || op[0] != '-')
+        {
+            return false;
+        }
+
+        return std::strchr("nztrwxefdbcpSLhsgukOG", op[1]) != nullptr;
+    }
+
+    auto is_binary_test_operator(const std::string& op) -> bool
+    {
+        static const char* const operators[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne",
+                                                "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+        for (const char* candidate : operators)
+        {
+            if (op == candidate)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Decodes the escape sequence at str[i] ('\' included) into decoded, leaving i
+    // on its last character. Returns false for \c, which stops all further output.
+    auto decode_printf_escape(const std::string& str, size_t& i, char (&decoded)[2],
+                              size_t& length) -> bool
+    {
+        length = 1;
+        if (i + 1 >= str.size())
+        {
+            decoded[0] = '\\';
+            return true;
+        }
+
+        char c = str[++i];
+        switch (c)
+        {
+        case 'n':
+            decoded[0] = '\n';
+            return true;
+        case 't':
+            decoded[0] = '\t';
+            return true;
+        case 'r':
+            decoded[0] = '\r';
+            return true;
+        case 'a':
+            decoded[0] = '\a';
+            return true;
+        case 'b':
+            decoded[0] = '\b';
+            return true;
+        case 'f':
+            decoded[0] = '\f';
+            return true;
+        case 'v':
+            decoded[0] = '\v';
+            return true;
+        case 'e':
+            decoded[0] = '\x1b';
+            return true;
+        case '\\':
+        case '\"':
+        case '\'':
+            decoded[0] = c;
+            return true;
+        case 'c':
+            length = 0;
+            return false;
+        case 'x':
+        {
+            int value = 0;
+            int digits = 0;
+            while (digits < 2 && i + 1 < str.size() && std::isxdigit(str[i + 1]))
+            {
+                char hex = str[++i];
+                value = value * 16 + (std::isdigit(hex) ? hex - '0' : std::tolower(hex) - 'a' + 10);
+                digits++;
+            }
+            decoded[0] = (digits > 0) ? static_cast<char>(value) : 'x';
+            return true;
+        }
+        default:
+            break;
+        }
+
+        if (c >= '0' && c <= '7')
+        {
+            // \NNN, and \0NNN as accepted by %b
+            int value = c - '0';
+            int max_digits = (c == '0') ? 3 : 2;
+            for (int digits = 0; digits < max_digits && i + 1 < str.size() && str[i + 1] >= '0'
+                                 && str[i + 1] <= '7';
+                 digits++)
+            {
+                value = value * 8 + (str[++i] - '0');
+            }
+            decoded[0] = static_cast<char>(value);
+            return true;
+        }
+
+        decoded[0] = '\\';
+        decoded[1] = c;
+        length = 2;
+        return true;
+    }
+
+    auto parse_printf_number(const std::string* arg, bool is_float, int& status)
+        -> std::pair<long long, double>
+    {
+        if (arg == nullptr || arg->empty())
+        {
+            return {0, 0.0};
+        }
+
+        // 'c and "c give the character's code
+        if ((*arg)[0] == '\'' || (*arg)[0] == '\"')
+        {
+            unsigned char code = arg->size() > 1 ? (*arg)[1] : 0;
+            return {code, static_cast<double>(code)};
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        long long integer_value = 0;
+        double float_value = 0.0;
+        if (is_float)
+        {
+            float_value = std::strtod(arg->c_str(), &end);
+        }
+        else if ((*arg)[0] == '-')
+        {
+            integer_value = std::strtoll(arg->c_str(), &end, 0);
+        }
+        else
+        {
+            integer_value = static_cast<long long>(std::strtoull(arg->c_str(), &end, 0));
+        }
+
+        if (*end != '\0' || errno == ERANGE)
+        {
+            std::cerr << "printf: " << *arg << ": invalid number" << std::endl;
+            status = 1;
+        }
+
+        return {integer_value, float_value};
+    }
+
+    auto printf_command(const std::vector<std::string>& args) -> int
+    {
+        if (args.empty())
+        {
+            std::cerr << "printf: usage: printf format [arguments]" << std::endl;
+            return 2;
+        }
+
+        const std::string& format = args[0];
+        PrintfOutput output;
+        size_t arg_index = 1;
+        int status = 0;
+
+        auto next_argument = [&]() -> const std::string*
+        { return (arg_index < args.size()) ? &args[arg_index++] : nullptr; };
+
+        // NOTE(abi): the format is reused for as long as it keeps consuming arguments.
+        size_t consumed_before;
+        do
+        {
+            consumed_before = arg_index;
+
+            for (size_t i = 0; i < format.size(); i++)
+            {
+                char c = format[i];
+                if (c == '\\')
+                {
+                    char decoded[2];
+                    size_t decoded_length = 0;
+                    bool keep_going = decode_printf_escape(format, i, decoded, decoded_length);
+                    output.append(decoded, decoded_length);
+                    if (!keep_going)
+                    {
+                        output.flush();
+                        return status;
+                    }
+                    continue;
+                }
+
+                if (c != '%' || i + 1 >= format.size())
+                {
+                    output.append(c);
+                    continue;
+                }
+
+                if (format[i + 1] == '%')
+                {
+                    output.append('%');
+                    i++;
+                    continue;
+                }
+
+                // %[flags][width][.precision]conversion
+                char spec[48];
+                size_t spec_length = 0;
+                spec[spec_length++] = '%';
+                bool left_align = false;
+                while (++i < format.size() && std::strchr("-+ #0", format[i]) != nullptr
+                       && spec_length < 8)
+                {
+                    left_align = left_align || format[i] == '-';
+                    spec[spec_length++] = format[i];
+                }
+
+                int width = -1;
+                int precision = -1;
+                if (i < format.size() && format[i] == '*')
+                {
+                    width = static_cast<int>(
+                        parse_printf_number(next_argument(), false, status).first);
+                    i++;
+                }
+                else
+                {
+                    for (; i < format.size() && std::isdigit(format[i]); i++)
+                    {
+                        width = std::max(width, 0) * 10 + (format[i] - '0');
+                    }
+                }
+
+                if (i < format.size() && format[i] == '.')
+                {
+                    precision = 0;
+                    if (++i < format.size() && format[i] == '*')
+                    {
+                        precision = static_cast<int>(
+                            parse_printf_number(next_argument(), false, status).first);
+                        i++;
+                    }
+                    else
+                    {
+                        for (; i < format.size() && std::isdigit(format[i]); i++)
+                        {
+                            precision = precision * 10 + (format[i] - '0');
+                        }
+                    }
+                }
+
+                if (i >= format.size())
+                {
+                    std::cerr << "printf: missing format character" << std::endl;
+                    output.flush();
+                    return 1;
+                }
+
+                if (width < 0 && width != -1)
+                {
+                    left_align = true;
+                    width = -width;
+                }
+                if (width >= 0)
+                {
+                    spec_length += std::snprintf(spec + spec_length, sizeof(spec) - spec_length,
+                                                 "%d", width);
+                }
+                if (precision >= 0)
+                {
+                    spec_length += std::snprintf(spec + spec_length, sizeof(spec) - spec_length,
+                                                 ".%d", precision);
+                }
+
+                char conversion = format[i];
+                const std::string* arg = nullptr;
+                char number[512];
+                int number_length = 0;
+
+                switch (conversion)
+                {
+                case 's':
+                {
+                    arg = next_argument();
+                    size_t length = arg ? arg->size() : 0;
+                    if (precision >= 0)
+                    {
+                        length = std::min(length, static_cast<size_t>(precision));
+                    }
+                    output.append_padded(arg ? arg->data() : "", length, width, left_align);
+                    continue;
+                }
+                case 'b':
+                {
+                    arg = next_argument();
+                    std::string expanded;
+                    bool keep_going = true;
+                    for (size_t j = 0; arg != nullptr && j < arg->size() && keep_going; j++)
+                    {
+                        char decoded[2] = {(*arg)[j], '\0'};
+                        size_t decoded_length = 1;
+                        if (decoded[0] == '\\')
+                        {
+                            keep_going = decode_printf_escape(*arg, j, decoded, decoded_length);
+                        }
+                        expanded.append(decoded, decoded_length);
+                    }
+
+                    output.append_padded(expanded.data(), expanded.size(), width, left_align);
+                    if (!keep_going)
+                    {
+                        output.flush();
+                        return status;
+                    }
+                    continue;
+                }
+                case 'c':
+                {
+                    arg = next_argument();
+                    char character = (arg && !arg->empty()) ? (*arg)[0] : '\0';
+                    output.append_padded(&character, (arg && !arg->empty()) ? 1 : 0, width,
+                                         left_align);
+                    continue;
+                }
+                case 'd':
+                case 'i':
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                {
+                    long long value = parse_printf_number(next_argument(), false, status).first;
+                    spec[spec_length++] = 'l';
+                    spec[spec_length++] = 'l';
+                    spec[spec_length++] = conversion;
+                    spec[spec_length] = '\0';
+                    number_length = std::snprintf(number, sizeof(number), spec, value);
+                    break;
+                }
+                case 'f':
+                case 'F':
+                case 'e':
+                case 'E':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A':
+                {
+                    double value = parse_printf_number(next_argument(), true, status).second;
+                    spec[spec_length++] = conversion;
+                    spec[spec_length] = '\0';
+                    number_length = std::snprintf(number, sizeof(number), spec, value);
+                    break;
+                }
+                default:
+                    std::cerr << "printf: %" << conversion << ": invalid format character"
+                              << std::endl;
+                    output.flush();
+                    return 1;
+                }
+
+                output.append(number, std::min(static_cast<size_t>(std::max(number_length, 0)),
+                                               sizeof(number) - 1));
+            }
+        } while (arg_index < args.size() && arg_index > consumed_before);
+
+        output.flush();
+        return status;
+    }
+
+    auto read_command(const std::vector<std::string>& args) -> int
+    {
+        bool raw = false;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            if (args[i] == "-r")
+            {
+                raw = true;
+            }
+            else if (args[i] == "-p" && i + 1 < args.size())
+            {
+                if (isatty(STDIN_FILENO))
+                {
+                    std::cerr << args[++i];
+                }
+                else
+                {
+                    i++;
+                }
+            }
+            else if (!is_valid_variable_name(args[i]))
+            {
+                std::cerr << "read: `" << args[i] << "': not a valid identifier" << std::endl;
+                return 2;
+            }
+            else
+            {
+                names.push_back(args[i]);
+            }
+        }
+
+        std::string line;
+        std::vector<bool> escaped; // One per byte of line
+        bool has_newline = read_line_from_fd(STDIN_FILENO, line, escaped, raw);
+
+        if (names.empty())
+        {
+            set_variable("REPLY", line);
+            return has_newline ? 0 : 1;
+        }
+
+        // NOTE(abi): without -r, read_line_from_fd() flags escaped characters so that
+        // they don't act as separators.
+        auto ifs = get_variable("IFS");
+        std::string separators = ifs.has_value() ? *ifs : " \t\n";
+        auto is_separator = [&](size_t pos)
+        { return !escaped[pos] && separators.find(line[pos]) != std::string::npos; };
+
+        size_t pos = 0;
+        for (size_t name_index = 0; name_index < names.size(); name_index++)
+        {
+            while (pos < line.size() && is_separator(pos))
+            {
+                pos++;
+            }
+
+            // The last name takes the rest of the line
+            if (name_index == names.size() - 1)
+            {
+                size_t end = line.size();
+                while (end > pos && is_separator(end - 1))
+                {
+                    end--;
+                }
+                set_variable(names[name_index], line.substr(pos, end - pos));
+                break;
+            }
+
+            size_t field_start = pos;
+            while (pos < line.size() && !is_separator(pos))
+            {
+                pos++;
+            }
+            set_variable(names[name_index], line.substr(field_start, pos - field_start));
+        }
+
+        return has_newline ? 0 : 1;
+    }
+
+    auto read_line_from_fd(int fd, std::string& line, std::vector<bool>& escaped, bool raw)
+        -> bool
+    {
+        // NOTE(abi): the rest of the input belongs to whatever runs next, so we never
+        // consume past the newline. Regular files are read in blocks and seeked back,
+        // terminals already hand out a line per read(), and only pipes fall back to
+        // single bytes.
+        struct stat file_stat;
+        bool is_seekable = fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+        bool is_line_buffered = isatty(fd);
+
+        char buffer[4096];
+        bool is_escaped = false;
+        while (true)
+        {
+            size_t request_size = (is_seekable || is_line_buffered) ? sizeof(buffer) : 1;
+            ssize_t n = read(fd, buffer, request_size);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return false;
+            }
+
+            for (ssize_t i = 0; i < n; i++)
+            {
+                char c = buffer[i];
+                if (is_escaped)
+                {
+                    is_escaped = false;
+                    if (c != '\n')
+                    {
+                        line += c;
+                        escaped.push_back(true);
+                    }
+                    continue;
+                }
+
+                if (c == '\\' && !raw)
+                {
+                    is_escaped = true;
+                    continue;
+                }
+
+                if (c == '\n')
+                {
+                    if (is_seekable && i + 1 < n)
+                    {
+                        lseek(fd, i + 1 - n, SEEK_CUR);
+                    }
+                    return true;
+                }
+
+                line += c;
+                escaped.push_back(false);
+            }
+        }
+    }
+
+} // namespace ash
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // Builtin commands
+    auto test_command(const std::vector<std::string>& args) -> int;
+    auto bracket_test_command(const std::vector<std::string>& args) -> int;
+    auto printf_command(const std::vector<std::string>& args) -> int;
+    auto read_command(const std::vector<std::string>& args) -> int;
+
+    // test / [
+    auto evaluate_test(const std::vector<std::string>& args, size_t begin, size_t end) -> int;
+    auto evaluate_unary_test(const std::string& op, const std::string& operand) -> int;
+    auto evaluate_binary_test(const std::string& lhs, const std::string& op,
+                              const std::string& rhs) -> int;
+    auto is_unary_test_operator(const std::string& op) -> bool;
+    auto is_binary_test_operator(const std::string& op) -> bool;
+
+    // read
+    auto read_line_from_fd(int fd, std::string& line, std::vector<bool>& escaped, bool raw)
+        -> bool;
+
+} // namespace ash
@@ -0,0 +1,344 @@
+#include "server.hpp"
+#include "constants.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <poll.h>
+    #include <sys/signalfd.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto run_server(const std::string& socket_path) -> int
+    {
+        // Workers mix builtin and child output on the same fds. There's no readline or
+        // history to set up, serving requests is all a server does.
+        std::cout << std::unitbuf;
+        std::cerr << std::unitbuf;
+
+        // NOTE(abi): child exits and shutdown requests arrive through a signalfd, so
+        // the loop below is the only place they are handled and workers are answered
+        // as soon as they finish.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+        int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+        int listen_fd = open_server_socket(socket_path);
+        if (signal_fd == -1 || listen_fd == -1)
+        {
+            std::cerr << "ash: --server: " << socket_path << ": " << std::strerror(errno)
+                      << std::endl;
+            return 1;
+        }
+
+        std::vector<ServerWorker> workers;
+        std::vector<PendingConnection> pending;
+        bool is_running = true;
+        while (is_running)
+        {
+            // NOTE(abi): a request is only read once it has arrived, so a client that
+            // connects and says nothing holds up no one. It's dropped at its deadline.
+            std::vector<struct pollfd> poll_fds = {{signal_fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+            int timeout_ms = -1;
+            auto now = std::chrono::steady_clock::now();
+            for (const PendingConnection& connection : pending)
+            {
+                poll_fds.push_back({connection.connection_fd, POLLIN, 0});
+                auto remaining =
+                    std::chrono::ceil<std::chrono::milliseconds>(connection.deadline - now);
+                int remaining_ms = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+                timeout_ms = (timeout_ms == -1) ? remaining_ms : std::min(timeout_ms, remaining_ms);
+            }
+
+            // A client hanging up takes its worker down
+            size_t first_worker = poll_fds.size();
+            std::vector<pid_t> polled_pids;
+            for (const ServerWorker& worker : workers)
+            {
+                if (!worker.is_abandoned)
+                {
+                    poll_fds.push_back({worker.connection_fd, 0, 0});
+                    polled_pids.push_back(worker.pid);
+                }
+            }
+
+            if (poll(poll_fds.data(), poll_fds.size(), timeout_ms) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+            {
+                is_running = is_running && info.ssi_signo == SIGCHLD;
+            }
+
+            for (size_t i = first_worker; i < poll_fds.size(); i++)
+            {
+                if ((poll_fds[i].revents & (POLLHUP | POLLERR)) == 0)
+                {
+                    continue;
+                }
+
+                pid_t pid = polled_pids[i - first_worker];
+                kill(-pid, SIGTERM);
+                for (ServerWorker& worker : workers)
+                {
+                    worker.is_abandoned = worker.is_abandoned || worker.pid == pid;
+                }
+            }
+            reap_server_workers(workers);
+
+            // Backwards, so the connections before i still line up with their poll_fds
+            now = std::chrono::steady_clock::now();
+            for (size_t i = pending.size(); i-- > 0;)
+            {
+                PendingConnection connection = pending[i];
+                bool is_ready = poll_fds[2 + i].revents != 0;
+                if (!is_ready && now < connection.deadline)
+                {
+                    continue;
+                }
+
+                pending.erase(pending.begin() + static_cast<ptrdiff_t>(i));
+                if (is_running && is_ready)
+                {
+                    start_server_request(listen_fd, connection.connection_fd, workers, pending);
+                }
+                else
+                {
+                    close(connection.connection_fd);
+                }
+            }
+
+            if (is_running && (poll_fds[1].revents & POLLIN) != 0)
+            {
+                accept_server_connection(listen_fd, pending);
+            }
+        }
+
+        for (const ServerWorker& worker : workers)
+        {
+            kill(-worker.pid, SIGTERM);
+            close(worker.connection_fd);
+        }
+        for (const PendingConnection& connection : pending)
+        {
+            close(connection.connection_fd);
+        }
+        close(listen_fd);
+        close(signal_fd);
+        unlink(socket_path.c_str());
+        return 0;
+    }
+
+    auto open_server_socket(const std::string& socket_path) -> int
+    {
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+        // A socket left behind by a server that didn't shut down cleanly
+        struct stat st;
+        if (stat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            unlink(socket_path.c_str());
+        }
+
+        int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+        {
+            return -1;
+        }
+
+        // NOTE(abi): connecting is enough to run commands as us, so the socket is created
+        // private to the user rather than chmod'ed after it's already reachable.
+        int buffer_size = config::SERVER_MAX_REQUEST_SIZE;
+        setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        mode_t previous_umask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+        bool is_bound =
+            bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+        umask(previous_umask);
+        if (!is_bound || listen(listen_fd, SOMAXCONN) == -1)
+        {
+            int error = errno;
+            close(listen_fd);
+            errno = error;
+            return -1;
+        }
+
+        return listen_fd;
+    }
+
+    auto accept_server_connection(int listen_fd, std::vector<PendingConnection>& pending) -> void
+    {
+        int connection_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection_fd == -1)
+        {
+            return;
+        }
+
+        // Only our own user, whatever the socket's permissions end up being
+        struct ucred credentials = {};
+        socklen_t credentials_size = sizeof(credentials);
+        bool is_trusted = getsockopt(connection_fd, SOL_SOCKET, SO_PEERCRED, &credentials,
+                                     &credentials_size) == 0
+                          && credentials.uid == geteuid();
+        if (!is_trusted)
+        {
+            close(connection_fd);
+            return;
+        }
+
+        // Clients send their request right after connecting, a silent one is dropped
+        auto timeout = std::chrono::seconds(config::SERVER_REQUEST_TIMEOUT_SECONDS);
+        pending.push_back({connection_fd, std::chrono::steady_clock::now() + timeout});
+    }
+
+    auto start_server_request(int listen_fd, int connection_fd, std::vector<ServerWorker>& workers,
+                              const std::vector<PendingConnection>& pending) -> void
+    {
+        ServerRequest request;
+        StandardFds fds;
+        if (!receive_server_request(connection_fd, request, fds))
+        {
+            close(connection_fd);
+            return;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listen_fd);
+            for (const ServerWorker& worker : workers)
+            {
+                close(worker.connection_fd);
+            }
+            for (const PendingConnection& connection : pending)
+            {
+                close(connection.connection_fd);
+            }
+            close(connection_fd);
+
+            exit(run_server_worker(request, fds));
+        }
+
+        for (int fd : fds)
+        {
+            close(fd);
+        }
+
+        if (pid == -1)
+        {
+            send_server_status(connection_fd, 1);
+            close(connection_fd);
+            return;
+        }
+
+        setpgid(pid, pid);
+        workers.push_back({pid, connection_fd});
+    }
+
+    auto run_server_worker(const ServerRequest& request, const StandardFds& fds) -> int
+    {
+        // Its own process group, so a client hanging up stops everything it started
+        setpgid(0, 0);
+
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, nullptr);
+
+        for (int fd = 0; fd < static_cast<int>(fds.size()); fd++)
+        {
+            dup2(fds[fd], fd);
+        }
+        for (int fd : fds)
+        {
+            if (fd > STDERR_FILENO)
+            {
+                close(fd);
+            }
+        }
+
+        // The client's environment and directory, as if it had started the shell
+        clearenv();
+        for (const std::string& variable : request.environment)
+        {
+            size_t equals = variable.find('=');
+            if (equals != std::string::npos && equals > 0)
+            {
+                setenv(variable.substr(0, equals).c_str(), variable.c_str() + equals + 1, 1);
+            }
+        }
+        forget_hashed_paths();
+
+        if (chdir(request.working_directory.c_str()) != 0)
+        {
+            std::cerr << "ash: " << request.working_directory << ": " << std::strerror(errno)
+                      << std::endl;
+            return 1;
+        }
+        shell_state->working_directory.clear(); // The client's, from its $PWD if that holds
+
+        if (!request.arguments.empty())
+        {
+            shell_state->shell_name = request.arguments[0];
+            shell_state->positional_parameters.assign(request.arguments.begin() + 1,
+                                                      request.arguments.end());
+        }
+
+        execute_line(request.command);
+        return shell_state->last_exit_status;
+    }
+
+    auto reap_server_workers(std::vector<ServerWorker>& workers) -> void
+    {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (auto it = workers.begin(); it != workers.end(); ++it)
+            {
+                if (it->pid == pid)
+                {
+                    send_server_status(it->connection_fd, get_exit_status(status));
+                    close(it->connection_fd);
+                    workers.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+
+} // namespace ash
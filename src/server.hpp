@@ -0,0 +1,47 @@
+#pragma once
+
+#include "server_protocol.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <sys/types.h>
+
+#endif
+
+namespace ash
+{
+
+    // A request being run, answered once its worker is reaped
+    struct ServerWorker
+    {
+        pid_t pid;
+        int connection_fd;
+        bool is_abandoned = false; // The client hung up, only the exit is left to reap
+    };
+
+    // A client that connected but hasn't sent its request yet
+    struct PendingConnection
+    {
+        int connection_fd;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // Server
+    auto run_server(const std::string& socket_path) -> int;
+    auto open_server_socket(const std::string& socket_path) -> int;
+    auto accept_server_connection(int listen_fd, std::vector<PendingConnection>& pending)
+        -> void;
+    auto start_server_request(int listen_fd, int connection_fd, std::vector<ServerWorker>& workers,
+                              const std::vector<PendingConnection>& pending) -> void;
+    auto run_server_worker(const ServerRequest& request, const StandardFds& fds) -> int;
+    auto reap_server_workers(std::vector<ServerWorker>& workers) -> void;
+
+} // namespace ash
@@ -0,0 +1,174 @@
+#include "server_protocol.hpp"
+#include "constants.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <sys/socket.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto encode_server_request(const ServerRequest& request) -> std::string
+    {
+        // NUL-terminated fields: magic, directory, command, argument count, arguments,
+        // then the environment up to the end
+        std::string data;
+        auto append_field = [&data](const std::string& field)
+        {
+            data += field;
+            data += '\0';
+        };
+
+        append_field(config::SERVER_PROTOCOL_MAGIC);
+        append_field(request.working_directory);
+        append_field(request.command);
+        append_field(std::to_string(request.arguments.size()));
+        for (const std::string& argument : request.arguments)
+        {
+            append_field(argument);
+        }
+        for (const std::string& variable : request.environment)
+        {
+            append_field(variable);
+        }
+
+        return data;
+    }
+
+    auto decode_server_request(const std::string& data, ServerRequest& request) -> bool
+    {
+        std::vector<std::string> fields;
+        for (size_t pos = 0; pos < data.size();)
+        {
+            size_t end = data.find('\0', pos);
+            if (end == std::string::npos)
+            {
+                return false;
+            }
+            fields.push_back(data.substr(pos, end - pos));
+            pos = end + 1;
+        }
+
+        size_t argument_count = 0;
+        if (fields.size() < 4 || fields[0] != config::SERVER_PROTOCOL_MAGIC)
+        {
+            return false;
+        }
+
+        auto [end, error] = std::from_chars(fields[3].data(), fields[3].data() + fields[3].size(),
+                                            argument_count);
+        if (error != std::errc() || argument_count > fields.size() - 4)
+        {
+            return false;
+        }
+
+        request.working_directory = std::move(fields[1]);
+        request.command = std::move(fields[2]);
+        request.arguments.assign(std::make_move_iterator(fields.begin() + 4),
+                                 std::make_move_iterator(fields.begin() + 4 + argument_count));
+        request.environment.assign(std::make_move_iterator(fields.begin() + 4 + argument_count),
+                                   std::make_move_iterator(fields.end()));
+        return true;
+    }
+
+    auto send_server_request(int socket_fd, const ServerRequest& request, const StandardFds& fds)
+        -> bool
+    {
+        std::string data = encode_server_request(request);
+        if (data.size() > config::SERVER_MAX_REQUEST_SIZE)
+        {
+            return false;
+        }
+
+        struct iovec iov = {data.data(), data.size()};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(header), fds.data(), sizeof(fds));
+
+        return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+    }
+
+    auto receive_server_request(int socket_fd, ServerRequest& request, StandardFds& fds) -> bool
+    {
+        std::string data(config::SERVER_MAX_REQUEST_SIZE, '\0');
+        struct iovec iov = {data.data(), data.size()};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        fds = {-1, -1, -1};
+        ssize_t bytes_received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        bool has_fds = bytes_received > 0 && header != nullptr && header->cmsg_level == SOL_SOCKET
+                       && header->cmsg_type == SCM_RIGHTS;
+        size_t fd_count = has_fds ? (header->cmsg_len - CMSG_LEN(0)) / sizeof(int) : 0;
+        if (has_fds)
+        {
+            std::memcpy(fds.data(), CMSG_DATA(header),
+                        std::min(fd_count, fds.size()) * sizeof(int));
+        }
+
+        // Whatever arrived is closed again when the request is unusable
+        bool is_valid = has_fds && fd_count == fds.size()
+                        && (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0;
+        data.resize(is_valid ? static_cast<size_t>(bytes_received) : 0);
+        if (!is_valid || !decode_server_request(data, request))
+        {
+            for (int& fd : fds)
+            {
+                if (fd != -1)
+                {
+                    close(fd);
+                }
+                fd = -1;
+            }
+            return false;
+        }
+
+        return true;
+    }
+
+    auto send_server_status(int socket_fd, int status) -> bool
+    {
+        int32_t value = status;
+        return send(socket_fd, &value, sizeof(value), MSG_NOSIGNAL) == sizeof(value);
+    }
+
+    auto receive_server_status(int socket_fd, int& status) -> bool
+    {
+        int32_t value = 0;
+        ssize_t bytes_received = recv(socket_fd, &value, sizeof(value), 0);
+        if (bytes_received != sizeof(value))
+        {
+            return false;
+        }
+
+        status = value;
+        return true;
+    }
+
+} // namespace ash
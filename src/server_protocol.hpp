@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace ash
+{
+
+    // NOTE(abi): one invocation for `ash --server`. It travels as a single
+    // SOCK_SEQPACKET message, together with the client's stdin, stdout and stderr
+    // passed as SCM_RIGHTS, and is answered with the exit status.
+    struct ServerRequest
+    {
+        std::string working_directory;
+        std::string command;
+        std::vector<std::string> arguments; // $0 first, when given
+        std::vector<std::string> environment;
+    };
+
+    using StandardFds = std::array<int, 3>;
+
+    // Encoding
+    auto encode_server_request(const ServerRequest& request) -> std::string;
+    auto decode_server_request(const std::string& data, ServerRequest& request) -> bool;
+
+    // Transport
+    auto send_server_request(int socket_fd, const ServerRequest& request, const StandardFds& fds)
+        -> bool;
+    auto receive_server_request(int socket_fd, ServerRequest& request, StandardFds& fds) -> bool;
+    auto send_server_status(int socket_fd, int status) -> bool;
+    auto receive_server_status(int socket_fd, int& status) -> bool;
+
+} // namespace ash
@@ -1,17 +1,37 @@
 #include "shell.hpp"
 #include "commands.hpp"
+#include "completion.hpp"
 #include "constants.hpp"
+#include "editor.hpp"
+#include "frecency.hpp"
+#include "interpreter.hpp"
+#include "io.hpp"
+#include "prompt.hpp"
+#include "snapshot.hpp"
 #include "state.hpp"
-
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <utility>
 
 #ifdef _WIN32
 // TODO(abi): ...
 
 #else
 
+    #include <fcntl.h>
     #include <readline/history.h>
     #include <readline/readline.h>
+    #include <sys/stat.h>
     #include <sys/wait.h>
     #include <unistd.h>
 
@@ -22,20 +42,39 @@ namespace ash
 
     auto initialize_shell() -> void
     {
+        shell_state->startup_phase_start = std::chrono::steady_clock::now();
+
         std::cout << std::unitbuf;
         std::cerr << std::unitbuf;
 
+        // NOTE(abi): a large HISTFILE shouldn't delay the first prompt. It's read on a
+        // background thread and merged in once ready, or when something needs it.
         auto histfile = get_histfile();
         if (histfile.has_value())
         {
-            load_history_from_file(histfile.value());
+            start_loading_history(histfile.value());
         }
+        record_startup_phase("history");
 
         ::rl_attempted_completion_function = command_completion;
+        ::rl_completer_word_break_characters = config::COMPLETION_WORD_BREAKS;
+        ::rl_completer_quote_characters = config::COMPLETION_QUOTES;
+        ::rl_char_is_quoted_p = is_completion_char_quoted;
+
+        // NOTE(abi): completions carry their own trailing slash, since readline would
+        // stat the escaped name to decide and mark plain directories twice.
+        ::rl_variable_bind("mark-directories", "off");
+        record_startup_phase("readline");
     }
 
     auto cleanup_shell() -> void
     {
+        // Nothing to append unless something was entered, so don't wait for the load
+        if (shell_state->command_history.size() > shell_state->command_history_last_write_index)
+        {
+            finish_loading_history(true);
+        }
+
         auto histfile = get_histfile();
         if (histfile.has_value())
         {
@@ -43,8 +82,123 @@ namespace ash
         }
     }
 
+    auto get_rc_file() -> std::optional<std::string>
+    {
+        const char* home = std::getenv("HOME");
+        if (home == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        return std::string(home) + "/" + config::RC_FILENAME;
+    }
+
+    auto load_rc_file() -> bool
+    {
+        std::optional<std::string> rc_file = get_rc_file();
+        if (!rc_file.has_value())
+        {
+            return true;
+        }
+
+        int fd = open(rc_file->c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return true;
+        }
+
+        // NOTE(abi): the snapshot is keyed by the stat of the descriptor we read, so a
+        // file that changes under us can't be cached with stale contents.
+        struct stat rc_stat;
+        Program program;
+        if (fstat(fd, &rc_stat) == -1)
+        {
+            close(fd);
+            return true;
+        }
+
+        if (load_program_snapshot(*rc_file, rc_stat, program))
+        {
+            close(fd);
+            record_startup_phase("rc snapshot load");
+        }
+        else
+        {
+            std::string source(static_cast<size_t>(rc_stat.st_size), '\0');
+            bool is_read = read_exact(fd, source.data(), source.size());
+            close(fd);
+            if (!is_read)
+            {
+                std::cerr << "ash: " << *rc_file << ": " << std::strerror(errno) << std::endl;
+                return true;
+            }
+
+            std::string error;
+            if (compile_program(source, program, error) != CompileStatus::OK)
+            {
+                std::cerr << "ash: " << *rc_file << ": " << error << std::endl;
+                return true;
+            }
+            record_startup_phase("rc compile");
+
+            save_program_snapshot(*rc_file, rc_stat, program);
+            record_startup_phase("rc snapshot write");
+        }
+
+        bool keep_running = run_program(program);
+        record_startup_phase("rc run");
+        return keep_running;
+    }
+
+    auto record_startup_phase(const std::string& name) -> void
+    {
+        auto now = std::chrono::steady_clock::now();
+        shell_state->startup_phases.push_back({name, now - shell_state->startup_phase_start});
+        shell_state->startup_phase_start = now;
+    }
+
+    auto print_startup_profile() -> void
+    {
+        if (!shell_state->options.startup_profile)
+        {
+            return;
+        }
+
+        auto print_phase = [](const std::string& name, std::chrono::steady_clock::duration duration)
+        {
+            std::chrono::duration<double, std::milli> milliseconds = duration;
+            std::cerr << "  " << std::left << std::setw(20) << name << std::right << std::fixed
+                      << std::setprecision(3) << std::setw(10) << milliseconds.count() << " ms"
+                      << std::endl;
+        };
+
+        std::cerr << "ash: startup profile" << std::endl;
+        std::chrono::steady_clock::duration total{};
+        for (const StartupPhase& phase : shell_state->startup_phases)
+        {
+            print_phase(phase.name, phase.duration);
+            total += phase.duration;
+        }
+        print_phase("total", total);
+    }
+
     auto read_input(const char* prompt) -> std::optional<std::string>
     {
+        finish_loading_history(false);
+        if (shell_state->options.native_editor && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+        {
+            return read_edited_line(prompt);
+        }
+
+        // NOTE(abi): readline spins calling the event hook once a pipe hits EOF, so the
+        // hook is only used on a terminal, and only while something is still pending.
+        bool is_pending = shell_state->pending_history != nullptr
+                          || !shell_state->prompt.pending_segments.empty();
+        if (is_pending && isatty(STDIN_FILENO))
+        {
+            ::rl_event_hook = readline_event_hook;
+        }
+
         char* input_cstr = readline(prompt);
         if (input_cstr == nullptr)
         {
@@ -59,13 +213,44 @@ namespace ash
 
     auto command_completion(const char* text, int start, int end) -> char**
     {
-        if (start == 0)
+        rl_attempted_completion_over = 1;
+
+        std::string command;
+        CompletionContext context = get_completion_context(rl_line_buffer, start, command);
+        if (context == CompletionContext::COMMAND && std::strchr(text, '/') == nullptr)
         {
             return rl_completion_matches(text, command_generator);
         }
 
-        rl_attempted_completion_over = 1;
-        return nullptr;
+        std::vector<std::string>& matches = shell_state->completion_matches;
+        matches = complete_filename(text, get_completion_filter(context, command),
+                                    rl_completion_quote_character != 0);
+
+        // Only the last path component is listed, and a directory isn't closed off
+        rl_filename_completion_desired = 1;
+        rl_completion_suppress_append = (matches.size() == 1 && matches[0].ends_with('/'));
+        return rl_completion_matches(text, completion_match_generator);
+    }
+
+    auto readline_event_hook() -> int
+    {
+        // Leave the list alone while the user is scrolling through it
+        if (::where_history() == ::history_length)
+        {
+            finish_loading_history(false);
+        }
+
+        if (poll_prompt_segments(0))
+        {
+            redraw_prompt();
+        }
+
+        if (shell_state->pending_history == nullptr && shell_state->prompt.pending_segments.empty())
+        {
+            ::rl_event_hook = nullptr;
+        }
+
+        return 0;
     }
 
     auto command_generator(const char* text, int state) -> char*
@@ -75,27 +260,54 @@ namespace ash
 
         if (state == 0)
         {
-            all_matches.clear();
+            all_matches = get_command_matches(text);
             match_index = 0;
+        }
+
+        if (match_index < all_matches.size())
+        {
+            return strdup(all_matches[match_index++].c_str());
+        }
+
+        return nullptr;
+    }
+
+    auto get_command_matches(const std::string& prefix) -> std::vector<std::string>
+    {
+        std::vector<std::string> matches;
 
-            // Builtins
-            std::string prefix(text);
-            for (const std::string& builtin : SHELL_BUILTINS)
+        // Builtins
+        for (const std::string& builtin : SHELL_BUILTINS)
+        {
+            if (builtin.starts_with(prefix))
             {
-                if (builtin.find(prefix) == 0)
-                {
-                    all_matches.push_back(builtin);
-                }
+                matches.push_back(builtin);
             }
+        }
 
-            // Executables
-            std::vector<std::string> executables = get_matching_executables_in_path(text);
-            all_matches.insert(all_matches.end(), executables.begin(), executables.end());
+        // Executables
+        const std::vector<std::string>& executables = get_executable_index().names;
+        for (auto it = std::lower_bound(executables.begin(), executables.end(), prefix);
+             it != executables.end() && it->starts_with(prefix); ++it)
+        {
+            matches.push_back(*it);
         }
 
-        if (match_index < all_matches.size())
+        return matches;
+    }
+
+    auto completion_match_generator(const char* text, int state) -> char*
+    {
+        static size_t match_index;
+        if (state == 0)
         {
-            return strdup(all_matches[match_index++].c_str());
+            match_index = 0;
+        }
+
+        const std::vector<std::string>& matches = shell_state->completion_matches;
+        if (match_index < matches.size())
+        {
+            return strdup(matches[match_index++].c_str());
         }
 
         return nullptr;
@@ -103,14 +315,33 @@ namespace ash
 
     auto repl_loop() -> void
     {
+        start_indexing_executables();
+        start_loading_directory_index();
+
         while (true)
         {
-            auto input = read_input(config::PROMPT);
+            // Slow segments are drawn from the cache, and redrawn once they finish
+            start_prompt_segments();
+            poll_prompt_segments(config::PROMPT_SEGMENT_GRACE_MS);
+
+            shell_state->prompt.is_displayed = true;
+            auto input = read_input(render_prompt().c_str());
+            shell_state->prompt.is_displayed = false;
             if (!input.has_value())
             {
                 break;
             }
 
+            while (has_incomplete_input(input.value()))
+            {
+                auto line = read_input(config::CONTINUATION_PROMPT);
+                if (!line.has_value())
+                {
+                    break;
+                }
+                input.value() += "\n" + line.value();
+            }
+
             if (!handle_input(input.value()))
             {
                 break;
@@ -122,40 +353,49 @@ namespace ash
     {
         if (!input.empty())
         {
-            shell_state.command_history.push_back(input);
+            shell_state->command_history.push_back(input);
             ::add_history(input.c_str());
         }
 
-        if (has_pipes(input))
-        {
-            auto commands = parse_pipeline(input);
-            execute_pipeline(commands);
+        return execute_line(input);
+    }
 
-            return true;
-        }
+    auto has_incomplete_input(const std::string& input) -> bool
+    {
+        // A complete line is left compiled for execute_line
+        std::shared_ptr<const Program> program;
+        std::string error;
+        return get_compiled_program(input, program, error, false) == CompileStatus::INCOMPLETE;
+    }
 
-        auto [command, command_end_pos] = parse_command_and_position(input);
-        if (command.empty())
+    auto execute_line(const std::string& input) -> bool
+    {
+        // NOTE(abi): held for the whole run, the line may push itself out of the cache.
+        std::shared_ptr<const Program> program;
+        std::string error;
+        if (get_compiled_program(input, program, error) != CompileStatus::OK)
         {
+            std::cerr << "ash: " << error << std::endl;
+            shell_state->last_exit_status = 2;
             return true;
         }
 
-        if (command == "exit")
-        {
-            return false;
-        }
-
-        std::string args =
-            (command_end_pos < input.length()) ? input.substr(command_end_pos + 1) : "";
-        RedirectionSpec redirection_spec = parse_and_strip_redirection(args);
+        return run_program(*program);
+    }
 
-        auto success = execute_command(command, args, redirection_spec);
-        if (!success)
+    auto execute_script_file(const std::string& path) -> bool
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
         {
-            handle_invalid_command(command);
+            std::cerr << "ash: " << path << ": No such file or directory" << std::endl;
+            shell_state->last_exit_status = 127;
+            return false;
         }
 
-        return true;
+        std::string source((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+        return execute_line(source);
     }
 
     auto handle_invalid_command(const std::string& command) -> void
@@ -163,64 +403,132 @@ namespace ash
         std::cout << command << ": command not found" << std::endl;
     }
 
-    auto execute_builtin(const std::string& command, const std::string& args) -> void
+    auto get_exit_status(int wait_status) -> int
     {
-        auto it = BUILTIN_HANDLERS.find(command);
-        if (it != BUILTIN_HANDLERS.end())
+        if (WIFSIGNALED(wait_status))
         {
-            it->second(args);
+            return 128 + WTERMSIG(wait_status);
         }
+
+        return WEXITSTATUS(wait_status);
     }
 
-    auto execute_command(const std::string& command, const std::string& args,
-                         RedirectionSpec redirection_spec) -> bool
+    auto execute_command(const CommandSpec& written_cmd) -> bool
     {
-        std::string executable_path;
-        if (!is_builtin(command))
+        const RedirectionSpec& redirection_spec = written_cmd.redirection;
+        bool can_exec_in_place = std::exchange(shell_state->can_exec_in_place, false);
+
+        std::optional<CommandSpec> expanded_cmd;
+        if (written_cmd.command_word.has_value())
         {
-            executable_path = find_executable_in_path(command);
-            if (executable_path.empty())
+            expanded_cmd = expand_command_word(written_cmd);
+            if (!expanded_cmd.has_value())
             {
-                return false;
+                shell_state->last_exit_status = 1;
+                return true;
             }
         }
+        const CommandSpec& cmd = expanded_cmd.has_value() ? *expanded_cmd : written_cmd;
+
+        // Only redirections and assignments, which open (and create) their files and
+        // set the variables for good
+        if (cmd.command.empty())
+        {
+            std::vector<SavedFd> saved_fds;
+            bool is_applied = apply_fd_actions(compile_fd_actions(redirection_spec), &saved_fds);
+            restore_fds(saved_fds);
+            is_applied = is_applied && assign_variables(cmd.assignments);
+            shell_state->last_exit_status = is_applied ? 0 : 1;
+            return true;
+        }
+
+        // NOTE(abi): the result of an expansion is never an alias, and it's reported
+        // here since the caller only knows the name as written.
+        CommandType type;
+        const CommandEntry* entry = resolve_command(cmd.command, type, !expanded_cmd.has_value());
+        if (entry == nullptr && expanded_cmd.has_value())
+        {
+            handle_invalid_command(cmd.command);
+            shell_state->last_exit_status = 127;
+            return true;
+        }
+
+        if (entry == nullptr)
+        {
+            return false;
+        }
+
+        if (type == CommandType::ALIAS)
+        {
+            return execute_alias(*entry, cmd);
+        }
+
+        // NOTE(abi): the function may redefine itself while it runs, so the call holds
+        // its own reference to the body.
+        std::string executable_path = entry->executable_path;
+        std::shared_ptr<const Program> function = entry->function;
+        const BuiltinHandler* builtin = entry->builtin;
+
+        std::vector<ActiveProcessSubstitution> process_substitutions =
+            start_process_substitutions(cmd.process_substitutions);
+        std::optional<std::vector<std::string>> expanded_args =
+            get_substituted_arguments(cmd.args, process_substitutions);
+        std::optional<VariableValues> assigned_values =
+            expanded_args.has_value() ? expand_assignments(cmd.assignments) : std::nullopt;
+        if (!assigned_values.has_value())
+        {
+            finish_process_substitutions(process_substitutions);
+            shell_state->last_exit_status = 1;
+            return true;
+        }
+        std::vector<std::string>& args = *expanded_args;
 
-        bool needs_fork = redirection_spec.has_stdout_redirection
-                          || redirection_spec.has_stderr_redirection || !is_builtin(command);
+        // NOTE(abi): NAME=value cmd only lasts for the command. An external command gets
+        // the values in the environment it's started with, builtins and functions have
+        // them set around the call.
+        std::vector<SavedVariable> saved_variables;
+
+        // NOTE(abi): builtins and functions run in-process even when redirected, their
+        // descriptors are saved and restored around the call instead of paying for a fork.
+        bool needs_fork = type == CommandType::EXTERNAL;
         if (needs_fork)
         {
-            pid_t pid = fork();
+            const JobResources& resources = shell_state->job_resources;
+            std::string cgroup = has_job_cgroup(resources) ? create_job_cgroup(resources) : "";
+
+            // NOTE(abi): a subshell that ends with this command has nothing left to do
+            // but wait for it, so it becomes the command instead of forking again. A
+            // job cgroup is only cleaned up by a parent that waits for it.
+            bool is_exec_in_place = can_exec_in_place && process_substitutions.empty()
+                                    && cgroup.empty();
+            assign_temporarily(*assigned_values, saved_variables);
+            std::vector<std::string> environment;
+            std::vector<char*> envp = get_exec_environment(environment);
+            restore_variables(saved_variables);
+            if (is_exec_in_place)
+            {
+                std::cout.flush();
+                std::cerr.flush();
+            }
+
+            pid_t pid = is_exec_in_place ? 0 : fork();
             if (pid == -1)
             {
                 std::cerr << "Failed to fork process" << std::endl;
+                remove_job_cgroup(cgroup);
+                finish_process_substitutions(process_substitutions);
                 return false;
             }
 
             // Child process
             if (pid == 0)
             {
-                if (redirection_spec.has_stdout_redirection)
-                {
-                    if (!redirect_stream(StandardStream::OUT, redirection_spec.stdout_filename,
-                                         redirection_spec.stdout_mode))
-                    {
-                        exit(1);
-                    }
-                }
-
-                if (redirection_spec.has_stderr_redirection)
-                {
-                    if (!redirect_stream(StandardStream::ERR, redirection_spec.stderr_filename,
-                                         redirection_spec.stderr_mode))
-                    {
-                        exit(1);
-                    }
-                }
+                apply_job_resources(resources, cgroup);
+                inherit_process_substitutions(process_substitutions);
 
-                if (is_builtin(command))
+                if (!apply_fd_actions(compile_fd_actions(redirection_spec)))
                 {
-                    execute_builtin(command, args);
-                    exit(0);
+                    exit(1);
                 }
 
                 // Program name
@@ -233,16 +541,15 @@ namespace ash
 
                 // Arguments
                 // NOTE(abi): the C-like version needs to be null-terminated.
-                std::vector<std::string> parsed_args = parse_arguments(args);
                 std::vector<char*> c_args;
                 c_args.push_back(const_cast<char*>(program_name.c_str()));
-                for (const auto& arg : parsed_args)
+                for (const auto& arg : args)
                 {
                     c_args.push_back(const_cast<char*>(arg.c_str()));
                 }
                 c_args.push_back(nullptr);
 
-                execvp(executable_path.c_str(), c_args.data());
+                execvpe(executable_path.c_str(), c_args.data(), envp.data());
 
                 std::cerr << executable_path << ": command not found" << std::endl;
                 exit(1);
@@ -251,13 +558,107 @@ namespace ash
             // Parent process
             int status;
             waitpid(pid, &status, 0);
+            shell_state->last_exit_status = get_exit_status(status);
+            remove_job_cgroup(cgroup);
+            finish_process_substitutions(process_substitutions);
             return true;
         }
 
-        execute_builtin(command, args);
+        // NOTE(abi): a reader that goes away must not take the shell (or a libash host)
+        // down with an in-process builtin, which sees EPIPE instead. A handler that does
+        // nothing is used over SIG_IGN since exec resets it, so commands the builtin
+        // starts still get the default action.
+        struct sigaction pipe_action = {};
+        struct sigaction previous_pipe_action = {};
+        pipe_action.sa_handler = [](int) {};
+        if (function == nullptr)
+        {
+            sigaction(SIGPIPE, &pipe_action, &previous_pipe_action);
+        }
+
+        // NOTE(abi): the streams outlive the redirection, so whatever is buffered goes out
+        // before it, and a failed write is reported but not left behind in their state.
+        std::cout.flush();
+        std::cerr.flush();
+        std::vector<SavedFd> saved_fds;
+        bool is_write_failed = false;
+        int write_error = 0;
+        if (apply_fd_actions(compile_fd_actions(redirection_spec), &saved_fds))
+        {
+            assign_temporarily(*assigned_values, saved_variables);
+            shell_state->last_exit_status =
+                (function != nullptr) ? call_function(*function, args) : (*builtin)(args);
+            is_write_failed = !std::cout.flush();
+            write_error = errno;
+            restore_variables(saved_variables);
+        }
+        else
+        {
+            shell_state->last_exit_status = 1;
+        }
+        restore_fds(saved_fds);
+        std::cout.clear();
+        std::cerr.clear();
+
+        if (is_write_failed && function == nullptr)
+        {
+            std::cerr << cmd.command << ": write error: " << std::strerror(write_error)
+                      << std::endl;
+            if (shell_state->last_exit_status == 0)
+            {
+                shell_state->last_exit_status = 1;
+            }
+        }
+
+        if (function == nullptr)
+        {
+            sigaction(SIGPIPE, &previous_pipe_action, nullptr);
+        }
+
+        finish_process_substitutions(process_substitutions);
         return true;
     }
 
+    auto make_literal_command(const std::vector<std::string>& command) -> CommandSpec
+    {
+        // NOTE(abi): for builtins that run an already expanded command line. The words
+        // go back in as quoted literals and are executed exactly as given.
+        CommandSpec cmd;
+        cmd.command = command[0];
+        for (size_t i = 1; i < command.size(); i++)
+        {
+            Word word;
+            word.parts.push_back({WordPartType::LITERAL, command[i], true});
+            word.is_quoted = true;
+            cmd.args.push_back(std::move(word));
+        }
+
+        return cmd;
+    }
+
+    auto expand_command_word(const CommandSpec& cmd) -> std::optional<CommandSpec>
+    {
+        // NOTE(abi): the name is expanded with the arguments as one list, so $c may bring
+        // arguments of its own or vanish and leave the first argument as the name.
+        std::vector<Word> words;
+        words.reserve(cmd.args.size() + 1);
+        words.push_back(*cmd.command_word);
+        words.insert(words.end(), cmd.args.begin(), cmd.args.end());
+
+        std::optional<std::vector<std::string>> fields = expand_words(words);
+        if (!fields.has_value())
+        {
+            return std::nullopt;
+        }
+
+        CommandSpec expanded = fields->empty() ? CommandSpec{} : make_literal_command(*fields);
+        expanded.redirection = cmd.redirection;
+        expanded.process_substitutions = cmd.process_substitutions;
+        expanded.assignments = cmd.assignments;
+        expanded.fan_out = cmd.fan_out;
+        return expanded;
+    }
+
     auto execute_pipeline(const std::vector<CommandSpec>& commands) -> bool
     {
         if (commands.empty())
@@ -266,100 +667,198 @@ namespace ash
         }
 
         // Single command, no pipeline
-        if (commands.size() == 1)
+        bool has_fan_out = !commands.back().fan_out.empty();
+        if (commands.size() == 1 && !has_fan_out)
         {
-            return execute_command(commands[0].command, commands[0].args, commands[0].redirection);
+            return execute_command(commands[0]);
+        }
+
+        std::vector<CommandSpec> expanded_commands;
+        const std::vector<CommandSpec>& unexpanded_stages =
+            expand_aliases(commands, expanded_commands) ? expanded_commands : commands;
+
+        // Command names with expansions are expanded before anything is started
+        std::vector<CommandSpec> expanded_stages;
+        bool has_command_word =
+            std::any_of(unexpanded_stages.begin(), unexpanded_stages.end(),
+                        [](const CommandSpec& cmd) { return cmd.command_word.has_value(); });
+        for (size_t i = 0; has_command_word && i < unexpanded_stages.size(); i++)
+        {
+            const CommandSpec& cmd = unexpanded_stages[i];
+            std::optional<CommandSpec> expanded =
+                cmd.command_word.has_value() ? expand_command_word(cmd) : cmd;
+            if (!expanded.has_value())
+            {
+                shell_state->last_exit_status = 1;
+                return false;
+            }
+            expanded_stages.push_back(std::move(*expanded));
+        }
+        const std::vector<CommandSpec>& stages =
+            has_command_word ? expanded_stages : unexpanded_stages;
+
+        // NOTE(abi): substitutions are started before the pipes exist, so that they
+        // don't inherit pipe ends and hold them open past the writers' exit.
+        std::vector<std::vector<ActiveProcessSubstitution>> process_substitutions;
+        std::vector<std::vector<std::string>> substituted_args;
+        std::vector<VariableValues> assigned_values;
+        for (const CommandSpec& cmd : stages)
+        {
+            process_substitutions.push_back(start_process_substitutions(cmd.process_substitutions));
+            std::optional<std::vector<std::string>> args =
+                get_substituted_arguments(cmd.args, process_substitutions.back());
+            std::optional<VariableValues> values =
+                args.has_value() ? expand_assignments(cmd.assignments) : std::nullopt;
+            if (!values.has_value())
+            {
+                break;
+            }
+            substituted_args.push_back(std::move(*args));
+            assigned_values.push_back(std::move(*values));
+        }
+
+        auto finish_all_process_substitutions = [&process_substitutions]()
+        {
+            for (auto& active_substitutions : process_substitutions)
+            {
+                finish_process_substitutions(active_substitutions);
+            }
+        };
+
+        // Nothing runs when an argument fails to expand
+        if (substituted_args.size() < stages.size())
+        {
+            finish_all_process_substitutions();
+            shell_state->last_exit_status = 1;
+            return false;
         }
 
         // Create pipes
-        int num_commands = commands.size();
-        int pipes[num_commands - 1][2];
-        for (int i = 0; i < num_commands - 1; i++)
+        int num_commands = stages.size();
+        auto pipes = create_pipeline_pipes(num_commands - 1 + (has_fan_out ? 1 : 0));
+        if (!pipes.has_value())
+        {
+            std::cerr << "Failed to create pipe" << std::endl;
+            finish_all_process_substitutions();
+            shell_state->last_exit_status = 1;
+            return false;
+        }
+
+        // Every stage is resolved before any is started, aliases were expanded above
+        std::vector<CommandType> types(stages.size());
+        std::vector<const CommandEntry*> entries(stages.size());
+        for (size_t i = 0; i < stages.size(); i++)
         {
-            if (pipe(pipes[i]) == -1)
+            if (stages[i].body != nullptr)
             {
-                std::cerr << "Failed to create pipe" << std::endl;
+                continue;
+            }
+
+            entries[i] = resolve_command(stages[i].command, types[i], false);
+            if (entries[i] == nullptr)
+            {
+                close_pipeline_pipes(*pipes);
+                std::cerr << stages[i].command << ": command not found" << std::endl;
+                finish_all_process_substitutions();
+                shell_state->last_exit_status = 127;
                 return false;
             }
         }
 
+        // NOTE(abi): the stages of a pipeline are one job and share its cgroup
+        const JobResources& resources = shell_state->job_resources;
+        std::string cgroup = has_job_cgroup(resources) ? create_job_cgroup(resources) : "";
+
         // Fork and execute commands
+        std::vector<std::string> environment;
+        std::vector<char*> envp = get_exec_environment(environment);
         std::vector<pid_t> pids;
         for (int i = 0; i < num_commands; i++)
         {
-            const CommandSpec& cmd = commands[i];
-
-            std::string executable_path;
-            if (!is_builtin(cmd.command))
+            const CommandSpec& cmd = stages[i];
+            CommandType type = types[i];
+            const CommandEntry* entry = entries[i];
+
+            // A stage's own assignments are in the state and the environment it forks with
+            std::vector<SavedVariable> saved_variables;
+            std::vector<std::string> stage_environment;
+            std::vector<char*> stage_envp;
+            if (!assigned_values[i].empty())
             {
-                executable_path = find_executable_in_path(cmd.command);
-                if (executable_path.empty())
-                {
-                    for (int j = 0; j < num_commands - 1; j++)
-                    {
-                        close(pipes[j][0]);
-                        close(pipes[j][1]);
-                    }
-                    std::cerr << cmd.command << ": command not found" << std::endl;
-                    return false;
-                }
+                assign_temporarily(assigned_values[i], saved_variables);
+                stage_envp = get_exec_environment(stage_environment);
             }
 
+            // The stages already started see EOF once the pipes are gone
             pid_t pid = fork();
+            if (pid != 0)
+            {
+                restore_variables(saved_variables);
+            }
+
             if (pid == -1)
             {
                 std::cerr << "Failed to fork process" << std::endl;
+                close_pipeline_pipes(*pipes);
+                for (pid_t started : pids)
+                {
+                    waitpid(started, nullptr, 0);
+                }
+                remove_job_cgroup(cgroup);
+                finish_all_process_substitutions();
+                shell_state->last_exit_status = 1;
                 return false;
             }
 
             if (pid == 0)
             {
-                // Redirect stdin from the previous pipe, if it's not the first command
-                if (i > 0)
-                {
-                    dup2(pipes[i - 1][0], static_cast<int>(StandardStream::IN));
-                }
+                apply_job_resources(resources, cgroup);
+                inherit_process_substitutions(process_substitutions[i]);
 
-                // Redirect stdout to the next pipe, if it's not the last command
-                if (i < num_commands - 1)
+                // NOTE(abi): the pipe ends are part of the redirection plan, so a file
+                // redirection on the same stream elides the pipe dup altogether. All
+                // pipe descriptors are O_CLOEXEC and vanish on exec without a close loop.
+                std::vector<FdAction> pipe_actions;
+                if (i > 0)
                 {
-                    dup2(pipes[i][1], static_cast<int>(StandardStream::OUT));
+                    pipe_actions.push_back({FdActionType::DUPLICATE,
+                                            static_cast<int>(StandardStream::IN),
+                                            (*pipes)[i - 1][0]});
                 }
-
-                // Close all pipe file descriptors in child
-                for (int j = 0; j < num_commands - 1; j++)
+                if (i < num_commands - 1 || has_fan_out)
                 {
-                    close(pipes[j][0]);
-                    close(pipes[j][1]);
+                    pipe_actions.push_back({FdActionType::DUPLICATE,
+                                            static_cast<int>(StandardStream::OUT),
+                                            (*pipes)[i][1]});
                 }
 
-                // Handle file redirections
-                if (cmd.redirection.has_stdout_redirection)
+                std::vector<FdAction> actions = compile_fd_actions(cmd.redirection, pipe_actions);
+                if (!apply_fd_actions(actions))
                 {
-                    if (!redirect_stream(StandardStream::OUT, cmd.redirection.stdout_filename,
-                                         cmd.redirection.stdout_mode))
-                    {
-                        exit(1);
-                    }
+                    exit(1);
                 }
 
-                if (cmd.redirection.has_stderr_redirection)
+                // A compound stage is a subshell, this child already is one
+                if (cmd.body != nullptr)
                 {
-                    if (!redirect_stream(StandardStream::ERR, cmd.redirection.stderr_filename,
-                                         cmd.redirection.stderr_mode))
-                    {
-                        exit(1);
-                    }
+                    close_pipeline_pipes(*pipes, actions);
+                    run_program(*cmd.body, true);
+                    exit(shell_state->last_exit_status);
                 }
 
-                // Builtin
-                if (is_builtin(cmd.command))
+                // Builtin or function
+                if (type != CommandType::EXTERNAL)
                 {
-                    execute_builtin(cmd.command, cmd.args);
-                    exit(0);
+                    // They don't exec, so they drop the pipe ends by hand to let their
+                    // neighbours see EOF
+                    close_pipeline_pipes(*pipes, actions);
+                    exit((entry->function != nullptr)
+                             ? call_function(*entry->function, substituted_args[i])
+                             : (*entry->builtin)(substituted_args[i]));
                 }
 
                 // External command
+                const std::string& executable_path = entry->executable_path;
                 std::string program_name;
                 size_t last_slash = executable_path.rfind('/');
                 if (last_slash != std::string::npos)
@@ -371,16 +870,16 @@ namespace ash
                     program_name = executable_path;
                 }
 
-                std::vector<std::string> parsed_args = parse_arguments(cmd.args);
                 std::vector<char*> c_args;
                 c_args.push_back(const_cast<char*>(program_name.c_str()));
-                for (const auto& arg : parsed_args)
+                for (const auto& arg : substituted_args[i])
                 {
                     c_args.push_back(const_cast<char*>(arg.c_str()));
                 }
                 c_args.push_back(nullptr);
 
-                execvp(executable_path.c_str(), c_args.data());
+                execvpe(executable_path.c_str(), c_args.data(),
+                        stage_envp.empty() ? envp.data() : stage_envp.data());
 
                 std::cerr << executable_path << ": command not found" << std::endl;
                 exit(1);
@@ -391,20 +890,344 @@ namespace ash
 
         // NOTE(abi): we must close all pipes so that commands reading from stdin get
         // EOF.
-        for (int i = 0; i < num_commands - 1; i++)
+        std::optional<int> fan_out_status;
+        if (has_fan_out)
+        {
+            PipelinePipe fan_out_pipe = pipes->back();
+            pipes->pop_back();
+            close_pipeline_pipes(*pipes);
+            close(fan_out_pipe[1]);
+
+            fan_out_status = execute_fan_out(stages.back().fan_out, fan_out_pipe[0]);
+            close(fan_out_pipe[0]);
+        }
+        else
         {
-            close(pipes[i][0]);
-            close(pipes[i][1]);
+            close_pipeline_pipes(*pipes);
         }
 
-        // Wait for all children to complete
+        // Wait for all children to complete, the last one decides the status. With a fan
+        // out, the last stage is the last consumer.
         for (pid_t pid : pids)
         {
             int status;
             waitpid(pid, &status, 0);
+            shell_state->last_exit_status = get_exit_status(status);
         }
+        shell_state->last_exit_status = fan_out_status.value_or(shell_state->last_exit_status);
+
+        remove_job_cgroup(cgroup);
+        finish_all_process_substitutions();
+
+        return true;
+    }
+
+    auto execute_alias(const CommandEntry& entry, const CommandSpec& cmd) -> bool
+    {
+        std::vector<CommandSpec> commands = apply_alias(entry, cmd);
+
+        shell_state->expanding_aliases.push_back(cmd.command);
+        run_pipeline(commands);
+        shell_state->expanding_aliases.pop_back();
 
         return true;
     }
 
+    auto expand_aliases(const std::vector<CommandSpec>& commands,
+                        std::vector<CommandSpec>& expanded) -> bool
+    {
+        // NOTE(abi): most pipelines have no aliases, those are run without a copy.
+        bool has_alias = false;
+        for (const CommandSpec& cmd : commands)
+        {
+            CommandType type;
+            bool is_named = cmd.body == nullptr && !cmd.command_word.has_value();
+            const CommandEntry* entry = is_named ? resolve_command(cmd.command, type) : nullptr;
+            if (entry == nullptr || type != CommandType::ALIAS)
+            {
+                if (has_alias)
+                {
+                    expanded.push_back(cmd);
+                }
+                continue;
+            }
+
+            if (!has_alias)
+            {
+                has_alias = true;
+                expanded.assign(commands.begin(), commands.begin() + (&cmd - commands.data()));
+            }
+
+            std::vector<CommandSpec> alias_commands = apply_alias(*entry, cmd);
+            std::vector<CommandSpec> nested_commands;
+            shell_state->expanding_aliases.push_back(cmd.command);
+            bool is_nested = expand_aliases(alias_commands, nested_commands);
+            shell_state->expanding_aliases.pop_back();
+
+            const std::vector<CommandSpec>& result = is_nested ? nested_commands : alias_commands;
+            expanded.insert(expanded.end(), result.begin(), result.end());
+        }
+
+        return has_alias;
+    }
+
+    auto execute_fan_out(const std::vector<std::vector<CommandSpec>>& consumers, int input_fd)
+        -> int
+    {
+        std::vector<pid_t> pids;
+        std::vector<int> output_fds;
+
+        for (const std::vector<CommandSpec>& consumer : consumers)
+        {
+            auto consumer_pipe = create_pipeline_pipes(1);
+            if (!consumer_pipe.has_value())
+            {
+                std::cerr << "Failed to create pipe" << std::endl;
+                break;
+            }
+            auto [read_fd, write_fd] = consumer_pipe->front();
+
+            pid_t pid = fork();
+            if (pid == -1)
+            {
+                std::cerr << "Failed to fork process" << std::endl;
+                close_pipeline_pipes(*consumer_pipe);
+                break;
+            }
+
+            if (pid == 0)
+            {
+                // NOTE(abi): consumers must not hold each other's write ends, or none
+                // of them would ever see EOF.
+                for (int fd : output_fds)
+                {
+                    close(fd);
+                }
+                close(input_fd);
+                close(write_fd);
+
+                dup2(read_fd, static_cast<int>(StandardStream::IN));
+                close(read_fd);
+
+                run_pipeline(consumer);
+                exit(shell_state->last_exit_status);
+            }
+
+            close(read_fd);
+            output_fds.push_back(write_fd);
+            pids.push_back(pid);
+        }
+
+        fan_out_pipe(input_fd, output_fds);
+
+        for (int fd : output_fds)
+        {
+            close(fd);
+        }
+
+        // Like a pipeline's, the status is the last consumer's
+        int status = 1;
+        for (pid_t pid : pids)
+        {
+            int wait_status;
+            waitpid(pid, &wait_status, 0);
+            status = get_exit_status(wait_status);
+        }
+
+        return (pids.size() == consumers.size()) ? status : 1;
+    }
+
+    auto create_pipeline_pipes(size_t count) -> std::optional<std::vector<PipelinePipe>>
+    {
+        std::vector<PipelinePipe> pipes(count);
+        std::optional<int> capacity = get_pipe_capacity();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pipe2(pipes[i].data(), O_CLOEXEC) == -1)
+            {
+                pipes.resize(i);
+                close_pipeline_pipes(pipes);
+                return std::nullopt;
+            }
+
+            // NOTE(abi): a failed resize (e.g. over the unprivileged limit) just keeps
+            // the default capacity.
+            if (capacity.has_value())
+            {
+                fcntl(pipes[i][1], F_SETPIPE_SZ, *capacity);
+            }
+        }
+
+        return pipes;
+    }
+
+    auto close_pipeline_pipes(const std::vector<PipelinePipe>& pipes,
+                              const std::vector<FdAction>& keep) -> void
+    {
+        for (const PipelinePipe& pipe_fds : pipes)
+        {
+            for (int fd : pipe_fds)
+            {
+                bool is_kept = std::any_of(keep.begin(), keep.end(), [fd](const FdAction& action)
+                                           { return action.fd == fd; });
+                if (!is_kept)
+                {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    auto get_pipe_capacity() -> std::optional<int>
+    {
+        // Bytes, or with a k or m suffix. A shell variable will do, it needn't be exported.
+        std::optional<std::string> pipe_size_value = get_variable("ASH_PIPE_SIZE");
+        if (pipe_size_value.has_value() && !pipe_size_value->empty())
+        {
+            const char* pipe_size = pipe_size_value->c_str();
+            const char* last = pipe_size + pipe_size_value->size();
+            int size = 0;
+            std::from_chars_result result = std::from_chars(pipe_size, last, size);
+            int scale = 1;
+            if (result.ec == std::errc() && result.ptr + 1 == last)
+            {
+                scale = (std::tolower(*result.ptr) == 'k') ? 1 << 10
+                        : (std::tolower(*result.ptr) == 'm') ? 1 << 20
+                                                               : 0;
+            }
+            else if (result.ptr != last)
+            {
+                scale = 0;
+            }
+
+            if (result.ec == std::errc() && size > 0 && scale > 0 && size <= INT_MAX / scale)
+            {
+                return size * scale;
+            }
+            if (!shell_state->is_pipe_size_reported)
+            {
+                std::cerr << "ash: ASH_PIPE_SIZE: invalid size `" << pipe_size
+                          << "', using the default" << std::endl;
+                shell_state->is_pipe_size_reported = true;
+            }
+        }
+
+        if (!shell_state->options.big_pipes)
+        {
+            return std::nullopt;
+        }
+
+        static const int max_pipe_size = []()
+        {
+            std::ifstream file(config::PIPE_MAX_SIZE_PATH);
+            int size = 0;
+            if (file >> size && size > 0)
+            {
+                return size;
+            }
+            return config::BIG_PIPE_SIZE;
+        }();
+
+        return max_pipe_size;
+    }
+
+    auto start_process_substitutions(const std::vector<ProcessSubstitution>& process_substitutions)
+        -> std::vector<ActiveProcessSubstitution>
+    {
+        std::vector<ActiveProcessSubstitution> active_substitutions;
+        for (const ProcessSubstitution& process_substitution : process_substitutions)
+        {
+            bool is_input = process_substitution.direction == ProcessSubstitutionDirection::INPUT;
+
+            int pipe_fds[2];
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+            {
+                std::cerr << "Failed to create pipe" << std::endl;
+                break;
+            }
+
+            // NOTE(abi): the shell keeps the end the command will open through
+            // /dev/fd, the substituted process gets the other one as stdin/stdout.
+            int shell_fd = is_input ? pipe_fds[0] : pipe_fds[1];
+            int process_fd = is_input ? pipe_fds[1] : pipe_fds[0];
+
+            pid_t pid = fork();
+            if (pid == -1)
+            {
+                std::cerr << "Failed to fork process" << std::endl;
+                close(pipe_fds[0]);
+                close(pipe_fds[1]);
+                break;
+            }
+
+            if (pid == 0)
+            {
+                for (const ActiveProcessSubstitution& active : active_substitutions)
+                {
+                    close(active.fd);
+                }
+                close(shell_fd);
+
+                StandardStream stream = is_input ? StandardStream::OUT : StandardStream::IN;
+                dup2(process_fd, static_cast<int>(stream));
+                close(process_fd);
+
+                execute_line(process_substitution.command_line);
+                exit(0);
+            }
+
+            close(process_fd);
+            active_substitutions.push_back({pid, shell_fd});
+        }
+
+        return active_substitutions;
+    }
+
+    auto get_substituted_arguments(const std::vector<Word>& args,
+                                   const std::vector<ActiveProcessSubstitution>& active)
+        -> std::optional<std::vector<std::string>>
+    {
+        std::optional<std::vector<std::string>> expanded_args = expand_words(args);
+        if (!expanded_args.has_value() || active.empty())
+        {
+            return expanded_args;
+        }
+
+        std::vector<std::string> paths;
+        for (const ActiveProcessSubstitution& process_substitution : active)
+        {
+            paths.push_back("/dev/fd/" + std::to_string(process_substitution.fd));
+        }
+
+        replace_process_substitution_markers(*expanded_args, paths);
+        return expanded_args;
+    }
+
+    auto inherit_process_substitutions(
+        const std::vector<ActiveProcessSubstitution>& process_substitutions) -> void
+    {
+        for (const ActiveProcessSubstitution& active : process_substitutions)
+        {
+            fcntl(active.fd, F_SETFD, 0);
+        }
+    }
+
+    auto finish_process_substitutions(std::vector<ActiveProcessSubstitution>& process_substitutions)
+        -> void
+    {
+        for (const ActiveProcessSubstitution& active : process_substitutions)
+        {
+            close(active.fd);
+        }
+
+        for (const ActiveProcessSubstitution& active : process_substitutions)
+        {
+            int status;
+            waitpid(active.pid, &status, 0);
+        }
+
+        process_substitutions.clear();
+    }
+
 } // namespace ash
@@ -1,31 +1,87 @@
 #pragma once
 
+#include "commands.hpp"
 #include "parser.hpp"
 
+#include <array>
 #include <optional>
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <sys/types.h>
+
+#endif
+
 namespace ash
 {
+
+    using PipelinePipe = std::array<int, 2>;
+
+    struct ActiveProcessSubstitution
+    {
+        pid_t pid;
+        int fd;
+    };
+
     // Lifecycle
     auto initialize_shell() -> void;
     auto cleanup_shell() -> void;
 
+    // Startup
+    auto get_rc_file() -> std::optional<std::string>;
+    auto load_rc_file() -> bool;
+    auto record_startup_phase(const std::string& name) -> void;
+    auto print_startup_profile() -> void;
+
     // REPL
     auto read_input(const char* prompt) -> std::optional<std::string>;
     auto command_completion(const char* text, int start, int end) -> char**;
+    auto readline_event_hook() -> int;
     auto command_generator(const char* text, int state) -> char*;
+    auto get_command_matches(const std::string& prefix) -> std::vector<std::string>;
+    auto completion_match_generator(const char* text, int state) -> char*;
     auto repl_loop() -> void;
 
     // Input handling
     auto handle_input(const std::string& input) -> bool;
+    auto has_incomplete_input(const std::string& input) -> bool;
+    auto execute_line(const std::string& input) -> bool;
+    auto execute_script_file(const std::string& path) -> bool;
     auto handle_invalid_command(const std::string& input) -> void;
 
     // Execution
-    auto execute_builtin(const std::string& command, const std::string& args) -> void;
-    auto execute_command(const std::string& command, const std::string& args,
-                         RedirectionSpec redirection_spec) -> bool;
+    auto get_exit_status(int wait_status) -> int;
+    auto execute_command(const CommandSpec& cmd) -> bool;
+    auto make_literal_command(const std::vector<std::string>& command) -> CommandSpec;
+    auto expand_command_word(const CommandSpec& cmd) -> std::optional<CommandSpec>;
     auto execute_pipeline(const std::vector<CommandSpec>& commands) -> bool;
+    auto execute_alias(const CommandEntry& entry, const CommandSpec& cmd) -> bool;
+    auto expand_aliases(const std::vector<CommandSpec>& commands,
+                        std::vector<CommandSpec>& expanded) -> bool;
+
+    // Pipelines
+    auto execute_fan_out(const std::vector<std::vector<CommandSpec>>& consumers, int input_fd)
+        -> int;
+    auto create_pipeline_pipes(size_t count) -> std::optional<std::vector<PipelinePipe>>;
+    auto close_pipeline_pipes(const std::vector<PipelinePipe>& pipes,
+                              const std::vector<FdAction>& keep = {}) -> void;
+    auto get_pipe_capacity() -> std::optional<int>;
+
+    // Process substitution
+    auto start_process_substitutions(const std::vector<ProcessSubstitution>& process_substitutions)
+        -> std::vector<ActiveProcessSubstitution>;
+    auto get_substituted_arguments(const std::vector<Word>& args,
+                                   const std::vector<ActiveProcessSubstitution>& active)
+        -> std::optional<std::vector<std::string>>;
+    auto inherit_process_substitutions(
+        const std::vector<ActiveProcessSubstitution>& process_substitutions) -> void;
+    auto finish_process_substitutions(std::vector<ActiveProcessSubstitution>& process_substitutions)
+        -> void;
 
 } // namespace ash
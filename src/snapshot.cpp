@@ -0,0 +1,841 @@
+#include "snapshot.hpp"
+#include "braces.hpp"
+#include "constants.hpp"
+#include "commands.hpp"
+#include "variables.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto SnapshotWriter::write_integer(int64_t value) -> void
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    auto SnapshotWriter::write(const std::string& str) -> void
+    {
+        write_integer(static_cast<int64_t>(str.size()));
+        buffer += str;
+    }
+
+    auto SnapshotWriter::write(const WordPart& part) -> void
+    {
+        write_integer(static_cast<int64_t>(part.type));
+        write(part.text);
+        write_integer(part.is_quoted);
+    }
+
+    auto SnapshotWriter::write(const BraceNode& node) -> void
+    {
+        write_integer(static_cast<int64_t>(node.type));
+        write(node.parts);
+        write(node.alternatives);
+        write_integer(static_cast<int64_t>(node.alternative_offsets.size()));
+        for (size_t offset : node.alternative_offsets)
+        {
+            write_integer(static_cast<int64_t>(offset));
+        }
+        write_integer(node.start);
+        write_integer(node.step);
+        write_integer(static_cast<int64_t>(node.width));
+        write_integer(node.is_character);
+        write_integer(static_cast<int64_t>(node.value_count));
+        write_integer(static_cast<int64_t>(node.stride));
+    }
+
+    auto SnapshotWriter::write(const Word& word) -> void
+    {
+        write(word.parts);
+        write_integer(word.is_quoted);
+        write(word.brace_pattern);
+    }
+
+    auto SnapshotWriter::write(const Redirection& redirection) -> void
+    {
+        write_integer(redirection.fd);
+        write_integer(static_cast<int64_t>(redirection.op));
+        write(redirection.target);
+        write_integer(redirection.source_fd);
+        write(redirection.here_document_delimiter);
+        write_integer(redirection.strip_leading_tabs);
+        write_integer(redirection.is_delimiter_quoted);
+    }
+
+    auto SnapshotWriter::write(const RedirectionSpec& redirection_spec) -> void
+    {
+        write(redirection_spec.redirections);
+    }
+
+    auto SnapshotWriter::write(const ProcessSubstitution& process_substitution) -> void
+    {
+        write(process_substitution.command_line);
+        write_integer(static_cast<int64_t>(process_substitution.direction));
+    }
+
+    auto SnapshotWriter::write(const CommandSpec& cmd) -> void
+    {
+        write(cmd.command);
+        write_integer(cmd.command_word.has_value());
+        if (cmd.command_word.has_value())
+        {
+            write(*cmd.command_word);
+        }
+        write(cmd.args);
+        write(cmd.redirection);
+        write(cmd.process_substitutions);
+        write(cmd.assignments);
+        write(cmd.fan_out);
+        write_integer(cmd.body != nullptr);
+        if (cmd.body != nullptr)
+        {
+            write(*cmd.body);
+        }
+    }
+
+    auto SnapshotWriter::write(const Instruction& instruction) -> void
+    {
+        write_integer(static_cast<int64_t>(instruction.op));
+        write_integer(instruction.operand);
+        write_integer(instruction.target);
+    }
+
+    auto SnapshotWriter::write(const Assignment& assignment) -> void
+    {
+        write(assignment.name);
+        write(assignment.value);
+    }
+
+    auto SnapshotWriter::write(const ForLoop& loop) -> void
+    {
+        write(loop.variable);
+        write(loop.words);
+    }
+
+    auto SnapshotWriter::write(const FunctionDefinition& function) -> void
+    {
+        write(function.name);
+        write(*function.body);
+    }
+
+    auto SnapshotWriter::write(const Subshell& subshell) -> void
+    {
+        write(*subshell.body);
+    }
+
+    auto SnapshotWriter::write(const Program& program) -> void
+    {
+        write(program.instructions);
+        write(program.pipelines);
+        write(program.assignments);
+        write(program.for_loops);
+        write(program.words);
+        write(program.case_patterns);
+        write(program.redirections);
+        write(program.functions);
+        write(program.subshells);
+    }
+
+    auto SnapshotReader::read_integer(int64_t& value) -> bool
+    {
+        if (size - pos < sizeof(value))
+        {
+            return false;
+        }
+
+        std::memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    auto SnapshotReader::read(std::string& str) -> bool
+    {
+        int64_t length = 0;
+        if (!read_integer(length) || length < 0 || static_cast<size_t>(length) > size - pos)
+        {
+            return false;
+        }
+
+        str.assign(data + pos, static_cast<size_t>(length));
+        pos += static_cast<size_t>(length);
+        return true;
+    }
+
+    auto SnapshotReader::read(WordPart& part) -> bool
+    {
+        return read_value(part.type) && read(part.text) && read_value(part.is_quoted);
+    }
+
+    auto SnapshotReader::read(BraceNode& node) -> bool
+    {
+        int64_t offset_count = 0;
+        if (!read_value(node.type) || !read(node.parts) || !read(node.alternatives)
+            || !read_integer(offset_count) || offset_count < 0
+            || static_cast<size_t>(offset_count) > size - pos)
+        {
+            return false;
+        }
+
+        node.alternative_offsets.resize(static_cast<size_t>(offset_count));
+        for (size_t& offset : node.alternative_offsets)
+        {
+            if (!read_value(offset))
+            {
+                return false;
+            }
+        }
+
+        return read_integer(node.start) && read_integer(node.step) && read_value(node.width)
+               && read_value(node.is_character) && read_value(node.value_count)
+               && read_value(node.stride);
+    }
+
+    auto SnapshotReader::read(Word& word) -> bool
+    {
+        return read(word.parts) && read_value(word.is_quoted) && read(word.brace_pattern);
+    }
+
+    auto SnapshotReader::read(Redirection& redirection) -> bool
+    {
+        return read_value(redirection.fd) && read_value(redirection.op) && read(redirection.target)
+               && read_value(redirection.source_fd) && read(redirection.here_document_delimiter)
+               && read_value(redirection.strip_leading_tabs)
+               && read_value(redirection.is_delimiter_quoted);
+    }
+
+    auto SnapshotReader::read(RedirectionSpec& redirection_spec) -> bool
+    {
+        return read(redirection_spec.redirections);
+    }
+
+    auto SnapshotReader::read(ProcessSubstitution& process_substitution) -> bool
+    {
+        return read(process_substitution.command_line)
+               && read_value(process_substitution.direction);
+    }
+
+    auto SnapshotReader::read(CommandSpec& cmd) -> bool
+    {
+        bool has_command_word = false;
+        if (!read(cmd.command) || !read_value(has_command_word))
+        {
+            return false;
+        }
+
+        if (has_command_word && !read(cmd.command_word.emplace()))
+        {
+            return false;
+        }
+
+        bool has_body = false;
+        if (!read(cmd.args) || !read(cmd.redirection)
+            || !read(cmd.process_substitutions) || !read(cmd.assignments) || !read(cmd.fan_out)
+            || !read_value(has_body))
+        {
+            return false;
+        }
+
+        if (has_body)
+        {
+            auto body = std::make_shared<Program>();
+            if (!read(*body))
+            {
+                return false;
+            }
+            cmd.body = std::move(body);
+        }
+        return true;
+    }
+
+    auto SnapshotReader::read(Instruction& instruction) -> bool
+    {
+        return read_value(instruction.op) && read_value(instruction.operand)
+               && read_value(instruction.target);
+    }
+
+    auto SnapshotReader::read(Assignment& assignment) -> bool
+    {
+        return read(assignment.name) && read(assignment.value);
+    }
+
+    auto SnapshotReader::read(ForLoop& loop) -> bool
+    {
+        return read(loop.variable) && read(loop.words);
+    }
+
+    auto SnapshotReader::read(FunctionDefinition& function) -> bool
+    {
+        auto body = std::make_shared<Program>();
+        if (!read(function.name) || !read(*body))
+        {
+            return false;
+        }
+
+        function.body = std::move(body);
+        return true;
+    }
+
+    auto SnapshotReader::read(Subshell& subshell) -> bool
+    {
+        auto body = std::make_shared<Program>();
+        if (!read(*body))
+        {
+            return false;
+        }
+
+        subshell.body = std::move(body);
+        return true;
+    }
+
+    auto SnapshotReader::read(Program& program) -> bool
+    {
+        return read(program.instructions) && read(program.pipelines) && read(program.assignments)
+               && read(program.for_loops) && read(program.words) && read(program.case_patterns)
+               && read(program.redirections) && read(program.functions)
+               && read(program.subshells);
+    }
+
+    auto get_snapshot_path(const std::string& source_path) -> std::string
+    {
+        return source_path + config::SNAPSHOT_SUFFIX;
+    }
+
+    auto write_snapshot_key(SnapshotWriter& writer, const std::string& source_path,
+                            const struct stat& source_stat) -> void
+    {
+        // NOTE(abi): a snapshot is only valid for the exact file it was compiled from,
+        // and for the build of ash that wrote it.
+        writer.buffer.append(config::SNAPSHOT_MAGIC, std::strlen(config::SNAPSHOT_MAGIC));
+        writer.write_integer(config::SNAPSHOT_VERSION);
+        writer.write(source_path);
+        writer.write_integer(source_stat.st_mtim.tv_sec);
+        writer.write_integer(source_stat.st_mtim.tv_nsec);
+        writer.write_integer(source_stat.st_size);
+    }
+
+    auto get_snapshot_checksum(const char* data, size_t size) -> uint64_t
+    {
+        // FNV-1a, plenty to notice a damaged or truncated file
+        uint64_t hash = 0xcbf29ce484222325;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    auto load_program_snapshot(const std::string& source_path, const struct stat& source_stat,
+                               Program& program) -> bool
+    {
+        int fd = open(get_snapshot_path(source_path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct stat snapshot_stat;
+        if (fstat(fd, &snapshot_stat) == -1 || snapshot_stat.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        size_t size = static_cast<size_t>(snapshot_stat.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+
+        SnapshotWriter key;
+        write_snapshot_key(key, source_path, source_stat);
+
+        const char* data = static_cast<const char*>(mapping);
+        bool is_loaded = false;
+        const std::string& expected_key = key.buffer;
+        // NOTE(abi): the program is run as read, so a snapshot that was damaged (or
+        // edited) must not get that far. The body's checksum catches the former, and
+        // every index, enum and jump is checked against the tables it refers to.
+        uint64_t checksum = 0;
+        if (size >= expected_key.size() + sizeof(checksum)
+            && std::memcmp(data, expected_key.data(), expected_key.size()) == 0)
+        {
+            size_t body_end = size - sizeof(checksum);
+            std::memcpy(&checksum, data + body_end, sizeof(checksum));
+            SnapshotReader reader{data, body_end, expected_key.size()};
+            is_loaded = checksum
+                            == get_snapshot_checksum(data + reader.pos, body_end - reader.pos)
+                        && reader.read(program) && reader.pos == body_end
+                        && is_valid_program(program, static_cast<size_t>(source_stat.st_size));
+        }
+
+        munmap(mapping, size);
+
+        if (!is_loaded)
+        {
+            program = Program();
+        }
+        return is_loaded;
+    }
+
+    auto save_program_snapshot(const std::string& source_path, const struct stat& source_stat,
+                               const Program& program) -> bool
+    {
+        SnapshotWriter writer;
+        write_snapshot_key(writer, source_path, source_stat);
+        size_t body_start = writer.buffer.size();
+        writer.write(program);
+        writer.write_integer(static_cast<int64_t>(get_snapshot_checksum(
+            writer.buffer.data() + body_start, writer.buffer.size() - body_start)));
+
+        // Written aside and renamed into place, so a concurrent shell never maps a
+        // half-written snapshot
+        std::string snapshot_path = get_snapshot_path(source_path);
+        std::string temporary_path = snapshot_path + "." + std::to_string(getpid());
+        int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      permissions::DEFAULT_FILE_MODE);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        bool is_written = write_all(fd, writer.buffer.data(), writer.buffer.size());
+        is_written = (close(fd) == 0) && is_written;
+        if (!is_written || rename(temporary_path.c_str(), snapshot_path.c_str()) == -1)
+        {
+            unlink(temporary_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    auto is_valid_program(const Program& program, size_t source_size) -> bool
+    {
+        size_t count = program.instructions.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            const Instruction& instruction = program.instructions[i];
+            uint32_t operand = instruction.operand;
+            bool is_valid = true;
+            switch (instruction.op)
+            {
+            case OpCode::NOP:
+            case OpCode::SET_STATUS:
+            case OpCode::NEGATE_STATUS:
+            case OpCode::FOR_END:
+            case OpCode::REDIRECT_END:
+                break;
+            case OpCode::RUN_PIPELINE:
+            case OpCode::EXIT:
+            case OpCode::RETURN:
+                is_valid = operand < program.pipelines.size()
+                           && !program.pipelines[operand].empty();
+                break;
+            case OpCode::ASSIGN:
+                is_valid = operand < program.assignments.size();
+                break;
+            case OpCode::JUMP:
+            case OpCode::JUMP_IF_SUCCESS:
+            case OpCode::JUMP_IF_FAILURE:
+                is_valid = instruction.target <= count;
+                break;
+            case OpCode::FOR_BEGIN:
+                is_valid = operand < program.for_loops.size();
+                break;
+            case OpCode::FOR_NEXT:
+                is_valid = operand < program.for_loops.size() && instruction.target <= count;
+                break;
+            case OpCode::CASE_BEGIN:
+                is_valid = operand < program.words.size() && instruction.target <= count;
+                break;
+            case OpCode::CASE_MATCH:
+                is_valid = operand < program.case_patterns.size() && instruction.target <= count;
+                break;
+            case OpCode::REDIRECT_BEGIN:
+                is_valid = operand < program.redirections.size() && instruction.target > i
+                           && instruction.target < count
+                           && program.instructions[instruction.target].op
+                                  == OpCode::REDIRECT_END;
+                break;
+            case OpCode::DEFINE_FUNCTION:
+                is_valid = operand < program.functions.size()
+                           && program.functions[operand].body != nullptr;
+                break;
+            case OpCode::RUN_SUBSHELL:
+                is_valid = operand < program.subshells.size()
+                           && program.subshells[operand].body != nullptr;
+                break;
+            default:
+                is_valid = false;
+                break;
+            }
+
+            if (!is_valid)
+            {
+                return false;
+            }
+        }
+
+        if (!is_valid_control_flow(program))
+        {
+            return false;
+        }
+
+        // The tables, and the bodies of functions and subshells
+        auto is_valid = [source_size](const Word& word)
+        { return is_valid_word(word, source_size); };
+        auto are_valid = [&is_valid](const std::vector<Word>& words)
+        { return std::all_of(words.begin(), words.end(), is_valid); };
+
+        for (const std::vector<CommandSpec>& commands : program.pipelines)
+        {
+            for (const CommandSpec& cmd : commands)
+            {
+                if (!is_valid_command(cmd, source_size))
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (const std::vector<Assignment>& assignments : program.assignments)
+        {
+            for (const Assignment& assignment : assignments)
+            {
+                if (!is_valid(assignment.value))
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (const ForLoop& loop : program.for_loops)
+        {
+            if (!are_valid(loop.words))
+            {
+                return false;
+            }
+        }
+
+        for (const RedirectionSpec& redirection_spec : program.redirections)
+        {
+            for (const Redirection& redirection : redirection_spec.redirections)
+            {
+                if (redirection.op > RedirectionOperator::DOCUMENT)
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (const FunctionDefinition& function : program.functions)
+        {
+            if (function.body == nullptr || !is_valid_program(*function.body, source_size))
+            {
+                return false;
+            }
+        }
+
+        for (const Subshell& subshell : program.subshells)
+        {
+            if (subshell.body == nullptr || !is_valid_program(*subshell.body, source_size))
+            {
+                return false;
+            }
+        }
+
+        return are_valid(program.words)
+               && std::all_of(program.case_patterns.begin(), program.case_patterns.end(),
+                              are_valid);
+    }
+
+    auto is_valid_control_flow(const Program& program) -> bool
+    {
+        // NOTE(abi): loop state is pushed by FOR_BEGIN and saved descriptors by
+        // REDIRECT_BEGIN, and the code after them pops both unchecked. So the regions
+        // they open must nest, nothing may jump into one, and a break or continue may
+        // only drop the loops it leaves.
+        struct Region
+        {
+            size_t begin;
+            size_t end;
+            bool is_loop;
+        };
+
+        const std::vector<Instruction>& instructions = program.instructions;
+        size_t count = instructions.size();
+        std::vector<Region> regions;
+        std::vector<bool> is_region_end(count, false);
+        for (size_t i = 0; i < count; i++)
+        {
+            const Instruction& instruction = instructions[i];
+            if (instruction.op == OpCode::FOR_BEGIN)
+            {
+                // FOR_BEGIN, FOR_NEXT, the body, and a jump back to FOR_NEXT
+                if (i + 1 >= count || instructions[i + 1].op != OpCode::FOR_NEXT
+                    || instructions[i + 1].operand != instruction.operand)
+                {
+                    return false;
+                }
+
+                size_t end = instructions[i + 1].target;
+                if (end < i + 3 || instructions[end - 1].op != OpCode::JUMP
+                    || instructions[end - 1].target != i + 1)
+                {
+                    return false;
+                }
+                regions.push_back({i + 1, end, true});
+            }
+            else if (instruction.op == OpCode::FOR_NEXT
+                     && (i == 0 || instructions[i - 1].op != OpCode::FOR_BEGIN))
+            {
+                return false;
+            }
+            else if (instruction.op == OpCode::REDIRECT_BEGIN)
+            {
+                if (is_region_end[instruction.target])
+                {
+                    return false;
+                }
+                is_region_end[instruction.target] = true;
+                regions.push_back({i + 1, instruction.target + 1, false});
+            }
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (instructions[i].op == OpCode::REDIRECT_END && !is_region_end[i])
+            {
+                return false;
+            }
+        }
+
+        // The innermost region around each instruction, and how many loops it's in
+        constexpr size_t NO_REGION = std::numeric_limits<size_t>::max();
+        std::vector<size_t> innermost(count + 1, NO_REGION);
+        std::vector<size_t> loop_depth(count + 1, 0);
+        std::vector<size_t> open_regions;
+        size_t open_loops = 0;
+        size_t next_region = 0;
+        for (size_t pc = 0; pc <= count; pc++)
+        {
+            while (!open_regions.empty() && regions[open_regions.back()].end <= pc)
+            {
+                open_loops -= regions[open_regions.back()].is_loop ? 1 : 0;
+                open_regions.pop_back();
+            }
+
+            while (next_region < regions.size() && regions[next_region].begin == pc)
+            {
+                if (!open_regions.empty()
+                    && regions[next_region].end > regions[open_regions.back()].end)
+                {
+                    return false;
+                }
+                open_loops += regions[next_region].is_loop ? 1 : 0;
+                open_regions.push_back(next_region++);
+            }
+
+            innermost[pc] = open_regions.empty() ? NO_REGION : open_regions.back();
+            loop_depth[pc] = open_loops;
+        }
+
+        auto is_jump_allowed = [&](size_t from, size_t to) -> bool
+        {
+            size_t region = innermost[to];
+            return region == NO_REGION
+                   || (regions[region].begin <= from && from < regions[region].end);
+        };
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const Instruction& instruction = instructions[i];
+            switch (instruction.op)
+            {
+            case OpCode::JUMP:
+            case OpCode::JUMP_IF_SUCCESS:
+            case OpCode::JUMP_IF_FAILURE:
+            case OpCode::FOR_NEXT:
+            case OpCode::CASE_BEGIN:
+            case OpCode::CASE_MATCH:
+                if (!is_jump_allowed(i, instruction.target))
+                {
+                    return false;
+                }
+                break;
+            case OpCode::FOR_END:
+            {
+                // A run of them ends in the jump that leaves those loops
+                if (i > 0 && instructions[i - 1].op == OpCode::FOR_END)
+                {
+                    break;
+                }
+
+                size_t run_end = i;
+                while (run_end < count && instructions[run_end].op == OpCode::FOR_END)
+                {
+                    run_end++;
+                }
+
+                size_t dropped = run_end - i;
+                if (dropped > loop_depth[i] || run_end == count
+                    || instructions[run_end].op != OpCode::JUMP
+                    || loop_depth[instructions[run_end].target] > loop_depth[i] - dropped)
+                {
+                    return false;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    auto is_valid_command(const CommandSpec& cmd, size_t source_size) -> bool
+    {
+        for (const Redirection& redirection : cmd.redirection.redirections)
+        {
+            if (redirection.op > RedirectionOperator::DOCUMENT)
+            {
+                return false;
+            }
+        }
+
+        for (const ProcessSubstitution& process_substitution : cmd.process_substitutions)
+        {
+            if (process_substitution.direction > ProcessSubstitutionDirection::OUTPUT)
+            {
+                return false;
+            }
+        }
+
+        for (const std::vector<CommandSpec>& consumer : cmd.fan_out)
+        {
+            if (consumer.empty())
+            {
+                return false;
+            }
+
+            for (const CommandSpec& consumer_cmd : consumer)
+            {
+                if (!is_valid_command(consumer_cmd, source_size))
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (cmd.command_word.has_value() && !is_valid_word(*cmd.command_word, source_size))
+        {
+            return false;
+        }
+
+        for (const Word& arg : cmd.args)
+        {
+            if (!is_valid_word(arg, source_size))
+            {
+                return false;
+            }
+        }
+
+        // The names end up in the environment
+        for (const Assignment& assignment : cmd.assignments)
+        {
+            if (!is_valid_variable_name(assignment.name)
+                || !is_valid_word(assignment.value, source_size))
+            {
+                return false;
+            }
+        }
+        return cmd.body == nullptr || is_valid_program(*cmd.body, source_size);
+    }
+
+    auto is_valid_word(const Word& word, size_t source_size) -> bool
+    {
+        for (const WordPart& part : word.parts)
+        {
+            if (part.type > WordPartType::ARITHMETIC)
+            {
+                return false;
+            }
+        }
+        return is_valid_brace_pattern(word.brace_pattern, source_size);
+    }
+
+    auto is_valid_brace_pattern(const std::vector<BraceNode>& pattern, size_t source_size)
+        -> bool
+    {
+        // Generation indexes with the counts and strides worked out by the parser, so they
+        // have to add up the same way here. A padded sequence is no wider than its text.
+        size_t stride = 1;
+        for (auto it = pattern.rbegin(); it != pattern.rend(); ++it)
+        {
+            const BraceNode& node = *it;
+            if (node.type > BraceNodeType::SEQUENCE || node.stride != stride
+                || node.value_count == 0 || node.step == 0 || node.width > source_size
+                || (node.type == BraceNodeType::PARTS && node.value_count != 1))
+            {
+                return false;
+            }
+
+            for (const WordPart& part : node.parts)
+            {
+                if (part.type > WordPartType::ARITHMETIC)
+                {
+                    return false;
+                }
+            }
+
+            if (node.type == BraceNodeType::ALTERNATION)
+            {
+                if (node.alternatives.empty()
+                    || node.alternative_offsets.size() != node.alternatives.size())
+                {
+                    return false;
+                }
+
+                size_t value_count = 0;
+                for (size_t i = 0; i < node.alternatives.size(); i++)
+                {
+                    if (node.alternative_offsets[i] != value_count
+                        || !is_valid_brace_pattern(node.alternatives[i], source_size))
+                    {
+                        return false;
+                    }
+                    value_count += get_brace_expansion_count(node.alternatives[i]);
+                }
+
+                if (value_count != node.value_count)
+                {
+                    return false;
+                }
+            }
+
+            if (__builtin_mul_overflow(stride, node.value_count, &stride))
+            {
+                stride = std::numeric_limits<size_t>::max();
+            }
+        }
+        return true;
+    }
+
+} // namespace ash
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "interpreter.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <sys/stat.h>
+
+#endif
+
+namespace ash
+{
+
+    // NOTE(abi): a compiled program written out field by field, so that loading it
+    // back skips the parser. Integers are stored in host byte order, the snapshot is
+    // a cache for this machine and not an interchange format.
+    struct SnapshotWriter
+    {
+        std::string buffer;
+
+        auto write_integer(int64_t value) -> void;
+        auto write(const std::string& str) -> void;
+        auto write(const WordPart& part) -> void;
+        auto write(const BraceNode& node) -> void;
+        auto write(const Word& word) -> void;
+        auto write(const Redirection& redirection) -> void;
+        auto write(const RedirectionSpec& redirection_spec) -> void;
+        auto write(const ProcessSubstitution& process_substitution) -> void;
+        auto write(const CommandSpec& cmd) -> void;
+        auto write(const Instruction& instruction) -> void;
+        auto write(const Assignment& assignment) -> void;
+        auto write(const ForLoop& loop) -> void;
+        auto write(const FunctionDefinition& function) -> void;
+        auto write(const Subshell& subshell) -> void;
+        auto write(const Program& program) -> void;
+
+        template <typename T>
+        auto write(const std::vector<T>& values) -> void
+        {
+            write_integer(static_cast<int64_t>(values.size()));
+            for (const T& value : values)
+            {
+                write(value);
+            }
+        }
+    };
+
+    struct SnapshotReader
+    {
+        const char* data;
+        size_t size;
+        size_t pos = 0;
+
+        auto read_integer(int64_t& value) -> bool;
+        auto read(std::string& str) -> bool;
+        auto read(WordPart& part) -> bool;
+        auto read(BraceNode& node) -> bool;
+        auto read(Word& word) -> bool;
+        auto read(Redirection& redirection) -> bool;
+        auto read(RedirectionSpec& redirection_spec) -> bool;
+        auto read(ProcessSubstitution& process_substitution) -> bool;
+        auto read(CommandSpec& cmd) -> bool;
+        auto read(Instruction& instruction) -> bool;
+        auto read(Assignment& assignment) -> bool;
+        auto read(ForLoop& loop) -> bool;
+        auto read(FunctionDefinition& function) -> bool;
+        auto read(Subshell& subshell) -> bool;
+        auto read(Program& program) -> bool;
+
+        template <typename T>
+        auto read(std::vector<T>& values) -> bool
+        {
+            // Every element takes at least one byte, which bounds corrupt counts
+            int64_t count = 0;
+            if (!read_integer(count) || count < 0 || static_cast<size_t>(count) > size - pos)
+            {
+                return false;
+            }
+
+            values.resize(static_cast<size_t>(count));
+            for (T& value : values)
+            {
+                if (!read(value))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template <typename T>
+        auto read_value(T& value) -> bool
+        {
+            int64_t integer = 0;
+            if (!read_integer(integer))
+            {
+                return false;
+            }
+            value = static_cast<T>(integer);
+            return true;
+        }
+    };
+
+    // Snapshots
+    auto get_snapshot_path(const std::string& source_path) -> std::string;
+    auto load_program_snapshot(const std::string& source_path, const struct stat& source_stat,
+                               Program& program) -> bool;
+    auto save_program_snapshot(const std::string& source_path, const struct stat& source_stat,
+                               const Program& program) -> bool;
+    auto write_snapshot_key(SnapshotWriter& writer, const std::string& source_path,
+                            const struct stat& source_stat) -> void;
+    auto get_snapshot_checksum(const char* data, size_t size) -> uint64_t;
+
+    // Validation
+    auto is_valid_program(const Program& program, size_t source_size) -> bool;
+    auto is_valid_control_flow(const Program& program) -> bool;
+    auto is_valid_command(const CommandSpec& cmd, size_t source_size) -> bool;
+    auto is_valid_word(const Word& word, size_t source_size) -> bool;
+    auto is_valid_brace_pattern(const std::vector<BraceNode>& pattern, size_t source_size)
+        -> bool;
+
+} // namespace ash
@@ -1,17 +1,78 @@
 #pragma once
 
+#include "background.hpp"
+#include "commands.hpp"
+#include "completion.hpp"
+#include "constants.hpp"
+#include "editor.hpp"
+#include "frecency.hpp"
+#include "interpreter.hpp"
+#include "prompt.hpp"
+#include "resources.hpp"
+
+#include <chrono>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace ash
 {
 
+    struct ShellOptions
+    {
+        bool big_pipes = false;
+        bool native_editor = config::NATIVE_EDITOR_DEFAULT;
+        bool startup_profile = false;
+    };
+
+    struct StartupPhase
+    {
+        std::string name;
+        std::chrono::steady_clock::duration duration;
+    };
+
     struct ShellState
     {
+        std::string working_directory; // Logical, as $PWD; empty until first asked for
         std::string previous_directory;
         std::vector<std::string> command_history;
         size_t command_history_last_write_index = 0;
+        ShellOptions options;
+        std::unordered_map<std::string, std::string> variables;
+
+        // NOTE(abi): the executable exports through the process environment. A libash
+        // context works on its own copy instead, which only the commands it starts see.
+        bool has_own_environment = false;
+        std::unordered_map<std::string, std::string> environment;
+
+        std::unordered_map<std::string, CommandEntry> command_table;
+        std::vector<std::string> expanding_aliases;
+        std::string shell_name = "ash";
+        std::vector<std::string> positional_parameters;
+        std::shared_ptr<BackgroundResult<std::vector<std::string>>> pending_history;
+        std::shared_ptr<BackgroundResult<ExecutableIndex>> pending_executable_index;
+        ExecutableIndex executable_index;
+        ProgramCache program_cache;
+        std::string directory_index_file; // Where cd records visits, empty when it doesn't
+        std::shared_ptr<BackgroundResult<FrecencyIndex>> pending_directory_index;
+        std::vector<DirectoryVisit> pending_directory_visits; // Made while it was loading
+        FrecencyIndex directory_index;
+        PromptState prompt;
+        LineEditor editor;
+        std::unordered_map<std::string, std::shared_ptr<DirectoryLookup>> directory_listings;
+        std::vector<std::string> completion_matches;
+        std::vector<StartupPhase> startup_phases;
+        std::chrono::steady_clock::time_point startup_phase_start;
+        JobResources job_resources;
+        size_t job_count = 0;
+        bool is_cgroup_failure_reported = false;
+        bool is_pipe_size_reported = false;
+        bool can_exec_in_place = false; // The command about to run is a subshell's last
+        int last_exit_status = 0;
+        bool is_exiting = false;
     };
 
-    extern ShellState shell_state;
+    // NOTE(abi): the state of the shell running on this thread. The executable has a
+    // single one, embedders get one per context (see libash.hpp).
+    extern thread_local ShellState* shell_state;
 } // namespace ash
@@ -0,0 +1,377 @@
+#include "variables.hpp"
+#include "commands.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    auto get_variable(const std::string& name) -> std::optional<std::string>
+    {
+        // Special parameters
+        if (name == "?")
+        {
+            return std::to_string(shell_state->last_exit_status);
+        }
+
+        if (name == "$")
+        {
+            return std::to_string(getpid());
+        }
+
+        if (name == "#")
+        {
+            return std::to_string(shell_state->positional_parameters.size());
+        }
+
+        if (name == "@" || name == "*")
+        {
+            std::string joined;
+            for (const std::string& parameter : shell_state->positional_parameters)
+            {
+                joined += joined.empty() ? parameter : " " + parameter;
+            }
+            return joined;
+        }
+
+        // Positional parameters, $0 is the shell or script name
+        if (!name.empty() && name[0] >= '0' && name[0] <= '9')
+        {
+            size_t index = 0;
+            auto [end, error] = std::from_chars(name.data(), name.data() + name.size(), index);
+            if (error != std::errc() || end != name.data() + name.size())
+            {
+                return std::nullopt;
+            }
+
+            if (index == 0)
+            {
+                return shell_state->shell_name;
+            }
+
+            if (index > shell_state->positional_parameters.size())
+            {
+                return std::nullopt;
+            }
+            return shell_state->positional_parameters[index - 1];
+        }
+
+        // NOTE(abi): shell variables shadow the environment.
+        auto it = shell_state->variables.find(name);
+        if (it != shell_state->variables.end())
+        {
+            return it->second;
+        }
+
+        const char* value = get_exported_variable(name);
+        if (value == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        return std::string(value);
+    }
+
+    auto set_variable(const std::string& name, const std::string& value) -> void
+    {
+        // Exported variables stay in the environment, so children see the update
+        if (get_exported_variable(name) != nullptr)
+        {
+            export_variable(name, value);
+            return;
+        }
+
+        shell_state->variables[name] = value;
+        if (name == "PATH")
+        {
+            forget_hashed_paths();
+        }
+    }
+
+    auto unset_variable(const std::string& name) -> void
+    {
+        shell_state->variables.erase(name);
+        if (shell_state->has_own_environment)
+        {
+            shell_state->environment.erase(name);
+        }
+        else
+        {
+            unsetenv(name.c_str());
+        }
+
+        if (name == "PATH")
+        {
+            forget_hashed_paths();
+        }
+    }
+
+    auto get_positional_parameters() -> const std::vector<std::string>&
+    {
+        return shell_state->positional_parameters;
+    }
+
+    auto is_valid_variable_name(const std::string& name) -> bool
+    {
+        if (name.empty() || (name[0] >= '0' && name[0] <= '9'))
+        {
+            return false;
+        }
+
+        for (char c : name)
+        {
+            bool is_alphanumeric =
+                (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+            if (!is_alphanumeric && c != '_')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    auto parse_variable_reference(const std::string& str, size_t dollar_pos, std::string& name)
+        -> size_t
+    {
+        size_t pos = dollar_pos + 1;
+        if (pos >= str.length())
+        {
+            return 0;
+        }
+
+        // $?, $$, $#, $@, $*, $0-$9
+        if (str[pos] == '?' || str[pos] == '$' || str[pos] == '#' || str[pos] == '@'
+            || str[pos] == '*' || (str[pos] >= '0' && str[pos] <= '9'))
+        {
+            name = str.substr(pos, 1);
+            return 2;
+        }
+
+        // ${name}
+        if (str[pos] == '{')
+        {
+            size_t close_pos = str.find('}', pos);
+            if (close_pos == std::string::npos)
+            {
+                return 0;
+            }
+
+            name = str.substr(pos + 1, close_pos - pos - 1);
+            return close_pos - dollar_pos + 1;
+        }
+
+        // $name
+        size_t end = pos;
+        while (end < str.length()
+               && ((str[end] >= 'a' && str[end] <= 'z') || (str[end] >= 'A' && str[end] <= 'Z')
+                   || (str[end] >= '0' && str[end] <= '9' && end > pos) || str[end] == '_'))
+        {
+            end++;
+        }
+
+        if (end == pos)
+        {
+            return 0;
+        }
+
+        name = str.substr(pos, end - pos);
+        return end - dollar_pos;
+    }
+
+    auto get_exported_variable(const std::string& name) -> const char*
+    {
+        if (!shell_state->has_own_environment)
+        {
+            return std::getenv(name.c_str());
+        }
+
+        auto it = shell_state->environment.find(name);
+        return (it != shell_state->environment.end()) ? it->second.c_str() : nullptr;
+    }
+
+    auto export_variable(const std::string& name, const std::string& value) -> void
+    {
+        shell_state->variables.erase(name);
+        if (shell_state->has_own_environment)
+        {
+            shell_state->environment[name] = value;
+        }
+        else
+        {
+            setenv(name.c_str(), value.c_str(), 1);
+        }
+
+        // NOTE(abi): hashed command paths are only valid for the PATH they were found in.
+        if (name == "PATH")
+        {
+            forget_hashed_paths();
+        }
+    }
+
+    auto get_exported_variables() -> VariableValues
+    {
+        VariableValues variables;
+        if (shell_state->has_own_environment)
+        {
+            variables.assign(shell_state->environment.begin(), shell_state->environment.end());
+        }
+        else
+        {
+            std::unordered_map<std::string, std::string> environment = copy_process_environment();
+            variables.assign(environment.begin(), environment.end());
+        }
+
+        std::sort(variables.begin(), variables.end());
+        return variables;
+    }
+
+    auto copy_process_environment() -> std::unordered_map<std::string, std::string>
+    {
+        std::unordered_map<std::string, std::string> environment;
+        for (char** entry = environ; *entry != nullptr; entry++)
+        {
+            const char* equals = std::strchr(*entry, '=');
+            if (equals != nullptr)
+            {
+                environment.emplace(std::string(*entry, equals - *entry), equals + 1);
+            }
+        }
+
+        return environment;
+    }
+
+    auto get_exec_environment(std::vector<std::string>& entries) -> std::vector<char*>
+    {
+        // NOTE(abi): built before forking, a libash host may have other threads holding
+        // the allocator's locks. The pointers are only valid while entries lives.
+        std::vector<char*> envp;
+        if (!shell_state->has_own_environment)
+        {
+            for (char** entry = environ; *entry != nullptr; entry++)
+            {
+                envp.push_back(*entry);
+            }
+        }
+        else
+        {
+            entries.clear();
+            entries.reserve(shell_state->environment.size());
+            for (const auto& [name, value] : shell_state->environment)
+            {
+                entries.push_back(name + "=" + value);
+            }
+
+            for (std::string& entry : entries)
+            {
+                envp.push_back(entry.data());
+            }
+        }
+
+        envp.push_back(nullptr);
+        return envp;
+    }
+
+    auto assign_variables(const std::vector<Assignment>& assignments) -> bool
+    {
+        std::string value;
+        for (const Assignment& assignment : assignments)
+        {
+            if (expand_word(assignment.value, value) == ExpansionResult::FAILED)
+            {
+                return false;
+            }
+            set_variable(assignment.name, value);
+        }
+
+        return true;
+    }
+
+    auto expand_assignments(const std::vector<Assignment>& assignments)
+        -> std::optional<VariableValues>
+    {
+        // NOTE(abi): each value sees the ones before it, as in a=1 b=$a cmd, so they
+        // are set while the rest expand and put back afterwards.
+        VariableValues values;
+        std::vector<SavedVariable> saved;
+        std::string value;
+        for (const Assignment& assignment : assignments)
+        {
+            if (expand_word(assignment.value, value) == ExpansionResult::FAILED)
+            {
+                restore_variables(saved);
+                return std::nullopt;
+            }
+
+            values.emplace_back(assignment.name, value);
+            if (&assignment != &assignments.back())
+            {
+                assign_temporarily({values.back()}, saved);
+            }
+        }
+
+        restore_variables(saved);
+        return values;
+    }
+
+    auto assign_temporarily(const VariableValues& values, std::vector<SavedVariable>& saved)
+        -> void
+    {
+        // Exported, so that the commands a builtin or function starts see them too
+        for (const auto& [name, value] : values)
+        {
+            SavedVariable previous{name, std::nullopt, false};
+            if (const char* exported = get_exported_variable(name))
+            {
+                previous.value = exported;
+                previous.is_exported = true;
+            }
+            else if (auto it = shell_state->variables.find(name);
+                     it != shell_state->variables.end())
+            {
+                previous.value = it->second;
+            }
+
+            saved.push_back(std::move(previous));
+            export_variable(name, value);
+        }
+    }
+
+    auto restore_variables(std::vector<SavedVariable>& saved) -> void
+    {
+        // Backwards, so a name assigned twice gets its first value back
+        for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+        {
+            unset_variable(it->name);
+            if (!it->value.has_value())
+            {
+                continue;
+            }
+
+            if (it->is_exported)
+            {
+                export_variable(it->name, *it->value);
+            }
+            else
+            {
+                set_variable(it->name, *it->value);
+            }
+        }
+
+        saved.clear();
+    }
+
+} // namespace ash
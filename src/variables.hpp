@@ -0,0 +1,48 @@
+#pragma once
+
+#include "parser.hpp"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ash
+{
+
+    using VariableValues = std::vector<std::pair<std::string, std::string>>;
+
+    // A variable's value from before a temporary assignment
+    struct SavedVariable
+    {
+        std::string name;
+        std::optional<std::string> value; // Unset when empty
+        bool is_exported = false;
+    };
+
+    // Variables
+    auto get_variable(const std::string& name) -> std::optional<std::string>;
+    auto set_variable(const std::string& name, const std::string& value) -> void;
+    auto unset_variable(const std::string& name) -> void;
+    auto get_positional_parameters() -> const std::vector<std::string>&;
+    auto is_valid_variable_name(const std::string& name) -> bool;
+    auto parse_variable_reference(const std::string& str, size_t dollar_pos, std::string& name)
+        -> size_t;
+
+    // Environment
+    auto get_exported_variable(const std::string& name) -> const char*;
+    auto export_variable(const std::string& name, const std::string& value) -> void;
+    auto get_exported_variables() -> VariableValues;
+    auto copy_process_environment() -> std::unordered_map<std::string, std::string>;
+    auto get_exec_environment(std::vector<std::string>& entries) -> std::vector<char*>;
+
+    // Assignments
+    auto assign_variables(const std::vector<Assignment>& assignments) -> bool;
+    auto expand_assignments(const std::vector<Assignment>& assignments)
+        -> std::optional<VariableValues>;
+    auto assign_temporarily(const VariableValues& values, std::vector<SavedVariable>& saved)
+        -> void;
+    auto restore_variables(std::vector<SavedVariable>& saved) -> void;
+
+} // namespace ash
@@ -0,0 +1,492 @@
+#include "watch.hpp"
+#include "completion.hpp"
+#include "constants.hpp"
+#include "memo.hpp"
+#include "shell.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+// TODO(abi): ...
+
+#else
+
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <fnmatch.h>
+    #include <glob.h>
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+
+#endif
+
+namespace ash
+{
+
+    // Write end of the pipe that wakes watch-run up on Ctrl-C
+    int watch_interrupt_fd = -1;
+
+    auto watch_run_command(const BuiltinArguments& args) -> int
+    {
+        WatchOptions options;
+        if (!parse_watch_options(args, options))
+        {
+            std::cerr << "watch-run: usage: watch-run [--no-restart] paths... -- command [args...]"
+                      << std::endl;
+            return 2;
+        }
+
+        WatchSession session;
+        session.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (session.inotify_fd == -1)
+        {
+            std::cerr << "watch-run: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+
+        for (const std::string& pattern : options.patterns)
+        {
+            if (!add_watch_pattern(session, pattern))
+            {
+                std::cerr << "watch-run: " << pattern << ": " << std::strerror(errno) << std::endl;
+                close(session.inotify_fd);
+                return 1;
+            }
+        }
+
+        // NOTE(abi): the command runs in its own process group so a restart takes down
+        // everything it started. That keeps it out of the terminal's Ctrl-C, which is
+        // caught here and passed on instead.
+        int interrupt_pipe[2];
+        if (pipe2(interrupt_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+        {
+            std::cerr << "watch-run: " << std::strerror(errno) << std::endl;
+            close(session.inotify_fd);
+            return 1;
+        }
+        watch_interrupt_fd = interrupt_pipe[1];
+
+        struct sigaction interrupt_action = {};
+        struct sigaction previous_action = {};
+        interrupt_action.sa_handler = handle_watch_interrupt;
+        sigemptyset(&interrupt_action.sa_mask);
+        sigaction(SIGINT, &interrupt_action, &previous_action);
+
+        using Clock = std::chrono::steady_clock;
+        const CommandSpec cmd = make_literal_command(options.command);
+        Clock::time_point deadline;
+        bool is_pending = false;
+
+        start_watched_command(session, cmd);
+        while (true)
+        {
+            // Settle first, then wait for a command that isn't restarted to finish
+            int timeout_ms = -1;
+            bool is_waiting = is_pending && session.pid != -1 && !options.is_restarting;
+            if (is_pending && !is_waiting)
+            {
+                auto remaining = deadline - Clock::now();
+                timeout_ms = std::max(0, static_cast<int>(
+                    std::chrono::ceil<std::chrono::milliseconds>(remaining).count()));
+            }
+            if (session.pid != -1 && session.pid_fd == -1)
+            {
+                timeout_ms = (timeout_ms == -1)
+                                 ? config::WATCH_REAP_INTERVAL_MS
+                                 : std::min(timeout_ms, config::WATCH_REAP_INTERVAL_MS);
+            }
+
+            struct pollfd poll_fds[3] = {{interrupt_pipe[0], POLLIN, 0},
+                                         {session.inotify_fd, POLLIN, 0},
+                                         {session.pid_fd, POLLIN, 0}};
+            if (poll(poll_fds, session.pid_fd != -1 ? 3 : 2, timeout_ms) == -1 && errno != EINTR)
+            {
+                break;
+            }
+
+            if (poll_fds[0].revents != 0)
+            {
+                break;
+            }
+
+            if (session.pid != -1)
+            {
+                reap_watched_command(session, false);
+            }
+
+            if (poll_fds[1].revents != 0 && read_watch_events(session))
+            {
+                // Every event pushes the run back, a burst of saves becomes one run
+                is_pending = true;
+                deadline = Clock::now() + std::chrono::milliseconds(config::WATCH_DEBOUNCE_MS);
+            }
+
+            if (!is_pending || Clock::now() < deadline
+                || (session.pid != -1 && !options.is_restarting))
+            {
+                continue;
+            }
+
+            is_pending = false;
+            if (has_pending_changes(session))
+            {
+                stop_watched_command(session);
+                start_watched_command(session, cmd);
+            }
+        }
+
+        stop_watched_command(session);
+        sigaction(SIGINT, &previous_action, nullptr);
+        watch_interrupt_fd = -1;
+        close(interrupt_pipe[0]);
+        close(interrupt_pipe[1]);
+        close(session.inotify_fd);
+
+        std::cout << std::endl;
+        return 128 + SIGINT;
+    }
+
+    auto parse_watch_options(const BuiltinArguments& args, WatchOptions& options) -> bool
+    {
+        size_t i = 0;
+        for (; i < args.size() && args[i] != "--"; i++)
+        {
+            if (args[i] == "--no-restart")
+            {
+                options.is_restarting = false;
+            }
+            else
+            {
+                options.patterns.push_back(args[i]);
+            }
+        }
+
+        if (i == args.size() || options.patterns.empty())
+        {
+            return false;
+        }
+
+        options.command.assign(args.begin() + i + 1, args.end());
+        return !options.command.empty();
+    }
+
+    auto handle_watch_interrupt(int) -> void
+    {
+        int error = errno;
+        char byte = 0;
+        if (watch_interrupt_fd != -1 && write(watch_interrupt_fd, &byte, 1) == -1)
+        {
+            // The pipe is full, watch-run is already on its way out
+        }
+        errno = error;
+    }
+
+    auto add_watch_pattern(WatchSession& session, const std::string& pattern) -> bool
+    {
+        std::string path = pattern;
+        while (path.size() > 1 && path.back() == '/')
+        {
+            path.pop_back();
+        }
+
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            return add_watched_directory(session, path, true);
+        }
+
+        // Event paths are built from the directory, so bare names get one too
+        if (path.find('/') == std::string::npos)
+        {
+            path = "./" + path;
+        }
+        session.patterns.push_back(path);
+
+        size_t last_slash = path.rfind('/');
+        std::string directory = (last_slash == 0) ? "/" : path.substr(0, last_slash);
+        if (directory.find_first_of("*?[") == std::string::npos)
+        {
+            if (!add_watched_directory(session, directory, false))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            glob_t directories;
+            if (glob(directory.c_str(), GLOB_ONLYDIR, nullptr, &directories) == 0)
+            {
+                for (size_t i = 0; i < directories.gl_pathc; i++)
+                {
+                    add_watched_directory(session, directories.gl_pathv[i], false);
+                }
+            }
+            globfree(&directories);
+        }
+
+        // What the files hold now is the baseline for telling real changes apart
+        glob_t matches;
+        if (glob(path.c_str(), 0, nullptr, &matches) == 0)
+        {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+            {
+                has_content_changed(session, matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+
+        return true;
+    }
+
+    auto add_watched_directory(WatchSession& session, const std::string& path, bool is_recursive)
+        -> bool
+    {
+        constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                                        | IN_MOVED_TO | IN_ONLYDIR;
+        int wd = inotify_add_watch(session.inotify_fd, path.c_str(), WATCH_MASK);
+        if (wd == -1)
+        {
+            return false;
+        }
+
+        // The same directory can be both a pattern's home and under a watched tree
+        auto [it, is_new] = session.directories.try_emplace(wd, WatchedDirectory{path, false});
+        if (it->second.is_recursive || !is_recursive)
+        {
+            return true;
+        }
+        it->second.is_recursive = true;
+
+        // Hidden directories (.git and the like) churn on their own and are left out
+        for (const DirectoryEntry& entry : read_directory_entries(path))
+        {
+            bool is_directory = entry.type == DT_DIR
+                                || (entry.type == DT_UNKNOWN && is_directory_entry(path, entry));
+            if (is_directory && entry.name[0] != '.')
+            {
+                add_watched_directory(session, path + "/" + entry.name, true);
+            }
+        }
+
+        return true;
+    }
+
+    auto read_watch_events(WatchSession& session) -> bool
+    {
+        alignas(struct inotify_event) char buffer[config::WATCH_EVENT_BUFFER_SIZE];
+        bool has_events = false;
+
+        ssize_t bytes_read;
+        while ((bytes_read = read(session.inotify_fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t offset = 0; offset < bytes_read;)
+            {
+                auto* event = reinterpret_cast<struct inotify_event*>(buffer + offset);
+                offset += sizeof(struct inotify_event) + event->len;
+
+                if ((event->mask & IN_Q_OVERFLOW) != 0)
+                {
+                    session.has_forced_change = true;
+                    has_events = true;
+                    continue;
+                }
+
+                auto it = session.directories.find(event->wd);
+                if ((event->mask & IN_IGNORED) != 0)
+                {
+                    if (it != session.directories.end())
+                    {
+                        session.directories.erase(it);
+                    }
+                    continue;
+                }
+                if (it == session.directories.end() || event->len == 0)
+                {
+                    continue;
+                }
+
+                const WatchedDirectory& directory = it->second;
+                std::string name = event->name;
+                std::string path = (directory.path == "/") ? "/" + name
+                                                           : directory.path + "/" + name;
+
+                // NOTE(abi): a directory moved in or out changes the tree in ways its own
+                // events won't show. A new empty one doesn't, its files show up as they come.
+                if ((event->mask & IN_ISDIR) != 0)
+                {
+                    if (directory.is_recursive && name[0] != '.')
+                    {
+                        if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+                        {
+                            add_watched_directory(session, path, true);
+                        }
+                        if ((event->mask & (IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) != 0)
+                        {
+                            session.has_forced_change = true;
+                            has_events = true;
+                        }
+                    }
+                    continue;
+                }
+
+                if (is_watched_path(session, directory, path))
+                {
+                    session.pending_paths.insert(path);
+                    has_events = true;
+                }
+            }
+        }
+
+        return has_events;
+    }
+
+    auto is_watched_path(const WatchSession& session, const WatchedDirectory& directory,
+                         const std::string& path) -> bool
+    {
+        if (directory.is_recursive)
+        {
+            return true;
+        }
+
+        return std::any_of(session.patterns.begin(), session.patterns.end(),
+                           [&path](const std::string& pattern)
+                           { return fnmatch(pattern.c_str(), path.c_str(), FNM_PATHNAME) == 0; });
+    }
+
+    auto has_pending_changes(WatchSession& session) -> bool
+    {
+        // Everything is checked, so the hashes are current for the next round
+        bool has_changes = session.has_forced_change;
+        for (const std::string& path : session.pending_paths)
+        {
+            has_changes = has_content_changed(session, path) || has_changes;
+        }
+
+        session.pending_paths.clear();
+        session.has_forced_change = false;
+        return has_changes;
+    }
+
+    auto has_content_changed(WatchSession& session, const std::string& path) -> bool
+    {
+        // Temporary files that came and went in between never count
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            return session.content_hashes.erase(path) > 0;
+        }
+
+        MemoHash hash;
+        hash_memo_input(hash, path, false);
+        std::string& previous = session.content_hashes[path];
+        std::string current = hash.to_hex();
+        if (previous == current)
+        {
+            return false;
+        }
+
+        previous = std::move(current);
+        return true;
+    }
+
+    auto start_watched_command(WatchSession& session, const CommandSpec& cmd) -> void
+    {
+        std::cout.flush();
+        std::cerr.flush();
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            std::cerr << "watch-run: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        if (pid == 0)
+        {
+            setpgid(0, 0);
+            signal(SIGINT, SIG_DFL);
+
+            // Out of the terminal's foreground group, reading it would stop the command
+            int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (null_fd != -1)
+            {
+                dup2(null_fd, STDIN_FILENO);
+                close(null_fd);
+            }
+
+            if (!execute_command(cmd))
+            {
+                handle_invalid_command(cmd.command);
+                exit(127);
+            }
+            exit(shell_state->last_exit_status);
+        }
+
+        setpgid(pid, pid);
+        session.pid = pid;
+        session.pid_fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    }
+
+    auto stop_watched_command(WatchSession& session) -> void
+    {
+        if (session.pid == -1)
+        {
+            return;
+        }
+
+        // Asked nicely first, a command that won't stop is killed
+        kill(-session.pid, SIGTERM);
+        for (int waited_ms = 0; waited_ms < config::WATCH_STOP_TIMEOUT_MS;
+             waited_ms += config::WATCH_REAP_INTERVAL_MS)
+        {
+            if (reap_watched_command(session, false))
+            {
+                return;
+            }
+
+            struct pollfd poll_fd = {session.pid_fd, POLLIN, 0};
+            poll(&poll_fd, session.pid_fd != -1 ? 1 : 0, config::WATCH_REAP_INTERVAL_MS);
+        }
+
+        kill(-session.pid, SIGKILL);
+        reap_watched_command(session, true);
+    }
+
+    auto reap_watched_command(WatchSession& session, bool wait) -> bool
+    {
+        int status;
+        pid_t result;
+        do
+        {
+            result = waitpid(session.pid, &status, wait ? 0 : WNOHANG);
+        } while (result == -1 && errno == EINTR);
+
+        if (result == 0)
+        {
+            return false;
+        }
+
+        if (result == session.pid)
+        {
+            shell_state->last_exit_status = get_exit_status(status);
+        }
+        if (session.pid_fd != -1)
+        {
+            close(session.pid_fd);
+        }
+        session.pid = -1;
+        session.pid_fd = -1;
+        return true;
+    }
+
+} // namespace ash
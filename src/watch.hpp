@@ -0,0 +1,72 @@
+#pragma once
+
+#include "commands.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+
+// TODO(abi): ...
+
+#else
+
+    #include <sys/types.h>
+
+#endif
+
+namespace ash
+{
+
+    struct WatchOptions
+    {
+        std::vector<std::string> patterns; // Paths, directories or globs
+        std::vector<std::string> command;  // Name first
+        bool is_restarting = true;         // Otherwise a running command is left to finish
+    };
+
+    struct WatchedDirectory
+    {
+        std::string path;
+        bool is_recursive; // Everything below counts, not just the matching names
+    };
+
+    // NOTE(abi): files are watched through their directories, so editors that save by
+    // renaming over the original don't lose the watch. Touched paths are only compared
+    // once the events have settled, and a change counts when the content differs from
+    // what was last seen.
+    struct WatchSession
+    {
+        int inotify_fd = -1;
+        std::vector<std::string> patterns;
+        std::unordered_map<int, WatchedDirectory> directories; // By watch descriptor
+        std::unordered_map<std::string, std::string> content_hashes;
+        std::unordered_set<std::string> pending_paths; // Touched since the last check
+        bool has_forced_change = false;                // Structure changed or events were lost
+        pid_t pid = -1;
+        int pid_fd = -1; // Readable once the command exits, -1 when it's polled for
+    };
+
+    // Builtin
+    auto watch_run_command(const BuiltinArguments& args) -> int;
+    auto parse_watch_options(const BuiltinArguments& args, WatchOptions& options) -> bool;
+    auto handle_watch_interrupt(int signal) -> void;
+
+    // Watches
+    auto add_watch_pattern(WatchSession& session, const std::string& pattern) -> bool;
+    auto add_watched_directory(WatchSession& session, const std::string& path, bool is_recursive)
+        -> bool;
+    auto read_watch_events(WatchSession& session) -> bool;
+    auto is_watched_path(const WatchSession& session, const WatchedDirectory& directory,
+                         const std::string& path) -> bool;
+    auto has_pending_changes(WatchSession& session) -> bool;
+    auto has_content_changed(WatchSession& session, const std::string& path) -> bool;
+
+    // Command
+    auto start_watched_command(WatchSession& session, const CommandSpec& cmd) -> void;
+    auto stop_watched_command(WatchSession& session) -> void;
+    auto reap_watched_command(WatchSession& session, bool wait) -> bool;
+
+} // namespace ash